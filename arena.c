@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include "definations.h"
+#include "helper.h"
+#include "arena.h"
+
+// 区域分配器
+// 从大块的内存中按顺序切出小块，不单独释放，reset_arena 时整体回收
+// 回收后 block 不还给系统，下一次分配时继续复用
+
+static struct ArenaBlock *new_arena_block(int size) {
+  struct ArenaBlock *block = (struct ArenaBlock *) malloc(sizeof(struct ArenaBlock));
+  if (!block) error("Unable to malloc an arena block");
+  block->data = (char *) malloc(size);
+  if (!block->data) error("Unable to malloc an arena block");
+  block->size = size;
+  block->next = NULL;
+  return (block);
+}
+
+struct Arena *new_arena(int block_size) {
+  struct Arena *arena = (struct Arena *) malloc(sizeof(struct Arena));
+  if (!arena) error("Unable to malloc an arena");
+  arena->block_size = block_size;
+  arena->block_head = new_arena_block(block_size);
+  arena->current_block = arena->block_head;
+  arena->pointer = arena->block_head->data;
+  arena->remain = block_size;
+  arena->allocated_bytes = 0;
+  arena->reserved_bytes = block_size;
+  return (arena);
+}
+
+// 当前 block 不够用时，换到下一个 block，没有合适的就新建一个
+static void switch_arena_block(struct Arena *arena, int size) {
+  struct ArenaBlock *block = arena->current_block->next;
+  int block_size = arena->block_size;
+
+  if (!block || block->size < size) {
+    if (size > block_size) block_size = size;
+    block = new_arena_block(block_size);
+    block->next = arena->current_block->next;
+    arena->current_block->next = block;
+    arena->reserved_bytes = arena->reserved_bytes + block_size;
+  }
+  arena->current_block = block;
+  arena->pointer = block->data;
+  arena->remain = block->size;
+}
+
+// 分配 size 个字节，按 8 字节对齐，内容清零
+void *allocate_from_arena(struct Arena *arena, int size) {
+  char *p;
+
+  size = (size + 7) & (~7);
+  if (size > arena->remain) switch_arena_block(arena, size);
+
+  p = arena->pointer;
+  arena->pointer = arena->pointer + size;
+  arena->remain = arena->remain - size;
+  arena->allocated_bytes = arena->allocated_bytes + size;
+  memset(p, 0, size);
+  return ((void *) p);
+}
+
+void reset_arena(struct Arena *arena) {
+  arena->current_block = arena->block_head;
+  arena->pointer = arena->block_head->data;
+  arena->remain = arena->block_head->size;
+}
@@ -0,0 +1,10 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "definations.h"
+
+struct Arena *new_arena(int block_size);
+void *allocate_from_arena(struct Arena *arena, int size);
+void reset_arena(struct Arena *arena);
+
+#endif
@@ -0,0 +1,1615 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "data.h"
+#include "definations.h"
+#include "assembler.h"
+
+// 集成汇编器
+// 把 generator_core.c 生成的 AT&T 汇编直接编码成 ELF64 可重定位文件，
+// 省掉每个源文件一次的 as 子进程
+// 这里只认识 zcc 自己会生成的那部分指令和伪指令，
+// 遇到不认识的写法时返回 -1，由调用方退回到外部的 as
+
+#define ASM_HASH_SIZE 1024
+
+enum {
+  ASM_OPERAND_NONE,
+  ASM_OPERAND_REGISTER,
+  ASM_OPERAND_IMMEDIATE,
+  ASM_OPERAND_MEMORY,
+  ASM_OPERAND_SYMBOL        // jmp/call 的目标
+};
+
+enum {
+  ASM_FIXUP_PC32,           // 32 位相对地址，rip 寻址
+  ASM_FIXUP_PLT32,          // jmp/jcc/call，和 as 一样，目标不在本文件时用 R_X86_64_PLT32
+  ASM_FIXUP_GOTPCREL,       // call *foo@GOTPCREL(%rip)
+  ASM_FIXUP_REL8,           // loop 和改成短跳转的 jmp/jcc
+  ASM_FIXUP_ABS64,          // .quad symbol
+  ASM_FIXUP_ABS32,          // .long symbol
+  ASM_FIXUP_DIFF32          // .long a-b
+};
+
+// ELF 重定位类型
+#define R_X86_64_64 1
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+#define R_X86_64_32 10
+#define R_X86_64_GOTPCRELX 41
+
+// 节头表中各个节的下标
+enum {
+  ELF_SECTION_NULL,
+  ELF_SECTION_TEXT,
+  ELF_SECTION_DATA,
+  ELF_SECTION_NOTE,
+  ELF_SECTION_SYMTAB,
+  ELF_SECTION_STRTAB,
+  ELF_SECTION_RELA_TEXT,
+  ELF_SECTION_RELA_DATA,
+  ELF_SECTION_SHSTRTAB,
+  ELF_SECTION_NUMBER
+};
+
+struct AsmBuffer {
+  char *data;
+  int size;
+  int capacity;
+};
+
+struct AsmSection {
+  struct AsmBuffer *content;
+  struct AsmBuffer *relocation;   // 对应的 .rela 节
+  int section_index;              // 在节头表中的下标
+  int symbol_index;               // 对应的 STT_SECTION 符号在符号表中的下标
+};
+
+struct AsmSymbol {
+  char *name;
+  struct AsmSection *section;     // 定义所在的节，NULL 表示未定义
+  int value;                      // 在节中的偏移
+  int is_global;
+  int is_function;
+  int is_referenced;
+  int symbol_index;               // 在符号表中的下标
+  struct AsmSymbol *hash_next;
+  struct AsmSymbol *next;         // 按创建顺序串起来，生成符号表时使用
+};
+
+struct AsmFixup {
+  struct AsmSection *section;
+  int offset;
+  int type;
+  struct AsmSymbol *symbol;
+  struct AsmSymbol *minus_symbol; // ASM_FIXUP_DIFF32 的减数
+  long addend;
+  int short_opcode;               // jmp/jcc 的 rel8 形式的 opcode，0 表示不能改成短跳转
+  struct AsmFixup *next;
+};
+
+struct AsmOperand {
+  int kind;
+  int register_index;             // 寄存器编号，0-15
+  int size;                       // 寄存器宽度，1/4/8
+  long value;                     // 立即数或者偏移
+  int base;                       // 基址寄存器，-1 表示没有
+  int index;                      // 变址寄存器，-1 表示没有
+  int scale;
+  int is_rip;
+  int is_plt;
+  int is_gotpcrel;                // symbol@GOTPCREL(%rip)，读取 GOT 中的地址
+  int is_indirect;                // jmp *%rax
+  struct AsmSymbol *symbol;       // 偏移中的符号
+};
+
+static char *register_64_list[] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+static char *register_32_list[] = {
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+static char *register_8_list[] = {
+  "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+
+// 条件码后缀，jcc/setcc 共用，编码值见 condition_code_list
+static char *condition_name_list[] = {
+  "o", "no", "b", "c", "nae", "ae", "nb", "nc",
+  "e", "z", "ne", "nz", "be", "na", "a", "nbe",
+  "s", "ns", "p", "pe", "np", "po", "l", "nge",
+  "ge", "nl", "le", "ng", "g", "nle"
+};
+static int condition_code_list[] = {
+  0, 1, 2, 2, 2, 3, 3, 3,
+  4, 4, 5, 5, 6, 6, 7, 7,
+  8, 9, 10, 10, 11, 11, 12, 12,
+  13, 13, 14, 14, 15, 15
+};
+#define CONDITION_NUMBER 30
+
+static struct AsmSection *text_section;
+static struct AsmSection *data_section;
+static struct AsmSection *current_section;
+static struct AsmSymbol **symbol_hash;
+static struct AsmSymbol *symbol_head, *symbol_tail;
+static struct AsmFixup *fixup_head, *fixup_tail;
+
+static char *line_pointer;        // 当前行解析到的位置
+static int assembler_line;
+static char assembler_error[TEXT_LENGTH];
+
+static struct AsmOperand first_operand;
+static struct AsmOperand second_operand;
+static struct AsmOperand third_operand;
+
+char *get_assembler_error() {
+  return (assembler_error);
+}
+
+// 记录不支持的写法，返回 -1 方便直接 return
+static int unsupported(char *message) {
+  snprintf(assembler_error, TEXT_LENGTH, "%s on line %d", message, assembler_line);
+  return (-1);
+}
+
+static struct AsmBuffer *new_buffer() {
+  struct AsmBuffer *b = (struct AsmBuffer *) malloc(sizeof(struct AsmBuffer));
+  b->capacity = 256;
+  b->size = 0;
+  b->data = (char *) malloc(b->capacity);
+  return (b);
+}
+
+static void free_buffer(struct AsmBuffer *b) {
+  free(b->data);
+  free(b);
+}
+
+static void buffer_put_byte(struct AsmBuffer *b, int value) {
+  if (b->size >= b->capacity) {
+    b->capacity = b->capacity * 2;
+    b->data = (char *) realloc(b->data, b->capacity);
+  }
+  b->data[b->size] = (char) value;
+  b->size = b->size + 1;
+}
+
+// 按小端序写入 size 个字节
+static void buffer_put_value(struct AsmBuffer *b, long value, int size) {
+  int i;
+  for (i = 0; i < size; i++) {
+    buffer_put_byte(b, (int) (value & 255));
+    value = value >> 8;
+  }
+}
+
+static void buffer_patch_value(struct AsmBuffer *b, int offset, long value, int size) {
+  int i;
+  for (i = 0; i < size; i++) {
+    b->data[offset + i] = (char) (value & 255);
+    value = value >> 8;
+  }
+}
+
+static void buffer_align(struct AsmBuffer *b, int alignment) {
+  while (b->size % alignment) buffer_put_byte(b, 0);
+}
+
+static void buffer_put_string(struct AsmBuffer *b, char *s) {
+  while (*s) {
+    buffer_put_byte(b, *s);
+    s++;
+  }
+  buffer_put_byte(b, 0);
+}
+
+static struct AsmSection *new_section(int section_index, int symbol_index) {
+  struct AsmSection *s = (struct AsmSection *) malloc(sizeof(struct AsmSection));
+  s->content = new_buffer();
+  s->relocation = new_buffer();
+  s->section_index = section_index;
+  s->symbol_index = symbol_index;
+  return (s);
+}
+
+static void free_section(struct AsmSection *s) {
+  free_buffer(s->content);
+  free_buffer(s->relocation);
+  free(s);
+}
+
+static void emit_byte(int value) {
+  buffer_put_byte(current_section->content, value);
+}
+
+static void emit_value(long value, int size) {
+  buffer_put_value(current_section->content, value, size);
+}
+
+static int get_current_offset() {
+  return (current_section->content->size);
+}
+
+static int hash_name(char *name, int length) {
+  int h = 0;
+  int i;
+  for (i = 0; i < length; i++) {
+    h = (h * 31 + name[i]) & (ASM_HASH_SIZE - 1);
+  }
+  return (h);
+}
+
+// 查找符号，没有就新建一个
+static struct AsmSymbol *find_assembler_symbol(char *name, int length) {
+  struct AsmSymbol *s;
+  int h = hash_name(name, length);
+
+  for (s = symbol_hash[h]; s; s = s->hash_next) {
+    if (!strncmp(s->name, name, length) && s->name[length] == 0)
+      return (s);
+  }
+
+  s = (struct AsmSymbol *) malloc(sizeof(struct AsmSymbol));
+  s->name = (char *) malloc(length + 1);
+  strncpy(s->name, name, length);
+  s->name[length] = 0;
+  s->section = NULL;
+  s->value = 0;
+  s->is_global = 0;
+  s->is_function = 0;
+  s->is_referenced = 0;
+  s->symbol_index = 0;
+  s->hash_next = symbol_hash[h];
+  symbol_hash[h] = s;
+  s->next = NULL;
+  if (symbol_tail) {
+    symbol_tail->next = s;
+    symbol_tail = s;
+  } else {
+    symbol_head = symbol_tail = s;
+  }
+  return (s);
+}
+
+static void add_fixup(int type, struct AsmSymbol *symbol, long addend) {
+  struct AsmFixup *f = (struct AsmFixup *) malloc(sizeof(struct AsmFixup));
+  f->section = current_section;
+  f->offset = get_current_offset();
+  f->type = type;
+  f->symbol = symbol;
+  f->minus_symbol = NULL;
+  f->addend = addend;
+  f->short_opcode = 0;
+  f->next = NULL;
+  symbol->is_referenced = 1;
+  if (fixup_tail) {
+    fixup_tail->next = f;
+    fixup_tail = f;
+  } else {
+    fixup_head = fixup_tail = f;
+  }
+}
+
+static int check_identifier_character(int c) {
+  return ((c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') ||
+          c == '_' || c == '.' || c == '$');
+}
+
+static void skip_whitespace() {
+  while (*line_pointer == ' ' || *line_pointer == '\t') line_pointer++;
+}
+
+// 当前行是否已经结束，'#' 后面是注释
+static int check_line_end() {
+  skip_whitespace();
+  return (*line_pointer == 0 || *line_pointer == '#');
+}
+
+static int check_and_skip(int c) {
+  skip_whitespace();
+  if (*line_pointer != c) return (0);
+  line_pointer++;
+  return (1);
+}
+
+// 读一个标识符，name 指向名字的起点，返回长度
+static int scan_assembler_identifier(char **name) {
+  int length = 0;
+  skip_whitespace();
+  *name = line_pointer;
+  while (check_identifier_character(*line_pointer)) {
+    line_pointer++;
+    length++;
+  }
+  return (length);
+}
+
+// 读一个十进制或十六进制整数，支持负号
+static int scan_number(long *value) {
+  int negative = 0;
+  int c;
+  long n = 0;
+
+  skip_whitespace();
+  if (*line_pointer == '-') {
+    negative = 1;
+    line_pointer++;
+  }
+  c = *line_pointer;
+  if (c < '0' || c > '9') return (-1);
+
+  if (c == '0' && (line_pointer[1] == 'x' || line_pointer[1] == 'X')) {
+    line_pointer = line_pointer + 2;
+    while (1) {
+      c = *line_pointer;
+      if (c >= '0' && c <= '9') n = n * 16 + c - '0';
+      else if (c >= 'a' && c <= 'f') n = n * 16 + c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') n = n * 16 + c - 'A' + 10;
+      else break;
+      line_pointer++;
+    }
+  } else {
+    while (1) {
+      c = *line_pointer;
+      if (c < '0' || c > '9') break;
+      n = n * 10 + c - '0';
+      line_pointer++;
+    }
+  }
+
+  if (negative) n = -n;
+  *value = n;
+  return (0);
+}
+
+static int check_number_start() {
+  int c;
+  skip_whitespace();
+  c = *line_pointer;
+  return ((c >= '0' && c <= '9') || c == '-');
+}
+
+// 在 list 中查找长度为 length 的名字
+static int find_name(char **list, int number, char *name, int length) {
+  int i;
+  for (i = 0; i < number; i++) {
+    if (!strncmp(list[i], name, length) && list[i][length] == 0)
+      return (i);
+  }
+  return (-1);
+}
+
+// 解析 %reg，设置寄存器编号和宽度
+static int parse_register(struct AsmOperand *op) {
+  char *name;
+  int length, i;
+
+  if (!check_and_skip('%')) return (unsupported("Expected register"));
+  length = scan_assembler_identifier(&name);
+
+  if ((i = find_name(register_64_list, 16, name, length)) >= 0) {
+    op->size = 8;
+  } else if ((i = find_name(register_32_list, 16, name, length)) >= 0) {
+    op->size = 4;
+  } else if ((i = find_name(register_8_list, 16, name, length)) >= 0) {
+    op->size = 1;
+  } else if (length == 3 && !strncmp(name, "rip", 3)) {
+    op->is_rip = 1;
+    return (0);
+  } else {
+    return (unsupported("Unknown register"));
+  }
+  op->register_index = i;
+  return (0);
+}
+
+// 解析 symbol、symbol+n、symbol-n 或者 n 形式的偏移
+static int parse_displacement(struct AsmOperand *op) {
+  char *name;
+  int length;
+  long n;
+
+  if (check_number_start()) {
+    if (scan_number(&n) < 0) return (unsupported("Bad number"));
+    op->value = n;
+    return (0);
+  }
+
+  length = scan_assembler_identifier(&name);
+  if (!length) return (0);
+  op->symbol = find_assembler_symbol(name, length);
+
+  if (*line_pointer == '@') {
+    line_pointer++;
+    length = scan_assembler_identifier(&name);
+    if (length == 3 && !strncmp(name, "PLT", 3)) op->is_plt = 1;
+    else if (length == 8 && !strncmp(name, "GOTPCREL", 8)) op->is_gotpcrel = 1;
+    else return (unsupported("Unknown symbol modifier"));
+  }
+
+  if (*line_pointer == '+') {
+    line_pointer++;
+    if (scan_number(&n) < 0) return (unsupported("Bad number"));
+    op->value = n;
+  } else if (*line_pointer == '-') {
+    line_pointer++;
+    if (scan_number(&n) < 0) return (unsupported("Bad number"));
+    op->value = -n;
+  }
+  return (0);
+}
+
+// 解析一个操作数
+// %reg、$imm、disp(%base,%index,scale)、symbol(%rip)、label、*%reg
+static int parse_operand(struct AsmOperand *op) {
+  struct AsmOperand index_operand;
+  long scale, n;
+
+  op->kind = ASM_OPERAND_NONE;
+  op->register_index = 0;
+  op->size = 0;
+  op->value = 0;
+  op->base = -1;
+  op->index = -1;
+  op->scale = 1;
+  op->is_rip = 0;
+  op->is_plt = 0;
+  op->is_gotpcrel = 0;
+  op->is_indirect = 0;
+  op->symbol = NULL;
+
+  if (check_and_skip('*')) op->is_indirect = 1;
+
+  skip_whitespace();
+  if (*line_pointer == '%') {
+    op->kind = ASM_OPERAND_REGISTER;
+    if (parse_register(op) < 0) return (-1);
+    if (op->is_rip) return (unsupported("Bad use of %rip"));
+    return (0);
+  }
+
+  if (*line_pointer == '$') {
+    line_pointer++;
+    op->kind = ASM_OPERAND_IMMEDIATE;
+    if (scan_number(&n) < 0)
+      return (unsupported("Only numeric immediates are supported"));
+    op->value = n;
+    return (0);
+  }
+
+  if (parse_displacement(op) < 0) return (-1);
+
+  if (!check_and_skip('(')) {
+    if (!op->symbol || op->is_gotpcrel) return (unsupported("Bad operand"));
+    op->kind = ASM_OPERAND_SYMBOL;
+    return (0);
+  }
+
+  op->kind = ASM_OPERAND_MEMORY;
+  if (op->is_plt) return (unsupported("Bad use of @PLT"));
+  skip_whitespace();
+  if (*line_pointer == '%') {
+    if (parse_register(op) < 0) return (-1);
+    if (!op->is_rip) {
+      if (op->size != 8) return (unsupported("Base register must be 64 bits"));
+      op->base = op->register_index;
+    }
+  }
+
+  if (check_and_skip(',')) {
+    index_operand.is_rip = 0;
+    if (parse_register(&index_operand) < 0) return (-1);
+    if (index_operand.is_rip || index_operand.size != 8 || index_operand.register_index == 4)
+      return (unsupported("Bad index register"));
+    op->index = index_operand.register_index;
+    if (check_and_skip(',')) {
+      if (scan_number(&scale) < 0) return (unsupported("Bad scale"));
+      if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        return (unsupported("Bad scale"));
+      op->scale = (int) scale;
+    }
+  }
+  if (!check_and_skip(')')) return (unsupported("Expected )"));
+
+  if (op->is_rip && op->index >= 0) return (unsupported("Bad rip addressing"));
+  if (op->is_gotpcrel && !op->is_rip) return (unsupported("Bad use of @GOTPCREL"));
+  if (!op->is_rip && op->base < 0) return (unsupported("Absolute addressing is not supported"));
+  if (!op->is_rip && op->symbol) return (unsupported("Symbolic displacement needs %rip"));
+  return (0);
+}
+
+// 解析逗号分隔的操作数，返回操作数的个数
+static int parse_operand_list() {
+  if (check_line_end()) return (0);
+  if (parse_operand(&first_operand) < 0) return (-1);
+  if (!check_and_skip(',')) return (1);
+  if (parse_operand(&second_operand) < 0) return (-1);
+  if (!check_and_skip(',')) return (2);
+  if (parse_operand(&third_operand) < 0) return (-1);
+  return (3);
+}
+
+static int check_extended_byte_register(int register_index) {
+  return (register_index >= 4 && register_index <= 7);
+}
+
+/**
+ * 输出 [REX] opcode ModRM [SIB] [displacement]
+ * opcode 最多两个字节，高位的先输出
+ * reg_field 是 ModRM 中 reg 字段的值，可以是寄存器编号，也可以是 /digit 扩展码
+ * immediate_size 是指令末尾立即数的字节数，rip 寻址计算相对地址时需要
+*/
+static int emit_modrm_instruction(
+  int opcode,
+  int opcode_length,
+  int reg_field,
+  int reg_is_byte,
+  struct AsmOperand *rm,
+  int rex_w,
+  int immediate_size
+) {
+  int rex = 0, need_rex = 0;
+  int mod, rm_field, index_field, base;
+  long displacement;
+
+  if (rex_w) rex = rex | 8;
+  if (reg_field & 8) rex = rex | 4;
+  if (reg_is_byte && check_extended_byte_register(reg_field)) need_rex = 1;
+
+  if (rm->kind == ASM_OPERAND_REGISTER) {
+    if (rm->register_index & 8) rex = rex | 1;
+    if (rm->size == 1 && check_extended_byte_register(rm->register_index)) need_rex = 1;
+  } else if (rm->kind == ASM_OPERAND_MEMORY) {
+    if (rm->base >= 0 && (rm->base & 8)) rex = rex | 1;
+    if (rm->index >= 0 && (rm->index & 8)) rex = rex | 2;
+  } else {
+    return (unsupported("Bad operand"));
+  }
+
+  if (rex || need_rex) emit_byte(0x40 | rex);
+  if (opcode_length == 2) emit_byte((opcode >> 8) & 255);
+  emit_byte(opcode & 255);
+
+  reg_field = (reg_field & 7) << 3;
+
+  if (rm->kind == ASM_OPERAND_REGISTER) {
+    emit_byte(0xc0 | reg_field | (rm->register_index & 7));
+    return (0);
+  }
+
+  // rip 相对寻址，displacement 相对于整条指令的末尾
+  if (rm->is_rip) {
+    emit_byte(reg_field | 5);
+    if (rm->symbol) {
+      add_fixup(rm->is_gotpcrel ? ASM_FIXUP_GOTPCREL : ASM_FIXUP_PC32,
+        rm->symbol, rm->value - 4 - immediate_size);
+      emit_value(0, 4);
+    } else {
+      emit_value(rm->value, 4);
+    }
+    return (0);
+  }
+
+  base = rm->base;
+  displacement = rm->value;
+  if (displacement == 0 && (base & 7) != 5) mod = 0;
+  else if (displacement >= -128 && displacement <= 127) mod = 1;
+  else mod = 2;
+
+  if (rm->index >= 0 || (base & 7) == 4) rm_field = 4;
+  else rm_field = base & 7;
+
+  emit_byte((mod << 6) | reg_field | rm_field);
+  if (rm_field == 4) {
+    // SIB，scale 为 1/2/4/8 对应 0/1/2/3
+    if (rm->scale == 1) mod = 0;
+    else if (rm->scale == 2) mod = 1;
+    else if (rm->scale == 4) mod = 2;
+    else mod = 3;
+    // 没有变址寄存器时 index 字段填 4
+    index_field = 4;
+    if (rm->index >= 0) index_field = rm->index & 7;
+    emit_byte((mod << 6) | (index_field << 3) | (base & 7));
+  }
+
+  if (displacement == 0 && (base & 7) != 5) return (0);
+  if (displacement >= -128 && displacement <= 127) emit_value(displacement, 1);
+  else emit_value(displacement, 4);
+  return (0);
+}
+
+static int check_int8(long value) {
+  return (value >= -128 && value <= 127);
+}
+
+static int check_int32(long value) {
+  return (value >= -2147483647 - 1 && value <= 2147483647);
+}
+
+// jmp/jcc/call 后跟一个 32 位相对地址
+// short_opcode 为 jmp/jcc 的 rel8 形式，汇编完之后 relax_branch_fixup 决定能否用它
+static int emit_branch_target(struct AsmOperand *op, int short_opcode) {
+  if (op->kind != ASM_OPERAND_SYMBOL || op->value)
+    return (unsupported("Bad branch target"));
+  add_fixup(ASM_FIXUP_PLT32, op->symbol, -4);
+  // 和 as 一样，foo@PLT 总是 rel32
+  if (!op->is_plt) fixup_tail->short_opcode = short_opcode;
+  emit_value(0, 4);
+  return (0);
+}
+
+// 检查寄存器/内存操作数的宽度是否与指令后缀一致
+// 内存操作数本身没有宽度，由后缀决定
+static int check_operand_size(struct AsmOperand *op, int size) {
+  if (op->kind == ASM_OPERAND_REGISTER && op->size != size)
+    return (unsupported("Operand size mismatch"));
+  return (0);
+}
+
+// 没有后缀的指令，比如 test，宽度由寄存器操作数决定
+static int infer_size(int operand_number) {
+  if (operand_number >= 2 && second_operand.kind == ASM_OPERAND_REGISTER)
+    return (second_operand.size);
+  if (operand_number >= 1 && first_operand.kind == ASM_OPERAND_REGISTER)
+    return (first_operand.size);
+  return (unsupported("Cannot infer operand size"));
+}
+
+// 把 "addq" 拆成 "add" 和宽度 8
+// 返回去掉后缀后的长度
+static int split_suffix(char *mnemonic, int length, char **list, int number, int *size) {
+  int c;
+
+  if (find_name(list, number, mnemonic, length) >= 0) {
+    *size = 0;
+    return (length);
+  }
+  c = mnemonic[length - 1];
+  if (find_name(list, number, mnemonic, length - 1) < 0) return (-1);
+  if (c == 'b') *size = 1;
+  else if (c == 'l') *size = 4;
+  else if (c == 'q') *size = 8;
+  else return (-1);
+  return (length - 1);
+}
+
+static int find_condition(char *name, int length) {
+  int i = find_name(condition_name_list, CONDITION_NUMBER, name, length);
+  if (i < 0) return (-1);
+  return (condition_code_list[i]);
+}
+
+// add/or/and/sub/xor/cmp，opcode 的 /digit 值与名字的下标对应
+static char *alu_list[] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+
+// 除了 alu 之外的带宽度后缀的指令
+static char *sized_list[] = {
+  "mov", "lea", "test", "imul", "idiv", "div", "mul", "neg", "not",
+  "shl", "sal", "shr", "sar", "inc", "dec", "push", "pop", "call", "jmp"
+};
+
+enum {
+  ASM_MOV, ASM_LEA, ASM_TEST, ASM_IMUL, ASM_IDIV, ASM_DIV, ASM_MUL, ASM_NEG, ASM_NOT,
+  ASM_SHL, ASM_SAL, ASM_SHR, ASM_SAR, ASM_INC, ASM_DEC, ASM_PUSH, ASM_POP, ASM_CALL, ASM_JMP
+};
+
+static int encode_alu(int alu, int size, int operand_number) {
+  struct AsmOperand *source = &first_operand;
+  struct AsmOperand *destination = &second_operand;
+  int w = (size == 8);
+
+  if (operand_number != 2) return (unsupported("Expected two operands"));
+  if (check_operand_size(destination, size) < 0) return (-1);
+
+  if (source->kind == ASM_OPERAND_IMMEDIATE) {
+    if (size == 1) {
+      if (emit_modrm_instruction(0x80, 1, alu, 0, destination, 0, 1) < 0) return (-1);
+      emit_value(source->value, 1);
+      return (0);
+    }
+    if (check_int8(source->value)) {
+      if (emit_modrm_instruction(0x83, 1, alu, 0, destination, w, 1) < 0) return (-1);
+      emit_value(source->value, 1);
+      return (0);
+    }
+    if (!check_int32(source->value)) return (unsupported("Immediate out of range"));
+    if (emit_modrm_instruction(0x81, 1, alu, 0, destination, w, 4) < 0) return (-1);
+    emit_value(source->value, 4);
+    return (0);
+  }
+
+  if (source->kind == ASM_OPERAND_REGISTER) {
+    if (check_operand_size(source, size) < 0) return (-1);
+    return (emit_modrm_instruction(alu * 8 + (size != 1), 1,
+      source->register_index, size == 1, destination, w, 0));
+  }
+
+  if (source->kind == ASM_OPERAND_MEMORY && destination->kind == ASM_OPERAND_REGISTER) {
+    return (emit_modrm_instruction(alu * 8 + 2 + (size != 1), 1,
+      destination->register_index, size == 1, source, w, 0));
+  }
+  return (unsupported("Bad operands"));
+}
+
+// 单操作数的 F7 /digit 类指令：not/neg/mul/div/idiv
+static int encode_unary(int digit, int size, int operand_number) {
+  if (operand_number != 1) return (unsupported("Expected one operand"));
+  if (check_operand_size(&first_operand, size) < 0) return (-1);
+  if (first_operand.kind != ASM_OPERAND_REGISTER && first_operand.kind != ASM_OPERAND_MEMORY)
+    return (unsupported("Bad operand"));
+  return (emit_modrm_instruction(size == 1 ? 0xf6 : 0xf7, 1, digit, 0,
+    &first_operand, size == 8, 0));
+}
+
+// shl/sal/shr/sar，移位量为 %cl 或者立即数
+static int encode_shift(int digit, int size, int operand_number) {
+  struct AsmOperand *destination;
+
+  if (operand_number == 1) {
+    destination = &first_operand;
+    if (check_operand_size(destination, size) < 0) return (-1);
+    return (emit_modrm_instruction(size == 1 ? 0xd0 : 0xd1, 1, digit, 0, destination, size == 8, 0));
+  }
+  if (operand_number != 2) return (unsupported("Expected two operands"));
+  destination = &second_operand;
+  if (check_operand_size(destination, size) < 0) return (-1);
+
+  if (first_operand.kind == ASM_OPERAND_REGISTER) {
+    if (first_operand.register_index != 1 || first_operand.size != 1)
+      return (unsupported("Shift count must be %cl"));
+    return (emit_modrm_instruction(size == 1 ? 0xd2 : 0xd3, 1, digit, 0, destination, size == 8, 0));
+  }
+  if (first_operand.kind != ASM_OPERAND_IMMEDIATE)
+    return (unsupported("Bad shift count"));
+  // 和 as 一样，移 1 位时用没有立即数的 d0/d1
+  if (first_operand.value == 1)
+    return (emit_modrm_instruction(size == 1 ? 0xd0 : 0xd1, 1, digit, 0, destination, size == 8, 0));
+  if (emit_modrm_instruction(size == 1 ? 0xc0 : 0xc1, 1, digit, 0, destination, size == 8, 1) < 0)
+    return (-1);
+  emit_value(first_operand.value, 1);
+  return (0);
+}
+
+static int encode_mov(int size, int operand_number) {
+  struct AsmOperand *source = &first_operand;
+  struct AsmOperand *destination = &second_operand;
+  int w = (size == 8);
+  int r;
+
+  if (operand_number != 2) return (unsupported("Expected two operands"));
+  if (check_operand_size(destination, size) < 0) return (-1);
+
+  if (source->kind == ASM_OPERAND_IMMEDIATE) {
+    if (size == 8 && !check_int32(source->value)) {
+      // movabsq $imm64, %reg
+      if (destination->kind != ASM_OPERAND_REGISTER)
+        return (unsupported("64-bit immediate needs a register"));
+      r = destination->register_index;
+      emit_byte(0x48 | ((r >> 3) & 1));
+      emit_byte(0xb8 + (r & 7));
+      emit_value(source->value, 8);
+      return (0);
+    }
+    if (size == 1) {
+      if (emit_modrm_instruction(0xc6, 1, 0, 0, destination, 0, 1) < 0) return (-1);
+      emit_value(source->value, 1);
+      return (0);
+    }
+    if (emit_modrm_instruction(0xc7, 1, 0, 0, destination, w, 4) < 0) return (-1);
+    emit_value(source->value, 4);
+    return (0);
+  }
+
+  if (source->kind == ASM_OPERAND_REGISTER) {
+    if (check_operand_size(source, size) < 0) return (-1);
+    return (emit_modrm_instruction(size == 1 ? 0x88 : 0x89, 1,
+      source->register_index, size == 1, destination, w, 0));
+  }
+
+  if (source->kind == ASM_OPERAND_MEMORY && destination->kind == ASM_OPERAND_REGISTER) {
+    return (emit_modrm_instruction(size == 1 ? 0x8a : 0x8b, 1,
+      destination->register_index, size == 1, source, w, 0));
+  }
+  return (unsupported("Bad operands"));
+}
+
+// movzbq/movzbl/movsbq/movsbl/movslq 这类带扩展的 mov
+static int encode_mov_extend(int opcode, int opcode_length, int source_size, int destination_size, int operand_number) {
+  if (operand_number != 2) return (unsupported("Expected two operands"));
+  if (second_operand.kind != ASM_OPERAND_REGISTER || second_operand.size != destination_size)
+    return (unsupported("Bad destination"));
+  if (check_operand_size(&first_operand, source_size) < 0) return (-1);
+  if (first_operand.kind != ASM_OPERAND_REGISTER && first_operand.kind != ASM_OPERAND_MEMORY)
+    return (unsupported("Bad source"));
+  return (emit_modrm_instruction(opcode, opcode_length, second_operand.register_index, 0,
+    &first_operand, destination_size == 8, 0));
+}
+
+static int encode_sized(int instruction, int size, int operand_number) {
+  int r;
+
+  // 没有后缀时由寄存器宽度决定
+  if (!size && instruction != ASM_CALL && instruction != ASM_JMP &&
+      instruction != ASM_PUSH && instruction != ASM_POP) {
+    if ((size = infer_size(operand_number)) < 0) return (-1);
+  }
+  if (size == 2) return (unsupported("16-bit operands are not supported"));
+
+  switch (instruction) {
+    case ASM_MOV:
+      return (encode_mov(size, operand_number));
+    case ASM_LEA:
+      if (operand_number != 2 || first_operand.kind != ASM_OPERAND_MEMORY ||
+          second_operand.kind != ASM_OPERAND_REGISTER || second_operand.size != size || size == 1)
+        return (unsupported("Bad lea"));
+      return (emit_modrm_instruction(0x8d, 1, second_operand.register_index, 0,
+        &first_operand, size == 8, 0));
+    case ASM_TEST:
+      if (operand_number != 2) return (unsupported("Expected two operands"));
+      if (check_operand_size(&second_operand, size) < 0) return (-1);
+      if (first_operand.kind == ASM_OPERAND_IMMEDIATE) {
+        if (size == 1) {
+          if (emit_modrm_instruction(0xf6, 1, 0, 0, &second_operand, 0, 1) < 0) return (-1);
+          emit_value(first_operand.value, 1);
+          return (0);
+        }
+        if (emit_modrm_instruction(0xf7, 1, 0, 0, &second_operand, size == 8, 4) < 0) return (-1);
+        emit_value(first_operand.value, 4);
+        return (0);
+      }
+      if (first_operand.kind != ASM_OPERAND_REGISTER) return (unsupported("Bad test"));
+      if (check_operand_size(&first_operand, size) < 0) return (-1);
+      return (emit_modrm_instruction(size == 1 ? 0x84 : 0x85, 1, first_operand.register_index,
+        size == 1, &second_operand, size == 8, 0));
+    case ASM_IMUL:
+      if (size == 1) return (unsupported("Bad imul"));
+      if (operand_number == 1) return (encode_unary(5, size, operand_number));
+      if (first_operand.kind == ASM_OPERAND_IMMEDIATE) {
+        // imulq $imm, %src, %dst，两个操作数时 src 与 dst 相同
+        if (operand_number == 2) {
+          third_operand.kind = second_operand.kind;
+          third_operand.register_index = second_operand.register_index;
+          third_operand.size = second_operand.size;
+        }
+        if (third_operand.kind != ASM_OPERAND_REGISTER || third_operand.size != size)
+          return (unsupported("Bad imul"));
+        if (check_int8(first_operand.value)) {
+          if (emit_modrm_instruction(0x6b, 1, third_operand.register_index, 0,
+              &second_operand, size == 8, 1) < 0) return (-1);
+          emit_value(first_operand.value, 1);
+          return (0);
+        }
+        if (emit_modrm_instruction(0x69, 1, third_operand.register_index, 0,
+            &second_operand, size == 8, 4) < 0) return (-1);
+        emit_value(first_operand.value, 4);
+        return (0);
+      }
+      if (operand_number != 2 || second_operand.kind != ASM_OPERAND_REGISTER ||
+          second_operand.size != size)
+        return (unsupported("Bad imul"));
+      if (check_operand_size(&first_operand, size) < 0) return (-1);
+      return (emit_modrm_instruction(0x0faf, 2, second_operand.register_index, 0,
+        &first_operand, size == 8, 0));
+    case ASM_IDIV: return (encode_unary(7, size, operand_number));
+    case ASM_DIV: return (encode_unary(6, size, operand_number));
+    case ASM_MUL: return (encode_unary(4, size, operand_number));
+    case ASM_NEG: return (encode_unary(3, size, operand_number));
+    case ASM_NOT: return (encode_unary(2, size, operand_number));
+    case ASM_SHL:
+    case ASM_SAL: return (encode_shift(4, size, operand_number));
+    case ASM_SHR: return (encode_shift(5, size, operand_number));
+    case ASM_SAR: return (encode_shift(7, size, operand_number));
+    case ASM_INC:
+    case ASM_DEC:
+      if (operand_number != 1) return (unsupported("Expected one operand"));
+      if (check_operand_size(&first_operand, size) < 0) return (-1);
+      return (emit_modrm_instruction(size == 1 ? 0xfe : 0xff, 1,
+        instruction == ASM_INC ? 0 : 1, 0, &first_operand, size == 8, 0));
+    case ASM_PUSH:
+    case ASM_POP:
+      if (operand_number != 1 || first_operand.kind != ASM_OPERAND_REGISTER ||
+          first_operand.size != 8 || (size && size != 8))
+        return (unsupported("Bad push/pop"));
+      r = first_operand.register_index;
+      if (r & 8) emit_byte(0x41);
+      if (instruction == ASM_PUSH) emit_byte(0x50 + (r & 7));
+      else emit_byte(0x58 + (r & 7));
+      return (0);
+    case ASM_CALL:
+    case ASM_JMP:
+      if (operand_number != 1 || (size && size != 8)) return (unsupported("Bad branch"));
+      if (first_operand.is_indirect) {
+        // call *%rax、jmp *%rax，寄存器本身是 64 位，不需要 REX.W
+        return (emit_modrm_instruction(0xff, 1, instruction == ASM_CALL ? 2 : 4, 0,
+          &first_operand, 0, 0));
+      }
+      if (instruction == ASM_CALL) {
+        emit_byte(0xe8);
+        return (emit_branch_target(&first_operand, 0));
+      }
+      emit_byte(0xe9);
+      return (emit_branch_target(&first_operand, 0xeb));
+  }
+  return (unsupported("Unknown instruction"));
+}
+
+// 编码一条指令，mnemonic 为指令名，line_pointer 指向操作数
+static int encode_instruction(char *mnemonic, int length) {
+  int operand_number, size, condition, i;
+
+  if ((operand_number = parse_operand_list()) < 0) return (-1);
+  if (!check_line_end()) return (unsupported("Junk at end of line"));
+
+  if (length == 3 && !strncmp(mnemonic, "ret", 3)) {
+    emit_byte(0xc3);
+    return (0);
+  }
+  if (length == 3 && !strncmp(mnemonic, "cqo", 3)) {
+    emit_byte(0x48);
+    emit_byte(0x99);
+    return (0);
+  }
+  if (length == 4 && !strncmp(mnemonic, "cltq", 4)) {
+    emit_byte(0x48);
+    emit_byte(0x98);
+    return (0);
+  }
+  if (length == 4 && !strncmp(mnemonic, "cltd", 4)) {
+    emit_byte(0x99);
+    return (0);
+  }
+  if (length == 3 && !strncmp(mnemonic, "cld", 3)) {
+    emit_byte(0xfc);
+    return (0);
+  }
+  if (length == 5 && !strncmp(mnemonic, "leave", 5)) {
+    emit_byte(0xc9);
+    return (0);
+  }
+  if (length == 3 && !strncmp(mnemonic, "nop", 3)) {
+    emit_byte(0x90);
+    return (0);
+  }
+  if (length == 5 && !strncmp(mnemonic, "lodsq", 5)) {
+    emit_byte(0x48);
+    emit_byte(0xad);
+    return (0);
+  }
+  if (length == 4 && !strncmp(mnemonic, "loop", 4)) {
+    if (operand_number != 1 || first_operand.kind != ASM_OPERAND_SYMBOL)
+      return (unsupported("Bad loop target"));
+    emit_byte(0xe2);
+    add_fixup(ASM_FIXUP_REL8, first_operand.symbol, -1);
+    emit_byte(0);
+    return (0);
+  }
+
+  if (length == 6 && !strncmp(mnemonic, "movzbq", 6))
+    return (encode_mov_extend(0x0fb6, 2, 1, 8, operand_number));
+  if (length == 6 && !strncmp(mnemonic, "movzbl", 6))
+    return (encode_mov_extend(0x0fb6, 2, 1, 4, operand_number));
+  if (length == 6 && !strncmp(mnemonic, "movsbq", 6))
+    return (encode_mov_extend(0x0fbe, 2, 1, 8, operand_number));
+  if (length == 6 && !strncmp(mnemonic, "movsbl", 6))
+    return (encode_mov_extend(0x0fbe, 2, 1, 4, operand_number));
+  if (length == 6 && !strncmp(mnemonic, "movslq", 6))
+    return (encode_mov_extend(0x63, 1, 4, 8, operand_number));
+
+  // jcc 和 setcc
+  if (mnemonic[0] == 'j' && (condition = find_condition(mnemonic + 1, length - 1)) >= 0) {
+    if (operand_number != 1) return (unsupported("Bad branch"));
+    emit_byte(0x0f);
+    emit_byte(0x80 + condition);
+    return (emit_branch_target(&first_operand, 0x70 + condition));
+  }
+  if (length > 3 && !strncmp(mnemonic, "set", 3) &&
+      (condition = find_condition(mnemonic + 3, length - 3)) >= 0) {
+    if (operand_number != 1 || check_operand_size(&first_operand, 1) < 0)
+      return (unsupported("Bad setcc"));
+    return (emit_modrm_instruction(0x0f90 + condition, 2, 0, 0, &first_operand, 0, 0));
+  }
+
+  if ((i = split_suffix(mnemonic, length, alu_list, 8, &size)) >= 0) {
+    i = find_name(alu_list, 8, mnemonic, i);
+    if (!size && (size = infer_size(operand_number)) < 0) return (-1);
+    return (encode_alu(i, size, operand_number));
+  }
+  if ((i = split_suffix(mnemonic, length, sized_list, 19, &size)) >= 0)
+    return (encode_sized(find_name(sized_list, 19, mnemonic, i), size, operand_number));
+
+  return (unsupported("Unknown instruction"));
+}
+
+// .byte/.long/.quad 的一个数据项：数字、symbol、symbol+n 或者 a-b
+static int emit_data_item(int size) {
+  struct AsmSymbol *symbol, *minus_symbol;
+  char *name;
+  int length;
+  long n;
+
+  if (check_number_start()) {
+    if (scan_number(&n) < 0) return (unsupported("Bad number"));
+    emit_value(n, size);
+    return (0);
+  }
+
+  if (!(length = scan_assembler_identifier(&name))) return (unsupported("Bad data item"));
+  symbol = find_assembler_symbol(name, length);
+  n = 0;
+
+  if (check_and_skip('-')) {
+    skip_whitespace();
+    if (check_number_start()) {
+      if (scan_number(&n) < 0) return (unsupported("Bad number"));
+      n = -n;
+    } else {
+      // a-b，两个符号都在同一节时差值是常量
+      if (!(length = scan_assembler_identifier(&name))) return (unsupported("Bad data item"));
+      minus_symbol = find_assembler_symbol(name, length);
+      if (size != 4) return (unsupported("Symbol difference must be .long"));
+      add_fixup(ASM_FIXUP_DIFF32, symbol, 0);
+      fixup_tail->minus_symbol = minus_symbol;
+      minus_symbol->is_referenced = 1;
+      emit_value(0, 4);
+      return (0);
+    }
+  } else if (check_and_skip('+')) {
+    if (scan_number(&n) < 0) return (unsupported("Bad number"));
+  }
+
+  if (size == 8) add_fixup(ASM_FIXUP_ABS64, symbol, n);
+  else if (size == 4) add_fixup(ASM_FIXUP_ABS32, symbol, n);
+  else return (unsupported("Symbol in .byte"));
+  emit_value(0, size);
+  return (0);
+}
+
+static int encode_directive(char *directive, int length) {
+  struct AsmSymbol *symbol;
+  char *name;
+  int size = 0;
+
+  if (length == 5 && !strncmp(directive, ".text", 5)) {
+    current_section = text_section;
+    return (0);
+  }
+  if (length == 5 && !strncmp(directive, ".data", 5)) {
+    current_section = data_section;
+    return (0);
+  }
+  if ((length == 6 && !strncmp(directive, ".globl", 6)) ||
+      (length == 7 && !strncmp(directive, ".global", 7))) {
+    if (!(length = scan_assembler_identifier(&name))) return (unsupported("Expected symbol"));
+    symbol = find_assembler_symbol(name, length);
+    symbol->is_global = 1;
+    return (0);
+  }
+  if (length == 6 && !strncmp(directive, ".local", 6)) {
+    if (!(length = scan_assembler_identifier(&name))) return (unsupported("Expected symbol"));
+    symbol = find_assembler_symbol(name, length);
+    symbol->is_global = 0;
+    return (0);
+  }
+  if (length == 5 && !strncmp(directive, ".type", 5)) {
+    if (!(length = scan_assembler_identifier(&name))) return (unsupported("Expected symbol"));
+    symbol = find_assembler_symbol(name, length);
+    if (!check_and_skip(',') || !check_and_skip('@')) return (unsupported("Bad .type"));
+    length = scan_assembler_identifier(&name);
+    if (length == 8 && !strncmp(name, "function", 8)) symbol->is_function = 1;
+    else if (length != 6 || strncmp(name, "object", 6)) return (unsupported("Bad .type"));
+    return (0);
+  }
+  if (length == 5 && !strncmp(directive, ".byte", 5)) size = 1;
+  else if (length == 5 && !strncmp(directive, ".long", 5)) size = 4;
+  else if (length == 5 && !strncmp(directive, ".quad", 5)) size = 8;
+  if (!size) return (unsupported("Unknown directive"));
+
+  while (1) {
+    if (emit_data_item(size) < 0) return (-1);
+    if (!check_and_skip(',')) break;
+  }
+  return (0);
+}
+
+static int define_label(char *name, int length) {
+  struct AsmSymbol *symbol = find_assembler_symbol(name, length);
+  if (symbol->section) return (unsupported("Label defined twice"));
+  symbol->section = current_section;
+  symbol->value = get_current_offset();
+  return (0);
+}
+
+// 汇编一行，line 以 '\0' 结尾
+static int assemble_line(char *line) {
+  char *name;
+  int length;
+
+  line_pointer = line;
+  while (1) {
+    if (check_line_end()) return (0);
+    if (!(length = scan_assembler_identifier(&name))) return (unsupported("Syntax error"));
+    if (*line_pointer != ':') break;
+    line_pointer++;
+    if (define_label(name, length) < 0) return (-1);
+  }
+
+  if (name[0] == '.') {
+    if (encode_directive(name, length) < 0) return (-1);
+    if (!check_line_end()) return (unsupported("Junk at end of line"));
+    return (0);
+  }
+  return (encode_instruction(name, length));
+}
+
+// 符号在 ELF 重定位中使用的下标和需要额外加上的 addend
+// 本地符号用所在节的 section 符号加偏移来表示
+static int get_relocation_symbol_index(struct AsmSymbol *symbol) {
+  if (symbol->section && !symbol->is_global) return (symbol->section->symbol_index);
+  return (symbol->symbol_index);
+}
+
+static long get_relocation_symbol_offset(struct AsmSymbol *symbol) {
+  if (symbol->section && !symbol->is_global) return (symbol->value);
+  return (0);
+}
+
+static void add_relocation(struct AsmFixup *f, int type) {
+  struct AsmBuffer *b = f->section->relocation;
+  long info = get_relocation_symbol_index(f->symbol);
+
+  buffer_put_value(b, f->offset, 8);
+  buffer_put_value(b, (info << 32) | type, 8);
+  buffer_put_value(b, f->addend + get_relocation_symbol_offset(f->symbol), 8);
+}
+
+/**
+ * call/jmp *foo@GOTPCREL(%rip) 的目标就在本节中时，和链接器一样改成直接跳转，不再经过 GOT
+ * call：ff 15 rel32 改成 67 e8 rel32(addr32 call foo)
+ * jmp：ff 25 rel32 改成 e9 rel32 90(jmp foo; nop)
+ * 其他指令返回 0，还是交给链接器
+*/
+static int relax_gotpcrel_fixup(struct AsmFixup *f) {
+  char *data = f->section->content->data;
+  int offset = f->offset;
+  // 相对于 rel32 之后的位置，jmp 的 rel32 提前了一个字节
+  long value = f->symbol->value + f->addend - offset;
+
+  if ((data[offset - 2] & 255) != 0xff) return (0);
+  if ((data[offset - 1] & 255) == 0x15) {
+    buffer_patch_value(f->section->content, offset - 2, 0xe867, 2);
+    buffer_patch_value(f->section->content, offset, value, 4);
+    return (1);
+  }
+  if ((data[offset - 1] & 255) == 0x25) {
+    buffer_patch_value(f->section->content, offset - 2, 0xe9, 1);
+    buffer_patch_value(f->section->content, offset - 1, value + 1, 4);
+    buffer_patch_value(f->section->content, offset + 3, 0x90, 1);
+    return (1);
+  }
+  return (0);
+}
+
+// 可以改成短跳转的 jmp/jcc，按在节中的位置排列，在 relax_branch_fixup 中使用
+static struct AsmFixup **branch_list;
+static int *branch_start_list;      // 长跳转指令的起始位置
+static int *branch_shrink_list;     // 改成短跳转少掉的字节数，0 表示还是长跳转
+static int *shrink_before_list;     // 第 i 条跳转之前的跳转一共少掉的字节数
+static int branch_number;
+
+// jmp 由 e9 rel32 改成 eb rel8，jcc 由 0f 8x rel32 改成 7x rel8
+static int get_long_branch_size(struct AsmFixup *f) {
+  if (f->short_opcode == 0xeb) return (5);
+  return (6);
+}
+
+// 长跳转布局中的位置 offset 在改过之后的位置，只有起始位置在它之前的跳转会影响它
+static int get_relaxed_offset(int offset) {
+  int low = 0, high = branch_number, middle;
+
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (branch_start_list[middle] < offset) low = middle + 1;
+    else high = middle;
+  }
+  return (offset - shrink_before_list[low]);
+}
+
+static void compute_shrink_before() {
+  int i;
+
+  shrink_before_list[0] = 0;
+  for (i = 0; i < branch_number; i++)
+    shrink_before_list[i + 1] = shrink_before_list[i] + branch_shrink_list[i];
+}
+
+// 长跳转换成 rel8，复制其余的字节，rel8 改成 ASM_FIXUP_REL8 由 resolve_fixup 回填
+static void rewrite_relaxed_section(struct AsmSection *section) {
+  struct AsmBuffer *old_content = section->content, *content = new_buffer();
+  struct AsmFixup *f;
+  int i, position = 0;
+
+  for (i = 0; i < branch_number; i++) {
+    if (branch_shrink_list[i]) {
+      f = branch_list[i];
+      while (position < branch_start_list[i]) {
+        buffer_put_byte(content, old_content->data[position]);
+        position++;
+      }
+      buffer_put_byte(content, f->short_opcode);
+      f->type = ASM_FIXUP_REL8;
+      f->addend = -1;
+      f->offset = content->size;
+      buffer_put_byte(content, 0);
+      position = branch_start_list[i] + get_long_branch_size(f);
+    }
+  }
+  while (position < old_content->size) {
+    buffer_put_byte(content, old_content->data[position]);
+    position++;
+  }
+  free_buffer(old_content);
+  section->content = content;
+}
+
+/**
+ * 跳转到本节中的标签的 jmp/jcc 尽量用 rel8，和 as 一样
+ * 编码时都是长跳转，整个文件汇编完之后才知道标签的位置：
+ * 1. 先把所有的跳转都当成短跳转，位移放不进一个有符号字节的改回长跳转，
+ *    改回之后后面的位置都变了，重复直到没有跳转再改回，跳转只会变长，所以一定会停下来
+ * 2. 按最后的布局移动节中的标签和 fixup，重写节的内容
+ * 全局符号和 resolve_fixup 中的 call 一样直接跳转，写成 foo@PLT 的跳转不改
+*/
+static void relax_branch_fixup(struct AsmSection *section) {
+  struct AsmFixup *f;
+  struct AsmSymbol *s;
+  int i, changed, end;
+
+  branch_number = 0;
+  for (f = fixup_head; f; f = f->next) {
+    if (f->section == section && f->short_opcode &&
+        f->symbol->section == section)
+      branch_number++;
+  }
+  if (!branch_number) return;
+
+  branch_list = (struct AsmFixup **) malloc(branch_number * sizeof(struct AsmFixup *));
+  branch_start_list = (int *) malloc(branch_number * sizeof(int));
+  branch_shrink_list = (int *) malloc(branch_number * sizeof(int));
+  shrink_before_list = (int *) malloc((branch_number + 1) * sizeof(int));
+  i = 0;
+  for (f = fixup_head; f; f = f->next) {
+    if (f->section == section && f->short_opcode &&
+        f->symbol->section == section) {
+      branch_list[i] = f;
+      branch_start_list[i] = f->offset + 4 - get_long_branch_size(f);
+      branch_shrink_list[i] = get_long_branch_size(f) - 2;
+      i++;
+    }
+  }
+
+  changed = 1;
+  while (changed) {
+    changed = 0;
+    compute_shrink_before();
+    for (i = 0; i < branch_number; i++) {
+      if (branch_shrink_list[i]) {
+        end = get_relaxed_offset(branch_start_list[i]) + 2;
+        if (!check_int8(get_relaxed_offset(branch_list[i]->symbol->value) - end)) {
+          branch_shrink_list[i] = 0;
+          changed = 1;
+        }
+      }
+    }
+  }
+
+  for (s = symbol_head; s; s = s->next) {
+    if (s->section == section) s->value = get_relaxed_offset(s->value);
+  }
+  // 短跳转的 fixup 在重写时再设置位置
+  for (f = fixup_head; f; f = f->next) {
+    if (f->section == section) f->offset = get_relaxed_offset(f->offset);
+  }
+  rewrite_relaxed_section(section);
+
+  free(branch_list);
+  free(branch_start_list);
+  free(branch_shrink_list);
+  free(shrink_before_list);
+}
+
+/**
+ * 处理所有的 fixup，能在本文件内算出来的直接回填，否则生成重定位项
+ * 跳转到本节中定义的函数时，即使是全局符号也直接回填：
+ * 生成的是可执行文件，不会被别的定义替换，和 generator_core.c 直接调用本文件中的函数一样
+ * 这样调用时还没有定义的函数(例如互相递归的函数)最后也是直接调用
+*/
+static int resolve_fixup() {
+  struct AsmFixup *f;
+  struct AsmSymbol *s;
+  long value;
+
+  for (f = fixup_head; f; f = f->next) {
+    s = f->symbol;
+    switch (f->type) {
+      case ASM_FIXUP_PC32:
+      case ASM_FIXUP_PLT32:
+        if (s->section == f->section && (!s->is_global || f->type == ASM_FIXUP_PLT32)) {
+          value = s->value + f->addend - f->offset;
+          buffer_patch_value(f->section->content, f->offset, value, 4);
+        } else {
+          add_relocation(f, f->type == ASM_FIXUP_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32);
+        }
+        break;
+      case ASM_FIXUP_GOTPCREL:
+        // 读 GOT 中的地址时要由链接器把地址放进 GOT，即使符号在本文件中也不能直接回填
+        if (s->section != f->section || !relax_gotpcrel_fixup(f))
+          add_relocation(f, R_X86_64_GOTPCRELX);
+        break;
+      case ASM_FIXUP_REL8:
+        // 短跳转的目标在 relax_branch_fixup 中检查过，这里只有 loop 会出错
+        if (s->section != f->section)
+          return (unsupported("loop target must be in the same section"));
+        value = s->value + f->addend - f->offset;
+        if (!check_int8(value)) return (unsupported("loop target out of range"));
+        buffer_patch_value(f->section->content, f->offset, value, 1);
+        break;
+      case ASM_FIXUP_ABS64:
+        add_relocation(f, R_X86_64_64);
+        break;
+      case ASM_FIXUP_ABS32:
+        add_relocation(f, R_X86_64_32);
+        break;
+      case ASM_FIXUP_DIFF32:
+        if (!s->section || s->section != f->minus_symbol->section)
+          return (unsupported("Symbol difference across sections"));
+        value = s->value - f->minus_symbol->value + f->addend;
+        buffer_patch_value(f->section->content, f->offset, value, 4);
+        break;
+    }
+  }
+  return (0);
+}
+
+// 符号表：0 号为空，然后是 .text/.data 的 section 符号，
+// 本地标签不导出，最后是全局符号和未定义的外部符号
+static int build_symbol_table(struct AsmBuffer *symtab, struct AsmBuffer *strtab) {
+  struct AsmSymbol *s;
+  int index;
+
+  buffer_put_byte(strtab, 0);
+  buffer_put_value(symtab, 0, 24);
+
+  for (index = 1; index <= 2; index++) {
+    buffer_put_value(symtab, 0, 4);             // st_name
+    buffer_put_byte(symtab, 3);                 // st_info: STB_LOCAL, STT_SECTION
+    buffer_put_byte(symtab, 0);                 // st_other
+    buffer_put_value(symtab, index, 2);         // st_shndx
+    buffer_put_value(symtab, 0, 16);            // st_value, st_size
+  }
+
+  // 这里不能用 continue：zcc 的 continue 会跳过 for 的自增部分
+  for (s = symbol_head; s; s = s->next) {
+    if (s->is_global || (s->is_referenced && !s->section)) {
+      s->symbol_index = index;
+      index++;
+      buffer_put_value(symtab, strtab->size, 4);
+      buffer_put_string(strtab, s->name);
+      // STB_GLOBAL，函数为 STT_FUNC，其它为 STT_NOTYPE
+      buffer_put_byte(symtab, 0x10 | (s->is_function << 1));
+      buffer_put_byte(symtab, 0);
+      buffer_put_value(symtab, s->section ? s->section->section_index : 0, 2);
+      buffer_put_value(symtab, s->value, 8);
+      buffer_put_value(symtab, 0, 8);
+    }
+  }
+  return (3);
+}
+
+static void put_section_header(
+  struct AsmBuffer *b,
+  int name, int type, long flags, long offset, long size,
+  int link, int info, long alignment, long entry_size
+) {
+  buffer_put_value(b, name, 4);
+  buffer_put_value(b, type, 4);
+  buffer_put_value(b, flags, 8);
+  buffer_put_value(b, 0, 8);                    // sh_addr
+  buffer_put_value(b, offset, 8);
+  buffer_put_value(b, size, 8);
+  buffer_put_value(b, link, 4);
+  buffer_put_value(b, info, 4);
+  buffer_put_value(b, alignment, 8);
+  buffer_put_value(b, entry_size, 8);
+}
+
+// 把 section 内容追加到 elf 中，返回在文件中的偏移
+static int append_section(struct AsmBuffer *elf, struct AsmBuffer *b, int alignment) {
+  int offset, i;
+
+  buffer_align(elf, alignment);
+  offset = elf->size;
+  for (i = 0; i < b->size; i++) buffer_put_byte(elf, b->data[i]);
+  return (offset);
+}
+
+static int write_elf_file(char *output_filename) {
+  struct AsmBuffer *elf, *symtab, *strtab, *shstrtab, *headers;
+  int text_offset, data_offset, symtab_offset, strtab_offset;
+  int rela_text_offset, rela_data_offset, shstrtab_offset, header_offset;
+  int text_name, data_name, note_name, symtab_name, strtab_name;
+  int rela_text_name, rela_data_name, shstrtab_name;
+  int first_global;
+  FILE *f;
+
+  // 符号表中有标签的位置，要先定下跳转的长短
+  relax_branch_fixup(text_section);
+  symtab = new_buffer();
+  strtab = new_buffer();
+  first_global = build_symbol_table(symtab, strtab);
+  if (resolve_fixup() < 0) {
+    free_buffer(symtab);
+    free_buffer(strtab);
+    return (-1);
+  }
+
+  shstrtab = new_buffer();
+  buffer_put_byte(shstrtab, 0);
+  text_name = shstrtab->size; buffer_put_string(shstrtab, ".text");
+  data_name = shstrtab->size; buffer_put_string(shstrtab, ".data");
+  note_name = shstrtab->size; buffer_put_string(shstrtab, ".note.GNU-stack");
+  symtab_name = shstrtab->size; buffer_put_string(shstrtab, ".symtab");
+  strtab_name = shstrtab->size; buffer_put_string(shstrtab, ".strtab");
+  rela_text_name = shstrtab->size; buffer_put_string(shstrtab, ".rela.text");
+  rela_data_name = shstrtab->size; buffer_put_string(shstrtab, ".rela.data");
+  shstrtab_name = shstrtab->size; buffer_put_string(shstrtab, ".shstrtab");
+
+  // ELF 头在最后回填，先占 64 个字节
+  elf = new_buffer();
+  buffer_put_value(elf, 0, 64);
+  text_offset = append_section(elf, text_section->content, 16);
+  data_offset = append_section(elf, data_section->content, 8);
+  symtab_offset = append_section(elf, symtab, 8);
+  strtab_offset = append_section(elf, strtab, 1);
+  rela_text_offset = append_section(elf, text_section->relocation, 8);
+  rela_data_offset = append_section(elf, data_section->relocation, 8);
+  shstrtab_offset = append_section(elf, shstrtab, 1);
+  buffer_align(elf, 8);
+  header_offset = elf->size;
+
+  headers = new_buffer();
+  put_section_header(headers, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  // SHT_PROGBITS，SHF_ALLOC | SHF_EXECINSTR
+  put_section_header(headers, text_name, 1, 6, text_offset, text_section->content->size, 0, 0, 16, 0);
+  // SHT_PROGBITS，SHF_WRITE | SHF_ALLOC
+  put_section_header(headers, data_name, 1, 3, data_offset, data_section->content->size, 0, 0, 8, 0);
+  put_section_header(headers, note_name, 1, 0, data_offset, 0, 0, 0, 1, 0);
+  // SHT_SYMTAB，sh_link 指向 .strtab，sh_info 为第一个全局符号的下标
+  put_section_header(headers, symtab_name, 2, 0, symtab_offset, symtab->size,
+    ELF_SECTION_STRTAB, first_global, 8, 24);
+  put_section_header(headers, strtab_name, 3, 0, strtab_offset, strtab->size, 0, 0, 1, 0);
+  // SHT_RELA，SHF_INFO_LINK
+  put_section_header(headers, rela_text_name, 4, 0x40, rela_text_offset,
+    text_section->relocation->size, ELF_SECTION_SYMTAB, ELF_SECTION_TEXT, 8, 24);
+  put_section_header(headers, rela_data_name, 4, 0x40, rela_data_offset,
+    data_section->relocation->size, ELF_SECTION_SYMTAB, ELF_SECTION_DATA, 8, 24);
+  put_section_header(headers, shstrtab_name, 3, 0, shstrtab_offset, shstrtab->size, 0, 0, 1, 0);
+  append_section(elf, headers, 8);
+
+  // ELF 头：ELFCLASS64、小端序、ET_REL、EM_X86_64
+  buffer_patch_value(elf, 0, 0x464c457f, 4);
+  buffer_patch_value(elf, 4, 0x010102, 4);
+  buffer_patch_value(elf, 16, 1, 2);            // e_type
+  buffer_patch_value(elf, 18, 62, 2);           // e_machine
+  buffer_patch_value(elf, 20, 1, 4);            // e_version
+  buffer_patch_value(elf, 40, header_offset, 8);// e_shoff
+  buffer_patch_value(elf, 52, 64, 2);           // e_ehsize
+  buffer_patch_value(elf, 58, 64, 2);           // e_shentsize
+  buffer_patch_value(elf, 60, ELF_SECTION_NUMBER, 2);
+  buffer_patch_value(elf, 62, ELF_SECTION_SHSTRTAB, 2);
+
+  f = fopen(output_filename, "w");
+  if (f) {
+    if ((int) fwrite(elf->data, 1, elf->size, f) != elf->size) {
+      fclose(f);
+      f = NULL;
+    } else if (fclose(f)) {
+      f = NULL;
+    }
+  }
+  free_buffer(elf);
+  free_buffer(symtab);
+  free_buffer(strtab);
+  free_buffer(shstrtab);
+  free_buffer(headers);
+  if (!f) {
+    snprintf(assembler_error, TEXT_LENGTH, "Unable to write %s: %s", output_filename, strerror(errno));
+    return (-1);
+  }
+  return (0);
+}
+
+// 把整个文件读进内存，返回以 '\0' 结尾的内容
+static char *read_whole_file(char *filename) {
+  struct AsmBuffer *b;
+  char *data;
+  FILE *f;
+  int c;
+
+  if (!(f = fopen(filename, "r"))) {
+    snprintf(assembler_error, TEXT_LENGTH, "Unable to open %s: %s", filename, strerror(errno));
+    return (NULL);
+  }
+  b = new_buffer();
+  while ((c = fgetc(f)) != EOF) buffer_put_byte(b, c);
+  buffer_put_byte(b, 0);
+  fclose(f);
+  data = b->data;
+  free(b);
+  return (data);
+}
+
+static void free_assembler_state() {
+  struct AsmSymbol *s, *next_symbol;
+  struct AsmFixup *f, *next_fixup;
+
+  for (s = symbol_head; s; s = next_symbol) {
+    next_symbol = s->next;
+    free(s->name);
+    free(s);
+  }
+  for (f = fixup_head; f; f = next_fixup) {
+    next_fixup = f->next;
+    free(f);
+  }
+  free(symbol_hash);
+  free_section(text_section);
+  free_section(data_section);
+}
+
+/**
+ * 把 input_filename 中的汇编代码汇编成 ELF64 目标文件 output_filename
+ * 成功返回 0，遇到不支持的写法返回 -1，错误信息通过 get_assembler_error 拿到
+*/
+int assemble_file(char *input_filename, char *output_filename) {
+  char *content, *p, *line_start;
+  int result = 0;
+  int i;
+
+  if (!(content = read_whole_file(input_filename))) return (-1);
+
+  symbol_hash = (struct AsmSymbol **) malloc(ASM_HASH_SIZE * sizeof(struct AsmSymbol *));
+  for (i = 0; i < ASM_HASH_SIZE; i++) symbol_hash[i] = NULL;
+  symbol_head = symbol_tail = NULL;
+  fixup_head = fixup_tail = NULL;
+  text_section = new_section(ELF_SECTION_TEXT, 1);
+  data_section = new_section(ELF_SECTION_DATA, 2);
+  current_section = text_section;
+  assembler_line = 0;
+
+  p = content;
+  while (*p && !result) {
+    line_start = p;
+    while (*p && *p != '\n') p++;
+    if (*p) {
+      *p = 0;
+      p++;
+    }
+    assembler_line++;
+    result = assemble_line(line_start);
+  }
+
+  if (!result) result = write_elf_file(output_filename);
+  if (result) unlink(output_filename);
+
+  free_assembler_state();
+  free(content);
+  return (result);
+}
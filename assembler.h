@@ -0,0 +1,7 @@
+#ifndef __ASSEMBLER_H__
+#define __ASSEMBLER_H__
+
+int assemble_file(char *input_filename, char *output_filename);
+char *get_assembler_error();
+
+#endif
@@ -1,8 +1,235 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include "definations.h"
+#include "data.h"
 #include "helper.h"
+#include "ast.h"
+
+// AST 节点表
+// 节点按创建的顺序放在连续的节点块中，每块 AST_NODE_BLOCK_SIZE 个节点，节点之间用下标引用
+// 块不会移动，所以创建新节点之后，之前拿到的 struct ASTNode * 仍然有效
+// 节点的 symbol_table 和 composite_type 放在 payload 表中，大部分节点两个都没有，不占空间
+// 有两张节点表：
+// 1. 函数的节点表，下标为正，函数生成完代码之后清空，下一个函数接着用同样的节点块
+// 2. 整个文件的节点表，下标为负，放可以内联的函数体，编译下一个源文件时清空
+// 节点块和 payload 表都是 malloc 的，清空时只把个数归零，不再从 arena 分配
+
+#define AST_NODE_BLOCK_SIZE 256
+#define AST_TABLE_INITIAL_CAPACITY 16
+
+struct ASTNodeTable {
+  char **block_list;                        // 节点块，第 i 个节点在第 i / AST_NODE_BLOCK_SIZE 块中
+  int block_capacity;
+  int node_number;                          // 下一个节点的下标，0 号不用
+  int new_node_start;                       // get_new_ast_node_start 上次调用时的 node_number
+  struct SymbolTable **symbol_table_list;   // payload 表，0 号不用
+  struct SymbolTable **composite_type_list;
+  int payload_capacity;
+  int payload_number;
+  int sign;                                 // 下标的符号
+};
+
+static struct ASTNodeTable *function_ast_table;
+static struct ASTNodeTable *translation_unit_ast_table;
+
+static struct ASTNodeTable *new_ast_node_table(int sign) {
+  struct ASTNodeTable *table = (struct ASTNodeTable *) malloc(sizeof(struct ASTNodeTable));
+
+  if (!table) error("Unable to malloc an AST node table");
+  table->block_capacity = AST_TABLE_INITIAL_CAPACITY;
+  table->block_list = (char **) calloc(table->block_capacity, sizeof(char *));
+  table->payload_capacity = AST_TABLE_INITIAL_CAPACITY;
+  table->symbol_table_list = (struct SymbolTable **)
+    malloc(table->payload_capacity * sizeof(struct SymbolTable *));
+  table->composite_type_list = (struct SymbolTable **)
+    malloc(table->payload_capacity * sizeof(struct SymbolTable *));
+  if (!table->block_list || !table->symbol_table_list || !table->composite_type_list)
+    error("Unable to malloc an AST node table");
+  table->sign = sign;
+  return (table);
+}
+
+static void reset_ast_node_table(struct ASTNodeTable *table) {
+  table->node_number = 1;
+  table->new_node_start = 1;
+  table->payload_number = 1;
+}
+
+// 函数的代码生成完之后调用
+void reset_function_ast_nodes() {
+  if (!function_ast_table) function_ast_table = new_ast_node_table(1);
+  reset_ast_node_table(function_ast_table);
+}
+
+// 编译一个新的源文件之前调用
+void reset_translation_unit_ast_nodes() {
+  if (!translation_unit_ast_table) translation_unit_ast_table = new_ast_node_table(-1);
+  reset_ast_node_table(translation_unit_ast_table);
+}
+
+static struct ASTNode *find_ast_node(struct ASTNodeTable *table, int i) {
+  return ((struct ASTNode *)
+    (table->block_list[i / AST_NODE_BLOCK_SIZE] + (i % AST_NODE_BLOCK_SIZE) * sizeof(struct ASTNode)));
+}
+
+// 在节点表的末尾加上一个清零的节点
+static struct ASTNode *allocate_ast_node(struct ASTNodeTable *table) {
+  struct ASTNode *node;
+  int i = table->node_number;
+  int block = i / AST_NODE_BLOCK_SIZE;
+
+  if (block >= table->block_capacity) {
+    table->block_list = (char **) realloc(table->block_list, 2 * table->block_capacity * sizeof(char *));
+    if (!table->block_list) error("Unable to malloc AST nodes");
+    memset((char *) table->block_list + table->block_capacity * sizeof(char *), 0,
+      table->block_capacity * sizeof(char *));
+    table->block_capacity = 2 * table->block_capacity;
+  }
+  if (!table->block_list[block]) {
+    table->block_list[block] = (char *) malloc(AST_NODE_BLOCK_SIZE * sizeof(struct ASTNode));
+    if (!table->block_list[block]) error("Unable to malloc AST nodes");
+  }
+
+  node = find_ast_node(table, i);
+  memset(node, 0, sizeof(struct ASTNode));
+  node->index = table->sign * i;
+  table->node_number = i + 1;
+  return (node);
+}
+
+// 下标为 index 的节点，0 返回 NULL
+// 函数的节点表最常用，直接计算地址，少一次函数调用
+struct ASTNode *get_ast_node(int index) {
+  if (index > 0)
+    return ((struct ASTNode *) (function_ast_table->block_list[index / AST_NODE_BLOCK_SIZE] +
+      (index % AST_NODE_BLOCK_SIZE) * sizeof(struct ASTNode)));
+  if (index < 0) return (find_ast_node(translation_unit_ast_table, -index));
+  return (NULL);
+}
+
+// 函数的节点表中节点的个数加 1，下标从 1 到它减 1 的节点按创建的顺序排列
+int get_ast_node_number() {
+  return (function_ast_table->node_number);
+}
+
+// 返回上次调用之后新建的第一个节点的下标，optimise 用它只扫描新的节点
+int get_new_ast_node_start() {
+  int start = function_ast_table->new_node_start;
+
+  function_ast_table->new_node_start = function_ast_table->node_number;
+  return (start);
+}
+
+struct ASTNode *get_ast_left(struct ASTNode *node) {
+  return (get_ast_node(node->left_index));
+}
+
+struct ASTNode *get_ast_middle(struct ASTNode *node) {
+  return (get_ast_node(node->middle_index));
+}
+
+struct ASTNode *get_ast_right(struct ASTNode *node) {
+  return (get_ast_node(node->right_index));
+}
+
+static int get_ast_index(struct ASTNode *node) {
+  if (!node) return (0);
+  return (node->index);
+}
+
+void set_ast_left(struct ASTNode *node, struct ASTNode *child) {
+  node->left_index = get_ast_index(child);
+}
+
+void set_ast_middle(struct ASTNode *node, struct ASTNode *child) {
+  node->middle_index = get_ast_index(child);
+}
+
+void set_ast_right(struct ASTNode *node, struct ASTNode *child) {
+  node->right_index = get_ast_index(child);
+}
+
+static struct ASTNodeTable *find_ast_node_table(struct ASTNode *node) {
+  if (node->index < 0) return (translation_unit_ast_table);
+  return (function_ast_table);
+}
+
+struct SymbolTable *get_ast_symbol_table(struct ASTNode *node) {
+  struct ASTNodeTable *table;
+
+  if (!node->payload_index) return (NULL);
+  table = find_ast_node_table(node);
+  return (table->symbol_table_list[node->payload_index]);
+}
+
+struct SymbolTable *get_ast_composite_type(struct ASTNode *node) {
+  struct ASTNodeTable *table;
+
+  if (!node->payload_index) return (NULL);
+  table = find_ast_node_table(node);
+  return (table->composite_type_list[node->payload_index]);
+}
+
+/**
+ * 节点还没有 payload 时在表的末尾加一项
+ * 两个指针都是 NULL 时不需要 payload
+ * 表是重复使用的，新的一项要先清零
+*/
+static int get_ast_payload(struct ASTNode *node, struct SymbolTable *t) {
+  struct ASTNodeTable *table = find_ast_node_table(node);
+  int capacity = table->payload_capacity;
+
+  if (node->payload_index || !t) return (node->payload_index);
+  if (table->payload_number >= capacity) {
+    table->payload_capacity = 2 * capacity;
+    table->symbol_table_list = (struct SymbolTable **)
+      realloc(table->symbol_table_list, table->payload_capacity * sizeof(struct SymbolTable *));
+    table->composite_type_list = (struct SymbolTable **)
+      realloc(table->composite_type_list, table->payload_capacity * sizeof(struct SymbolTable *));
+    if (!table->symbol_table_list || !table->composite_type_list)
+      error("Unable to malloc AST nodes");
+  }
+  node->payload_index = table->payload_number;
+  table->symbol_table_list[node->payload_index] = NULL;
+  table->composite_type_list[node->payload_index] = NULL;
+  table->payload_number = table->payload_number + 1;
+  return (node->payload_index);
+}
+
+void set_ast_symbol_table(struct ASTNode *node, struct SymbolTable *t) {
+  struct ASTNodeTable *table = find_ast_node_table(node);
+  int i = get_ast_payload(node, t);
+
+  if (i) table->symbol_table_list[i] = t;
+}
+
+void set_ast_composite_type(struct ASTNode *node, struct SymbolTable *t) {
+  struct ASTNodeTable *table = find_ast_node_table(node);
+  int i = get_ast_payload(node, t);
+
+  if (i) table->composite_type_list[i] = t;
+}
+
+/**
+ * 复制一个节点，不复制子节点
+ * is_translation_unit 为 1 时复制到整个文件的节点表中，否则复制到函数的节点表中
+*/
+struct ASTNode *copy_ast_node(struct ASTNode *node, int is_translation_unit) {
+  struct ASTNode *copy;
+
+  if (is_translation_unit) copy = allocate_ast_node(translation_unit_ast_table);
+  else copy = allocate_ast_node(function_ast_table);
+  copy->operation = node->operation;
+  copy->primitive_type = node->primitive_type;
+  copy->rvalue = node->rvalue;
+  copy->terminal = node->terminal;
+  copy->ast_node_integer_value = node->ast_node_integer_value;
+  set_ast_symbol_table(copy, get_ast_symbol_table(node));
+  set_ast_composite_type(copy, get_ast_composite_type(node));
+  return (copy);
+}
 
 struct ASTNode *create_ast_node(
   int operation,
@@ -14,20 +241,17 @@ struct ASTNode *create_ast_node(
   struct SymbolTable *symbol_table,
   struct SymbolTable *composite_type
 ) {
-  struct ASTNode *node;
-
-  node = (struct ASTNode *) malloc(sizeof(struct ASTNode));
-  if (node == NULL)
-    error("Unable to malloc in function make_ast_node");
+  // 放在函数的节点表中，函数的代码生成完之后整体回收
+  struct ASTNode *node = allocate_ast_node(function_ast_table);
 
-  node->operation = operation;
-  node->primitive_type = primitive_type;
-  node->left = left;
-  node->middle = middle;
-  node->right = right;
+  node->operation = (char) operation;
+  node->primitive_type = (char) primitive_type;
+  set_ast_left(node, left);
+  set_ast_middle(node, middle);
+  set_ast_right(node, right);
   node->ast_node_integer_value = integer_value;
-  node->symbol_table = symbol_table;
-  node->composite_type = composite_type;
+  set_ast_symbol_table(node, symbol_table);
+  set_ast_composite_type(node, composite_type);
 
   return (node);
 }
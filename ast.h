@@ -27,5 +27,21 @@ struct ASTNode *create_ast_left_node(
   struct SymbolTable *symbol_table,
   struct SymbolTable *composite_type
 );
+void reset_function_ast_nodes();
+void reset_translation_unit_ast_nodes();
+struct ASTNode *get_ast_node(int index);
+int get_ast_node_number();
+int get_new_ast_node_start();
+struct ASTNode *get_ast_left(struct ASTNode *node);
+struct ASTNode *get_ast_middle(struct ASTNode *node);
+struct ASTNode *get_ast_right(struct ASTNode *node);
+void set_ast_left(struct ASTNode *node, struct ASTNode *child);
+void set_ast_middle(struct ASTNode *node, struct ASTNode *child);
+void set_ast_right(struct ASTNode *node, struct ASTNode *child);
+struct SymbolTable *get_ast_symbol_table(struct ASTNode *node);
+struct SymbolTable *get_ast_composite_type(struct ASTNode *node);
+void set_ast_symbol_table(struct ASTNode *node, struct SymbolTable *t);
+void set_ast_composite_type(struct ASTNode *node, struct SymbolTable *t);
+struct ASTNode *copy_ast_node(struct ASTNode *node, int is_translation_unit);
 
 #endif
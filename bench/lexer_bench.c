@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define extern_
+  #include "data.h"
+#undef extern_
+
+#include "definations.h"
+#include "scan.h"
+#include "preprocess.h"
+
+// 词法分析的基准测试
+// 对给定的每个文件先做预处理，然后反复扫描预处理后的内容，统计 MB/s 和 tokens/s
+// 最后再扫描一份生成的大文件，里面是大的查找表、长字符串、很多标识符和关键字
+
+#define REPEAT_TIME 0.05
+#define SYNTHETIC_ROW_NUMBER 200000
+
+static double get_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec + t.tv_nsec / 1e9);
+}
+
+static long scan_all_tokens(char *text, char *filename) {
+  long tokens = 0;
+
+  input_pointer = text;
+  global_input_filename = filename;
+  line = 1;
+  start_line = 1;
+  putback_buffer = '\n';
+  look_ahead_token.token = 0;
+  while (scan(&token_from_file)) tokens++;
+  return (tokens);
+}
+
+// 反复扫描 text，至少持续 REPEAT_TIME 秒，返回平均扫描一遍所用的秒数
+static double measure(char *text, char *filename, long *tokens) {
+  double start = get_seconds(), elapsed;
+  long rounds = 0;
+
+  do {
+    *tokens = scan_all_tokens(text, filename);
+    rounds++;
+    elapsed = get_seconds() - start;
+  } while (elapsed < REPEAT_TIME);
+
+  return (elapsed / rounds);
+}
+
+static void report(char *name, long length, long tokens, double seconds) {
+  printf("%s: %ld bytes, %ld tokens, %.1f MB/s, %.2f M tokens/s\n",
+    name, length, tokens, length / seconds / 1e6, tokens / seconds / 1e6);
+}
+
+static char *generate_synthetic_text(long *length) {
+  long capacity = 128L * SYNTHETIC_ROW_NUMBER + 1024, size = 0;
+  char *text = malloc(capacity + PREPROCESS_PADDING);
+  int i;
+
+  size += sprintf(text + size, "int lookup_table[] = {\n");
+  for (i = 0; i < SYNTHETIC_ROW_NUMBER / 2; i++)
+    size += sprintf(text + size, "  %d, %d, 0x%x, %d,\n", i, i * 7, i * 13, i % 255);
+  size += sprintf(text + size, "  0 };\n");
+  for (i = 0; i < SYNTHETIC_ROW_NUMBER / 4; i++) {
+    size += sprintf(text + size,
+      "char *message_%d = \"generated message number %d with some padding text\";\n", i, i);
+    size += sprintf(text + size,
+      "long accumulate_value_%d(long first_argument, long second_argument);\n", i);
+    size += sprintf(text + size,
+      "static int check_%d(int value) { if (value > %d) return (value); "
+      "while (value < 0) value = value + 1; return (sizeof(char)); }\n", i, i);
+  }
+  memset(text + size, 0, PREPROCESS_PADDING);
+  *length = size;
+  return (text);
+}
+
+int main(int argc, char **argv) {
+  char *include_directory = INCDIR, *text;
+  char name[TEXT_LENGTH];
+  long length, tokens, total_length = 0, total_tokens = 0;
+  double seconds, total_time = 0;
+  int i = 1, length_int, file_count = 0;
+
+  if (argc > 2 && !strcmp(argv[1], "-I")) {
+    include_directory = argv[2];
+    i = 3;
+  }
+
+  for (; i < argc; i++) {
+    text = preprocess_file(argv[i], include_directory, &length_int);
+    if (!text) {
+      fprintf(stderr, "Unable to open %s\n", argv[i]);
+      exit(1);
+    }
+    seconds = measure(text, argv[i], &tokens);
+    file_count++;
+    total_length += length_int;
+    total_tokens += tokens;
+    total_time += seconds;
+    free(text);
+  }
+  if (file_count) {
+    snprintf(name, TEXT_LENGTH, "%d files", file_count);
+    report(name, total_length, total_tokens, total_time);
+  }
+
+  text = generate_synthetic_text(&length);
+  seconds = measure(text, "synthetic.zc", &tokens);
+  report("synthetic", length, tokens, seconds);
+  free(text);
+  return (0);
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define extern_
+  #include "data.h"
+#undef extern_
+
+#include "definations.h"
+#include "scan.h"
+#include "generator.h"
+#include "declaration.h"
+#include "symbol_table.h"
+#include "preprocess.h"
+
+// 符号表的压力测试
+// 生成一个有大量全局变量、枚举值和 typedef 的源文件，在进程内完成一次编译前端和代码生成，
+// 统计所用的时间，生成的汇编代码写到 /dev/null
+
+#define DEFAULT_GLOBAL_NUMBER 100000
+
+static double get_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec + t.tv_nsec / 1e9);
+}
+
+static char *generate_source(int global_number) {
+  long capacity = 160L * global_number + 1024, size = 0;
+  char *text = malloc(capacity + PREPROCESS_PADDING);
+  int i, n = global_number / 10;
+
+  size += sprintf(text + size, "enum {\n");
+  for (i = 0; i < n; i++) size += sprintf(text + size, "  value_%d,\n", i);
+  size += sprintf(text + size, "  value_last\n};\n");
+  for (i = 0; i < n; i++) size += sprintf(text + size, "typedef int type_%d;\n", i);
+  for (i = 0; i < global_number; i++) size += sprintf(text + size, "type_%d global_%d;\n", i % n, i);
+
+  size += sprintf(text + size, "int main() {\n");
+  for (i = 0; i < n; i++)
+    size += sprintf(text + size, "  global_%d = global_%d + value_%d;\n",
+      i * 7 % global_number, global_number - 1 - i, i);
+  size += sprintf(text + size, "  return (0);\n}\n");
+  memset(text + size, 0, PREPROCESS_PADDING);
+  return (text);
+}
+
+int main(int argc, char **argv) {
+  int global_number = DEFAULT_GLOBAL_NUMBER;
+  double start, elapsed;
+  char *text;
+
+  if (argc > 1) global_number = atoi(argv[1]);
+  if (global_number < 10) global_number = 10;
+  text = generate_source(global_number);
+
+  if (!(output_file = fopen("/dev/null", "w"))) {
+    fprintf(stderr, "Unable to open /dev/null\n");
+    exit(1);
+  }
+  global_input_filename = "symbol_bench.zc";
+  global_output_filename = "/dev/null";
+  input_pointer = text;
+  line = 1;
+  start_line = 1;
+  putback_buffer = '\n';
+
+  start = get_seconds();
+  clear_all_symbol_tables();
+  scan(&token_from_file);
+  look_ahead_token.token = 0;
+  generate_preamble_code();
+  parse_global_declaration();
+  generate_postamble_code();
+  elapsed = get_seconds() - start;
+
+  printf("%d globals, %d enum values, %d typedefs: %.3f s\n",
+    global_number, global_number / 10, global_number / 10, elapsed);
+  fclose(output_file);
+  free(text);
+  return (0);
+}
@@ -16,13 +16,14 @@ extern char *token_strings[];
 extern_ int line;
 extern_ int start_line;
 extern_ int putback_buffer;
-extern_ FILE *input_file;
+extern_ char *input_pointer;
 extern_ FILE *output_file;
 extern_ char *global_output_filename;
 extern_ char *global_input_filename;
 extern_ struct Token token_from_file;
 extern_ struct Token look_ahead_token;
 extern_ char text_buffer[TEXT_LENGTH + 1];
+extern_ char *interned_text_buffer; // 最近扫描到的标识符，经过 intern_string 驻留
 extern_ int loop_level;   // 嵌套的循环的层级
 extern_ int switch_level; // 嵌套的 switch 的层级
 
@@ -32,6 +33,12 @@ extern_ int output_keep_object_file;
 extern_ int output_binary_file;
 extern_ int output_verbose;
 extern_ int output_dump_symbol_table;
+extern_ int output_dump_linear_ir;
+extern_ int no_plt;       // -fno-plt，外部函数通过 GOT 调用，不经过 PLT
+extern_ int inline_limit; // 可以内联的函数体最多有多少个 ast 节点，0 表示不内联
+
+extern_ struct Arena *function_arena;            // 函数内的 AST 节点和局部变量，函数生成代码之后释放
+extern_ struct Arena *translation_unit_arena;    // 其余的符号，每个源文件编译开始时释放
 
 extern_ struct SymbolTable *current_function_symbol_id;          // 当前函数
 extern_ struct SymbolTable *global_head, *global_tail;           // 全局变量和函数
@@ -43,6 +50,7 @@ extern_ struct SymbolTable *struct_head, *struct_tail;           // struct symbo
 extern_ struct SymbolTable *union_head, *union_tail;             // union symbol table 指针
 extern_ struct SymbolTable *enum_head, *enum_tail;               // enum symbol table 指针
 extern_ struct SymbolTable *typedef_head, *typedef_tail;         // typedef symbol table 指针
+extern_ struct InlineFunction *inline_function_head;             // 可以内联的函数
 
 
 #endif
@@ -12,6 +12,8 @@
 #include "declaration.h"
 #include "parser.h"
 #include "optimizer.h"
+#include "arena.h"
+#include "inliner.h"
 
 /**
  * 如何解析函数声明和定义？
@@ -117,16 +119,18 @@ static struct SymbolTable *parse_composite_declaration(int primitive_type) {
   struct SymbolTable *composite_type = NULL, *member;
   int offset, member_primitive_type;
   struct ASTNode *tree;
+  char *name = NULL;
 
   // 跳过 struct/union 关键字
   scan(&token_from_file);
 
   // 判断 struct/union 后面的类型名字是否被定义过
   if (token_from_file.token == TOKEN_IDENTIFIER) {
+    name = interned_text_buffer;
     if (primitive_type == PRIMITIVE_STRUCT) {
-      composite_type = find_struct_symbol(text_buffer);
+      composite_type = find_struct_symbol(name);
     } else {
-      composite_type = find_union_symbol(text_buffer);
+      composite_type = find_union_symbol(name);
     }
     // 跳过类型名字
     scan(&token_from_file);
@@ -145,11 +149,11 @@ static struct SymbolTable *parse_composite_declaration(int primitive_type) {
   // 如果要做定义，那么此时 composite_type 应该要为空
   if (composite_type) error_with_message("Previously defined struct/union", text_buffer);
 
-  // 开始构建 struct/union node
+  // 开始构建 struct/union node，匿名的 struct/union 没有名字
   if (primitive_type == PRIMITIVE_STRUCT) {
-    composite_type = add_struct_symbol(text_buffer);
+    composite_type = add_struct_symbol(name);
   } else {
-    composite_type = add_union_symbol(text_buffer);
+    composite_type = add_union_symbol(name);
   }
   // 跳过 '{'
   scan(&token_from_file);
@@ -213,8 +217,8 @@ static void parse_enum_declaration() {
 
   // 如果有已经声明的 xxx，就找出它
   if (token_from_file.token == TOKEN_IDENTIFIER) {
-    t = find_enum_type_symbol(text_buffer);
-    name = strdup(text_buffer);
+    name = interned_text_buffer;
+    t = find_enum_type_symbol(name);
     scan(&token_from_file);
   }
 
@@ -238,8 +242,8 @@ static void parse_enum_declaration() {
   // 解析所有的 enum 枚举变量
   while (1) {
     // 拿到枚举变量名
+    name = interned_text_buffer;
     verify_identifier();
-    name = strdup(text_buffer);
 
     // 确保枚举变量名不重复
     t = find_enum_value_symbol(name);
@@ -278,8 +282,8 @@ int convert_literal_token_2_integer_value(int primitive_type) {
   // 如果有类型强制转换，标记 tree child 有强制转换的类型
   // char *c = (char *)0;
   if (tree->operation == AST_TYPE_CASTING) {
-    tree->left->primitive_type = tree->primitive_type;
-    tree = tree->left;
+    get_ast_left(tree)->primitive_type = tree->primitive_type;
+    tree = get_ast_left(tree);
   }
 
   if (tree->operation != AST_INTEGER_LITERAL &&
@@ -422,7 +426,7 @@ static struct SymbolTable *parse_array_declaration(
     }
 
     // 没用到的空间初始化为 0
-    for (j = i; j < t->element_number; j++) init_value_list[j] = 0;
+    for (j = i; j < element_number; j++) init_value_list[j] = 0;
     if (i > element_number) element_number = i;
     t->init_value_list = init_value_list;
   }
@@ -520,7 +524,7 @@ static struct SymbolTable *parse_scalar_declaration(
       expression_node->rvalue = 1;
 
       // 检查类型
-      expression_node = modify_type(expression_node, var_node->primitive_type, 0, var_node->composite_type);
+      expression_node = modify_type(expression_node, var_node->primitive_type, 0, get_ast_composite_type(var_node));
       if (!expression_node)
         error("Incompatible expression in assignment");
 
@@ -533,7 +537,7 @@ static struct SymbolTable *parse_scalar_declaration(
         var_node,
         0,
         NULL,
-        expression_node->composite_type);
+        get_ast_composite_type(expression_node));
     }
   }
 
@@ -553,7 +557,7 @@ static struct SymbolTable *parse_symbol_declaration(
   struct ASTNode **tree
 ) {
   struct SymbolTable *t = NULL;
-  char *var_name = strdup(text_buffer);
+  char *var_name = interned_text_buffer;
 
   verify_identifier();
 
@@ -636,16 +640,16 @@ int parse_typedef_declaration(struct SymbolTable **composite_type) {
   if (storage_class)
     error("Can't have extern in a typedef declaration");
 
+  // 解析 '*'
+  primitive_type = convert_multiply_token_2_primitive_type(primitive_type);
+
   // 解析 xxx
   // 如果重复定义就报错
-  if (find_typedef_symbol(text_buffer))
+  if (find_typedef_symbol(interned_text_buffer))
     error_with_message("Redefinition of typedef", text_buffer);
 
-  // 解析 '*'
-  primitive_type = convert_multiply_token_2_primitive_type(primitive_type);
-
   // 如果没有重复定义就加入 typedef symbol table 链表
-  add_typedef_symbol(text_buffer, primitive_type, 0, 0, *composite_type);
+  add_typedef_symbol(interned_text_buffer, primitive_type, 0, 0, *composite_type);
 
   // 跳过 ';'
   scan(&token_from_file);
@@ -724,7 +728,7 @@ int convert_token_2_primitive_type(
       break;
     case TOKEN_IDENTIFIER:
       // 在解析一个类型或者碰到关键字的时候，需要去查一下这个是不是被 typedef 定义过
-      new_type = parse_type_of_typedef_declaration(text_buffer, composite_type);
+      new_type = parse_type_of_typedef_declaration(interned_text_buffer, composite_type);
       break;
     default:
       error_with_message("Illegal type, token", token_from_file.token_string);
@@ -743,6 +747,11 @@ struct SymbolTable *parse_function_declaration(
   struct SymbolTable *old_function_symbol_table,
                      *new_function_symbol_table = NULL;
   int end_label = 0, parameter_count = 0;
+  int function_storage_class = STORAGE_CLASS_GLOBAL;
+
+  // static 函数只在当前文件中可见，其它的都是全局函数
+  if (storage_class == STORAGE_CLASS_STATIC)
+    function_storage_class = STORAGE_CLASS_STATIC;
 
   // 如果之前有相同的 identifier，但是这个 identifier 不是函数
   if ((old_function_symbol_table = find_symbol(function_name)) != NULL)
@@ -758,9 +767,12 @@ struct SymbolTable *parse_function_declaration(
       primitive_type,
       STRUCTURAL_FUNCTION,
       0,
-      STORAGE_CLASS_GLOBAL,
-      NULL,
+      function_storage_class,
+      composite_type,
       end_label);
+  } else if (function_storage_class == STORAGE_CLASS_STATIC) {
+    // 之前的声明没有 static，以 static 为准
+    old_function_symbol_table->storage_class = STORAGE_CLASS_STATIC;
   }
 
   // 开始解析函数参数
@@ -788,6 +800,8 @@ struct SymbolTable *parse_function_declaration(
 
   // 到这一步说明是【定义】一个新函数
   current_function_symbol_id = old_function_symbol_table;
+  // 函数体中的递归调用以及之后的调用都可以直接 call
+  old_function_symbol_table->is_defined = 1;
 
   // 如果是新函数那么应该初始化 loop level
   loop_level = 0;
@@ -800,7 +814,7 @@ struct SymbolTable *parse_function_declaration(
   if (primitive_type != PRIMITIVE_VOID) {
     if (tree == NULL)
       error("No statements in function with non-void type");
-    final_statement = (tree->operation == AST_GLUE) ? tree->right : tree;
+    final_statement = (tree->operation == AST_GLUE) ? get_ast_right(tree) : tree;
     if (final_statement == NULL || final_statement->operation != AST_RETURN)
       error("No return for function with non-void type");
   }
@@ -815,6 +829,8 @@ struct SymbolTable *parse_function_declaration(
 
   // 优化 ast tree
   tree = optimise(tree);
+  // 记录下可以内联的函数体，之后的调用可以直接替换
+  record_inline_function(tree);
 
   if (output_dump_ast) {
     dump_ast(tree, NO_LABEL, 0);
@@ -824,6 +840,9 @@ struct SymbolTable *parse_function_declaration(
   interpret_ast_with_register(tree, NO_LABEL, NO_LABEL, NO_LABEL, 0);
 
   clear_local_symbol_table();
+  // 函数的代码已经生成完，AST 和局部变量都不再需要了
+  reset_arena(function_arena);
+  reset_function_ast_nodes();
 
   return (old_function_symbol_table);
 }
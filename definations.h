@@ -6,7 +6,6 @@
 #define A_OUT "a.out"
 #define AS_CMD "as -o "
 #define LD_CMD "cc -o "
-#define CPP_CMD "cpp -nostdinc -isystem "
 
 enum {
   TOKEN_EOF,
@@ -189,25 +188,170 @@ struct SymbolTable {
   // 本地变量相对于栈基指针的负向距离
   int symbol_table_position;
 
+  // 没有被取地址的标量局部变量和参数放在虚拟寄存器中，为虚拟寄存器的编号，0 表示放在栈上
+  int variable_register;
+  // 在循环外面已经算好的变量地址所在的虚拟寄存器，0 表示没有
+  int address_register;
+  // 对于函数，是否已经在当前文件中定义，定义过的函数可以直接 call
+  int is_defined;
+
   int *init_value_list; // 初始化值列表
   struct SymbolTable *next; // 下一个 symbol table 的指针
   struct SymbolTable *member; // 指向第一个函数参数、第一个 struct/union/enum 的 member 成员的 symbol table 指针
   struct SymbolTable *composite_type; // 指向复合类型 symbol table 的指针
 };
 
+// AST 节点，一个函数的节点按创建的顺序放在连续的节点块中(ast.c)，互相之间用 32 位下标引用
+// 下标为 0 表示没有节点，子节点和 symbol table 都通过 ast.h 中的 get_ast_xxx/set_ast_xxx 读写
+// 只有一部分节点有 symbol_table 和 composite_type，它们放在 payload 表中，节点里只记下标
 struct ASTNode {
-  // 操作符  + - * /
-  int operation;
-  int primitive_type; // 对应 void/char/int...
-  int rvalue; // boolean, 是否是右值节点，1 为 true, 0 为 false
-  struct ASTNode *left;
-  struct ASTNode *middle;
-  struct ASTNode *right;
-  struct SymbolTable *symbol_table;
-  struct SymbolTable *composite_type; // 指向复合类型 symbol table 的指针
+  // 下标和小字段挤在一起，整个节点 28 字节，原来用指针时是 48 字节
+  int left_index;
+  int middle_index;
+  int right_index;
+  int payload_index;  // 在 payload 表中的下标，0 表示两个指针都是 NULL
+  int index;          // 自己的下标，设置子节点时用
 
 #define ast_node_integer_value ast_node_scale_size
-int ast_node_scale_size;
+  int ast_node_scale_size;
+
+  // AST_XXX 不到 128 个，primitive_type 最大是 PRIMITIVE_UNION 加上 15 层指针，都放得进一个 char
+  char operation;     // 操作符  + - * /
+  char primitive_type; // 对应 void/char/int...
+  char rvalue; // boolean, 是否是右值节点，1 为 true, 0 为 false
+  char terminal; // boolean, 死代码消除时设置，语句执行完之后不能继续往下执行时为 1
+};
+
+// 可以内联的函数和它的函数体表达式
+struct InlineFunction {
+  struct SymbolTable *function;
+  struct ASTNode *body;
+  struct InlineFunction *next;
+};
+
+// 内存分配区域，分配的内存在 reset_arena 时一起释放
+struct ArenaBlock {
+  struct ArenaBlock *next;
+  char *data;
+  int size;
+};
+
+struct Arena {
+  struct ArenaBlock *block_head;
+  struct ArenaBlock *current_block;
+  char *pointer;          // 当前 block 中下一次分配的位置
+  int remain;             // 当前 block 剩余的字节数
+  int block_size;         // 新建 block 的默认大小
+  long allocated_bytes;   // 累计分配的字节数
+  long reserved_bytes;    // 所有 block 占用的字节数
+};
+
+// 三地址 IR 的操作
+// 操作数都是虚拟寄存器，编号从 1 开始；source2 为 NO_REGISTER 时第二个操作数是立即数 value
+enum {
+  IR_LABEL = 1,       // label:
+  IR_JUMP,            // goto label
+  IR_BRANCH,          // if (source1 condition source2) goto label
+  IR_SWITCH,          // 按照 source1 的值跳转到 case label，都不相等时跳到 label
+  IR_CONSTANT,        // destination = value
+  IR_STRING,          // destination = 字符串 L{value} 的地址
+  IR_ADDRESS,         // destination = &symbol
+  IR_COPY,            // destination = source1，按照 primitive_type 的宽度截断之后再扩展
+  IR_LOAD_VARIABLE,   // destination = symbol
+  IR_STORE_VARIABLE,  // symbol = source1
+  IR_LOAD,            // destination = *(source1 + index * scale + value)
+  IR_STORE,           // *(source1 + index * scale + value) = source2
+  IR_ADD,
+  IR_SUBTRACT,
+  IR_MULTIPLY,
+  IR_DIVIDE,
+  IR_MOD,
+  IR_AND,
+  IR_OR,
+  IR_XOR,
+  IR_SHIFT_LEFT,
+  IR_SHIFT_RIGHT,
+  IR_NEGATE,
+  IR_INVERT,
+  IR_LOGIC_NOT,       // destination = source1 == 0
+  IR_TO_BOOLEAN,      // destination = source1 != 0
+  IR_COMPARE,         // destination = source1 condition source2
+  IR_PARAMETER,       // destination = 第 index 个参数
+  IR_ARGUMENT,        // 第 index 个参数 = source1，一共 value 个参数
+  IR_CALL,            // destination = symbol(...)，一共 value 个参数
+  IR_TAIL_CALL,       // return symbol(...)，label 不为 NO_LABEL 时跳回函数开头的 label
+  IR_RETURN           // 返回值 = source1
+};
+
+// 三地址 IR 中的一条指令，一个函数的指令按顺序放在数组中
+struct IRInstruction {
+  struct SymbolTable *symbol; // 变量、函数
+  int *case_value_list;       // IR_SWITCH 的 case 值和对应的 label，一共 value 个
+  int *case_label_list;
+  int value;                  // 立即数、地址偏移、字符串的 label、参数和 case 的个数
+  int destination;            // 虚拟寄存器，没有时为 NO_REGISTER
+  int source1;
+  int source2;
+  int index;                  // 地址中的下标寄存器；参数的位置
+  int label;                  // 跳转目标，没有时为 NO_LABEL
+  int block;                  // 所在的基本块
+  int save_register_mask;     // IR_CALL 前后要保存的 caller-saved 寄存器，第 r 位对应寄存器 r
+  char operation;             // IR_XXX
+  char primitive_type;        // 读写内存、比较、截断时的类型
+  char condition;             // AST_COMPARE_XXX
+  char scale;                 // 地址中下标的倍数
+};
+
+// 一个函数的三地址 IR 和寄存器分配的结果
+struct IRFunction {
+  struct SymbolTable *symbol;
+  struct IRInstruction **instruction_list;
+  int instruction_number;
+  // 基本块是连续的一段指令，第 i 个块从 block_start_list[i] 开始，最后一项是指令的个数
+  int *block_start_list;
+  int block_number;
+  // label 所在的基本块，下标为 label 减去 label_base
+  int *label_block_list;
+  int label_base;
+  int label_number;
+  // 虚拟寄存器的个数加 1，0 号不用
+  int register_number;
+  // 每个虚拟寄存器分配到的物理寄存器，放在栈上时为 NO_REGISTER
+  int *register_assignment;
+  // 放在栈上的虚拟寄存器使用的栈槽编号，没有时为 -1
+  int *spill_slot_list;
+  int spill_slot_number;
+  // 对自己的尾调用跳回的 label，没有时为 NO_LABEL
+  int tail_call_label;
+};
+
+// 机器指令记录的种类
+enum {
+  MACHINE_INSTRUCTION = 1, // 普通指令
+  MACHINE_LABEL,           // label 定义
+  MACHINE_JUMP,            // 无条件跳转
+  MACHINE_BRANCH,          // 条件跳转
+  MACHINE_CALL,            // 函数调用
+  MACHINE_RETURN,          // ret
+  MACHINE_DIRECTIVE        // .long 等伪指令
+};
+
+#define MACHINE_MAX_OPERAND_NUMBER 4
+
+// 后端生成的一条机器指令，一个函数的记录按顺序串成双向链表
+// 窥孔优化和省略栈帧指针在这些记录上进行，最后才写到 output_file
+struct MachineInstruction {
+  struct MachineInstruction *prev;
+  struct MachineInstruction *next;
+  // 指令名、伪指令名，对于 label 是 label 的名字
+  char *opcode;
+  // 操作数按照目标汇编的顺序：x86-64 是 AT&T 语法，源操作数在前；AArch64 目标操作数在前
+  // 伪指令的参数整体放在第一个
+  // 最多 MACHINE_MAX_OPERAND_NUMBER 个
+  char **operand_list;
+  int label;          // label 或者跳转目标 Lx 中的 x，其他为 NO_LABEL
+  char kind;          // MACHINE_XXX
+  char operand_number;
 };
 
 // 如果在 generator.c 中的 interpret_ast_with_register
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+#include "definations.h"
+#include "arena.h"
+#include "machine.h"
+#include "frame.h"
+
+// 省略叶子函数的栈帧指针
+// 不调用其它函数、除了保存 %rbp 以外没有 push/pop 的函数，%rsp 在函数体中不会变，
+// 可以直接用 %rsp 访问栈上的变量，省掉 pushq %rbp、movq %rsp, %rbp 和 popq %rbp
+// 栈上的变量一共不超过 red zone 的 128 字节时，连调整 %rsp 的指令也一起去掉
+// 在所有其它优化之后运行，这时函数的指令已经不会再变了
+
+#define RED_ZONE_SIZE 128
+
+static int frame_function_count;
+static int frame_omitted_count;
+static struct MachineInstruction *frame_head;
+
+static int check_frame_instruction(struct MachineInstruction *instruction, char *opcode, char *operand) {
+  return (instruction->kind == MACHINE_INSTRUCTION &&
+          instruction->operand_number >= 1 &&
+          !strcmp(instruction->opcode, opcode) &&
+          !strcmp(instruction->operand_list[instruction->operand_number - 1], operand));
+}
+
+// 操作数中是否以 text 为寄存器，例如 %rbp 或者 (%rbp)
+static int check_operand_text(char *operand, char *text) {
+  int length = (int) strlen(text);
+
+  while (*operand) {
+    if (!strncmp(operand, text, length)) return (1);
+    operand++;
+  }
+  return (0);
+}
+
+// 除了保存和恢复 %rbp 以外的指令，只能通过 N(%rbp) 访问栈，不能直接用到 %rsp 和 %rbp
+static int check_frame_access(struct MachineInstruction *instruction, int *frame_size) {
+  char *operand;
+  int i;
+
+  if (!strcmp(instruction->opcode, "pushq") || !strcmp(instruction->opcode, "popq")) return (0);
+  if (check_frame_instruction(instruction, "movq", "%rbp") &&
+      !strcmp(instruction->operand_list[0], "%rsp"))
+    return (1);
+  if (check_frame_instruction(instruction, "addq", "%rsp") &&
+      instruction->operand_list[0][0] == '$') {
+    i = atoi(instruction->operand_list[0] + 1);
+    if (i < 0) *frame_size = -i;
+    return (1);
+  }
+
+  for (i = 0; i < instruction->operand_number; i++) {
+    operand = instruction->operand_list[i];
+    if (check_operand_text(operand, "%rsp") || check_operand_text(operand, "%esp")) return (0);
+    if (check_operand_text(operand, "%rbp") && !check_operand_text(operand, "(%rbp")) return (0);
+  }
+  return (1);
+}
+
+/**
+ * 检查函数能不能省略栈帧指针，能时返回 1
+ * frame_size 返回函数开头从 %rsp 中减去的字节数
+*/
+static int check_omit_frame_pointer(struct MachineInstruction *head, int *frame_size) {
+  struct MachineInstruction *instruction;
+  int push_count = 0, pop_count = 0;
+
+  *frame_size = 0;
+  for (instruction = head; instruction; instruction = instruction->next) {
+    if (instruction->kind == MACHINE_CALL) return (0);
+    if (instruction->kind == MACHINE_INSTRUCTION) {
+      if (check_frame_instruction(instruction, "pushq", "%rbp")) push_count++;
+      else if (check_frame_instruction(instruction, "popq", "%rbp")) pop_count++;
+      else if (!check_frame_access(instruction, frame_size)) return (0);
+    }
+  }
+  return (push_count == 1 && pop_count == 1);
+}
+
+static void remove_frame_instruction(struct MachineInstruction *instruction) {
+  if (instruction->prev) instruction->prev->next = instruction->next;
+  else frame_head = instruction->next;
+  if (instruction->next) instruction->next->prev = instruction->prev;
+}
+
+// N(%rbp...) 换成 M(%rsp...)，M = N + adjust
+static char *rewrite_frame_operand(char *operand, int adjust) {
+  char *s;
+  int i = 0, offset, length = (int) strlen(operand) + 16;
+
+  while (operand[i] != '(') i++;
+  offset = 0;
+  if (i > 0) offset = atoi(operand);
+  s = (char *) allocate_from_arena(function_arena, length);
+  snprintf(s, length, "%d(%%rsp%s", offset + adjust, operand + i + 5);
+  return (s);
+}
+
+static char *rewrite_frame_size(int size) {
+  char *s = (char *) allocate_from_arena(function_arena, 16);
+
+  snprintf(s, 16, "$%d", size);
+  return (s);
+}
+
+// 改写一条指令，frame_size 为 0 时栈上的变量都在 red zone 中
+static void rewrite_frame_instruction(struct MachineInstruction *instruction, int frame_size, int adjust) {
+  int i;
+
+  // 保存 callee-saved 寄存器的指令在原来调整 %rsp 的指令之前，
+  // 所以 %rsp 要在 pushq %rbp 的位置就减去 frame_size
+  if (frame_size && check_frame_instruction(instruction, "pushq", "%rbp")) {
+    instruction->opcode = "addq";
+    instruction->operand_list[1] = "%rsp";
+    instruction->operand_list[0] = rewrite_frame_size(-frame_size);
+    instruction->operand_number = 2;
+    return;
+  }
+  if (check_frame_instruction(instruction, "pushq", "%rbp") ||
+      check_frame_instruction(instruction, "popq", "%rbp") ||
+      check_frame_instruction(instruction, "movq", "%rbp")) {
+    remove_frame_instruction(instruction);
+    return;
+  }
+  // 不在 red zone 中时只保留函数结尾恢复 %rsp 的指令
+  if (check_frame_instruction(instruction, "addq", "%rsp") &&
+      (!frame_size || instruction->operand_list[0][1] == '-')) {
+    remove_frame_instruction(instruction);
+    return;
+  }
+  for (i = 0; i < instruction->operand_number; i++) {
+    if (check_operand_text(instruction->operand_list[i], "(%rbp"))
+      instruction->operand_list[i] = rewrite_frame_operand(instruction->operand_list[i], adjust);
+  }
+}
+
+/**
+ * 对一个函数的机器指令记录省略栈帧指针，返回新的第一条记录
+*/
+struct MachineInstruction *omit_frame_pointer(struct MachineInstruction *head) {
+  struct MachineInstruction *instruction, *next;
+  int frame_size, adjust;
+
+  frame_function_count++;
+  if (!check_omit_frame_pointer(head, &frame_size)) return (head);
+  frame_omitted_count++;
+
+  // 原来 %rbp 指向保存的 %rbp，比进入函数时的 %rsp 低 8 字节
+  // 现在 %rsp 只减去 frame_size，或者在 red zone 中时不变
+  if (frame_size + 8 <= RED_ZONE_SIZE) frame_size = 0;
+  adjust = frame_size - 8;
+
+  frame_head = head;
+  for (instruction = head; instruction; instruction = next) {
+    next = instruction->next;
+    if (instruction->kind == MACHINE_INSTRUCTION)
+      rewrite_frame_instruction(instruction, frame_size, adjust);
+  }
+  return (frame_head);
+}
+
+// -v 时输出省略了栈帧指针的函数个数，之后清零，下一个文件重新计数
+void print_frame_statistics() {
+  printf("frame: %d of %d functions without frame pointer\n",
+    frame_omitted_count, frame_function_count);
+  frame_function_count = 0;
+  frame_omitted_count = 0;
+}
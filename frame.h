@@ -0,0 +1,9 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include "definations.h"
+
+struct MachineInstruction *omit_frame_pointer(struct MachineInstruction *head);
+void print_frame_statistics();
+
+#endif
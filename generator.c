@@ -6,6 +6,10 @@
 #include "generator.h"
 #include "generator_core.h"
 #include "helper.h"
+#include "optimizer.h"
+#include "types.h"
+#include "arena.h"
+#include "linear_ir.h"
 
 // 这个 label 是为了在汇编 code 中生成类似 L1, L2 的代码用的
 // 目的是为了代码间的跳转
@@ -15,86 +19,262 @@ int generate_label() {
   return (label_id++);
 }
 
+// 条件取反，a < b 不成立就是 a >= b
+static int invert_compare_operation(int operation) {
+  switch (operation) {
+    case AST_COMPARE_EQUALS: return (AST_COMPARE_NOT_EQUALS);
+    case AST_COMPARE_NOT_EQUALS: return (AST_COMPARE_EQUALS);
+    case AST_COMPARE_LESS_THAN: return (AST_COMPARE_GREATER_EQUALS);
+    case AST_COMPARE_GREATER_THAN: return (AST_COMPARE_LESS_EQUALS);
+    case AST_COMPARE_LESS_EQUALS: return (AST_COMPARE_GREATER_THAN);
+  }
+  return (AST_COMPARE_LESS_THAN);
+}
+
+// 交换比较的左右两边，a < b 就是 b > a
+static int swap_compare_operation(int operation) {
+  switch (operation) {
+    case AST_COMPARE_LESS_THAN: return (AST_COMPARE_GREATER_THAN);
+    case AST_COMPARE_GREATER_THAN: return (AST_COMPARE_LESS_THAN);
+    case AST_COMPARE_LESS_EQUALS: return (AST_COMPARE_GREATER_EQUALS);
+    case AST_COMPARE_GREATER_EQUALS: return (AST_COMPARE_LESS_EQUALS);
+  }
+  return (operation);
+}
+
+/**
+ * 节点的值已经在虚拟寄存器中时直接使用这个寄存器
+ * 包括放在虚拟寄存器中的变量，以及外提到循环外面的数组、结构体地址
+ * 不是这种情况时返回 NO_REGISTER
+*/
+static int get_resident_register(struct ASTNode *node) {
+  struct SymbolTable *t = get_ast_symbol_table(node);
+
+  if (!t) return (NO_REGISTER);
+  if (node->operation == AST_IDENTIFIER_ADDRESS && t->address_register)
+    return (t->address_register);
+  if (node->operation == AST_IDENTIFIER && t->variable_register)
+    return (t->variable_register);
+  return (NO_REGISTER);
+}
+
+// 二元运算对应的 IR 操作，复合赋值对应其中的运算
+static int get_ir_operation(int operation) {
+  switch (operation) {
+    case AST_PLUS:
+    case AST_ASSIGN_PLUS:
+      return (IR_ADD);
+    case AST_MINUS:
+    case AST_ASSIGN_MINUS:
+      return (IR_SUBTRACT);
+    case AST_MULTIPLY:
+    case AST_ASSIGN_MULTIPLY:
+      return (IR_MULTIPLY);
+    case AST_DIVIDE:
+    case AST_ASSIGN_DIVIDE:
+      return (IR_DIVIDE);
+    case AST_MOD:
+    case AST_ASSIGN_MOD:
+      return (IR_MOD);
+    case AST_AMPERSAND: return (IR_AND);
+    case AST_OR: return (IR_OR);
+    case AST_XOR: return (IR_XOR);
+    case AST_LEFT_SHIFT: return (IR_SHIFT_LEFT);
+    case AST_RIGHT_SHIFT: return (IR_SHIFT_RIGHT);
+  }
+  error_with_digital("Bad ast operation for an ir operation:", operation);
+  return (0);
+}
+
+static int check_compare_operation(int operation) {
+  return (operation >= AST_COMPARE_EQUALS && operation <= AST_COMPARE_GREATER_EQUALS);
+}
+
+/**
+ * 生成需要跳转的条件语句的 IR
+ * 条件的值(是否不为 0)与 jump_if_true 相同时跳转到 label，否则顺序执行下去
+ * && || ! 直接变成一串条件跳转，不会先算出 0/1 再判断一次
+ * 和整数常量比较时常量作为立即数
+*/
+static void interpret_condition_with_register(struct ASTNode *node, int label, int jump_if_true) {
+  struct ASTNode *left = get_ast_left(node), *right = get_ast_right(node);
+  int operation = node->operation, left_register, right_register, skip_label;
+
+  switch (operation) {
+    case AST_TO_BE_BOOLEAN:
+      interpret_condition_with_register(left, label, jump_if_true);
+      return;
+    case AST_LOGIC_NOT:
+      interpret_condition_with_register(left, label, !jump_if_true);
+      return;
+    case AST_LOGIC_AND:
+    case AST_LOGIC_OR:
+      // && 为 false 时跳转，|| 为 true 时跳转，两边都可以直接跳到 label
+      if ((operation == AST_LOGIC_AND) != jump_if_true) {
+        interpret_condition_with_register(left, label, jump_if_true);
+        interpret_condition_with_register(right, label, jump_if_true);
+        return;
+      }
+      // 否则左边已经能决定结果时，要跳过右边
+      skip_label = generate_label();
+      interpret_condition_with_register(left, skip_label, !jump_if_true);
+      interpret_condition_with_register(right, label, jump_if_true);
+      emit_ir_label(skip_label);
+      return;
+    case AST_INTEGER_LITERAL:
+      if ((node->ast_node_integer_value != 0) == jump_if_true) emit_ir_jump(label);
+      return;
+    case AST_COMPARE_EQUALS:
+    case AST_COMPARE_NOT_EQUALS:
+    case AST_COMPARE_LESS_THAN:
+    case AST_COMPARE_GREATER_THAN:
+    case AST_COMPARE_LESS_EQUALS:
+    case AST_COMPARE_GREATER_EQUALS:
+      // IR_BRANCH 在条件成立时跳转
+      if (!jump_if_true) operation = invert_compare_operation(operation);
+      if (left->operation == AST_INTEGER_LITERAL && right->operation != AST_INTEGER_LITERAL) {
+        left = get_ast_right(node);
+        right = get_ast_left(node);
+        operation = swap_compare_operation(operation);
+      }
+      left_register = interpret_ast_with_register(left, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+      if (right->operation == AST_INTEGER_LITERAL) {
+        emit_ir_branch(
+          operation, node->primitive_type, left_register, NO_REGISTER, right->ast_node_integer_value, label);
+        return;
+      }
+      right_register = interpret_ast_with_register(right, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+      emit_ir_branch(operation, node->primitive_type, left_register, right_register, 0, label);
+      return;
+  }
+
+  left_register = interpret_ast_with_register(node, NO_LABEL, NO_LABEL, NO_LABEL, 0);
+  if (jump_if_true) operation = AST_COMPARE_NOT_EQUALS;
+  else operation = AST_COMPARE_EQUALS;
+  emit_ir_branch(operation, PRIMITIVE_LONG, left_register, NO_REGISTER, 0, label);
+}
+
 static int interpret_if_ast_with_register(
   struct ASTNode *node,
   int loop_start_label,
   int loop_end_label
 ) {
-  int label_start, label_end;
+  int label_start, label_end = NO_LABEL;
 
   label_start = generate_label();
-  if (node->right) label_end = generate_label();
+  // true 分支以 return/break/continue 结尾时，不需要跳过 else 分支
+  if (get_ast_right(node) && !check_terminal_statement(get_ast_middle(node)))
+    label_end = generate_label();
 
-  // 解析 if 中的 condition 条件语句，并生成对应的汇编代码
-  // 这个条件语句最终的执行的结果是 0，并跳转到 label_false 存在的地方
-  // 这里可以把 label_false 这个整型数值当作一个 register_index 给到对应的寄存器做处理
-  interpret_ast_with_register(node->left, label_start, NO_LABEL, NO_LABEL, node->operation);
-  generate_clearable_registers(NO_REGISTER);
+  // 条件不成立时跳转到 label_start
+  interpret_condition_with_register(get_ast_left(node), label_start, 0);
 
-  // 解析 true 部分的 statements，并生成对应汇编代码
-  interpret_ast_with_register(node->middle, NO_LABEL, loop_start_label, loop_end_label, node->operation);
-  generate_clearable_registers(NO_REGISTER);
+  // 解析 true 部分的 statements
+  interpret_ast_with_register(get_ast_middle(node), NO_LABEL, loop_start_label, loop_end_label, node->operation);
 
   // 如果有 ELSE 分支，则跳转到 label_end
-  if (node->right) register_jump(label_end);
-
-  // 开始写 label_start 定义的代码
-  register_label(label_start);
-  if (node->right) {
-    interpret_ast_with_register(node->right, NO_LABEL, NO_LABEL, loop_end_label, node->operation);
-    generate_clearable_registers(NO_REGISTER);
-    register_label(label_end);
+  if (label_end != NO_LABEL) emit_ir_jump(label_end);
+
+  emit_ir_label(label_start);
+  if (get_ast_right(node)) {
+    interpret_ast_with_register(get_ast_right(node), NO_LABEL, NO_LABEL, loop_end_label, node->operation);
+    if (label_end != NO_LABEL) emit_ir_label(label_end);
   }
 
   return (NO_REGISTER);
 }
 
+// 外提到循环外面的变量地址
+#define MAX_HOISTED_ADDRESS_NUMBER 3
+
+static struct SymbolTable *hoisted_address_list[MAX_HOISTED_ADDRESS_NUMBER];
+static int hoisted_address_number;
+static int loop_depth;
+
+// node 中是否用到了 t 的地址
+static int check_address_use(struct ASTNode *node, struct SymbolTable *t) {
+  if (!node) return (0);
+  if (node->operation == AST_IDENTIFIER_ADDRESS && get_ast_symbol_table(node) == t) return (1);
+  return (
+    check_address_use(get_ast_left(node), t) ||
+    check_address_use(get_ast_middle(node), t) ||
+    check_address_use(get_ast_right(node), t));
+}
+
+/**
+ * 进入最外层的循环之前(preheader)，把循环中用到的数组、结构体地址算好放进虚拟寄存器
+ * 变量的地址在整个函数中都不变，循环里面直接用这个寄存器
+*/
+static void hoist_loop_addresses(struct ASTNode *node) {
+  struct SymbolTable *t;
+  int i;
+
+  for (i = 0; i < hoisted_address_number; i++) {
+    t = hoisted_address_list[i];
+    if (check_address_use(node, t))
+      t->address_register = emit_ir_address(t, new_ir_register());
+  }
+}
+
+// 离开最外层的循环之后，外面的代码重新计算地址
+static void unhoist_loop_addresses() {
+  int i;
+
+  for (i = 0; i < hoisted_address_number; i++)
+    hoisted_address_list[i]->address_register = 0;
+}
+
 /**
- * 形成类似
- * Lstart:
+ * 循环的条件放在循环体的后面，每次迭代只有一次跳转
+ *         (最外层的循环在这里外提地址)
+ *         goto Lcondition
+ * Lbody:
+ *         statements
+ * Lcondition:
  *         evaluate condition
-	         jump to Lend if condition false
-	         statements
-	         jump to Lstart
-   Lend:
-   这样的效果
+ *         goto Lbody if condition true
+ * Lend:
+ * continue 跳转到 Lcondition
 */
 static int interpret_while_ast_with_register(struct ASTNode *node) {
-  int label_start, label_end;
+  int label_body, label_condition, label_end;
 
-  label_start = generate_label();
+  label_body = generate_label();
+  label_condition = generate_label();
   label_end = generate_label();
 
-  // 先生成一个 Lstart
-  register_label(label_start);
+  if (!loop_depth) hoist_loop_addresses(node);
+  loop_depth++;
 
-  // 解析 while 中的 condition 条件语句，并生成对应的汇编代码
-  // evaluate condition
-  // jump to Lend if condition false
-  interpret_ast_with_register(node->left, label_end, label_start, label_end, node->operation);
-  generate_clearable_registers(NO_REGISTER);
+  emit_ir_jump(label_condition);
+  emit_ir_label(label_body);
 
   // 解析 while 下面的复合语句
-  // statements
-  interpret_ast_with_register(node->right, NO_LABEL, label_start, label_end, node->operation);
-  generate_clearable_registers(NO_REGISTER);
+  interpret_ast_with_register(get_ast_right(node), NO_LABEL, label_condition, label_end, node->operation);
 
-  // jump to Lstart
-  register_jump(label_start);
+  // 条件成立时回到 Lbody，没有条件时一直循环
+  emit_ir_label(label_condition);
+  if (get_ast_left(node))
+    interpret_condition_with_register(get_ast_left(node), label_body, 1);
+  else
+    emit_ir_jump(label_body);
 
-  // 最后生成一个 Lend
-  register_label(label_end);
+  emit_ir_label(label_end);
 
+  loop_depth--;
+  if (!loop_depth) unhoist_loop_addresses();
   return (NO_REGISTER);
 }
 
-static int interpret_function_call_with_register(struct ASTNode *node) {
-  struct ASTNode *glue_node = node->left;
-  int register_index;
+/**
+ * 先算出所有参数的值，再依次放进传参的寄存器或者栈中，返回参数的个数
+ * 参数中的函数调用都在第一次传参之前完成，不会改掉已经放好的参数
+*/
+static int interpret_function_argument_with_register(struct ASTNode *node) {
+  struct ASTNode *glue_node;
+  int *argument_register;
   int function_argument_number = 0;
 
-  spill_all_register();
-
   // 处理如下的 tree
   //                AST_FUNCCALL
   //                 /
@@ -107,155 +287,568 @@ static int interpret_function_call_with_register(struct ASTNode *node) {
   //    AST_GLUE  expr2(2)
   //    /    \
   //  NULL  expr1(1)
-  while(glue_node) {
-    // 先生成相关表达式的汇编代码
-    register_index = interpret_ast_with_register(glue_node->right, NO_LABEL, NO_LABEL, NO_LABEL, glue_node->operation);
-    // 将其复制到第 n 个函数参数中
-    register_copy_argument(register_index, glue_node->ast_node_scale_size);
-    // 保留第一个参数
-    if (!function_argument_number) function_argument_number = glue_node->ast_node_scale_size;
-    glue_node = glue_node->left;
+  if (get_ast_left(node)) function_argument_number = get_ast_left(node)->ast_node_scale_size;
+  argument_register = (int *) allocate_from_arena(function_arena, (function_argument_number + 1) * sizeof(int));
+
+  for (glue_node = get_ast_left(node); glue_node; glue_node = get_ast_left(glue_node))
+    argument_register[glue_node->ast_node_scale_size] = interpret_ast_with_register(
+      get_ast_right(glue_node), NO_LABEL, NO_LABEL, NO_LABEL, glue_node->operation);
+
+  // 从最后一个参数开始，超过传参寄存器个数的参数要按这个顺序放到栈上
+  for (glue_node = get_ast_left(node); glue_node; glue_node = get_ast_left(glue_node))
+    emit_ir_argument(
+      argument_register[glue_node->ast_node_scale_size],
+      glue_node->ast_node_scale_size,
+      function_argument_number);
+  return (function_argument_number);
+}
+
+static int interpret_function_call_with_register(struct ASTNode *node) {
+  int function_argument_number = interpret_function_argument_with_register(node);
+
+  return (emit_ir_call(get_ast_symbol_table(node), function_argument_number));
+}
+
+// 尾调用
+// return f(...) 的参数都在寄存器中、返回值不用转换，并且函数中没有被取地址的变量时，
+// 调用之后不会再用到当前的栈帧
+// 对自己的调用变成跳回函数开头的循环，对其它函数的调用变成恢复栈帧之后的 jmp
+// 参数超过传参寄存器个数的调用要在栈上传参，仍然用 call
+static int tail_call_enabled;
+static int tail_call_label;
+static int tail_recursion_count;
+static int sibling_call_count;
+
+// 栈帧中只能有没有被取地址的标量变量，调用之后没有指针会指向这个栈帧
+static int check_tail_call_variable(struct SymbolTable *t) {
+  if (t->structural_type != STRUCTURAL_VARIABLE) return (0);
+  return (check_int_type(t->primitive_type) || check_pointer_type(t->primitive_type));
+}
+
+/**
+ * 函数的节点都在函数的节点表中，按下标扫描一遍就能找到所有取地址的节点，
+ * 不用对每个变量遍历一次函数体
+*/
+static int check_tail_call_frame(struct ASTNode *node) {
+  struct SymbolTable *t;
+  struct ASTNode *n;
+  int i, node_number = get_ast_node_number();
+
+  for (t = get_ast_symbol_table(node)->member; t; t = t->next) {
+    if (!check_tail_call_variable(t)) return (0);
+  }
+  for (t = local_head; t; t = t->next) {
+    if (!check_tail_call_variable(t)) return (0);
+  }
+  for (i = 1; i < node_number; i++) {
+    n = get_ast_node(i);
+    t = get_ast_symbol_table(n);
+    if (n->operation == AST_IDENTIFIER_ADDRESS && t &&
+        (t->storage_class == STORAGE_CLASS_LOCAL || t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER))
+      return (0);
   }
+  return (1);
+}
+
+// long 和指针的返回值都是完整的 64 位
+static int check_64_bit_return(int primitive_type) {
+  return (primitive_type == PRIMITIVE_LONG || check_pointer_type(primitive_type));
+}
 
-  return (register_function_call(node->symbol_table, function_argument_number));
+// return 语句的值能不能直接用尾调用的返回值
+static int check_tail_call(struct ASTNode *node) {
+  struct ASTNode *call = get_ast_left(node), *glue;
+  int argument_number = 0;
+
+  if (!tail_call_enabled || !call || call->operation != AST_FUNCTION_CALL) return (0);
+  for (glue = get_ast_left(call); glue; glue = get_ast_left(glue)) argument_number++;
+  if (argument_number > register_get_argument_register_number()) return (0);
+  if (call->primitive_type == current_function_symbol_id->primitive_type) return (1);
+  return (check_64_bit_return(call->primitive_type) &&
+          check_64_bit_return(current_function_symbol_id->primitive_type));
+}
+
+// 函数体中有没有对自己的尾调用
+static int check_self_tail_call(struct ASTNode *node, struct SymbolTable *function) {
+  if (!node) return (0);
+  if (node->operation == AST_RETURN && check_tail_call(node) && get_ast_symbol_table(get_ast_left(node)) == function)
+    return (1);
+  return (
+    check_self_tail_call(get_ast_left(node), function) ||
+    check_self_tail_call(get_ast_middle(node), function) ||
+    check_self_tail_call(get_ast_right(node), function));
+}
+
+/**
+ * 生成函数的 IR 之前调用，判断函数中能不能做尾调用
+ * 有对自己的尾调用时分配一个 label，放在读取参数的指令前
+*/
+static void prepare_tail_calls(struct ASTNode *node) {
+  tail_call_enabled = check_tail_call_frame(node);
+  tail_call_label = NO_LABEL;
+  if (check_self_tail_call(get_ast_left(node), get_ast_symbol_table(node)))
+    tail_call_label = generate_label();
+}
+
+static int interpret_tail_call_with_register(struct ASTNode *node) {
+  int label = NO_LABEL;
+
+  interpret_function_argument_with_register(node);
+  if (get_ast_symbol_table(node) == current_function_symbol_id) {
+    label = tail_call_label;
+    tail_recursion_count++;
+  } else {
+    sibling_call_count++;
+  }
+  emit_ir_tail_call(get_ast_symbol_table(node), label);
+  return (NO_REGISTER);
+}
+
+// -v 时输出尾调用的个数，之后清零，下一个文件重新计数
+void print_tail_call_statistics() {
+  printf("tail calls: %d turned into loops, %d turned into jumps\n",
+    tail_recursion_count, sibling_call_count);
+  tail_recursion_count = 0;
+  sibling_call_count = 0;
 }
 
 static int interpret_switch_ast_with_register(struct ASTNode *node) {
   int *case_value, *case_label, case_count = 0;
-  int label_jump_start, label_end, label_default = 0;
+  int label_end, label_default = 0;
   int i, register_index;
   struct ASTNode *c;
 
-  // 为 case value 和与之对应的 case label 创建数组
+  // 为 case value 和与之对应的 case label 创建数组，和 IR 一起在函数结束后释放
   // 注意这里的 node 的 integer_value 存的是构建 case tree 时的 case_count
   // 也就是 case 的个数
-  case_value = (int *) malloc((node->ast_node_integer_value + 1) * sizeof(int));
-  case_label = (int *) malloc((node->ast_node_integer_value + 1) * sizeof(int));
+  case_value = (int *) allocate_from_arena(function_arena, (node->ast_node_integer_value + 1) * sizeof(int));
+  case_label = (int *) allocate_from_arena(function_arena, (node->ast_node_integer_value + 1) * sizeof(int));
 
-  label_jump_start = generate_label();
   label_end = generate_label();
   label_default = label_end;
 
-  // 先生成 switch 条件语句的汇编代码
-  register_index = interpret_ast_with_register(node->left, NO_LABEL, NO_LABEL, NO_LABEL, 0);
-  register_jump(label_jump_start);
-  generate_clearable_registers(register_index);
-
-  // 遍历 tree 的右节点，为每个 case 生成汇编代码
-  for(i = 0, c = node->right; c; i++, c = c->right) {
-    // 为每个 case 创建 label
+  // 先为每个 case 创建 label，default 只会是最后一个
+  for (i = 0, c = get_ast_right(node); c; i++, c = get_ast_right(c)) {
     case_label[i] = generate_label();
     case_value[i] = c->ast_node_integer_value;
-    register_label(case_label[i]);
     if (c->operation == AST_DEFAULT)
       label_default = case_label[i];
     else
       case_count++;
-
-    // 为每个 case 生成汇编代码
-    if (c->left)
-      interpret_ast_with_register(c->left, NO_LABEL, NO_LABEL, label_end, 0);
-    generate_clearable_registers(NO_REGISTER);
   }
 
-  // 确保最后一个 case 跳过 switch 表
-  register_jump(label_end);
+  // 生成 switch 条件语句的 IR，紧接着分派到各个 case
+  register_index = interpret_ast_with_register(get_ast_left(node), NO_LABEL, NO_LABEL, NO_LABEL, 0);
+  emit_ir_switch(register_index, case_count, case_label, case_value, label_default);
+
+  // 遍历 tree 的右节点，为每个 case 生成 IR
+  for (i = 0, c = get_ast_right(node); c; i++, c = get_ast_right(c)) {
+    emit_ir_label(case_label[i]);
+    if (get_ast_left(c))
+      interpret_ast_with_register(get_ast_left(c), NO_LABEL, NO_LABEL, label_end, 0);
+  }
 
-  // 生成 switch 表和 end label
-  register_switch(register_index, case_count, label_jump_start, case_label, case_value, label_default);
-  register_label(label_end);
+  emit_ir_label(label_end);
   return (NO_REGISTER);
 }
 
-// 生成三元运算符语句的汇编代码
+// 生成三元运算符语句的 IR，两个分支的值都放进同一个虚拟寄存器
 static int interpret_ternary_ast_with_register(struct ASTNode *node) {
   int label_start, label_end, register_index, expression_register_index;
 
   label_start = generate_label();
   label_end = generate_label();
+  register_index = new_ir_register();
 
-  // 先产生条件语句的汇编，这个条件语句后面跟着是跳到 false 情况的
-  interpret_ast_with_register(
-    node->left,
-    label_start,
-    NO_LABEL,
-    NO_LABEL,
-    node->operation);
-
-  // 弄一个寄存器来保存俩表达式的结果
-  register_index = allocate_register();
+  // 条件不成立时跳到 false 表达式
+  interpret_condition_with_register(get_ast_left(node), label_start, 0);
 
-  // 生成 true 表达式的汇编以及 false label
-  // 把结果放入上述的寄存器中
   expression_register_index = interpret_ast_with_register(
-    node->middle,
+    get_ast_middle(node),
     NO_LABEL,
     NO_LABEL,
     NO_LABEL,
     node->operation);
-  register_move(expression_register_index, register_index);
-  register_clear_register(expression_register_index);
-  register_jump(label_end);
-  register_label(label_start);
+  if (expression_register_index != NO_REGISTER)
+    emit_ir_copy(PRIMITIVE_LONG, register_index, expression_register_index);
+  emit_ir_jump(label_end);
+  emit_ir_label(label_start);
 
-  // 生成 false 表达式的汇编以及 end label
-  // 把结果放入上述的寄存器中
   expression_register_index = interpret_ast_with_register(
-    node->right,
+    get_ast_right(node),
     NO_LABEL,
     NO_LABEL,
     NO_LABEL,
     node->operation);
-  register_move(expression_register_index, register_index);
-  register_clear_register(expression_register_index);
-  register_label(label_end);
+  if (expression_register_index != NO_REGISTER)
+    emit_ir_copy(PRIMITIVE_LONG, register_index, expression_register_index);
+  emit_ir_label(label_end);
 
   return (register_index);
 }
 
+// 需要 && || 的值的时候，先当作条件跳转，再在两个分支中分别放入 1 和 0
 static int interpret_logic_and_or_ast_with_register(struct ASTNode *node) {
-  int label_start = generate_label();
+  int label_false = generate_label();
   int label_end = generate_label();
-  int register_index ;
+  int register_index = new_ir_register();
 
-  register_index = interpret_ast_with_register(
-    node->left,
-    NO_LABEL,
-    NO_LABEL,
-    NO_LABEL,
-    0);
-  register_to_be_boolean(register_index, node->operation, label_start);
-  generate_clearable_registers(NO_REGISTER);
+  interpret_condition_with_register(node, label_false, 0);
 
-  register_index = interpret_ast_with_register(
-    node->right,
-    NO_LABEL,
-    NO_LABEL,
-    NO_LABEL,
-    0);
-  register_to_be_boolean(register_index, node->operation, label_start);
-  generate_clearable_registers(register_index);
-
-  if (node->operation == AST_LOGIC_AND) {
-    register_load_boolean(register_index, 1);
-    register_jump(label_end);
-    register_label(label_start);
-    register_load_boolean(register_index, 0);
+  emit_ir_constant(register_index, 1);
+  emit_ir_jump(label_end);
+  emit_ir_label(label_false);
+  emit_ir_constant(register_index, 0);
+  emit_ir_label(label_end);
+  return (register_index);
+}
+
+// 交换左右两边结果不变的运算
+static int check_commutative_operation(int operation) {
+  return (operation == AST_PLUS ||
+          operation == AST_MULTIPLY ||
+          operation == AST_AMPERSAND ||
+          operation == AST_OR ||
+          operation == AST_XOR);
+}
+
+/**
+ * 二元运算有一边是整数常量时，不把常量放进寄存器，而是作为立即数
+ * 乘法、除法、取模由后端用移位、lea 和乘法来代替
+ * 满足交换律的运算和比较，常量在左边也可以
+*/
+static int interpret_constant_operand_with_register(struct ASTNode *node) {
+  struct ASTNode *expression = get_ast_left(node), *constant = get_ast_right(node);
+  int operation = node->operation, register_index;
+
+  if (expression->operation == AST_INTEGER_LITERAL) {
+    expression = get_ast_right(node);
+    constant = get_ast_left(node);
+    operation = swap_compare_operation(operation);
+  }
+
+  register_index = interpret_ast_with_register(expression, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  if (check_compare_operation(operation))
+    return (emit_ir_compare(
+      operation, node->primitive_type, register_index, NO_REGISTER, constant->ast_node_integer_value));
+  return (emit_ir_binary_constant(
+    get_ir_operation(operation), node->primitive_type, register_index, constant->ast_node_integer_value));
+}
+
+// interpret_address_mode_with_register 拆出来的 index、scale 和 offset
+static int address_index_register, address_scale, address_offset;
+
+/**
+ * 把地址表达式拆成 base + index * scale + offset，生成 base 和 index 的 IR
+ * 返回 base 所在的虚拟寄存器，其余部分放在 address_xxx 中
+ * 可以拆的形式有 base + 常量(结构体成员、常量下标)、base + AST_SCALE(数组下标)
+ * 和 char 指针 + 整数
+*/
+static int interpret_address_mode_with_register(struct ASTNode *node) {
+  struct ASTNode *base = node, *index = NULL;
+  int base_register, index_register = NO_REGISTER, scale = 1, offset = 0, size;
+
+  if (node->operation == AST_PLUS) {
+    if (get_ast_right(node)->operation == AST_INTEGER_LITERAL) {
+      base = get_ast_left(node);
+      offset = get_ast_right(node)->ast_node_integer_value;
+    } else if (get_ast_left(node)->operation == AST_INTEGER_LITERAL) {
+      base = get_ast_right(node);
+      offset = get_ast_left(node)->ast_node_integer_value;
+    } else if (get_ast_right(node)->operation == AST_SCALE) {
+      base = get_ast_left(node);
+      index = get_ast_left(get_ast_right(node));
+      size = get_ast_right(node)->ast_node_scale_size;
+    } else if (get_ast_left(node)->operation == AST_SCALE) {
+      base = get_ast_right(node);
+      index = get_ast_left(get_ast_left(node));
+      size = get_ast_left(node)->ast_node_scale_size;
+    } else if (check_pointer_type(get_ast_left(node)->primitive_type) &&
+               check_int_type(get_ast_right(node)->primitive_type)) {
+      // char 指针加上整数时没有 AST_SCALE
+      base = get_ast_left(node);
+      index = get_ast_right(node);
+      size = 1;
+    }
+    if (index) {
+      if (size == 1 || size == 2 || size == 4 || size == 8) scale = size;
+      else index = NULL;
+      if (!index) base = node;
+    }
+  }
+
+  if (base == node) {
+    base_register = interpret_ast_with_register(node, NO_LABEL, NO_LABEL, NO_LABEL, AST_DEREFERENCE_POINTER);
   } else {
-    register_load_boolean(register_index, 0);
-    register_jump(label_end);
-    register_label(label_start);
-    register_load_boolean(register_index, 1);
+    base_register = interpret_ast_with_register(base, NO_LABEL, NO_LABEL, NO_LABEL, AST_PLUS);
+    if (index)
+      index_register = interpret_ast_with_register(index, NO_LABEL, NO_LABEL, NO_LABEL, AST_SCALE);
   }
 
-  register_label(label_end);
+  // 子表达式中可能也用到了这几个变量，所以最后再赋值
+  address_index_register = index_register;
+  address_scale = scale;
+  address_offset = offset;
+  return (base_register);
+}
+
+// *p 作为右值
+static int interpret_dereference_with_register(struct ASTNode *node) {
+  int base_register = interpret_address_mode_with_register(get_ast_left(node));
+  return (
+    emit_ir_load(
+      value_at(get_ast_left(node)->primitive_type),
+      base_register,
+      address_index_register,
+      address_scale,
+      address_offset)
+  );
+}
+
+// *p = x
+static int interpret_store_dereference_with_register(struct ASTNode *node) {
+  int value_register, base_register;
+
+  value_register = interpret_ast_with_register(get_ast_left(node), NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  base_register = interpret_address_mode_with_register(get_ast_left(get_ast_right(node)));
+  emit_ir_store(
+    get_ast_right(node)->primitive_type,
+    value_register,
+    base_register,
+    address_index_register,
+    address_scale,
+    address_offset);
+  return (value_register);
+}
+
+/**
+ * *p += x 等复合赋值
+ * 地址只计算一次，从这个地址读出旧值，运算之后再写回同一个地址
+*/
+static int interpret_compound_store_dereference_with_register(struct ASTNode *node) {
+  int value_register, base_register, index_register, scale, offset, left_register, primitive_type;
+
+  value_register = interpret_ast_with_register(get_ast_right(node), NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  base_register = interpret_address_mode_with_register(get_ast_left(get_ast_left(node)));
+  index_register = address_index_register;
+  scale = address_scale;
+  offset = address_offset;
+  primitive_type = value_at(get_ast_left(get_ast_left(node))->primitive_type);
+
+  left_register = emit_ir_load(primitive_type, base_register, index_register, scale, offset);
+  left_register = emit_ir_binary(
+    get_ir_operation(node->operation), primitive_type, left_register, value_register);
+  emit_ir_store(primitive_type, left_register, base_register, index_register, scale, offset);
+  if (generate_get_primitive_type_size(primitive_type) < 8)
+    left_register = emit_ir_copy(primitive_type, new_ir_register(), left_register);
+  return (left_register);
+}
+
+// 读取变量的值，放在虚拟寄存器中的变量直接用这个寄存器
+static int interpret_load_variable_with_register(struct SymbolTable *t) {
+  if (t->variable_register) return (t->variable_register);
+  return (emit_ir_load_variable(t));
+}
+
+// 把 register_index 中的值写入变量，char 和 int 按照各自的宽度截断
+static int interpret_store_variable_with_register(int register_index, struct SymbolTable *t) {
+  if (t->variable_register)
+    return (emit_ir_copy(t->primitive_type, t->variable_register, register_index));
+  emit_ir_store_variable(t, register_index);
   return (register_index);
 }
 
 /**
- * 这里主要将 ast 中的代码取出来，然后用汇编的方式进行值的加减乘除
- * 这里加减乘除后返回的是寄存器的标识
- *
+ * ++ 和 --，指针按照指向的类型的大小加减
+ * 后置时返回旧值，前置时返回截断之后的新值
+*/
+static int interpret_increase_with_register(struct SymbolTable *t, int operation) {
+  int offset = 1, value_register, old_register, new_register;
+
+  if (check_pointer_type(t->primitive_type))
+    offset = get_primitive_type_size(value_at(t->primitive_type), t->composite_type);
+  if (operation == AST_PRE_DECREASE || operation == AST_POST_DECREASE)
+    offset = -offset;
+
+  // 放在虚拟寄存器中的变量会被原地修改，后置时要先复制一份旧值
+  value_register = interpret_load_variable_with_register(t);
+  old_register = value_register;
+  if (t->variable_register &&
+      (operation == AST_POST_INCREASE || operation == AST_POST_DECREASE))
+    old_register = emit_ir_copy(PRIMITIVE_LONG, new_ir_register(), value_register);
+
+  new_register = emit_ir_binary_constant(IR_ADD, t->primitive_type, value_register, offset);
+  new_register = interpret_store_variable_with_register(new_register, t);
+
+  if (operation == AST_POST_INCREASE || operation == AST_POST_DECREASE)
+    return (old_register);
+  if (!t->variable_register && generate_get_primitive_type_size(t->primitive_type) < 8)
+    new_register = emit_ir_copy(t->primitive_type, new_ir_register(), new_register);
+  return (new_register);
+}
+
+// 可以放在虚拟寄存器中的变量：没有被取地址的标量局部变量和参数
+static int check_register_variable(struct SymbolTable *t) {
+  if (t->storage_class != STORAGE_CLASS_LOCAL &&
+      t->storage_class != STORAGE_CLASS_FUNCTION_PARAMETER)
+    return (0);
+  return (check_tail_call_variable(t));
+}
+
+// 按下标扫描函数的节点表，被取地址的局部变量和参数的 variable_register 记为 -1
+static void mark_address_taken_variables() {
+  struct SymbolTable *t;
+  struct ASTNode *n;
+  int i, node_number = get_ast_node_number();
+
+  for (i = 1; i < node_number; i++) {
+    n = get_ast_node(i);
+    t = get_ast_symbol_table(n);
+    if (n->operation == AST_IDENTIFIER_ADDRESS && t &&
+        (t->storage_class == STORAGE_CLASS_LOCAL || t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER))
+      t->variable_register = -1;
+  }
+}
+
+/**
+ * 生成函数的 IR 之前，给没有被取地址的标量局部变量和参数分配虚拟寄存器
+ * 之后对它们的读写都是虚拟寄存器之间的运算，由寄存器分配决定放在哪里
+*/
+static void allocate_variable_registers(struct ASTNode *node) {
+  struct SymbolTable *t;
+
+  for (t = get_ast_symbol_table(node)->member; t; t = t->next) t->variable_register = 0;
+  for (t = local_head; t; t = t->next) t->variable_register = 0;
+  mark_address_taken_variables();
+
+  for (t = get_ast_symbol_table(node)->member; t; t = t->next) {
+    if (t->variable_register || !check_register_variable(t)) t->variable_register = 0;
+    else t->variable_register = new_ir_register();
+  }
+  for (t = local_head; t; t = t->next) {
+    if (t->variable_register || !check_register_variable(t)) t->variable_register = 0;
+    else t->variable_register = new_ir_register();
+  }
+}
+
+// 函数结束之后，参数的 symbol table 还留在函数的 member 中
+static void clear_parameter_registers(struct SymbolTable *function) {
+  struct SymbolTable *t;
+
+  for (t = function->member; t; t = t->next) {
+    t->variable_register = 0;
+    t->address_register = 0;
+  }
+}
+
+/**
+ * 函数开头读取参数
+ * 放在虚拟寄存器中的参数直接读到它的寄存器中，其余用寄存器传的参数写入栈中
+ * 超过传参寄存器个数的参数已经在调用者的栈上了
+*/
+static void interpret_parameters(struct SymbolTable *function) {
+  struct SymbolTable *t;
+  int i;
+
+  for (t = function->member, i = 1; t; t = t->next, i++) {
+    if (t->variable_register)
+      emit_ir_parameter(t, i, t->variable_register);
+    else if (i <= register_get_argument_register_number())
+      emit_ir_store_variable(t, emit_ir_parameter(t, i, new_ir_register()));
+  }
+}
+
+// 参与地址外提的变量最多有多少个
+#define MAX_CANDIDATE_NUMBER 64
+// 循环中的使用次数乘以 LOOP_WEIGHT，权重最多到 MAX_USE_WEIGHT
+#define LOOP_WEIGHT 8
+#define MAX_USE_WEIGHT 4096
+
+static struct SymbolTable *candidate_list[MAX_CANDIDATE_NUMBER];
+static int use_count_list[MAX_CANDIDATE_NUMBER];
+static int candidate_number;
+
+static int find_candidate(struct SymbolTable *t) {
+  int i;
+  for (i = 0; i < candidate_number; i++) {
+    if (candidate_list[i] == t) return (i);
+  }
+  return (-1);
+}
+
+// 统计循环中用到的变量地址，weight 为 1 时不在循环中
+static void count_address_use(struct ASTNode *node, int weight) {
+  int i;
+
+  if (!node) return;
+
+  if (weight > 1 && node->operation == AST_IDENTIFIER_ADDRESS && get_ast_symbol_table(node)) {
+    i = find_candidate(get_ast_symbol_table(node));
+    if (i < 0 && candidate_number < MAX_CANDIDATE_NUMBER) {
+      i = candidate_number;
+      candidate_list[i] = get_ast_symbol_table(node);
+      use_count_list[i] = 0;
+      candidate_number++;
+    }
+    if (i >= 0) use_count_list[i] = use_count_list[i] + weight;
+  }
+
+  if (node->operation == AST_WHILE && weight < MAX_USE_WEIGHT)
+    weight = weight * LOOP_WEIGHT;
+
+  count_address_use(get_ast_left(node), weight);
+  count_address_use(get_ast_middle(node), weight);
+  count_address_use(get_ast_right(node), weight);
+}
+
+/**
+ * 选出循环中用得最多的几个数组、结构体地址，
+ * 这些地址在进入循环之前算好，见 hoist_loop_addresses
+*/
+static void allocate_address_registers(struct ASTNode *node) {
+  int i, best;
+
+  candidate_number = 0;
+  hoisted_address_number = 0;
+  count_address_use(get_ast_left(node), 1);
+
+  while (hoisted_address_number < MAX_HOISTED_ADDRESS_NUMBER) {
+    best = -1;
+    for (i = 0; i < candidate_number; i++) {
+      if (use_count_list[i] > 0 &&
+          (best < 0 || use_count_list[i] > use_count_list[best]))
+        best = i;
+    }
+    if (best < 0) break;
+    hoisted_address_list[hoisted_address_number] = candidate_list[best];
+    hoisted_address_number++;
+    use_count_list[best] = 0;
+  }
+}
+
+/**
+ * 生成一个函数的 IR，之后交给 finish_function_linear_ir 分配寄存器、生成机器指令
+ * 对自己的尾调用跳回读取参数之前的 label
+*/
+static int interpret_function_with_register(struct ASTNode *node) {
+  start_function_linear_ir(get_ast_symbol_table(node));
+  allocate_variable_registers(node);
+  allocate_address_registers(node);
+  prepare_tail_calls(node);
+
+  if (tail_call_label != NO_LABEL) emit_ir_label(tail_call_label);
+  interpret_parameters(get_ast_symbol_table(node));
+  interpret_ast_with_register(get_ast_left(node), NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  emit_ir_label(get_ast_symbol_table(node)->symbol_table_end_label);
+
+  finish_function_linear_ir(tail_call_label);
+  clear_parameter_registers(get_ast_symbol_table(node));
+  return (NO_REGISTER);
+}
+
+/**
+ * 这里主要将 ast 翻译成三地址 IR
+ * 表达式返回放着结果的虚拟寄存器，语句返回 NO_REGISTER
 */
 int interpret_ast_with_register(
   struct ASTNode *node,
@@ -295,22 +888,21 @@ int interpret_ast_with_register(
     case AST_IF:
       return (interpret_if_ast_with_register(node, loop_start_label, loop_end_label));
     case AST_GLUE:
-      if (node->left)
-        interpret_ast_with_register(node->left, if_label, loop_start_label, loop_end_label, node->operation);
-      generate_clearable_registers(NO_REGISTER);
-      if (node->right)
-        interpret_ast_with_register(node->right, if_label, loop_start_label, loop_end_label, node->operation);
-      generate_clearable_registers(NO_REGISTER);
+      if (get_ast_left(node))
+        interpret_ast_with_register(get_ast_left(node), if_label, loop_start_label, loop_end_label, node->operation);
+      if (get_ast_right(node))
+        interpret_ast_with_register(get_ast_right(node), if_label, loop_start_label, loop_end_label, node->operation);
       return (NO_REGISTER);
     case AST_WHILE:
       return (interpret_while_ast_with_register(node));
     case AST_FUNCTION_CALL:
       return (interpret_function_call_with_register(node));
+    case AST_RETURN:
+      if (check_tail_call(node))
+        return (interpret_tail_call_with_register(get_ast_left(node)));
+      break;
     case AST_FUNCTION:
-      register_function_preamble(node->symbol_table);
-      interpret_ast_with_register(node->left, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
-      register_function_postamble(node->symbol_table);
-      return (NO_REGISTER);
+      return (interpret_function_with_register(node));
     case AST_SWITCH:
       return (interpret_switch_ast_with_register(node));
     case AST_TERNARY:
@@ -318,23 +910,68 @@ int interpret_ast_with_register(
     case AST_LOGIC_AND:
     case AST_LOGIC_OR:
       return (interpret_logic_and_or_ast_with_register(node));
+    case AST_IDENTIFIER:
+    case AST_IDENTIFIER_ADDRESS:
+      left_register = get_resident_register(node);
+      if (left_register != NO_REGISTER) return (left_register);
+      break;
+    case AST_PLUS:
+    case AST_MINUS:
+    case AST_MULTIPLY:
+    case AST_AMPERSAND:
+    case AST_OR:
+    case AST_XOR:
+    case AST_DIVIDE:
+    case AST_MOD:
+    case AST_LEFT_SHIFT:
+    case AST_RIGHT_SHIFT:
+    case AST_COMPARE_EQUALS:
+    case AST_COMPARE_NOT_EQUALS:
+    case AST_COMPARE_LESS_THAN:
+    case AST_COMPARE_GREATER_THAN:
+    case AST_COMPARE_LESS_EQUALS:
+    case AST_COMPARE_GREATER_EQUALS:
+      if (get_ast_right(node)->operation == AST_INTEGER_LITERAL ||
+          (get_ast_left(node)->operation == AST_INTEGER_LITERAL &&
+           (check_commutative_operation(node->operation) ||
+            check_compare_operation(node->operation))))
+        return (interpret_constant_operand_with_register(node));
+      break;
+    case AST_DEREFERENCE_POINTER:
+      if (node->rvalue)
+        return (interpret_dereference_with_register(node));
+      break;
+    case AST_ASSIGN:
+      if (get_ast_right(node)->operation == AST_DEREFERENCE_POINTER)
+        return (interpret_store_dereference_with_register(node));
+      break;
+    case AST_ASSIGN_PLUS:
+    case AST_ASSIGN_MINUS:
+    case AST_ASSIGN_MULTIPLY:
+    case AST_ASSIGN_DIVIDE:
+    case AST_ASSIGN_MOD:
+      if (get_ast_left(node)->operation == AST_DEREFERENCE_POINTER)
+        return (interpret_compound_store_dereference_with_register(node));
+      break;
   }
 
-  if (node->left)
-    left_register = interpret_ast_with_register(node->left, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
-  if (node->right)
-    right_register = interpret_ast_with_register(node->right, NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  if (get_ast_left(node))
+    left_register = interpret_ast_with_register(get_ast_left(node), NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
+  if (get_ast_right(node))
+    right_register = interpret_ast_with_register(get_ast_right(node), NO_LABEL, NO_LABEL, NO_LABEL, node->operation);
 
   switch (node->operation) {
     case AST_PLUS:
-      return (register_plus(left_register, right_register));
     case AST_MINUS:
-      return (register_minus(left_register, right_register));
     case AST_MULTIPLY:
-      return (register_multiply(left_register, right_register));
     case AST_DIVIDE:
     case AST_MOD:
-      return (register_divide_and_mod(left_register, right_register, node->operation));
+    case AST_AMPERSAND:
+    case AST_OR:
+    case AST_XOR:
+    case AST_LEFT_SHIFT:
+    case AST_RIGHT_SHIFT:
+      return (emit_ir_binary(get_ir_operation(node->operation), node->primitive_type, left_register, right_register));
 
     case AST_COMPARE_EQUALS:
     case AST_COMPARE_NOT_EQUALS:
@@ -342,17 +979,15 @@ int interpret_ast_with_register(
     case AST_COMPARE_GREATER_THAN:
     case AST_COMPARE_LESS_EQUALS:
     case AST_COMPARE_GREATER_EQUALS:
-      if (parent_ast_operation == AST_IF ||
-          parent_ast_operation == AST_WHILE ||
-          parent_ast_operation == AST_TERNARY)
-        return (register_compare_and_jump( node->operation, left_register, right_register, if_label, node->primitive_type));
-      return (register_compare_and_set(node->operation, left_register, right_register, node->primitive_type));
+      return (emit_ir_compare(node->operation, node->primitive_type, left_register, right_register, 0));
     case AST_RETURN:
-      register_function_return(left_register, current_function_symbol_id);
+      if (left_register != NO_REGISTER)
+        emit_ir_return(current_function_symbol_id->primitive_type, left_register);
+      emit_ir_jump(current_function_symbol_id->symbol_table_end_label);
       return (NO_REGISTER);
 
     case AST_INTEGER_LITERAL:
-      return (register_load_interger_literal(node->ast_node_integer_value, node->primitive_type));
+      return (emit_ir_constant(new_ir_register(), node->ast_node_integer_value));
     case AST_IDENTIFIER:
       //               类似于 * y 这种情况
       //                     | |
@@ -360,124 +995,75 @@ int interpret_ast_with_register(
       // parent_ast_operation  node
       if (node->rvalue ||
           parent_ast_operation == AST_DEREFERENCE_POINTER)
-        return (register_load_variable(node->symbol_table, node->operation));
+        return (interpret_load_variable_with_register(get_ast_symbol_table(node)));
       return (NO_REGISTER);
     // a += b + c
     // 会被解析成如下
-    //       AST_PLUS
+    //       AST_ASSIGN_PLUS
     //      /        \
     //  AST_IDENT     AST_ADD
     //  rval a     /     \
     //         AST_IDENT  AST_IDENT
     //          rval b  rval c
+    // 算出 a + (b + c) 之后写回 a
     case AST_ASSIGN_PLUS:
     case AST_ASSIGN_MINUS:
     case AST_ASSIGN_MULTIPLY:
     case AST_ASSIGN_DIVIDE:
     case AST_ASSIGN_MOD:
+      left_register = emit_ir_binary(
+        get_ir_operation(node->operation), node->primitive_type, left_register, right_register);
+      return (interpret_store_variable_with_register(left_register, get_ast_symbol_table(get_ast_left(node))));
+    // x = y
+    // 在 parser 中 left 和 right 做了交换，right 是被赋值的变量
+    // 给指针赋值的 *x = y 在前面已经处理了
     case AST_ASSIGN:
-      // 处理前面 += -= *= /= %=
-      switch (node->operation) {
-        case AST_ASSIGN_PLUS:
-          left_register = register_plus(left_register, right_register);
-          node->right = node->left;
-          break;
-        case AST_ASSIGN_MINUS:
-          left_register = register_minus(left_register, right_register);
-          node->right = node->left;
-          break;
-        case AST_ASSIGN_MULTIPLY:
-          left_register = register_multiply(left_register, right_register);
-          node->right = node->left;
-          break;
-        case AST_ASSIGN_DIVIDE:
-          left_register = register_divide_and_mod(left_register, right_register, AST_DIVIDE);
-          node->right = node->left;
-          break;
-        case AST_ASSIGN_MOD:
-          left_register = register_divide_and_mod(left_register, right_register, AST_MOD);
-          node->right = node->left;
-          break;
-      }
-
-      // 处理 =
-      // 是赋值给一个变量还是给一个指针赋值?
-      // x = y
-      // *x = y
-      // 在 parser 中 left 和 right 做了交换，所以这里要对 right 的 operation 做判断
-      switch (node->right->operation) {
-        case AST_IDENTIFIER:
-          if (node->right->symbol_table->storage_class == STORAGE_CLASS_GLOBAL ||
-              node->right->symbol_table->storage_class == STORAGE_CLASS_EXTERN ||
-              node->right->symbol_table->storage_class == STORAGE_CLASS_STATIC)
-            return (register_store_value_2_variable(left_register, node->right->symbol_table));
-          return (register_store_local_value_2_variable(left_register, node->right->symbol_table));
-        case AST_DEREFERENCE_POINTER:
-          return (register_store_dereference_pointer(left_register, right_register, node->right->primitive_type));
-        default:
-          error_with_digital("Can't AST_ASSIGN in interpret_ast_with_register, operation", node->operation);
-      }
+      if (get_ast_right(node)->operation != AST_IDENTIFIER)
+        error_with_digital("Can't AST_ASSIGN in interpret_ast_with_register, operation", get_ast_right(node)->operation);
+      return (interpret_store_variable_with_register(left_register, get_ast_symbol_table(get_ast_right(node))));
 
     // &
     case AST_IDENTIFIER_ADDRESS:
       // 这里也有可能是 struct/union 成员的访问
-      if (node->symbol_table)
-        return (register_load_identifier_address(node->symbol_table));
+      if (get_ast_symbol_table(node))
+        return (emit_ir_address(get_ast_symbol_table(node), new_ir_register()));
       return (left_register);
     // *
     case AST_DEREFERENCE_POINTER:
-      if (node->rvalue)
-        return (register_dereference_pointer(left_register, node->left->primitive_type));
-      // 返回上一个回调交给 AST_ASSIGN 处理
+      // 不是右值时返回地址
       return (left_register);
 
-    // 对 char/int/long 类型转换的处理
+    // char/int/long 的值在寄存器中都已经扩展成了 64 位
     case AST_WIDEN:
-      return (register_widen(left_register, node->left->primitive_type, node->primitive_type));
+      return (left_register);
     // 对 char*/int*/long* 指针类型转换的处理
     case AST_SCALE:
-      switch (node->ast_node_scale_size) {
-        case 2: return (register_shift_left_by_constant(left_register, 1)); // 左移 1 位
-        case 4: return (register_shift_left_by_constant(left_register, 2)); // 左移 2 位
-        case 8: return (register_shift_left_by_constant(left_register, 3)); // 左移 3 位
-        default:
-          right_register = (register_load_interger_literal(node->ast_node_scale_size, PRIMITIVE_INT));
-          return (register_multiply(left_register, right_register));
-      }
+      if (node->ast_node_scale_size == 1) return (left_register);
+      return (emit_ir_binary_constant(IR_MULTIPLY, PRIMITIVE_LONG, left_register, node->ast_node_scale_size));
 
     // 处理 string
     case AST_STRING_LITERAL:
-      return (register_load_global_string(node->ast_node_integer_value));
+      return (emit_ir_string(node->ast_node_integer_value));
 
-    case AST_AMPERSAND:
-      return (register_and(left_register, right_register));
-    case AST_OR:
-      return (register_or(left_register, right_register));
-    case AST_XOR:
-      return (register_xor(left_register, right_register));
-    case AST_LEFT_SHIFT:
-      return (register_shift_left(left_register, right_register));
-    case AST_RIGHT_SHIFT:
-      return (register_shift_right(left_register, right_register));
     case AST_POST_INCREASE:
     case AST_POST_DECREASE:
-      return (register_load_variable(node->symbol_table, node->operation));
+      return (interpret_increase_with_register(get_ast_symbol_table(node), node->operation));
     case AST_PRE_INCREASE:
     case AST_PRE_DECREASE:
-      return (register_load_variable(node->left->symbol_table, node->operation));
+      return (interpret_increase_with_register(get_ast_symbol_table(get_ast_left(node)), node->operation));
     case AST_NEGATE:
-      return (register_negate(left_register));
+      return (emit_ir_unary(IR_NEGATE, left_register));
     case AST_INVERT:
-      return (register_invert(left_register));
+      return (emit_ir_unary(IR_INVERT, left_register));
     case AST_LOGIC_NOT:
-      return (register_logic_not(left_register));
+      return (emit_ir_unary(IR_LOGIC_NOT, left_register));
     case AST_TO_BE_BOOLEAN:
-      return (register_to_be_boolean(left_register, parent_ast_operation, if_label));
+      return (emit_ir_unary(IR_TO_BOOLEAN, left_register));
     case AST_BREAK:
-      register_jump(loop_end_label);
+      emit_ir_jump(loop_end_label);
       return (NO_REGISTER);
     case AST_CONTINUE:
-      register_jump(loop_start_label);
+      emit_ir_jump(loop_start_label);
       return (NO_REGISTER);
     case AST_TYPE_CASTING:
       return (left_register);
@@ -493,7 +1079,9 @@ void generate_global_symbol(struct SymbolTable *t) {
   register_generate_global_symbol(t);
 }
 
+// 每个文件从头开始，一次编译几个文件时每个文件的输出和单独编译时一样，-j 时也一样
 void generate_preamble_code() {
+  label_id = 1;
   register_preamble();
 }
 
@@ -501,10 +1089,6 @@ void generate_postamble_code() {
   register_postamble();
 }
 
-void generate_clearable_registers(int keep_register_index) {
-  clear_all_registers(keep_register_index);
-}
-
 int generate_global_string_code(char *string_value, int is_append_string) {
   int label = generate_label();
   register_generate_global_string(label, string_value, is_append_string);
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include "data.h"
 #include "definations.h"
@@ -7,9 +8,24 @@
 #include "generator.h"
 #include "generator_core.h"
 #include "types.h"
-
-#define FREE_REGISTER_NUMBER 4
-#define FIRST_PARAMETER_REGISTER_NUMBER 9
+#include "arena.h"
+#include "machine.h"
+#include "peephole.h"
+#include "frame.h"
+
+// x86-64 后端
+// 按照寄存器分配的结果，把一个函数的三地址 IR 翻译成机器指令记录，
+// 窥孔优化、省略栈帧指针之后再写到 output_file
+// 放在栈槽中的虚拟寄存器通过 %rax 和 %r11 这两个临时寄存器读写，它们不参与分配
+
+// 可以分配给虚拟寄存器的寄存器个数，从 FIRST_CALLEE_SAVED_REGISTER 开始是 callee-saved
+#define ALLOCATABLE_REGISTER_NUMBER 12
+#define FIRST_CALLEE_SAVED_REGISTER 7
+// 在 register_list 中的下标
+#define RDX_REGISTER 2
+#define RCX_REGISTER 3
+#define RAX_REGISTER 12
+#define R11_REGISTER 13
 
 enum {
   NO_SECTION_FLAG,
@@ -17,329 +33,165 @@ enum {
   DATA_SECTION_FLAG
 } current_section_flag = NO_SECTION_FLAG;
 
-static int free_registers[FREE_REGISTER_NUMBER] = { 1 };
+// 前 6 个依次是传参的寄存器，第 position 个参数在 register_list[position - 1] 中
 static char *register_list[] = {
-  "%r10", "%r11", "%r12", "%r13",
-  "%r9", "%r8",
-  "%rcx", "%rdx", "%rsi", "%rdi"
+  "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9", "%r10",
+  "%rbx", "%r12", "%r13", "%r14", "%r15",
+  "%rax", "%r11"
 }; // 64 位寄存器
-static char *lower_8_bits_register_list[] = {
-  "%r10b", "%r11b", "%r12b", "%r13b",
-  "%r9b", "%r8b",
-  "%cl", "%dl", "%sil", "%dil"
-}; // 低 8 位寄存器
 static char *lower_32_bits_register_list[] = {
-  "%r10d", "%r11d", "%r12d", "%r13d",
-  "%r9d", "%r8d",
-  "%ecx", "%edx", "%esi", "%edi"
+  "%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d", "%r10d",
+  "%ebx", "%r12d", "%r13d", "%r14d", "%r15d",
+  "%eax", "%r11d"
 }; // 低 32 位寄存器
+static char *lower_8_bits_register_list[] = {
+  "%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b", "%r10b",
+  "%bl", "%r12b", "%r13b", "%r14b", "%r15b",
+  "%al", "%r11b"
+}; // 低 8 位寄存器
 
 static char *compare_list[] =
   { "sete", "setne", "setl", "setg", "setle", "setge" };
 
-static char *inverted_compare_list[] = { "jne", "je", "jge", "jle", "jg", "jl" };
+static char *branch_list[] = { "je", "jne", "jl", "jg", "jle", "jge" };
+
+// 按照 1/4/8 字节的宽度选择指令
+static char *compare_instruction_list[] = { "cmpb", "cmpl", "cmpq" };
+static char *test_instruction_list[] = { "testb", "testl", "testq" };
+static char *load_instruction_list[] = { "movzbq", "movslq", "movq" };
+static char *store_instruction_list[] = { "movb", "movl", "movq" };
 
-// none/void/char/int/long
-static int primitive_size[] = { 0, 0, 1, 4, 8, 8, 8, 8 };
+// 当前函数的 IR
+static struct IRFunction *current_ir_function;
 
 // 相对于栈基指针的局部变量的位置
 static int local_offset;
 static int stack_offset;
 
-static int spilling_register_index = 0;
+// 第 0 个栈槽的位置，第 i 个栈槽在它上面 8 * i 字节
+static int spill_slot_offset;
 
-static int register_new_local_offset(int primitive_type_size) {
-  // 栈上位置至少间隔为 4 byte
-  local_offset += (primitive_type_size > 4) ? primitive_type_size : 4;
+// 寄存器在栈上保存的位置，没有用到时为 0
+// callee-saved 寄存器在函数开头和结尾保存和恢复，caller-saved 寄存器在调用前后
+static int save_offset_list[ALLOCATABLE_REGISTER_NUMBER];
+
+// 在栈上分配 size 字节，起始位置按 alignment 对齐
+static int register_new_local_offset(int size, int alignment) {
+  local_offset = (local_offset + size + alignment - 1) & ~(alignment - 1);
   return (-local_offset);
 }
 
-static void push_register(int register_index) {
-  fprintf(output_file, "\tpushq\t%s\n", register_list[register_index]);
+// 1/4/8 字节对应 *_instruction_list 中的下标
+static int get_size_index(int size) {
+  if (size == 1) return (0);
+  if (size == 4) return (1);
+  return (2);
 }
 
-static void pop_register(int register_index) {
-  fprintf(output_file, "\tpopq\t%s\n", register_list[register_index]);
+static char *get_sized_register(int register_index, int size) {
+  if (size == 1) return (lower_8_bits_register_list[register_index]);
+  if (size == 4) return (lower_32_bits_register_list[register_index]);
+  return (register_list[register_index]);
 }
 
-void clear_all_registers(int keep_register_index) {
-  int i;
-  for (i = 0; i < FREE_REGISTER_NUMBER; i++) {
-    if (i != keep_register_index)
-      free_registers[i] = 1;
-  }
+static void emit_instruction(char *opcode, char *operand0, char *operand1) {
+  emit_machine_instruction(MACHINE_INSTRUCTION, opcode, operand0, operand1);
 }
 
-/**
- * 分配一个寄存器，返回这个寄存器对应的下标
- * 如果已经没有寄存器分配，则抛出异常
-*/
-int allocate_register() {
-  int i;
-  for (i = 0; i < FREE_REGISTER_NUMBER; i++) {
-    if (free_registers[i]) {
-      free_registers[i] = 0;
-      return (i);
-    }
-  }
-
-  // 如果没有 register，就匀一个出来
-  i = spilling_register_index % FREE_REGISTER_NUMBER;
-  spilling_register_index++;
-  fprintf(output_file, "# spilling reg %d\n", i);
-  push_register(i);
-  return (i);
+static char *format_immediate(long value) {
+  return (format_machine_text("$%ld", value));
 }
 
-/**
- * 清空某个寄存器
-*/
-void register_clear_register(int register_index) {
-  if (free_registers[register_index]) {
-    error_with_digital("Error trying to clear register\n", register_index);
-  }
-
-  if (spilling_register_index <= 0) {
-    free_registers[register_index] = 1;
-    return;
-  }
-
-  // 如果是之前匀出来的 register, 现在需要放回去
-  spilling_register_index--;
-  register_index = spilling_register_index % FREE_REGISTER_NUMBER;
-  pop_register(register_index);
+static char *format_frame_operand(int offset) {
+  return (format_machine_text("%ld(%%rbp)", offset));
 }
 
-void spill_all_register() {
-  int i;
-  for (i = 0; i < FREE_REGISTER_NUMBER; i++)
-    push_register(i);
-}
+// name 按照 format 格式化，结果放在 function_arena 中
+static char *format_symbol_text(char *format, char *name) {
+  int length = (int) strlen(format) + (int) strlen(name) + 1;
+  char *s = (char *) allocate_from_arena(function_arena, length);
 
-static void unspill_all_register() {
-  int i;
-  for (i = FREE_REGISTER_NUMBER - 1; i >= 0; i--)
-    pop_register(i);
+  snprintf(s, length, format, name);
+  return (s);
 }
 
-/**
- * 汇编前置代码，写入到 output_file 中
-*/
-void register_preamble() {
-  clear_all_registers(NO_REGISTER);
-  register_text_section_flag();
-  fprintf(output_file,
-  "# %%rsi = switch table, %%rax = expr\n"
-  "\n"
-  "__switch:\n"
-  "        pushq   %%rsi\n"
-  "        movq    %%rdx, %%rsi\n"
-  "        movq    %%rax, %%rbx\n"
-  "        cld\n"
-  "        lodsq\n"
-  "        movq    %%rax, %%rcx\n"
-  "__next:\n"
-  "        lodsq\n"
-  "        movq    %%rax, %%rdx\n"
-  "        lodsq\n"
-  "        cmpq    %%rdx, %%rbx\n"
-  "        jnz     __no\n"
-  "        popq    %%rsi\n"
-  "        jmp     *%%rax\n"
-  "__no:\n"
-  "        loop    __next\n"
-  "        lodsq\n"
-  "        popq    %%rsi\n" "        jmp     *%%rax\n" "\n");
-}
+// offset(base, index, scale) 形式的内存地址，index 为 NO_REGISTER 时没有下标
+static char *format_address_operand(int offset, int base_register, int index_register, int scale) {
+  char *s = (char *) allocate_from_arena(function_arena, 64);
+  int n = 0;
 
-/**
- * 汇编后置代码，写入到 output_file 中
-*/
-void register_postamble() {
+  if (offset) n = snprintf(s, 64, "%d", offset);
+  if (index_register == NO_REGISTER)
+    snprintf(s + n, 64 - n, "(%s)", register_list[base_register]);
+  else
+    snprintf(s + n, 64 - n, "(%s,%s,%d)",
+      register_list[base_register], register_list[index_register], scale);
+  return (s);
 }
 
-/**
- * 把 value 放入某个寄存器中，并返回该寄存器的下标
-*/
-int register_load_interger_literal(int value, int primitive_type) {
-  int register_index = allocate_register();
-  fprintf(output_file, "\tmovq\t$%d, %s\n", value, register_list[register_index]);
-  return (register_index);
+static int get_assigned_register(int register_index) {
+  return (current_ir_function->register_assignment[register_index]);
 }
 
-// load global 和 load local 的替代
-int register_load_variable(struct SymbolTable *t, int operation) {
-  int register_index, post_register_index, offset = 1;
-  char *r, *post_r;
-
-  register_index = allocate_register();
-
-  r = register_list[register_index];
-
-  if (check_pointer_type(t->primitive_type))
-    offset = get_primitive_type_size(value_at(t->primitive_type), t->composite_type);
-
-  if (operation == AST_PRE_DECREASE ||
-      operation == AST_POST_DECREASE)
-    offset = -offset;
-
-  if (operation == AST_PRE_INCREASE ||
-      operation == AST_PRE_DECREASE) {
-    if (t->storage_class == STORAGE_CLASS_LOCAL ||
-        t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER)
-      fprintf(output_file, "\tleaq\t%d(%%rbp), %s\n", t->symbol_table_position, r);
-    else
-      fprintf(output_file, "\tleaq\t%s(%%rip), %s\n", t->name, r);
-
-    switch (t->size) {
-      case 1: fprintf(output_file, "\taddb\t$%d,(%s)\n", offset, r); break;
-      case 4: fprintf(output_file, "\taddl\t$%d,(%s)\n", offset, r); break;
-      case 8: fprintf(output_file, "\taddq\t$%d,(%s)\n", offset, r); break;
-    }
-  }
-
-  if (t->storage_class == STORAGE_CLASS_LOCAL ||
-      t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER) {
-    switch (t->size) {
-      case 1: fprintf(output_file, "\tmovzbq\t%d(%%rbp), %s\n", t->symbol_table_position, r); break;
-      case 4: fprintf(output_file, "\tmovslq\t%d(%%rbp), %s\n", t->symbol_table_position, r); break;
-      case 8: fprintf(output_file, "\tmovq\t%d(%%rbp), %s\n", t->symbol_table_position, r); break;
-    }
-  } else {
-    switch (t->size) {
-      case 1: fprintf(output_file, "\tmovzbq\t%s(%%rip), %s\n", t->name, r); break;
-      case 4: fprintf(output_file, "\tmovslq\t%s(%%rip), %s\n", t->name, r); break;
-      case 8: fprintf(output_file, "\tmovq\t%s(%%rip), %s\n", t->name, r); break;
-    }
-  }
-
-  if (operation == AST_POST_INCREASE ||
-      operation == AST_POST_DECREASE) {
-    post_register_index = allocate_register();
-    post_r = register_list[post_register_index];
+// 放在栈槽中的虚拟寄存器的位置
+static char *get_spill_operand(int register_index) {
+  return (format_frame_operand(spill_slot_offset + 8 * current_ir_function->spill_slot_list[register_index]));
+}
 
-    if (t->storage_class == STORAGE_CLASS_LOCAL ||
-        t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER)
-      fprintf(output_file, "\tleaq\t%d(%%rbp), %s\n", t->symbol_table_position, post_r);
-    else
-      fprintf(output_file, "\tleaq\t%s(%%rip), %s\n", t->name, post_r);
+// 虚拟寄存器作为 size 字节宽的操作数，在寄存器中时是寄存器的名字，否则是它的栈槽
+static char *get_operand(int register_index, int size) {
+  int r = get_assigned_register(register_index);
 
-    switch (t->size) {
-      case 1: fprintf(output_file, "\taddb\t$%d,(%s)\n", offset, post_r); break;
-      case 4: fprintf(output_file, "\taddl\t$%d,(%s)\n", offset, post_r); break;
-      case 8: fprintf(output_file, "\taddq\t$%d,(%s)\n", offset, post_r); break;
-    }
+  if (r != NO_REGISTER) return (get_sized_register(r, size));
+  return (get_spill_operand(register_index));
+}
 
-    register_clear_register(post_register_index);
-  }
+// 把虚拟寄存器的值放进一个寄存器中，返回这个寄存器，在栈槽中时先读到 scratch
+static int load_operand(int register_index, int scratch) {
+  int r = get_assigned_register(register_index);
 
-  return (register_index);
+  if (r != NO_REGISTER) return (r);
+  emit_instruction("movq", get_spill_operand(register_index), register_list[scratch]);
+  return (scratch);
 }
 
-/**
- * 两个寄存器相加，并将其放入其中一个寄存器中
-*/
-int register_plus(int left_register, int right_register) {
-  fprintf(output_file, "\taddq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
-}
+// 计算虚拟寄存器的值时使用的寄存器，放在栈槽中时先算到 scratch 中
+static int get_destination_register(int register_index, int scratch) {
+  int r = get_assigned_register(register_index);
 
-/**
- * 两个寄存器相减，并将其放入其中一个寄存器中
-*/
-int register_minus(int left_register, int right_register) {
-  fprintf(output_file, "\tsubq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+  if (r != NO_REGISTER) return (r);
+  return (scratch);
 }
 
-/**
- * 两个寄存器相乘，并将其放入其中一个寄存器中
-*/
-int register_multiply(int left_register, int right_register) {
-  fprintf(output_file, "\timulq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
-}
+// 值已经算到了寄存器 r 中，再放到虚拟寄存器真正的位置
+static void store_destination(int register_index, int r) {
+  int destination = get_assigned_register(register_index);
 
-/**
- * 两个寄存器相除，这里处理比较麻烦
- * 先把值放入 rax 寄存器
- * 进行除法运算后，再从 rax 寄存器中把结果拿出来，放入 left_register
-*/
-int register_divide_and_mod(
-  int left_register,
-  int right_register,
-  int operation
-) {
-  char *l = register_list[left_register];
-  char *r = register_list[right_register];
-
-  fprintf(output_file, "\tmovq\t%s, %%rax\n", l);
-  fprintf(output_file, "\tcqo\n");
-  fprintf(output_file, "\tidivq\t%s\n", r);
-  if (operation == AST_DIVIDE)
-    fprintf(output_file, "\tmovq\t%%rax, %s\n", l);
+  if (destination == r) return;
+  if (destination != NO_REGISTER)
+    emit_instruction("movq", register_list[r], register_list[destination]);
   else
-    fprintf(output_file, "\tmovq\t%%rdx, %s\n", l);
-
-  register_clear_register(right_register);
-  return (left_register);
+    emit_instruction("movq", register_list[r], get_spill_operand(register_index));
 }
 
 /**
- * 将寄存器中的值保存到一个变量中
+ * 汇编前置代码，写入到 output_file 中
 */
-int register_store_value_2_variable(int register_index, struct SymbolTable *t) {
-  if (register_get_primitive_type_size(t->primitive_type) == 8) {
-    fprintf(output_file, "\tmovq\t%s, %s(%%rip)\n",
-    register_list[register_index],
-    t->name);
-    return (register_index);
-  }
-  switch (t->primitive_type) {
-    case PRIMITIVE_CHAR:
-      fprintf(output_file, "\tmovb\t%s, %s(%%rip)\n",
-       lower_8_bits_register_list[register_index],
-       t->name);
-      break;
-    case PRIMITIVE_INT:
-      fprintf(output_file, "\tmovl\t%s, %s(%%rip)\n",
-       lower_32_bits_register_list[register_index],
-       t->name);
-      break;
-    default:
-      error_with_digital("Bad type in register_store_value_2_variable:", t->primitive_type);
-  }
-  return (register_index);
+void register_preamble() {
+  // 上一个文件结束时的节和这个文件无关
+  current_section_flag = NO_SECTION_FLAG;
+  register_text_section_flag();
 }
 
 /**
- * 将寄存器中的值保存到一个局部变量中
+ * 汇编后置代码，写入到 output_file 中
 */
-int register_store_local_value_2_variable(int register_index, struct SymbolTable *t) {
-  if (register_get_primitive_type_size(t->primitive_type) == 8) {
-    fprintf(output_file, "\tmovq\t%s, %d(%%rbp)\n",
-    register_list[register_index],
-    t->symbol_table_position);
-    return (register_index);
-  }
-  switch (t->primitive_type) {
-    case PRIMITIVE_CHAR:
-      fprintf(output_file, "\tmovb\t%s, %d(%%rbp)\n",
-       lower_8_bits_register_list[register_index],
-       t->symbol_table_position);
-      break;
-    case PRIMITIVE_INT:
-      fprintf(output_file, "\tmovl\t%s, %d(%%rbp)\n",
-       lower_32_bits_register_list[register_index],
-       t->symbol_table_position);
-      break;
-    default:
-      error_with_digital("Bad type in register_store_local_value_2_variable:", t->primitive_type);
-  }
-  return (register_index);
+void register_postamble() {
+}
+
+// 全局变量的初始值和字符串直接写入 output_file
+static void register_label(int label) {
+  fprintf(output_file, "L%d:\n", label);
 }
 
 /**
@@ -366,7 +218,7 @@ void register_generate_global_symbol(struct SymbolTable *t) {
   }
 
   register_data_section_flag();
-  fprintf(output_file, "\t.globl\t%s\n", t->name);
+  register_symbol_visibility(t);
   fprintf(output_file, "%s:\n", t->name);
   for (i = 0; i < t->element_number; i++) {
     init_value = 0;
@@ -421,398 +273,906 @@ void register_generate_global_string_end() {
 }
 
 /**
- * 比较两寄存器，如果是 true 则进行 set
+ * 给定一个 primitive type，返回其对应的字节数
 */
-int register_compare_and_set(
-  int ast_operation,
-  int left_register,
-  int right_register,
-  int primitive_type
-) {
-  int primitive_type_size = register_get_primitive_type_size(primitive_type);
-
-  if (ast_operation < AST_COMPARE_EQUALS
-    || ast_operation > AST_COMPARE_GREATER_EQUALS)
-    error("Bad ast operation in register_compare_and_set function");
-
-  // 对于不同的大小的类型比较，要用不同的比较指令，
-  // 因为做 64 位的比较时，32 位的 -1 会被当成一个正数(0xffffffff)
-  switch (primitive_type_size) {
-    case 1:
-      fprintf(output_file, "\tcmpb\t%s, %s\n",
-        lower_8_bits_register_list[right_register],
-        lower_8_bits_register_list[left_register]);
-      break;
-    case 4:
-      fprintf(output_file, "\tcmpl\t%s, %s\n",
-        lower_32_bits_register_list[right_register],
-        lower_32_bits_register_list[left_register]);
-      break;
+int register_get_primitive_type_size(int primitive_type) {
+  if (check_pointer_type(primitive_type)) return 8;
+  switch (primitive_type) {
+    case PRIMITIVE_CHAR: return 1;
+    case PRIMITIVE_INT: return 4;
+    case PRIMITIVE_LONG: return 8;
     default:
-      fprintf(output_file, "\tcmpq\t%s, %s\n",
-        register_list[right_register],
-        register_list[left_register]);
+      error_with_digital("Bad type in register_get_primitive_type_size()", primitive_type);
   }
+  return 0;
+}
 
-  fprintf(output_file, "\t%s\t%s\n",
-    compare_list[ast_operation - AST_COMPARE_EQUALS],
-    lower_8_bits_register_list[right_register]);
-
-  fprintf(output_file, "\tmovzbq\t%s, %s\n",
-    lower_8_bits_register_list[right_register],
-    register_list[right_register]);
-
-  register_clear_register(left_register);
-  return (right_register);
+// 寄存器分配的结果中寄存器的名字，-L 时输出
+char *register_get_register_name(int register_index) {
+  return (register_list[register_index]);
 }
 
-/**
- * 比较俩寄存器，如果是 false 则进行 jmp
-*/
-int register_compare_and_jump(
-  int ast_operation,
-  int left_register,
-  int right_register,
-  int label,
-  int primitive_type
-) {
-  int primitive_type_size = register_get_primitive_type_size(primitive_type);
+// 生成的汇编可以先交给集成汇编器
+int register_use_integrated_assembler() {
+  return (1);
+}
 
-  if (ast_operation < AST_COMPARE_EQUALS
-    || ast_operation > AST_COMPARE_GREATER_EQUALS)
-    error("Bad ast operation in register_compare_and_jump function");
+// 用寄存器传的参数个数
+int register_get_argument_register_number() {
+  return (6);
+}
 
-  switch (primitive_type_size) {
-    case 1:
-      fprintf(output_file, "\tcmpb\t%s, %s\n",
-        lower_8_bits_register_list[right_register],
-        lower_8_bits_register_list[left_register]);
-      break;
-    case 4:
-      fprintf(output_file, "\tcmpl\t%s, %s\n",
-        lower_32_bits_register_list[right_register],
-        lower_32_bits_register_list[left_register]);
-      break;
-    default:
-      fprintf(output_file, "\tcmpq\t%s, %s\n",
-        register_list[right_register],
-        register_list[left_register]);
-  }
+// 寄存器分配可以使用 register_list 中的前这么多个寄存器
+int register_get_allocatable_register_number() {
+  return (ALLOCATABLE_REGISTER_NUMBER);
+}
 
-  fprintf(output_file, "\t%s\tL%d\n",
-    inverted_compare_list[ast_operation - AST_COMPARE_EQUALS],
-    label);
+int register_check_callee_saved(int register_index) {
+  return (register_index >= FIRST_CALLEE_SAVED_REGISTER);
+}
 
-  register_clear_register(left_register);
-  register_clear_register(right_register);
+// 第 position 个参数所在的寄存器，在栈上时返回 NO_REGISTER
+int register_get_argument_register(int position) {
+  if (position <= 6) return (position - 1);
   return (NO_REGISTER);
 }
 
 /**
- * 创建 label
+ * 翻译这条指令时会改掉的可分配的寄存器，没有时返回 NO_REGISTER
+ * 除法和取模要用 %rdx，按寄存器移位时位数要放在 %cl 中
 */
-void register_label(int label) {
-  fprintf(output_file, "L%d:\n", label);
+int register_get_clobbered_register(struct IRInstruction *instruction) {
+  switch (instruction->operation) {
+    case IR_DIVIDE:
+    case IR_MOD:
+      return (RDX_REGISTER);
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+      if (instruction->source2 != NO_REGISTER) return (RCX_REGISTER);
+  }
+  return (NO_REGISTER);
+}
+
+// 变量在栈上的对齐：标量按自己的宽度，数组按元素的宽度，结构体和联合体按 8 字节
+static int get_frame_variable_alignment(struct SymbolTable *t) {
+  int primitive_type = t->primitive_type;
+
+  if (t->structural_type == STRUCTURAL_ARRAY) primitive_type = value_at(primitive_type);
+  if (check_int_type(primitive_type) || check_pointer_type(primitive_type))
+    return (register_get_primitive_type_size(primitive_type));
+  return (8);
 }
 
 /**
- * 创建一个跳到 label 的 jmp
+ * 给不在虚拟寄存器中的前 6 个参数和局部变量分配栈上的位置
+ * 按照 8、4、1 字节的对齐依次排列，中间没有空洞
+ * 超过 6 个参数寄存器的参数已经在调用者的栈上了
 */
-void register_jump(int label) {
-  fprintf(output_file, "\tjmp\tL%d\n", label);
+static void layout_frame_variables(struct SymbolTable *function) {
+  struct SymbolTable *t;
+  int i, alignment;
+
+  for (t = function->member, i = 1; t; t = t->next, i++) {
+    if (i > 6) t->symbol_table_position = 16 + 8 * (i - 7);
+  }
+
+  for (alignment = 8; alignment > 0; alignment = alignment / 2) {
+    for (t = function->member, i = 1; t && i <= 6; t = t->next, i++) {
+      if (!t->variable_register && get_frame_variable_alignment(t) == alignment)
+        t->symbol_table_position = register_new_local_offset(t->size, alignment);
+    }
+    for (t = local_head; t; t = t->next) {
+      if (!t->variable_register && get_frame_variable_alignment(t) == alignment)
+        t->symbol_table_position = register_new_local_offset(t->size, alignment);
+    }
+  }
 }
 
 /**
- * 解析函数定义的前置汇编代码
+ * 给函数的栈帧分配位置：
+ * 用到的 callee-saved 寄存器、调用前后要保存的 caller-saved 寄存器、
+ * 不在虚拟寄存器中的变量、寄存器分配用的栈槽
 */
-void register_function_preamble(struct SymbolTable *t) {
-  char *name = t->name;
+static void layout_frame(struct IRFunction *function) {
+  int i, r, save_mask = 0;
+
+  local_offset = 0;
+  for (i = 0; i < ALLOCATABLE_REGISTER_NUMBER; i++) save_offset_list[i] = 0;
+  for (i = 1; i < function->register_number; i++) {
+    r = function->register_assignment[i];
+    if (r >= FIRST_CALLEE_SAVED_REGISTER && !save_offset_list[r])
+      save_offset_list[r] = register_new_local_offset(8, 8);
+  }
+  for (i = 0; i < function->instruction_number; i++)
+    save_mask = save_mask | function->instruction_list[i]->save_register_mask;
+  for (r = 0; r < FIRST_CALLEE_SAVED_REGISTER; r++) {
+    if ((save_mask >> r) & 1) save_offset_list[r] = register_new_local_offset(8, 8);
+  }
+
+  layout_frame_variables(function->symbol);
+
+  spill_slot_offset = 0;
+  if (function->spill_slot_number)
+    spill_slot_offset = register_new_local_offset(8 * function->spill_slot_number, 8);
+
+  // 将栈指针对齐为 16 的倍数
+  stack_offset = (local_offset + 15) & (~15);
+}
+
+static void emit_function_prologue(struct SymbolTable *t) {
   int i;
-  int parameter_offset = 16;
-  int parameter_register_number = FIRST_PARAMETER_REGISTER_NUMBER;
-  struct SymbolTable *parameter_pointer, *local_var_pointer;
 
-  register_text_section_flag();
-  register_reset_local_variables();
-
-  fprintf(output_file,
-            "\t.globl\t%s\n"
-            "\t.type\t%s, @function\n"
-            "%s:\n"
-            "\tpushq\t%%rbp\n"
-            "\tmovq\t%%rsp, %%rbp\n",
-            name, name, name);
-
-  // 把在寄存器中的函数参数复制放入栈中
-  // 超过 6 个参数寄存器就 break
-  // position 将在后面解析的时候用到
-  for (
-    parameter_pointer = t->member, i = 1;
-    parameter_pointer;
-    parameter_pointer = parameter_pointer->next, i++
-  ) {
-    if (i > 6) {
-      parameter_pointer->symbol_table_position = parameter_offset;
-      parameter_offset += 8;
-    } else {
-      parameter_pointer->symbol_table_position
-        = register_new_local_offset(parameter_pointer->size);
-      register_store_local_value_2_variable(parameter_register_number--, parameter_pointer);
-    }
+  if (t->storage_class == STORAGE_CLASS_STATIC)
+    emit_machine_directive(".local", t->name);
+  else
+    emit_machine_directive(".globl", t->name);
+  emit_machine_directive(".type", format_symbol_text("%s, @function", t->name));
+  emit_machine_instruction(MACHINE_LABEL, t->name, NULL, NULL);
+  emit_instruction("pushq", "%rbp", NULL);
+  emit_instruction("movq", "%rsp", "%rbp");
+
+  // 先在栈上保存要用到的 callee-saved 寄存器
+  for (i = FIRST_CALLEE_SAVED_REGISTER; i < ALLOCATABLE_REGISTER_NUMBER; i++) {
+    if (save_offset_list[i])
+      emit_instruction("movq", register_list[i], format_frame_operand(save_offset_list[i]));
   }
+  emit_instruction("addq", format_immediate(-stack_offset), "%rsp");
+}
+
+// 恢复 callee-saved 寄存器和调用者的栈帧，之后 %rsp 指向返回地址
+static void emit_function_epilogue() {
+  int i;
 
-  // 剩下的如果是参数变量，继续放入栈中
-  // 如果是局部变量，创建新的 position
-  for (
-    local_var_pointer = local_head;
-    local_var_pointer;
-    local_var_pointer = local_var_pointer->next
-  ) {
-    local_var_pointer->symbol_table_position = register_new_local_offset(local_var_pointer->size);
+  for (i = FIRST_CALLEE_SAVED_REGISTER; i < ALLOCATABLE_REGISTER_NUMBER; i++) {
+    if (save_offset_list[i])
+      emit_instruction("movq", format_frame_operand(save_offset_list[i]), register_list[i]);
   }
+  // 栈指针回到最初的位置
+  emit_instruction("addq", format_immediate(stack_offset), "%rsp");
+  emit_instruction("popq", "%rbp", NULL);
+}
 
-  // 将栈指针对齐为 16 的倍数
-  stack_offset = (local_offset+15) & (~15);
-  fprintf(output_file, "\taddq\t$%d,%%rsp\n", -stack_offset);
+// 变量作为内存操作数
+static char *get_variable_operand(struct SymbolTable *t) {
+  if (t->storage_class == STORAGE_CLASS_LOCAL ||
+      t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER)
+    return (format_frame_operand(t->symbol_table_position));
+  return (format_symbol_text("%s(%%rip)", t->name));
 }
 
 /**
- * 解析函数定义的后置汇编代码
+ * call 或者 jmp 的目标
+ * 当前文件中定义的函数和 static 函数直接跳转，
+ * 外部函数通过 PLT 跳转，-fno-plt 时从 GOT 中取出地址跳转
 */
-void register_function_postamble(struct SymbolTable *t) {
-  register_label(t->symbol_table_end_label);
-  // 栈指针回到最初的位置
-  fprintf(output_file, "\taddq\t$%d,%%rsp\n", stack_offset);
-  fputs("\tpopq\t%rbp\n"
-        "\tret\n", output_file);
-  clear_all_registers(NO_REGISTER);
+static char *get_function_target(struct SymbolTable *t) {
+  if (t->is_defined || t->storage_class == STORAGE_CLASS_STATIC)
+    return (t->name);
+  if (no_plt)
+    return (format_symbol_text("*%s@GOTPCREL(%%rip)", t->name));
+  return (format_symbol_text("%s@PLT", t->name));
+}
+
+// 按照 primitive_type 的宽度把 source 扩展成 64 位，放入寄存器 r
+static void emit_extend(int primitive_type, int source, int r) {
+  int size = register_get_primitive_type_size(primitive_type);
+
+  emit_instruction(load_instruction_list[get_size_index(size)], get_operand(source, size), register_list[r]);
 }
 
 /**
- * 从 old_primitive_type 转向 new_primitive_type 时扩大在寄存器中的值
- * 返回这个新的值
+ * 按照类型的宽度比较 source1 和 source2，source2 为 NO_REGISTER 时和立即数比较
+ * 对于不同的大小的类型比较，要用不同的比较指令，
+ * 因为做 64 位的比较时，32 位的 -1 会被当成一个正数(0xffffffff)
 */
-int register_widen(
-  int register_index,
-  int old_primitive_type,
-  int new_primitive_type) {
-    return (register_index);
+static void emit_compare(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int size_index = get_size_index(size);
+  int r = load_operand(instruction->source1, RAX_REGISTER);
+  char *operand = get_sized_register(r, size);
+
+  if (instruction->source2 != NO_REGISTER)
+    emit_instruction(compare_instruction_list[size_index], get_operand(instruction->source2, size), operand);
+  else if (instruction->value == 0)
+    emit_instruction(test_instruction_list[size_index], operand, operand);
+  else
+    emit_instruction(compare_instruction_list[size_index], format_immediate(instruction->value), operand);
+}
+
+// 把比较的结果变成 0 或者 1
+static void emit_set(char *opcode, int destination) {
+  int r = get_destination_register(destination, R11_REGISTER);
+
+  emit_instruction(opcode, lower_8_bits_register_list[r], NULL);
+  emit_instruction("movzbq", lower_8_bits_register_list[r], register_list[r]);
+  store_destination(destination, r);
+}
+
+// + - * & | ^ << >> 对应的 64 位指令
+static char *get_operation_instruction(int operation) {
+  switch (operation) {
+    case IR_ADD: return ("addq");
+    case IR_SUBTRACT: return ("subq");
+    case IR_MULTIPLY: return ("imulq");
+    case IR_AND: return ("andq");
+    case IR_OR: return ("orq");
+    case IR_XOR: return ("xorq");
+    case IR_SHIFT_LEFT: return ("shlq");
+    case IR_SHIFT_RIGHT: return ("shrq");
+  }
+  error_with_digital("Bad ir operation for an instruction:", operation);
+  return (NULL);
+}
+
+static int check_commutative_ir_operation(int operation) {
+  return (operation == IR_ADD ||
+          operation == IR_MULTIPLY ||
+          operation == IR_AND ||
+          operation == IR_OR ||
+          operation == IR_XOR);
 }
 
 /**
- * 给定一个 primitive type，返回其对应的字节数
+ * destination = source1 op source2，两个操作数的指令，结果写回第一个操作数
+ * destination 的寄存器就是 source2 的寄存器时，可以交换的运算交换两边，否则先算到 %r11
 */
-int register_get_primitive_type_size(int primitive_type) {
-  if (check_pointer_type(primitive_type)) return 8;
-  switch (primitive_type) {
-    case PRIMITIVE_CHAR: return 1;
-    case PRIMITIVE_INT: return 4;
-    case PRIMITIVE_LONG: return 8;
-    default:
-      error_with_digital("Bad type in register_get_primitive_type_size()", primitive_type);
+static void emit_binary(struct IRInstruction *instruction) {
+  int source1 = instruction->source1, source2 = instruction->source2, swap;
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+
+  if (get_assigned_register(source2) == r && get_assigned_register(source1) != r) {
+    if (check_commutative_ir_operation(instruction->operation)) {
+      swap = source1;
+      source1 = source2;
+      source2 = swap;
+    } else {
+      r = R11_REGISTER;
+    }
   }
-  return 0;
+  emit_instruction("movq", get_operand(source1, 8), register_list[r]);
+  emit_instruction(get_operation_instruction(instruction->operation), get_operand(source2, 8), register_list[r]);
+  store_destination(instruction->destination, r);
+}
+
+// 如果 value 是 2 的 n 次方，返回 n，否则返回 -1
+static int get_power_of_two(long value) {
+  int n = 0;
+
+  if (value <= 0) return (-1);
+  while (!(value & 1)) {
+    value = value >> 1;
+    n++;
+  }
+  if (value != 1) return (-1);
+  return (n);
 }
 
 /**
- * 处理函数调用 function_call
+ * 寄存器乘以一个常量，尽量用移位、lea、加减来代替 imulq
 */
-int register_function_call(struct SymbolTable *t, int argument_number) {
-  int out_register_index;
-  // 调用函数
-  fprintf(output_file, "\tcall\t%s@PLT\n", t->name);
+static void emit_multiply_by_constant(int r, int value) {
+  char *name = register_list[r];
+  int shift, factor = 0;
 
-  // 如果参数大于 6 个，移除在栈上的参数
-  if (argument_number > 6)
-    fprintf(output_file, "\taddq\t$%d, %%rsp\n", 8 * (argument_number - 6));
+  if (value == 0) {
+    emit_instruction("movq", "$0", name);
+    return;
+  }
+  if (value == 1) return;
+  if (value == -1) {
+    emit_instruction("negq", name, NULL);
+    return;
+  }
+
+  shift = get_power_of_two(value);
+  if (shift >= 0) {
+    emit_instruction("salq", format_immediate(shift), name);
+    return;
+  }
 
-  unspill_all_register();
+  if (value > 0) {
+    // 3/5/9 再乘以 2 的 n 次方，一条 lea 加上一次移位
+    if (!(value % 9)) factor = 9;
+    else if (!(value % 5)) factor = 5;
+    else if (!(value % 3)) factor = 3;
+    if (factor) {
+      shift = get_power_of_two(value / factor);
+      if (shift >= 0) {
+        emit_instruction("leaq", format_address_operand(0, r, r, factor - 1), name);
+        if (shift) emit_instruction("salq", format_immediate(shift), name);
+        return;
+      }
+    }
 
-  out_register_index = allocate_register();
+    // 2^n + 1 和 2^n - 1
+    shift = get_power_of_two(value - 1);
+    if (shift > 0) {
+      emit_instruction("movq", name, "%rax");
+      emit_instruction("salq", format_immediate(shift), name);
+      emit_instruction("addq", "%rax", name);
+      return;
+    }
+    shift = get_power_of_two(value + 1);
+    if (shift > 0) {
+      emit_instruction("movq", name, "%rax");
+      emit_instruction("salq", format_immediate(shift), name);
+      emit_instruction("subq", "%rax", name);
+      return;
+    }
+  }
 
-  // 把返回值复制进寄存器
-  fprintf(output_file, "\tmovq\t%%rax, %s\n", register_list[out_register_index]);
-  return (out_register_index);
+  emit_instruction("imulq", format_immediate(value), name);
 }
 
 /**
- * 处理函数返回 function_return
+ * 寄存器除以一个常量或者对一个常量取模，避免使用 idivq
+ * 1. 除数是 2 的 n 次方时，负数先加上 2^n - 1 再算术右移，结果才是向 0 取整
+ * 2. 其他正的除数，char/int 的被除数用乘法代替除法：
+ *    取 s = 31 + ceil(log2(value))，magic = 2^s / value + 1，
+ *    商就是 (x * magic) >> s，x 为负数时再加 1，
+ *    |x| <= 2^31 时 x * magic 不会超出 64 位，结果是精确的
+ * 3. 剩下的情况还是用 idivq
 */
-void register_function_return(int register_index, struct SymbolTable *t) {
-  if (register_index == NO_REGISTER) {
-    register_jump(t->symbol_table_end_label);
+static void emit_divide_by_constant(int r, int value, int operation, int primitive_type) {
+  char *name = register_list[r];
+  int shift = get_power_of_two(value), log2 = 0;
+  long magic, power = 1;
+
+  if (value == 1) {
+    if (operation == IR_MOD)
+      emit_instruction("movq", "$0", name);
     return;
-  };
+  }
 
-  char *r = register_list[register_index];
+  // andq 的立即数只有 32 位，所以取模时 n 要小于 32
+  if (shift > 0 && (operation == IR_DIVIDE || shift < 32)) {
+    emit_instruction("movq", name, "%rax");
+    emit_instruction("sarq", "$63", "%rax");
+    emit_instruction("shrq", format_immediate(64 - shift), "%rax");
+    if (operation == IR_DIVIDE) {
+      emit_instruction("addq", "%rax", name);
+      emit_instruction("sarq", format_immediate(shift), name);
+    } else {
+      emit_instruction("addq", name, "%rax");
+      emit_instruction("andq", format_immediate(-value), "%rax");
+      emit_instruction("subq", "%rax", name);
+    }
+    return;
+  }
 
-  if (check_pointer_type(t->primitive_type)) {
-    fprintf(output_file, "\tmovq\t%s, %%rax\n", r);
-    register_jump(t->symbol_table_end_label);
+  if (value > 1 && register_get_primitive_type_size(primitive_type) <= 4) {
+    while (power < value) {
+      power = power * 2;
+      log2++;
+    }
+    power = 1;
+    power = power << (31 + log2);
+    magic = power / value + 1;
+
+    emit_instruction("movslq", lower_32_bits_register_list[r], name);
+    emit_instruction("movq", format_immediate(magic), "%rax");
+    emit_instruction("imulq", name, "%rax");
+    emit_instruction("sarq", format_immediate(31 + log2), "%rax");
+    if (operation == IR_DIVIDE) {
+      emit_instruction("sarq", "$63", name);
+      emit_instruction("subq", name, "%rax");
+      emit_instruction("movq", "%rax", name);
+    } else {
+      emit_instruction("movq", name, "%rdx");
+      emit_instruction("sarq", "$63", "%rdx");
+      emit_instruction("subq", "%rdx", "%rax");
+      emit_instruction("imulq", format_immediate(value), "%rax");
+      emit_instruction("subq", "%rax", name);
+    }
     return;
   }
 
-  switch (t->primitive_type) {
-    case PRIMITIVE_CHAR:
-      fprintf(output_file, "\tmovzbl\t%s, %%eax\n", lower_8_bits_register_list[register_index]);
+  // r 可能就是 %r11，先把被除数移到 %rax 再放入除数
+  emit_instruction("movq", name, "%rax");
+  emit_instruction("cqo", NULL, NULL);
+  emit_instruction("movq", format_immediate(value), "%r11");
+  emit_instruction("idivq", "%r11", NULL);
+  if (operation == IR_DIVIDE)
+    emit_instruction("movq", "%rax", name);
+  else
+    emit_instruction("movq", "%rdx", name);
+}
+
+/**
+ * destination = source1 op value
+ * 乘法、除法、取模用移位、lea 和乘法来代替
+ * 移位和用 %cl 时一样只取低 6 位
+*/
+static void emit_binary_constant(struct IRInstruction *instruction) {
+  int operation = instruction->operation, value = instruction->value;
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+
+  // 除法要用到 %rdx，结果不能在 %rdx 中计算
+  if (r == RDX_REGISTER && (operation == IR_DIVIDE || operation == IR_MOD))
+    r = R11_REGISTER;
+  emit_instruction("movq", get_operand(instruction->source1, 8), register_list[r]);
+
+  switch (operation) {
+    case IR_MULTIPLY:
+      emit_multiply_by_constant(r, value);
       break;
-    case PRIMITIVE_INT:
-      fprintf(output_file, "\tmovl\t%s, %%eax\n", lower_32_bits_register_list[register_index]);
+    case IR_DIVIDE:
+    case IR_MOD:
+      emit_divide_by_constant(r, value, operation, instruction->primitive_type);
       break;
-    case PRIMITIVE_LONG:
-      fprintf(output_file, "\tmovq\t%s, %%rax\n", r);
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+      emit_instruction(get_operation_instruction(operation), format_immediate(value & 63), register_list[r]);
       break;
     default:
-      error_with_digital("Bad function type in register_function_return:", t->primitive_type);
+      emit_instruction(get_operation_instruction(operation), format_immediate(value), register_list[r]);
   }
-  register_jump(t->symbol_table_end_label);
+  store_destination(instruction->destination, r);
 }
 
-int register_load_identifier_address(struct SymbolTable *t) {
-  int register_index = allocate_register();
-  char *r = register_list[register_index];
-  if (t->storage_class == STORAGE_CLASS_GLOBAL ||
-      t->storage_class == STORAGE_CLASS_EXTERN ||
-      t->storage_class == STORAGE_CLASS_STATIC)
-    fprintf(output_file, "\tleaq\t%s(%%rip), %s\n", t->name, r);
+/**
+ * 两个虚拟寄存器相除，先把被除数放入 %rax，
+ * 进行除法运算后，再从 %rax 或者 %rdx 中把结果拿出来
+ * 除数在 %rdx 中时先移到 %r11，cqo 会改掉 %rdx
+*/
+static void emit_divide_register(struct IRInstruction *instruction) {
+  char *operand = get_operand(instruction->source2, 8);
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+
+  if (get_assigned_register(instruction->source2) == RDX_REGISTER) {
+    emit_instruction("movq", "%rdx", "%r11");
+    operand = "%r11";
+  }
+  emit_instruction("movq", get_operand(instruction->source1, 8), "%rax");
+  emit_instruction("cqo", NULL, NULL);
+  emit_instruction("idivq", operand, NULL);
+  if (instruction->operation == IR_DIVIDE)
+    emit_instruction("movq", "%rax", register_list[r]);
   else
-    fprintf(output_file, "\tleaq\t%d(%%rbp), %s\n", t->symbol_table_position, r);
-  return (register_index);
+    emit_instruction("movq", "%rdx", register_list[r]);
+  store_destination(instruction->destination, r);
 }
 
-int register_dereference_pointer(int register_index, int primitive_type) {
-  char *r = register_list[register_index];
-  int new_primitive_type = value_at(primitive_type);
-  int primitive_type_size = register_get_primitive_type_size(new_primitive_type);
-  switch (primitive_type_size) {
-    case 1:
-      fprintf(output_file, "\tmovzbq\t(%s), %s\n", r, r);
-      break;
-    case 4:
-      fprintf(output_file, "\tmovslq\t(%s), %s\n", r, r);
-      break;
-    case 8:
-      fprintf(output_file, "\tmovq\t(%s), %s\n", r, r);
-      break;
-    default:
-      error_with_digital("Can't register_dereference_pointer on type:", primitive_type);
+// 移位的位数要放在 %cl 中，在 %r11 中计算，%rcx 原来的值已经不用了
+static void emit_shift_register(struct IRInstruction *instruction) {
+  emit_instruction("movq", get_operand(instruction->source1, 8), "%r11");
+  emit_instruction("movq", get_operand(instruction->source2, 8), "%rcx");
+  emit_instruction(get_operation_instruction(instruction->operation), "%cl", "%r11");
+  store_destination(instruction->destination, R11_REGISTER);
+}
+
+// negq 和 notq
+static void emit_unary(char *opcode, struct IRInstruction *instruction) {
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+
+  emit_instruction("movq", get_operand(instruction->source1, 8), register_list[r]);
+  emit_instruction(opcode, register_list[r], NULL);
+  store_destination(instruction->destination, r);
+}
+
+// 值为 0 时 sete 得到 1，setne 得到 0
+static void emit_test_and_set(char *opcode, struct IRInstruction *instruction) {
+  int r = load_operand(instruction->source1, RAX_REGISTER);
+
+  emit_instruction("testq", register_list[r], register_list[r]);
+  emit_set(opcode, instruction->destination);
+}
+
+/**
+ * 读写 value(base, index, scale) 时，base 放在寄存器中(或者 %r11)，index 放在寄存器中(或者 %rax)
+*/
+static char *get_memory_operand(struct IRInstruction *instruction) {
+  int base = load_operand(instruction->source1, R11_REGISTER), index = NO_REGISTER;
+
+  if (instruction->index != NO_REGISTER) index = load_operand(instruction->index, RAX_REGISTER);
+  return (format_address_operand(instruction->value, base, index, instruction->scale));
+}
+
+static void emit_load(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  char *operand = get_memory_operand(instruction);
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+
+  emit_instruction(load_instruction_list[get_size_index(size)], operand, register_list[r]);
+  store_destination(instruction->destination, r);
+}
+
+/**
+ * 写入的值也在栈槽中时，临时寄存器不够用，先用 lea 把地址算到 %r11 中，值读到 %rax
+*/
+static void emit_store(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int r = get_assigned_register(instruction->source2);
+  char *operand;
+
+  if (r == NO_REGISTER && instruction->index != NO_REGISTER) {
+    emit_instruction("leaq", get_memory_operand(instruction), "%r11");
+    operand = format_address_operand(0, R11_REGISTER, NO_REGISTER, 1);
+  } else {
+    operand = get_memory_operand(instruction);
   }
-  return (register_index);
+  if (r == NO_REGISTER) r = load_operand(instruction->source2, RAX_REGISTER);
+  emit_instruction(store_instruction_list[get_size_index(size)], get_sized_register(r, size), operand);
 }
 
-int register_store_dereference_pointer(int left_register, int right_register, int primitive_type) {
-  int primitive_type_size = register_get_primitive_type_size(primitive_type);
-  switch (primitive_type_size) {
-    case 1:
-      fprintf(output_file, "\tmovb\t%s, (%s)\n",
-        lower_8_bits_register_list[left_register],
-        register_list[right_register]);
-      break;
-    case 4:
-      fprintf(output_file, "\tmovl\t%s, (%s)\n",
-        lower_32_bits_register_list[left_register],
-        register_list[right_register]);
-      break;
-    case 8:
-      fprintf(output_file, "\tmovq\t%s, (%s)\n",
-        register_list[left_register],
-        register_list[right_register]);
-      break;
-    default:
-      error_with_digital("Can't register_store_dereference_pointer on type:", primitive_type);
+// destination = 第 index 个参数，按照参数的类型扩展成 64 位
+static void emit_parameter(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int r = get_destination_register(instruction->destination, R11_REGISTER);
+  int position = instruction->index;
+  char *operand;
+
+  if (position <= 6) operand = get_sized_register(position - 1, size);
+  else operand = format_frame_operand(16 + 8 * (position - 7));
+  emit_instruction(load_instruction_list[get_size_index(size)], operand, register_list[r]);
+  store_destination(instruction->destination, r);
+}
+
+/**
+ * 第 index 个参数放入传参的寄存器，超过 6 个的参数按照从后往前的顺序压栈
+ * 压栈的参数是奇数个时先多减 8，保证调用时栈仍然是 16 字节对齐的
+*/
+static void emit_argument(struct IRInstruction *instruction) {
+  int position = instruction->index, argument_number = instruction->value;
+
+  if (position <= 6) {
+    if (get_assigned_register(instruction->source1) != position - 1)
+      emit_instruction("movq", get_operand(instruction->source1, 8), register_list[position - 1]);
+    return;
+  }
+  if (position == argument_number && (argument_number - 6) % 2)
+    emit_instruction("subq", "$8", "%rsp");
+  emit_instruction("pushq", get_operand(instruction->source1, 8), NULL);
+}
+
+// 保存或者恢复 mask 中的 caller-saved 寄存器
+static void emit_call_save(int mask, int is_save) {
+  int r;
+
+  for (r = 0; r < FIRST_CALLEE_SAVED_REGISTER; r++) {
+    if (((mask >> r) & 1) && is_save)
+      emit_instruction("movq", register_list[r], format_frame_operand(save_offset_list[r]));
+    else if ((mask >> r) & 1)
+      emit_instruction("movq", format_frame_operand(save_offset_list[r]), register_list[r]);
   }
-  return (left_register);
 }
 
-int register_shift_left_by_constant(int register_index, int value) {
-  char *r = register_list[register_index];
-  fprintf(output_file, "\tsalq\t$%d, %s\n", value, r);
-  return (register_index);
+/**
+ * 调用函数之后移除在栈上的参数，返回值按照函数的类型扩展成 64 位
+ * 跨过调用还活跃的 caller-saved 寄存器在调用前保存，取出返回值之后恢复
+*/
+static void emit_call(struct IRInstruction *instruction) {
+  int stack_argument_number = instruction->value - 6, size, r;
+
+  emit_call_save(instruction->save_register_mask, 1);
+  emit_machine_instruction(MACHINE_CALL, "call", get_function_target(instruction->symbol), NULL);
+  // 压栈的参数是奇数个时还有对齐用的 8 字节
+  if (stack_argument_number > 0) {
+    stack_argument_number = stack_argument_number + (stack_argument_number & 1);
+    emit_instruction("addq", format_immediate(8 * stack_argument_number), "%rsp");
+  }
+
+  if (instruction->primitive_type != PRIMITIVE_VOID) {
+    size = register_get_primitive_type_size(instruction->primitive_type);
+    r = get_destination_register(instruction->destination, R11_REGISTER);
+    emit_instruction(load_instruction_list[get_size_index(size)], get_sized_register(RAX_REGISTER, size), register_list[r]);
+    store_destination(instruction->destination, r);
+  }
+  emit_call_save(instruction->save_register_mask, 0);
 }
 
 /**
- * 给定一个全局 string 的 label id，把它的地址加载进一个寄存器中
+ * 处理尾调用 return f(...)，参数已经放在传参的寄存器中
+ * label 不为 NO_LABEL 时是对自己的调用，跳回函数开头读取参数的地方，变成循环
+ * 否则先恢复调用者的栈帧，再 jmp 到被调用的函数，由它直接返回到调用者的调用者
 */
-int register_load_global_string(int label) {
-  int register_index = allocate_register();
-  fprintf(output_file, "\tleaq\tL%d(%%rip), %s\n", label, register_list[register_index]);
-  return (register_index);
+static void emit_tail_call(struct IRInstruction *instruction) {
+  if (instruction->label != NO_LABEL) {
+    emit_machine_instruction(MACHINE_JUMP, "jmp", format_label_operand(instruction->label), NULL);
+    return;
+  }
+  emit_function_epilogue();
+  emit_machine_instruction(MACHINE_JUMP, "jmp", get_function_target(instruction->symbol), NULL);
 }
 
-int register_and(int left_register, int right_register) {
-  fprintf(output_file, "\tandq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+// 返回值放入 %rax，char 和 int 按照函数的类型截断
+static void emit_return(struct IRInstruction *instruction) {
+  switch (register_get_primitive_type_size(instruction->primitive_type)) {
+    case 1:
+      emit_instruction("movzbl", get_operand(instruction->source1, 1), "%eax");
+      break;
+    case 4:
+      emit_instruction("movl", get_operand(instruction->source1, 4), "%eax");
+      break;
+    default:
+      emit_instruction("movq", get_operand(instruction->source1, 8), "%rax");
+  }
 }
 
-int register_or(int left_register, int right_register) {
-  fprintf(output_file, "\torq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+// case 个数少于这个值时逐个比较
+#define SWITCH_COMPARE_CHAIN_LIMIT 4
+// case 值的范围不超过 case 个数的这么多倍时使用跳转表
+#define SWITCH_JUMP_TABLE_DENSITY 3
+
+// 按 case 值从小到大排序，case label 跟着一起移动
+static void sort_switch_case(int *case_value, int *case_label, int case_count) {
+  int i, j, value, label;
+
+  for (i = 1; i < case_count; i++) {
+    value = case_value[i];
+    label = case_label[i];
+    for (j = i; j > 0 && case_value[j - 1] > value; j--) {
+      case_value[j] = case_value[j - 1];
+      case_label[j] = case_label[j - 1];
+    }
+    case_value[j] = value;
+    case_label[j] = label;
+  }
 }
 
-int register_xor(int left_register, int right_register) {
-  fprintf(output_file, "\txorq\t%s, %s\n", register_list[right_register], register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+static void emit_jump(int label) {
+  emit_machine_instruction(MACHINE_JUMP, "jmp", format_label_operand(label), NULL);
 }
 
-int register_negate(int register_index) {
-  fprintf(output_file, "\tnegq\t%s\n",
-    register_list[register_index]);
-  return (register_index);
+static void emit_branch(char *opcode, int label) {
+  emit_machine_instruction(MACHINE_BRANCH, opcode, format_label_operand(label), NULL);
 }
 
-int register_invert(int register_index) {
-  fprintf(output_file, "\tnotq\t%s\n",
-    register_list[register_index]);
-  return (register_index);
+// 逐个比较 [low, high] 中的 case 值，都不相等时跳到 default
+static void switch_compare_chain(
+  char *r,
+  int *case_value,
+  int *case_label,
+  int low,
+  int high,
+  int label_default
+) {
+  int i;
+
+  for (i = low; i <= high; i++) {
+    emit_instruction("cmpq", format_immediate(case_value[i]), r);
+    emit_branch("je", case_label[i]);
+  }
+  emit_jump(label_default);
 }
 
-int register_shift_left(int left_register, int right_register) {
-  fprintf(output_file, "\tmovb\t%s, %%cl\n", lower_8_bits_register_list[right_register]);
-  fprintf(output_file, "\tshlq\t%%cl, %s\n", register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+// 对排好序的 [low, high] 做二分查找，剩下的 case 不多时改为逐个比较
+static void switch_binary_search(
+  char *r,
+  int *case_value,
+  int *case_label,
+  int low,
+  int high,
+  int label_default
+) {
+  int middle, label_low;
+
+  if (high - low + 1 < SWITCH_COMPARE_CHAIN_LIMIT) {
+    switch_compare_chain(r, case_value, case_label, low, high, label_default);
+    return;
+  }
+
+  middle = (low + high) / 2;
+  label_low = generate_label();
+  emit_instruction("cmpq", format_immediate(case_value[middle]), r);
+  emit_branch("je", case_label[middle]);
+  emit_branch("jl", label_low);
+  switch_binary_search(r, case_value, case_label, middle + 1, high, label_default);
+  emit_machine_label(label_low);
+  switch_binary_search(r, case_value, case_label, low, middle - 1, label_default);
 }
 
-int register_shift_right(int left_register, int right_register) {
-  fprintf(output_file, "\tmovb\t%s, %%cl\n", lower_8_bits_register_list[right_register]);
-  fprintf(output_file, "\tshrq\t%%cl, %s\n", register_list[left_register]);
-  register_clear_register(right_register);
-  return (left_register);
+// 跳转表中的一项，label 相对于表头的偏移
+static char *format_jump_table_entry(int label, int table_label) {
+  char *s = (char *) allocate_from_arena(function_arena, 32);
+
+  snprintf(s, 32, "L%d - L%d", label, table_label);
+  return (s);
 }
 
-int register_logic_not(int register_index) {
-  fprintf(output_file, "\ttest\t%s, %s\n", register_list[register_index], register_list[register_index]);
-  fprintf(output_file, "\tsete\t%s\n", lower_8_bits_register_list[register_index]);
-  fprintf(output_file, "\tmovzbq\t%s, %s\n", lower_8_bits_register_list[register_index], register_list[register_index]);
-  return (register_index);
+/**
+ * 通过跳转表分派
+ * 表中是各个 case label 相对于表头的偏移，和代码放在一起，不需要重定位
+ * 减去最小值之后做一次无符号比较，小于最小值和大于最大值都会跳到 default
+*/
+static void switch_jump_table(
+  char *r,
+  int *case_value,
+  int *case_label,
+  int case_count,
+  int label_default
+) {
+  int table_label = generate_label();
+  int low = case_value[0], high = case_value[case_count - 1];
+  int i = 0, value;
+
+  emit_instruction("movq", r, "%rax");
+  if (low) emit_instruction("subq", format_immediate(low), "%rax");
+  emit_instruction("cmpq", format_immediate(high - low), "%rax");
+  emit_branch("ja", label_default);
+  emit_instruction("leaq", format_symbol_text("%s(%%rip)", format_label_operand(table_label)), "%r11");
+  emit_instruction("movslq", "(%r11,%rax,4)", "%rax");
+  emit_instruction("addq", "%r11", "%rax");
+  emit_machine_instruction(MACHINE_JUMP, "jmp", "*%rax", NULL);
+
+  emit_machine_label(table_label);
+  for (value = low; value <= high; value++) {
+    if (case_value[i] == value) {
+      emit_machine_directive(".long", format_jump_table_entry(case_label[i], table_label));
+      i++;
+    } else {
+      emit_machine_directive(".long", format_jump_table_entry(label_default, table_label));
+    }
+  }
 }
 
-void register_load_boolean(int register_index, int value) {
-  fprintf(output_file, "\tmovq\t$%d, %s\n", value, register_list[register_index]);
+/**
+ * 根据 source1 的值跳转到对应的 case label
+ * case 很少时逐个比较，值比较密集时用跳转表，否则二分查找
+ * 排序用的是复制出来的数组，IR 中的数组保持原来的顺序
+*/
+static void emit_switch(struct IRInstruction *instruction) {
+  char *r = register_list[load_operand(instruction->source1, R11_REGISTER)];
+  int case_count = instruction->value, label_default = instruction->label;
+  int *sorted_value, *sorted_label;
+  long range;
+
+  if (case_count == 0) {
+    emit_jump(label_default);
+    return;
+  }
+
+  sorted_value = (int *) allocate_from_arena(function_arena, case_count * sizeof(int));
+  sorted_label = (int *) allocate_from_arena(function_arena, case_count * sizeof(int));
+  memcpy(sorted_value, instruction->case_value_list, case_count * sizeof(int));
+  memcpy(sorted_label, instruction->case_label_list, case_count * sizeof(int));
+  sort_switch_case(sorted_value, sorted_label, case_count);
+  range = sorted_value[case_count - 1];
+  range = range - sorted_value[0] + 1;
+
+  if (case_count < SWITCH_COMPARE_CHAIN_LIMIT)
+    switch_compare_chain(r, sorted_value, sorted_label, 0, case_count - 1, label_default);
+  else if (range <= case_count * SWITCH_JUMP_TABLE_DENSITY)
+    switch_jump_table(r, sorted_value, sorted_label, case_count, label_default);
+  else
+    switch_binary_search(r, sorted_value, sorted_label, 0, case_count - 1, label_default);
 }
 
-int register_to_be_boolean(int register_index, int operation, int label) {
-  char *r = register_list[register_index];
-  char *lower_r = lower_8_bits_register_list[register_index];
-  fprintf(output_file, "\ttest\t%s, %s\n", r, r);
-  switch (operation) {
-    case AST_IF:
-    case AST_WHILE:
-    case AST_LOGIC_AND:
-      fprintf(output_file, "\tje\tL%d\n", label);
+// 翻译一条 IR
+static void generate_instruction(struct IRInstruction *instruction) {
+  int r;
+
+  switch (instruction->operation) {
+    case IR_LABEL:
+      emit_machine_label(instruction->label);
+      break;
+    case IR_JUMP:
+      emit_jump(instruction->label);
+      break;
+    case IR_BRANCH:
+      emit_compare(instruction);
+      emit_branch(branch_list[instruction->condition - AST_COMPARE_EQUALS], instruction->label);
+      break;
+    case IR_SWITCH:
+      emit_switch(instruction);
+      break;
+    case IR_CONSTANT:
+      emit_instruction("movq", format_immediate(instruction->value), get_operand(instruction->destination, 8));
       break;
-    case AST_LOGIC_OR:
-      fprintf(output_file, "\tjne\tL%d\n", label);
+    case IR_STRING:
+      r = get_destination_register(instruction->destination, R11_REGISTER);
+      emit_instruction("leaq", format_symbol_text("%s(%%rip)", format_label_operand(instruction->value)), register_list[r]);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_ADDRESS:
+      r = get_destination_register(instruction->destination, R11_REGISTER);
+      emit_instruction("leaq", get_variable_operand(instruction->symbol), register_list[r]);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_COPY:
+      r = get_destination_register(instruction->destination, R11_REGISTER);
+      emit_extend(instruction->primitive_type, instruction->source1, r);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_LOAD_VARIABLE:
+      r = get_destination_register(instruction->destination, R11_REGISTER);
+      emit_instruction(
+        load_instruction_list[get_size_index(register_get_primitive_type_size(instruction->primitive_type))],
+        get_variable_operand(instruction->symbol),
+        register_list[r]);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_STORE_VARIABLE:
+      r = load_operand(instruction->source1, R11_REGISTER);
+      emit_instruction(
+        store_instruction_list[get_size_index(register_get_primitive_type_size(instruction->primitive_type))],
+        get_sized_register(r, register_get_primitive_type_size(instruction->primitive_type)),
+        get_variable_operand(instruction->symbol));
+      break;
+    case IR_LOAD:
+      emit_load(instruction);
+      break;
+    case IR_STORE:
+      emit_store(instruction);
+      break;
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+      if (instruction->source2 == NO_REGISTER) emit_binary_constant(instruction);
+      else emit_binary(instruction);
+      break;
+    case IR_DIVIDE:
+    case IR_MOD:
+      if (instruction->source2 == NO_REGISTER) emit_binary_constant(instruction);
+      else emit_divide_register(instruction);
+      break;
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+      if (instruction->source2 == NO_REGISTER) emit_binary_constant(instruction);
+      else emit_shift_register(instruction);
+      break;
+    case IR_NEGATE:
+      emit_unary("negq", instruction);
+      break;
+    case IR_INVERT:
+      emit_unary("notq", instruction);
+      break;
+    case IR_LOGIC_NOT:
+      emit_test_and_set("sete", instruction);
+      break;
+    case IR_TO_BOOLEAN:
+      emit_test_and_set("setne", instruction);
+      break;
+    case IR_COMPARE:
+      emit_compare(instruction);
+      emit_set(compare_list[instruction->condition - AST_COMPARE_EQUALS], instruction->destination);
+      break;
+    case IR_PARAMETER:
+      emit_parameter(instruction);
+      break;
+    case IR_ARGUMENT:
+      emit_argument(instruction);
+      break;
+    case IR_CALL:
+      emit_call(instruction);
+      break;
+    case IR_TAIL_CALL:
+      emit_tail_call(instruction);
+      break;
+    case IR_RETURN:
+      emit_return(instruction);
       break;
     default:
-      fprintf(output_file, "\tsetnz\t%s\n", lower_r);
-      fprintf(output_file, "\tmovzbq\t%s, %s\n", lower_r, r);
+      error_with_digital("Bad ir operation in generate_instruction:", instruction->operation);
   }
+}
+
+/**
+ * 把一个函数的 IR 翻译成机器指令记录，优化之后写入 output_file
+*/
+void register_generate_function(struct IRFunction *function) {
+  struct MachineInstruction *head;
+  int i;
 
-  return (register_index);
+  current_ir_function = function;
+  register_text_section_flag();
+  layout_frame(function);
+
+  start_machine_function();
+  emit_function_prologue(function->symbol);
+  for (i = 0; i < function->instruction_number; i++)
+    generate_instruction(function->instruction_list[i]);
+  emit_function_epilogue();
+  emit_machine_instruction(MACHINE_RETURN, "ret", NULL, NULL);
+
+  head = finish_machine_function();
+  head = peephole_optimise(head);
+  head = omit_frame_pointer(head);
+  print_machine_instructions(output_file, head);
+  current_ir_function = NULL;
 }
 
 void register_reset_local_variables() {
@@ -831,17 +1191,12 @@ void register_data_section_flag() {
   current_section_flag = DATA_SECTION_FLAG;
 }
 
-void register_copy_argument(int register_index, int argument_position) {
-  char *r = register_list[register_index];
-  if (argument_position > 6) {
-    fprintf(output_file, "\tpushq\t%s\n", r);
-  } else {
-    // 如果参数在 6 个以内，则用其他寄存器的值存这些参数
-    fprintf(output_file, "\tmovq\t%s, %s\n",
-      r,
-      register_list[FIRST_PARAMETER_REGISTER_NUMBER - argument_position + 1]);
-  }
-  register_clear_register(register_index);
+// static 的函数和变量只在当前文件中可见，不导出
+void register_symbol_visibility(struct SymbolTable *t) {
+  if (t->storage_class == STORAGE_CLASS_STATIC)
+    fprintf(output_file, "\t.local\t%s\n", t->name);
+  else
+    fprintf(output_file, "\t.globl\t%s\n", t->name);
 }
 
 int register_align(int primitive_type, int offset, int direction) {
@@ -859,43 +1214,3 @@ int register_align(int primitive_type, int offset, int direction) {
 
   return (offset);
 }
-
-
-void register_switch(
-  int register_index,
-  int case_count,
-  int label_jump_start,
-  int *case_label,
-  int *case_value,
-  int label_default
-) {
-  int i, label;
-
-  // 为 switch 表创建 label
-  label = generate_label();
-  register_label(label);
-
-  // 如果没有 case，创建一个指向 default case 的 case
-  if (case_count == 0) {
-    case_value[0] = 0;
-    case_label[0] = label_default;
-    case_count = 1;
-  }
-
-  // 创建 switch jump 表
-  fprintf(output_file, "\t.quad\t%d\n", case_count);
-  for (i = 0; i < case_count; i++)
-    fprintf(output_file, "\t.quad\t%d, L%d\n", case_value[i], case_label[i]);
-  fprintf(output_file, "\t.quad\tL%d\n", label_default);
-
-  register_label(label_jump_start);
-  fprintf(output_file, "\tmovq\t%s, %%rax\n", register_list[register_index]);
-  fprintf(output_file, "\tleaq\tL%d(%%rip), %%rdx\n", label);
-  fprintf(output_file, "\tjmp\t__switch\n");
-}
-
-void register_move(int left_register, int right_register) {
-  fprintf(output_file, "\tmovq\t%s, %s\n",
-    register_list[left_register],
-    register_list[right_register]);
-}
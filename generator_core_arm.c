@@ -1,450 +1,1196 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include "data.h"
 #include "definations.h"
 #include "helper.h"
+#include "generator.h"
 #include "generator_core.h"
+#include "types.h"
+#include "arena.h"
+#include "machine.h"
 
-// 把大 int 类型数值放入内存中，用一个数组保存起来
-// postamble 会用到
-#define MAX_INTEGER_NUMBER 1024
+// AArch64 后端
+// 和 x86-64 后端一样，按照寄存器分配的结果把一个函数的三地址 IR 翻译成机器指令记录，
+// 再写到 output_file，操作数按照 AArch64 的顺序，目标操作数在前
+// 窥孔优化和省略栈帧指针只认识 x86-64 的指令，这里不做
+// 放在栈槽中的虚拟寄存器通过 x16 和 x17 这两个临时寄存器读写，它们不参与分配
 
-int integer_list[MAX_INTEGER_NUMBER] = { 0 };
-static int integer_list_index = 0;
+// 可以分配给虚拟寄存器的寄存器个数，从 FIRST_CALLEE_SAVED_REGISTER 开始是 callee-saved
+#define ALLOCATABLE_REGISTER_NUMBER 26
+#define FIRST_CALLEE_SAVED_REGISTER 16
+// 传参用的寄存器个数
+#define ARGUMENT_REGISTER_NUMBER 8
+// 在 register_list 中的下标
+#define X16_REGISTER 26
+#define X17_REGISTER 27
+#define X29_REGISTER 28
 
-static int free_registers[4] = { 1 };
-static char *register_list[4] = { "r4", "r5", "r6", "r7" };
+enum {
+  NO_SECTION_FLAG,
+  TEXT_SECTION_FLAG,
+  DATA_SECTION_FLAG
+} current_section_flag = NO_SECTION_FLAG;
 
-static char *compare_list[] =
-  { "moveq", "movne", "movlt", "movgt", "movle", "movge" };
+// 前 8 个依次是传参的寄存器，第 position 个参数在 register_list[position - 1] 中
+// x18 是平台保留的寄存器，x29 和 x30 是栈基指针和返回地址，都不使用
+static char *register_list[] = {
+  "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7",
+  "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+  "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28",
+  "x16", "x17", "x29"
+}; // 64 位寄存器
+static char *lower_32_bits_register_list[] = {
+  "w0", "w1", "w2", "w3", "w4", "w5", "w6", "w7",
+  "w8", "w9", "w10", "w11", "w12", "w13", "w14", "w15",
+  "w19", "w20", "w21", "w22", "w23", "w24", "w25", "w26", "w27", "w28",
+  "w16", "w17", "w29"
+}; // 低 32 位寄存器
 
-static char *inverted_compare_list[] =
-  { "movne", "moveq", "movge", "movle", "movgt", "movlt" };
+static char *condition_list[] = { "eq", "ne", "lt", "gt", "le", "ge" };
 
-static char *inverted_branch_list[] =
-  { "bne", "beq", "bge", "ble", "bgt", "blt" };
+static char *branch_list[] = { "b.eq", "b.ne", "b.lt", "b.gt", "b.le", "b.ge" };
 
-// none/void/char/int/long
-static int primitive_size[] = { 0, 0, 1, 4, 4, 4, 4, 4 };
+// 按照 1/4/8 字节的宽度选择指令，ldrb 零扩展，ldrsw 符号扩展，和 x86-64 后端一致
+static char *load_instruction_list[] = { "ldrb", "ldrsw", "ldr" };
+static char *store_instruction_list[] = { "strb", "str", "str" };
 
-void clear_all_registers(NO_REGISTER) {
-  free_registers[0] = free_registers[1] = free_registers[2] = free_registers[3] = 1;
+// 当前函数的 IR
+static struct IRFunction *current_ir_function;
+
+// 相对于栈基指针的局部变量的位置
+static int local_offset;
+static int stack_offset;
+
+// 第 0 个栈槽的位置，第 i 个栈槽在它上面 8 * i 字节
+static int spill_slot_offset;
+
+// 寄存器在栈上保存的位置，没有用到时为 0
+// callee-saved 寄存器在函数开头和结尾保存和恢复，caller-saved 寄存器在调用前后
+static int save_offset_list[ALLOCATABLE_REGISTER_NUMBER];
+
+// 在栈上分配 size 字节，起始位置按 alignment 对齐
+static int register_new_local_offset(int size, int alignment) {
+  local_offset = (local_offset + size + alignment - 1) & ~(alignment - 1);
+  return (-local_offset);
 }
 
-/**
- * 分配一个寄存器，返回这个寄存器对应的下标
- * 如果已经没有寄存器分配，则抛出异常
-*/
-static int allocate_register() {
-  for (int i = 0; i < 4; i++) {
-    if (free_registers[i]) {
-      free_registers[i] = 0;
-      return (i);
-    }
-  }
+// 1/4/8 字节对应 *_instruction_list 中的下标
+static int get_size_index(int size) {
+  if (size == 1) return (0);
+  if (size == 4) return (1);
+  return (2);
+}
 
-  error("Out of registers");
-  return (NO_REGISTER);
+// 8 字节用 x 寄存器，char 和 int 用 w 寄存器
+static char *get_sized_register(int register_index, int size) {
+  if (size == 8) return (register_list[register_index]);
+  return (lower_32_bits_register_list[register_index]);
 }
 
-/**
- * 清空某个寄存器
-*/
-static void clear_register(int index) {
-  if (free_registers[index])
-    error_with_digital("Error trying to clear registers", index);
-  free_registers[index] = 1;
+// 读内存时写入的寄存器，ldrsw 要写 x 寄存器
+static char *get_load_register(int register_index, int size) {
+  if (size == 1) return (lower_32_bits_register_list[register_index]);
+  return (register_list[register_index]);
+}
+
+// 另一个临时寄存器
+static int get_other_scratch(int r) {
+  if (r == X16_REGISTER) return (X17_REGISTER);
+  return (X16_REGISTER);
+}
+
+static void emit_instruction(char *opcode, char *operand0, char *operand1) {
+  emit_machine_instruction(MACHINE_INSTRUCTION, opcode, operand0, operand1);
+}
+
+static void emit_instruction3(char *opcode, char *operand0, char *operand1, char *operand2) {
+  struct MachineInstruction *instruction =
+    emit_machine_instruction(MACHINE_INSTRUCTION, opcode, operand0, operand1);
+
+  instruction->operand_list[2] = operand2;
+  instruction->operand_number = 3;
+}
+
+static void emit_instruction4(
+  char *opcode,
+  char *operand0,
+  char *operand1,
+  char *operand2,
+  char *operand3
+) {
+  struct MachineInstruction *instruction =
+    emit_machine_instruction(MACHINE_INSTRUCTION, opcode, operand0, operand1);
+
+  instruction->operand_list[2] = operand2;
+  instruction->operand_list[3] = operand3;
+  instruction->operand_number = 4;
+}
+
+static char *format_immediate(long value) {
+  return (format_machine_text("#%ld", value));
+}
+
+// name 按照 format 格式化，结果放在 function_arena 中
+static char *format_symbol_text(char *format, char *name) {
+  int length = (int) strlen(format) + (int) strlen(name) + 1;
+  char *s = (char *) allocate_from_arena(function_arena, length);
+
+  snprintf(s, length, format, name);
+  return (s);
+}
+
+// [base, #offset] 形式的内存地址
+static char *format_address_operand(int base_register, long offset) {
+  char *s = (char *) allocate_from_arena(function_arena, 32);
+
+  if (offset) snprintf(s, 32, "[%s, #%ld]", register_list[base_register], offset);
+  else snprintf(s, 32, "[%s]", register_list[base_register]);
+  return (s);
+}
+
+// 左移了 shift 位的寄存器或者立即数，用在 add 和 movk 中
+static char *format_shifted_operand(char *operand, int shift) {
+  char *s = (char *) allocate_from_arena(function_arena, 32);
+
+  snprintf(s, 32, "%s, lsl #%d", operand, shift);
+  return (s);
 }
 
 /**
- * 设置大 int 型数值在 label 下的 offset
+ * 把一个 64 位的常量放入寄存器
+ * 能用一条 mov 表示的直接 mov，否则 movz 放入低 16 位，再用 movk 依次填上不为 0 的 16 位
 */
-static void set_large_integer_offset(int value) {
-  int offset = -1;
-  for (int i = 0; i < integer_list_index; i++) {
-    if (value == integer_list[i]) {
-      offset = i * 4;
-      break;
-    }
+static void emit_move_immediate(int r, long value) {
+  char *name = register_list[r];
+  long chunk;
+  int shift;
+
+  if (value >= -65536 && value <= 65535) {
+    emit_instruction("mov", name, format_immediate(value));
+    return;
   }
-  // 如果不在列表中，则直接加入
-  if (offset < 0) {
-    offset = integer_list_index * 4;
-    if (integer_list_index == MAX_INTEGER_NUMBER)
-      error("Out of max integer number in set_large_integer_offset()");
-    integer_list[integer_list_index++] = value;
+  emit_instruction("movz", name, format_immediate(value & 65535));
+  for (shift = 16; shift < 64; shift = shift + 16) {
+    chunk = (value >> shift) & 65535;
+    if (chunk)
+      emit_instruction("movk", name, format_shifted_operand(format_immediate(chunk), shift));
   }
-  // 用 offset 写入 r3 这个寄存器
-  fprintf(output_file, "\tldr\tr3, .L3+%d\n", offset);
 }
 
 /**
- * 设置变量在 label 下的 offset
+ * destination = source + value
+ * add/sub 的立即数只有 12 位，超出时先把 value 放入 x17，destination 和 source 不能是 x17
 */
-static void set_variable_offset(int symbol_table_index) {
-  int offset = 0;
-  for (int i = 0; i < symbol_table_index; i++) {
-    if (symbol_table[i].structural_type == STRUCTURAL_VARIABLE)
-      offset += 4;
+static void emit_add_immediate(int destination, int source, long value) {
+  if (value >= 0 && value < 4096) {
+    emit_instruction3("add", register_list[destination], register_list[source], format_immediate(value));
+  } else if (value < 0 && value > -4096) {
+    emit_instruction3("sub", register_list[destination], register_list[source], format_immediate(-value));
+  } else {
+    emit_move_immediate(X17_REGISTER, value);
+    emit_instruction3("add", register_list[destination], register_list[source], "x17");
   }
-  // 用 offset 写入 r3 这个寄存器
-  fprintf(output_file, "\tldr\tr3, .L2+%d\n", offset);
+}
+
+/**
+ * 相对于栈基指针 x29 的内存地址
+ * ldur/stur 的偏移只有 -256 到 255，超出时先把地址算到 scratch 中
+*/
+static char *get_frame_operand(int offset, int scratch) {
+  if (offset >= -256 && offset <= 255) return (format_address_operand(X29_REGISTER, offset));
+  emit_move_immediate(scratch, offset);
+  emit_instruction3("add", register_list[scratch], "x29", register_list[scratch]);
+  return (format_address_operand(scratch, 0));
+}
+
+static int get_assigned_register(int register_index) {
+  return (current_ir_function->register_assignment[register_index]);
+}
+
+// 放在栈槽中的虚拟寄存器的位置，地址需要计算时用 scratch
+static char *get_spill_operand(int register_index, int scratch) {
+  return (get_frame_operand(spill_slot_offset + 8 * current_ir_function->spill_slot_list[register_index], scratch));
+}
+
+// 把虚拟寄存器的值放进一个寄存器中，返回这个寄存器，在栈槽中时先读到 scratch
+static int load_operand(int register_index, int scratch) {
+  int r = get_assigned_register(register_index);
+
+  if (r != NO_REGISTER) return (r);
+  emit_instruction("ldr", register_list[scratch], get_spill_operand(register_index, scratch));
+  return (scratch);
+}
+
+// 计算虚拟寄存器的值时使用的寄存器，放在栈槽中时先算到 scratch 中
+static int get_destination_register(int register_index, int scratch) {
+  int r = get_assigned_register(register_index);
+
+  if (r != NO_REGISTER) return (r);
+  return (scratch);
+}
+
+// 值已经算到了寄存器 r 中，再放到虚拟寄存器真正的位置
+static void store_destination(int register_index, int r) {
+  int destination = get_assigned_register(register_index);
+
+  if (destination == r) return;
+  if (destination != NO_REGISTER)
+    emit_instruction("mov", register_list[destination], register_list[r]);
+  else
+    emit_instruction("str", register_list[r], get_spill_operand(register_index, get_other_scratch(r)));
 }
 
 /**
  * 汇编前置代码，写入到 output_file 中
 */
 void register_preamble() {
-  clear_all_registers(NO_REGISTER);
-  fputs("\t.text\n", output_file);
+  // 上一个文件结束时的节和这个文件无关
+  current_section_flag = NO_SECTION_FLAG;
+  register_text_section_flag();
 }
 
 /**
  * 汇编后置代码，写入到 output_file 中
 */
 void register_postamble() {
-  fprintf(output_file, ".L2:\n");
-  for (int i = 0; i < global_symbol_table_index; i++) {
-    if (symbol_table[i].structural_type == STRUCTURAL_VARIABLE)
-      fprintf(output_file, "\t.word %s\n", symbol_table[i].name);
+}
+
+// 全局变量的初始值和字符串直接写入 output_file
+static void register_label(int label) {
+  fprintf(output_file, "L%d:\n", label);
+}
+
+/**
+ * 创建全局变量
+*/
+void register_generate_global_symbol(struct SymbolTable *t) {
+  int primitive_type,
+      primitive_type_size,
+      init_value,
+      i, j;
+  if (t == NULL)
+    return;
+  if (t->structural_type == STRUCTURAL_FUNCTION)
+    return;
+
+  // 区分是数组还是普通变量
+  if (t->structural_type == STRUCTURAL_ARRAY) {
+    // 数组跟指针一样，所以要 value_at 取得其 primitive_type
+    primitive_type = value_at(t->primitive_type);
+    primitive_type_size = get_primitive_type_size(primitive_type, t->composite_type);
+  } else {
+    primitive_type = t->primitive_type;
+    primitive_type_size = t->size;
   }
-  fprintf(output_file, ".L3:\n");
-  for (int i = 0; i < integer_list_index; i++) {
-    fprintf(output_file, "\t.word %d\n", integer_list[i]);
+
+  register_data_section_flag();
+  register_symbol_visibility(t);
+  fprintf(output_file, "%s:\n", t->name);
+  for (i = 0; i < t->element_number; i++) {
+    init_value = 0;
+    if (t->init_value_list)
+      init_value = t->init_value_list[i];
+
+    switch(primitive_type_size) {
+      case 1: fprintf(output_file, "\t.byte\t%d\n", init_value); break;
+      case 4: fprintf(output_file, "\t.long\t%d\n", init_value); break;
+      case 8:
+        // char *s = "..." 的初始值是字符串的 label
+        if (
+          t->init_value_list &&
+          primitive_type == pointer_to(PRIMITIVE_CHAR) &&
+          init_value != 0
+        ) {
+          fprintf(output_file, "\t.quad\tL%d\n", init_value);
+        } else {
+          fprintf(output_file, "\t.quad\t%d\n", init_value);
+        }
+        break;
+      default:
+        for (j = 0; j < primitive_type_size; j++)
+          fprintf(output_file, "\t.byte\t0\n");
+    }
   }
 }
 
 /**
- * 把 value 放入某个寄存器中，并返回该寄存器的下标
+ * 创建全局字符串
 */
-int register_load_interger_literal(int value, int primitive_type) {
-  int register_index = allocate_register();
-  if (value <= 1000)
-    fprintf(output_file, "\tmov\t%s, #%d\n", register_list[register_index], value);
-  else {
-    set_large_integer_offset(value);
-    fprintf(output_file, "\tldr\t%s, [r3]\n", register_list[register_index]);
+void register_generate_global_string(
+  int label,
+  char *string_value,
+  int is_append_string
+) {
+  char *p;
+  if (!is_append_string) register_label(label);
+  for (p = string_value; *p; p++) {
+    fprintf(output_file, "\t.byte\t%d\n", *p);
   }
-  return (register_index);
+}
+
+void register_generate_global_string_end() {
+  fprintf(output_file, "\t.byte\t0\n");
 }
 
 /**
- * 两个寄存器相加，并将其放入其中一个寄存器中
+ * 给定一个 primitive type，返回其对应的字节数
 */
-int register_plus(int left_register, int right_register) {
-  fprintf(output_file,
-    "\tadd\t%s, %s, %s\n",
-    register_list[right_register],
-    register_list[left_register],
-    register_list[right_register]);
-  clear_register(left_register);
-  return (right_register);
+int register_get_primitive_type_size(int primitive_type) {
+  if (check_pointer_type(primitive_type)) return 8;
+  switch (primitive_type) {
+    case PRIMITIVE_CHAR: return 1;
+    case PRIMITIVE_INT: return 4;
+    case PRIMITIVE_LONG: return 8;
+    default:
+      error_with_digital("Bad type in register_get_primitive_type_size()", primitive_type);
+  }
+  return 0;
+}
+
+// 寄存器分配的结果中寄存器的名字，-L 时输出
+char *register_get_register_name(int register_index) {
+  return (register_list[register_index]);
+}
+
+// 集成汇编器只认识 x86-64 的指令，生成的汇编交给外部的汇编器
+int register_use_integrated_assembler() {
+  return (0);
+}
+
+int register_get_argument_register_number() {
+  return (ARGUMENT_REGISTER_NUMBER);
+}
+
+// 寄存器分配可以使用 register_list 中的前这么多个寄存器
+int register_get_allocatable_register_number() {
+  return (ALLOCATABLE_REGISTER_NUMBER);
+}
+
+int register_check_callee_saved(int register_index) {
+  return (register_index >= FIRST_CALLEE_SAVED_REGISTER);
+}
+
+// 第 position 个参数所在的寄存器，在栈上时返回 NO_REGISTER
+int register_get_argument_register(int position) {
+  if (position <= ARGUMENT_REGISTER_NUMBER) return (position - 1);
+  return (NO_REGISTER);
+}
+
+// 翻译这条指令时会改掉的可分配的寄存器，返回值要放入 x0
+int register_get_clobbered_register(struct IRInstruction *instruction) {
+  if (instruction->operation == IR_RETURN) return (0);
+  return (NO_REGISTER);
+}
+
+// 变量在栈上的对齐：标量按自己的宽度，数组按元素的宽度，结构体和联合体按 8 字节
+static int get_frame_variable_alignment(struct SymbolTable *t) {
+  int primitive_type = t->primitive_type;
+
+  if (t->structural_type == STRUCTURAL_ARRAY) primitive_type = value_at(primitive_type);
+  if (check_int_type(primitive_type) || check_pointer_type(primitive_type))
+    return (register_get_primitive_type_size(primitive_type));
+  return (8);
 }
 
 /**
- * 两个寄存器相减，并将其放入其中一个寄存器中
+ * 给不在虚拟寄存器中的前 8 个参数和局部变量分配栈上的位置
+ * 超过 8 个参数寄存器的参数已经在调用者的栈上了，在保存的 x29 和 x30 上面
 */
-int register_minus(int left_register, int right_register) {
-  fprintf(output_file,
-    "\tsub\t%s, %s, %s\n",
-    register_list[left_register],
-    register_list[left_register],
-    register_list[right_register]);
-  clear_register(right_register);
-  return (left_register);
+static void layout_frame_variables(struct SymbolTable *function) {
+  struct SymbolTable *t;
+  int i, alignment;
+
+  for (t = function->member, i = 1; t; t = t->next, i++) {
+    if (i > ARGUMENT_REGISTER_NUMBER) t->symbol_table_position = 16 + 8 * (i - ARGUMENT_REGISTER_NUMBER - 1);
+  }
+
+  for (alignment = 8; alignment > 0; alignment = alignment / 2) {
+    for (t = function->member, i = 1; t && i <= ARGUMENT_REGISTER_NUMBER; t = t->next, i++) {
+      if (!t->variable_register && get_frame_variable_alignment(t) == alignment)
+        t->symbol_table_position = register_new_local_offset(t->size, alignment);
+    }
+    for (t = local_head; t; t = t->next) {
+      if (!t->variable_register && get_frame_variable_alignment(t) == alignment)
+        t->symbol_table_position = register_new_local_offset(t->size, alignment);
+    }
+  }
 }
 
 /**
- * 两个寄存器相乘，并将其放入其中一个寄存器中
+ * 给函数的栈帧分配位置：
+ * 用到的 callee-saved 寄存器、调用前后要保存的 caller-saved 寄存器、
+ * 寄存器分配用的栈槽、不在虚拟寄存器中的变量
+ * 栈槽放在变量前面，离 x29 近，读写时更容易用一条 ldur/stur
 */
-int register_multiply(int left_register, int right_register) {
-  fprintf(output_file,
-    "\tmul\t%s, %s, %s\n",
-    register_list[right_register],
-    register_list[left_register],
-    register_list[right_register]);
-  clear_register(left_register);
-  return (right_register);
+static void layout_frame(struct IRFunction *function) {
+  int i, r, save_mask = 0;
+
+  local_offset = 0;
+  for (i = 0; i < ALLOCATABLE_REGISTER_NUMBER; i++) save_offset_list[i] = 0;
+  for (i = 1; i < function->register_number; i++) {
+    r = function->register_assignment[i];
+    if (r >= FIRST_CALLEE_SAVED_REGISTER && !save_offset_list[r])
+      save_offset_list[r] = register_new_local_offset(8, 8);
+  }
+  for (i = 0; i < function->instruction_number; i++)
+    save_mask = save_mask | function->instruction_list[i]->save_register_mask;
+  for (r = 0; r < FIRST_CALLEE_SAVED_REGISTER; r++) {
+    if ((save_mask >> r) & 1) save_offset_list[r] = register_new_local_offset(8, 8);
+  }
+
+  spill_slot_offset = 0;
+  if (function->spill_slot_number)
+    spill_slot_offset = register_new_local_offset(8 * function->spill_slot_number, 8);
+
+  layout_frame_variables(function->symbol);
+
+  // sp 必须是 16 的倍数
+  stack_offset = (local_offset + 15) & (~15);
+}
+
+// sp = sp + value，sp 只能和 x 寄存器做扩展形式的加减，大的立即数先放入 x16
+static void emit_adjust_stack(long value) {
+  if (value == 0) return;
+  if (value > 0 && value < 4096) {
+    emit_instruction3("add", "sp", "sp", format_immediate(value));
+  } else if (value < 0 && value > -4096) {
+    emit_instruction3("sub", "sp", "sp", format_immediate(-value));
+  } else {
+    emit_move_immediate(X16_REGISTER, value);
+    emit_instruction3("add", "sp", "sp", "x16");
+  }
+}
+
+static void emit_function_prologue(struct SymbolTable *t) {
+  int i;
+
+  if (t->storage_class == STORAGE_CLASS_STATIC)
+    emit_machine_directive(".local", t->name);
+  else
+    emit_machine_directive(".globl", t->name);
+  emit_machine_directive(".type", format_symbol_text("%s, %%function", t->name));
+  // 字符串也放在 .text 中，指令要重新按 4 字节对齐
+  emit_machine_directive(".p2align", "2");
+  emit_machine_instruction(MACHINE_LABEL, t->name, NULL, NULL);
+  emit_instruction("stp", "x29, x30", "[sp, #-16]!");
+  emit_instruction("mov", "x29", "sp");
+  // 没有 red zone，先移动 sp 再保存 callee-saved 寄存器
+  emit_adjust_stack(-stack_offset);
+  for (i = FIRST_CALLEE_SAVED_REGISTER; i < ALLOCATABLE_REGISTER_NUMBER; i++) {
+    if (save_offset_list[i])
+      emit_instruction("str", register_list[i], get_frame_operand(save_offset_list[i], X16_REGISTER));
+  }
+}
+
+// 恢复 callee-saved 寄存器和调用者的栈帧，之后 x30 是返回地址
+static void emit_function_epilogue() {
+  int i;
+
+  for (i = FIRST_CALLEE_SAVED_REGISTER; i < ALLOCATABLE_REGISTER_NUMBER; i++) {
+    if (save_offset_list[i])
+      emit_instruction("ldr", register_list[i], get_frame_operand(save_offset_list[i], X16_REGISTER));
+  }
+  emit_instruction("mov", "sp", "x29");
+  emit_instruction("ldp", "x29, x30", "[sp], #16");
+}
+
+static int check_frame_variable(struct SymbolTable *t) {
+  return (t->storage_class == STORAGE_CLASS_LOCAL ||
+          t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER);
+}
+
+// 变量作为内存操作数，全局变量的页地址先放入 scratch
+static char *get_variable_operand(struct SymbolTable *t, int scratch) {
+  if (check_frame_variable(t)) return (get_frame_operand(t->symbol_table_position, scratch));
+  emit_instruction("adrp", register_list[scratch], t->name);
+  return (format_symbol_text(
+    format_symbol_text("[%s, :lo12:%%s]", register_list[scratch]),
+    t->name));
+}
+
+// 符号 name 的地址放入寄存器 r
+static void emit_symbol_address(int r, char *name) {
+  emit_instruction("adrp", register_list[r], name);
+  emit_instruction3("add", register_list[r], register_list[r], format_symbol_text(":lo12:%s", name));
 }
 
 /**
- * 两个寄存器相除，这里处理比较麻烦
- * 先把值放入 rax 寄存器
- * 进行除法运算后，再从 rax 寄存器中把结果拿出来，放入 left_register
+ * 调用或者跳转到函数 t，opcode 是 bl 或者 b
+ * 外部函数交给链接器经过 PLT，-fno-plt 时从 GOT 中取出地址放入 x16 再跳转
 */
-int register_divide(int left_register, int right_register) {
-  fprintf(output_file, "\tmov\tr0, %s\n", register_list[left_register]);
-  fprintf(output_file, "\tmov\tr1, %s\n", register_list[right_register]);
-  fprintf(output_file, "\tbl\t__aeabi_idiv\n");
-  fprintf(output_file, "\tmov\t%s, r0\n", register_list[left_register]);
-  clear_register(right_register);
-  return (left_register);
+static void emit_function_transfer(int kind, char *opcode, struct SymbolTable *t) {
+  if (no_plt && !t->is_defined && t->storage_class != STORAGE_CLASS_STATIC) {
+    emit_instruction("adrp", "x16", format_symbol_text(":got:%s", t->name));
+    emit_instruction("ldr", "x16", format_symbol_text("[x16, :got_lo12:%s]", t->name));
+    if (kind == MACHINE_CALL) emit_machine_instruction(MACHINE_CALL, "blr", "x16", NULL);
+    else emit_machine_instruction(MACHINE_JUMP, "br", "x16", NULL);
+    return;
+  }
+  emit_machine_instruction(kind, opcode, t->name, NULL);
 }
 
 /**
- * 打印指定的寄存器
+ * 按照 primitive_type 的宽度把寄存器 source 扩展成 64 位，放入寄存器 r
+ * char 零扩展，int 符号扩展，和读内存时一样
 */
-void register_print(int register_index) {
-  fprintf(output_file, "\tmov\tr0, %s\n", register_list[register_index]);
-  fprintf(output_file, "\tbl\tregister_print\n");
-  fprintf(output_file, "\tnop\n");
-  clear_register(register_index);
+static void emit_extend_register(int primitive_type, int source, int r) {
+  int size = register_get_primitive_type_size(primitive_type);
+
+  if (size == 1)
+    emit_instruction("uxtb", lower_32_bits_register_list[r], lower_32_bits_register_list[source]);
+  else if (size == 4)
+    emit_instruction("sxtw", register_list[r], lower_32_bits_register_list[source]);
+  else if (r != source)
+    emit_instruction("mov", register_list[r], register_list[source]);
+}
+
+// 把虚拟寄存器 source 扩展成 64 位放入 r，在栈槽中时直接按宽度读出来
+static void emit_extend(int primitive_type, int source, int r) {
+  int size = register_get_primitive_type_size(primitive_type);
+  int s = get_assigned_register(source);
+
+  if (s != NO_REGISTER) {
+    emit_extend_register(primitive_type, s, r);
+    return;
+  }
+  emit_instruction(load_instruction_list[get_size_index(size)],
+    get_load_register(r, size), get_spill_operand(source, r));
 }
 
 /**
- * 将一个变量的值保存到寄存器中
+ * 寄存器 operand 和立即数比较，超出 12 位时先把 value 放入 x17
 */
-int register_load_value_from_variable(int symbol_table_index) {
-  int register_index = allocate_register();
-  set_variable_offset(symbol_table_index);
-  fprintf(output_file, "\tldr\t%s, [r3]\n", register_list[register_index]);
-  return (register_index);
+static void emit_compare_immediate(char *operand, long value, int size) {
+  if (value >= 0 && value < 4096) {
+    emit_instruction("cmp", operand, format_immediate(value));
+  } else if (value < 0 && value > -4096) {
+    emit_instruction("cmn", operand, format_immediate(-value));
+  } else {
+    emit_move_immediate(X17_REGISTER, value);
+    emit_instruction("cmp", operand, get_sized_register(X17_REGISTER, size));
+  }
 }
 
 /**
- * 将寄存器中的值保存到一个变量中
+ * 按照类型的宽度比较 source1 和 source2，source2 为 NO_REGISTER 时和立即数比较
+ * 没有按字节比较的指令，char 先符号扩展到 32 位，和 x86-64 的 cmpb 结果相同
 */
-int register_store_value_2_variable(int register_index, int symbol_table_index) {
-  struct SymbolTable t = symbol_table[symbol_table_index];
-  set_variable_offset(symbol_table_index);
-  switch (t.primitive_type) {
-    case PRIMITIVE_CHAR:
-      fprintf(output_file, "\tstrb\t%s, [r3]\n",
-       register_list[register_index]);
-      break;
-    case PRIMITIVE_INT:
-    case PRIMITIVE_LONG:
-    case PRIMITIVE_CHAR_POINTER:
-    case PRIMITIVE_INT_POINTER:
-    case PRIMITIVE_LONG_POINTER:
-      fprintf(output_file, "\tstr\t%s, [r3]\n",
-      register_list[register_index]);
-      break;
-    default:
-      error_with_digital("Bad type in register_store_value_2_variable:", t.primitive_type);
+static void emit_compare(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int r = load_operand(instruction->source1, X16_REGISTER), s;
+  long value = instruction->value;
+  char *operand = get_sized_register(r, size);
+
+  if (size == 1) {
+    emit_instruction("sxtb", "w16", operand);
+    operand = "w16";
   }
-  return register_index;
+
+  if (instruction->source2 == NO_REGISTER) {
+    if (size == 1) {
+      value = value & 255;
+      if (value > 127) value = value - 256;
+    }
+    emit_compare_immediate(operand, value, size);
+    return;
+  }
+  s = load_operand(instruction->source2, X17_REGISTER);
+  if (size == 1)
+    emit_instruction3("cmp", operand, lower_32_bits_register_list[s], "sxtb");
+  else
+    emit_instruction("cmp", operand, get_sized_register(s, size));
+}
+
+// 把比较的结果变成 0 或者 1
+static void emit_set(char *condition, int destination) {
+  int r = get_destination_register(destination, X16_REGISTER);
+
+  emit_instruction("cset", register_list[r], condition);
+  store_destination(destination, r);
+}
+
+// + - * & | ^ << >> / 对应的指令
+static char *get_operation_instruction(int operation) {
+  switch (operation) {
+    case IR_ADD: return ("add");
+    case IR_SUBTRACT: return ("sub");
+    case IR_MULTIPLY: return ("mul");
+    case IR_DIVIDE: return ("sdiv");
+    case IR_AND: return ("and");
+    case IR_OR: return ("orr");
+    case IR_XOR: return ("eor");
+    case IR_SHIFT_LEFT: return ("lsl");
+    case IR_SHIFT_RIGHT: return ("lsr");
+  }
+  error_with_digital("Bad ir operation for an instruction:", operation);
+  return (NULL);
 }
 
 /**
- * 创建全局变量
+ * r = source1 % 除数，除数已经在寄存器 divisor 中
+ * 余数是 source1 - (source1 / divisor) * divisor，
+ * source1 也在 x16 中时商会把它覆盖，算完乘积之后再读一次
 */
-void register_generate_global_symbol(int symbol_table_index) {
-  struct SymbolTable t = symbol_table[symbol_table_index];
-  int primitive_type_size
-    = register_get_primitive_type_size(t.primitive_type);
-  fprintf(output_file, "\t.data\n" "\t.globl\t%s\n", t.name);
-  fprintf(output_file, "%s:", t.name);
-  for (int i = 0; i < t.size; i++) {
-    switch(primitive_type_size) {
-      case 1: fprintf(output_file, "\t.byte\t0\n"); break;
-      case 4: fprintf(output_file, "\t.long\t0\n"); break;
-      default: fatald("Unknown typesize in register_generate_global_symbol: ", primitive_type_size);
-    }
+static void emit_modulo(struct IRInstruction *instruction, int divisor, int r) {
+  int dividend = load_operand(instruction->source1, X16_REGISTER);
+
+  if (dividend != X16_REGISTER) {
+    emit_instruction3("sdiv", "x16", register_list[dividend], register_list[divisor]);
+    emit_instruction4("msub", register_list[r], "x16", register_list[divisor], register_list[dividend]);
+    return;
   }
+  emit_instruction3("sdiv", "x16", "x16", register_list[divisor]);
+  emit_instruction3("mul", "x16", "x16", register_list[divisor]);
+  dividend = load_operand(instruction->source1, X17_REGISTER);
+  emit_instruction3("sub", register_list[r], register_list[dividend], "x16");
 }
 
 /**
- * 创建全局字符串
+ * destination = source1 op source2，三个操作数的指令不用担心寄存器重叠
 */
-void register_generate_global_string(int label, char *string_value) {
-  register_label(label);
-  for (char *p = string_value; *p; p++) {
-    fprintf(output_file, "\t.byte\t%d\n", *p);
+static void emit_binary(struct IRInstruction *instruction) {
+  int r = get_destination_register(instruction->destination, X16_REGISTER);
+  int s1, s2;
+
+  if (instruction->operation == IR_MOD) {
+    emit_modulo(instruction, load_operand(instruction->source2, X17_REGISTER), r);
+  } else {
+    s1 = load_operand(instruction->source1, X16_REGISTER);
+    s2 = load_operand(instruction->source2, X17_REGISTER);
+    emit_instruction3(get_operation_instruction(instruction->operation),
+      register_list[r], register_list[s1], register_list[s2]);
   }
-  fprintf(output_file, "\t.byte\t0\n");
+  store_destination(instruction->destination, r);
+}
+
+// 如果 value 是 2 的 n 次方，返回 n，否则返回 -1
+static int get_power_of_two(long value) {
+  int n = 0;
+
+  if (value <= 0) return (-1);
+  while (!(value & 1)) {
+    value = value >> 1;
+    n++;
+  }
+  if (value != 1) return (-1);
+  return (n);
 }
 
 /**
- * 比较两寄存器，如果是 true 则进行 set
+ * destination = source1 op value
+ * 加减用 12 位的立即数，乘以 2 的 n 次方和移位用立即数移位，
+ * 其余的先把 value 放入 x17，再按两个寄存器计算
 */
-int register_compare_and_set(
-  int ast_operation,
-  int register_left,
-  int register_right
-) {
-  if (ast_operation < AST_COMPARE_EQUALS
-    || ast_operation > AST_COMPARE_GREATER_EQUALS)
-    error("Bad ast operaion in register_compare_and_set function");
+static void emit_binary_constant(struct IRInstruction *instruction) {
+  int operation = instruction->operation, r, s, shift;
+  long value = instruction->value;
 
-  fprintf(output_file, "\tcmp\t%s, %s\n",
-    register_list[register_right],
-    register_list[register_left]);
+  r = get_destination_register(instruction->destination, X16_REGISTER);
+  if (operation == IR_MOD) {
+    emit_move_immediate(X17_REGISTER, value);
+    emit_modulo(instruction, X17_REGISTER, r);
+    store_destination(instruction->destination, r);
+    return;
+  }
 
-  fprintf(output_file, "\t%s\t%s, #1\n",
-    compare_list[ast_operation - AST_COMPARE_EQUALS],
-    register_list[register_right]);
+  s = load_operand(instruction->source1, X16_REGISTER);
+  if (operation == IR_SUBTRACT) {
+    operation = IR_ADD;
+    value = -value;
+  }
+  shift = -1;
+  if (operation == IR_MULTIPLY) shift = get_power_of_two(value);
 
-  fprintf(output_file, "\t%s\t%s, #0\n",
-    inverted_compare_list[ast_operation - AST_COMPARE_EQUALS],
-    register_list[register_right]);
+  if (operation == IR_ADD) {
+    emit_add_immediate(r, s, value);
+  } else if (operation == IR_SHIFT_LEFT || operation == IR_SHIFT_RIGHT) {
+    emit_instruction3(get_operation_instruction(operation),
+      register_list[r], register_list[s], format_immediate(value & 63));
+  } else if (shift >= 0) {
+    emit_instruction3("lsl", register_list[r], register_list[s], format_immediate(shift));
+  } else {
+    emit_move_immediate(X17_REGISTER, value);
+    emit_instruction3(get_operation_instruction(operation), register_list[r], register_list[s], "x17");
+  }
+  store_destination(instruction->destination, r);
+}
 
-  fprintf(output_file, "\tuxtb\t%s, %s\n",
-    register_list[register_right],
-    register_list[register_right]);
+// neg 和 mvn
+static void emit_unary(char *opcode, struct IRInstruction *instruction) {
+  int r = get_destination_register(instruction->destination, X16_REGISTER);
+  int s = load_operand(instruction->source1, X16_REGISTER);
 
-  clear_register(register_left);
-  return register_right;
+  emit_instruction(opcode, register_list[r], register_list[s]);
+  store_destination(instruction->destination, r);
+}
+
+// 值为 0 时 eq 得到 1，ne 得到 0
+static void emit_test_and_set(char *condition, struct IRInstruction *instruction) {
+  int r = load_operand(instruction->source1, X16_REGISTER);
+
+  emit_instruction("cmp", register_list[r], "#0");
+  emit_set(condition, instruction->destination);
 }
 
 /**
- * 比较俩寄存器，如果是 false 则进行 jmp
+ * 读写 value(base, index, scale) 时的内存操作数
+ * 有下标或者偏移超出 ldur 的范围时，地址先算到 x16 中，x17 只在计算时临时使用
 */
-int register_compare_and_jump(
-  int ast_operation,
-  int register_left,
-  int register_right,
-  int label
-) {
-  if (ast_operation < AST_COMPARE_EQUALS
-    || ast_operation > AST_COMPARE_GREATER_EQUALS)
-    error("Bad ast operaion in register_compare_and_jump function");
+static char *get_memory_operand(struct IRInstruction *instruction) {
+  int base = load_operand(instruction->source1, X16_REGISTER), index;
+  long offset = instruction->value;
+
+  if (instruction->index != NO_REGISTER) {
+    index = load_operand(instruction->index, X17_REGISTER);
+    emit_instruction3("add", "x16", register_list[base],
+      format_shifted_operand(register_list[index], get_power_of_two(instruction->scale)));
+    base = X16_REGISTER;
+  }
+  if (offset >= -256 && offset <= 255) return (format_address_operand(base, offset));
+  emit_move_immediate(X17_REGISTER, offset);
+  emit_instruction3("add", "x16", register_list[base], "x17");
+  return (format_address_operand(X16_REGISTER, 0));
+}
 
-  fprintf(output_file, "\tcmp\t%s, %s\n",
-    register_list[register_left],
-    register_list[register_right]);
-  fprintf(output_file, "\t%s\tL%d\n",
-    inverted_branch_list[ast_operation - AST_COMPARE_EQUALS],
-    label);
+static void emit_load(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  char *operand = get_memory_operand(instruction);
+  int r = get_destination_register(instruction->destination, X16_REGISTER);
 
-  clear_all_registers(NO_REGISTER);
-  return NO_REGISTER;
+  emit_instruction(load_instruction_list[get_size_index(size)], get_load_register(r, size), operand);
+  store_destination(instruction->destination, r);
 }
 
-/**
- * 创建 label
-*/
-void register_label(int label) {
-  fprintf(output_file, "L%d:\n", label);
+// 地址只会留在 x16 或者 base 的寄存器中，写入的值在栈槽中时读到 x17
+static void emit_store(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  char *operand = get_memory_operand(instruction);
+  int r = load_operand(instruction->source2, X17_REGISTER);
+
+  emit_instruction(store_instruction_list[get_size_index(size)], get_sized_register(r, size), operand);
 }
 
-/**
- * 创建一个跳到 label 的 jmp
-*/
-void register_jump(int label) {
-  fprintf(output_file, "\tb\tL%d\n", label);
+// destination = 第 index 个参数，按照参数的类型扩展成 64 位
+static void emit_parameter(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int r = get_destination_register(instruction->destination, X16_REGISTER);
+  int position = instruction->index;
+
+  if (position <= ARGUMENT_REGISTER_NUMBER)
+    emit_extend_register(instruction->primitive_type, position - 1, r);
+  else
+    emit_instruction(load_instruction_list[get_size_index(size)], get_load_register(r, size),
+      get_frame_operand(16 + 8 * (position - ARGUMENT_REGISTER_NUMBER - 1), r));
+  store_destination(instruction->destination, r);
 }
 
-/**
- * 解析函数定义的前置汇编代码
-*/
-void register_function_preamble(int symbol_table_index) {
-  char *name = symbol_table[symbol_table_index].name;
-  fprintf(output_file,
-          "\t.text\n"
-          "\t.globl\t%s\n"
-          "\t.type\t%s, %%function\n"
-          "%s:\n" "\tpush\t{fp, lr}\n"
-          "\tadd\tfp, sp, #4\n"
-          "\tsub\tsp, sp, #8\n"
-          "\tstr\tr0, [fp, #-8]\n",
-            name, name, name);
+// 在栈上传的参数占用的字节数，保持 sp 16 字节对齐
+static int get_stack_argument_size(int argument_number) {
+  int n = argument_number - ARGUMENT_REGISTER_NUMBER;
+
+  if (n <= 0) return (0);
+  return (8 * (n + (n & 1)));
 }
 
 /**
- * 解析函数定义的后置汇编代码
+ * 第 index 个参数放入传参的寄存器，超过 8 个的参数写到栈上
+ * 参数从最后一个开始处理，处理最后一个时先给栈上的参数留出位置
 */
-void register_function_postamble(int symbol_table_index) {
-  struct SymbolTable t = symbol_table[symbol_table_index];
-  register_label(t.symbol_table_end_label);
-  fputs("\tsub\tsp, fp, #4\n"
-        "\tpop\t{fp, pc}\n"
-        "\t.align\t2\n"
-        , output_file);
+static void emit_argument(struct IRInstruction *instruction) {
+  int position = instruction->index, argument_number = instruction->value, r;
+  int s = get_assigned_register(instruction->source1);
+
+  if (position <= ARGUMENT_REGISTER_NUMBER) {
+    if (s == NO_REGISTER)
+      emit_instruction("ldr", register_list[position - 1], get_spill_operand(instruction->source1, position - 1));
+    else if (s != position - 1)
+      emit_instruction("mov", register_list[position - 1], register_list[s]);
+    return;
+  }
+  if (position == argument_number)
+    emit_adjust_stack(-get_stack_argument_size(argument_number));
+  r = load_operand(instruction->source1, X16_REGISTER);
+  emit_instruction("str", register_list[r],
+    format_machine_text("[sp, #%ld]", 8 * (position - ARGUMENT_REGISTER_NUMBER - 1)));
+}
+
+// 保存或者恢复 mask 中的 caller-saved 寄存器
+static void emit_call_save(int mask, int is_save) {
+  int r;
+
+  for (r = 0; r < FIRST_CALLEE_SAVED_REGISTER; r++) {
+    if (((mask >> r) & 1) && is_save)
+      emit_instruction("str", register_list[r], get_frame_operand(save_offset_list[r], X16_REGISTER));
+    else if ((mask >> r) & 1)
+      emit_instruction("ldr", register_list[r], get_frame_operand(save_offset_list[r], X16_REGISTER));
+  }
 }
 
 /**
- * 从 old_primitive_type 转向 new_primitive_type 时扩大在寄存器中的值
- * 返回这个新的值
+ * 调用函数之后移除在栈上的参数，返回值按照函数的类型扩展成 64 位
+ * 跨过调用还活跃的 caller-saved 寄存器在调用前保存，从 x0 取出返回值之后再恢复
 */
-int register_widen(
-  int register_index,
-  int old_primitive_type,
-  int new_primitive_type) {
-    return register_index;
+static void emit_call(struct IRInstruction *instruction) {
+  int r;
+
+  emit_call_save(instruction->save_register_mask, 1);
+  emit_function_transfer(MACHINE_CALL, "bl", instruction->symbol);
+  emit_adjust_stack(get_stack_argument_size(instruction->value));
+
+  if (instruction->primitive_type != PRIMITIVE_VOID) {
+    r = get_destination_register(instruction->destination, X16_REGISTER);
+    emit_extend_register(instruction->primitive_type, 0, r);
+    store_destination(instruction->destination, r);
+  }
+  emit_call_save(instruction->save_register_mask, 0);
 }
 
 /**
- * 给定一个 primitive type，返回其对应的字节数
+ * 处理尾调用 return f(...)，参数已经放在传参的寄存器中
+ * label 不为 NO_LABEL 时是对自己的调用，跳回函数开头读取参数的地方，变成循环
+ * 否则先恢复调用者的栈帧，再 b 到被调用的函数，由它直接返回到调用者的调用者
 */
-int register_get_primitive_type_size(int primitive_type) {
-  if (primitive_type < PRIMITIVE_NONE || primitive_type > PRIMITIVE_LONG_POINTER)
-    error("Bad type in register_get_primitive_type_size()");
-  return primitive_size[primitive_type];
+static void emit_tail_call(struct IRInstruction *instruction) {
+  if (instruction->label != NO_LABEL) {
+    emit_machine_instruction(MACHINE_JUMP, "b", format_label_operand(instruction->label), NULL);
+    return;
+  }
+  emit_function_epilogue();
+  emit_function_transfer(MACHINE_JUMP, "b", instruction->symbol);
+}
+
+// 返回值放入 x0，char 和 int 按照函数的类型截断
+static void emit_return(struct IRInstruction *instruction) {
+  int size = register_get_primitive_type_size(instruction->primitive_type);
+  int s = get_assigned_register(instruction->source1);
+
+  if (s == NO_REGISTER && size == 4) {
+    emit_instruction("ldr", "w0", get_spill_operand(instruction->source1, 0));
+  } else if (s == NO_REGISTER) {
+    emit_instruction(load_instruction_list[get_size_index(size)], get_load_register(0, size),
+      get_spill_operand(instruction->source1, 0));
+  } else if (size == 1) {
+    emit_instruction("uxtb", "w0", lower_32_bits_register_list[s]);
+  } else {
+    emit_instruction("mov", get_sized_register(0, size), get_sized_register(s, size));
+  }
+}
+
+// case 个数少于这个值时逐个比较
+#define SWITCH_COMPARE_CHAIN_LIMIT 4
+// case 值的范围不超过 case 个数的这么多倍时使用跳转表
+#define SWITCH_JUMP_TABLE_DENSITY 3
+
+// 按 case 值从小到大排序，case label 跟着一起移动
+static void sort_switch_case(int *case_value, int *case_label, int case_count) {
+  int i, j, value, label;
+
+  for (i = 1; i < case_count; i++) {
+    value = case_value[i];
+    label = case_label[i];
+    for (j = i; j > 0 && case_value[j - 1] > value; j--) {
+      case_value[j] = case_value[j - 1];
+      case_label[j] = case_label[j - 1];
+    }
+    case_value[j] = value;
+    case_label[j] = label;
+  }
+}
+
+static void emit_jump(int label) {
+  emit_machine_instruction(MACHINE_JUMP, "b", format_label_operand(label), NULL);
+}
+
+static void emit_branch(char *opcode, int label) {
+  emit_machine_instruction(MACHINE_BRANCH, opcode, format_label_operand(label), NULL);
+}
+
+// 逐个比较 [low, high] 中的 case 值，都不相等时跳到 default
+static void switch_compare_chain(
+  char *r,
+  int *case_value,
+  int *case_label,
+  int low,
+  int high,
+  int label_default
+) {
+  int i;
+
+  for (i = low; i <= high; i++) {
+    emit_compare_immediate(r, case_value[i], 8);
+    emit_branch("b.eq", case_label[i]);
+  }
+  emit_jump(label_default);
+}
+
+// 对排好序的 [low, high] 做二分查找，剩下的 case 不多时改为逐个比较
+static void switch_binary_search(
+  char *r,
+  int *case_value,
+  int *case_label,
+  int low,
+  int high,
+  int label_default
+) {
+  int middle, label_low;
+
+  if (high - low + 1 < SWITCH_COMPARE_CHAIN_LIMIT) {
+    switch_compare_chain(r, case_value, case_label, low, high, label_default);
+    return;
+  }
+
+  middle = (low + high) / 2;
+  label_low = generate_label();
+  emit_compare_immediate(r, case_value[middle], 8);
+  emit_branch("b.eq", case_label[middle]);
+  emit_branch("b.lt", label_low);
+  switch_binary_search(r, case_value, case_label, middle + 1, high, label_default);
+  emit_machine_label(label_low);
+  switch_binary_search(r, case_value, case_label, low, middle - 1, label_default);
+}
+
+// 跳转表中的一项，label 相对于表头的偏移
+static char *format_jump_table_entry(int label, int table_label) {
+  char *s = (char *) allocate_from_arena(function_arena, 32);
+
+  snprintf(s, 32, "L%d - L%d", label, table_label);
+  return (s);
 }
 
 /**
- * 处理函数调用 function_call
+ * 通过跳转表分派
+ * 表中是各个 case label 相对于表头的偏移，和代码放在一起，不需要重定位
+ * 减去最小值之后做一次无符号比较，小于最小值和大于最大值都会跳到 default
 */
-int register_function_call(int register_index, int symbol_table_index) {
-  fprintf(output_file, "\tmov\tr0, %s\n", register_list[register_index]);
-  fprintf(output_file, "\tbl\t%s\n", symbol_table[symbol_table_index].name);
-  fprintf(output_file, "\tmov\t%s, r0\n", register_list[register_index]);
-  return register_index;
+static void switch_jump_table(
+  int r,
+  int *case_value,
+  int *case_label,
+  int case_count,
+  int label_default
+) {
+  int table_label = generate_label();
+  int low = case_value[0], high = case_value[case_count - 1];
+  int i = 0, value;
+
+  emit_add_immediate(X16_REGISTER, r, -low);
+  emit_compare_immediate("x16", high - low, 8);
+  emit_branch("b.hi", label_default);
+  emit_instruction("adr", "x17", format_label_operand(table_label));
+  emit_instruction("ldrsw", "x16", "[x17, x16, lsl #2]");
+  emit_instruction3("add", "x17", "x17", "x16");
+  emit_machine_instruction(MACHINE_JUMP, "br", "x17", NULL);
+
+  emit_machine_label(table_label);
+  for (value = low; value <= high; value++) {
+    if (case_value[i] == value) {
+      emit_machine_directive(".long", format_jump_table_entry(case_label[i], table_label));
+      i++;
+    } else {
+      emit_machine_directive(".long", format_jump_table_entry(label_default, table_label));
+    }
+  }
 }
 
 /**
- * 处理函数返回 function_return
+ * 根据 source1 的值跳转到对应的 case label
+ * case 很少时逐个比较，值比较密集时用跳转表，否则二分查找
+ * 排序用的是复制出来的数组，IR 中的数组保持原来的顺序
 */
-void register_function_return(int register_index, int symbol_table_index) {
-  struct SymbolTable t = symbol_table[symbol_table_index];
-  char *r = register_list[register_index];
-  fprintf(output_file, "\tmov\tr0, %s\n", r);
-  register_jump(t.symbol_table_end_label);
-}
+static void emit_switch(struct IRInstruction *instruction) {
+  int r = load_operand(instruction->source1, X16_REGISTER);
+  int case_count = instruction->value, label_default = instruction->label;
+  int *sorted_value, *sorted_label;
+  long range;
+
+  if (case_count == 0) {
+    emit_jump(label_default);
+    return;
+  }
 
-int register_load_identifier_address(int symbol_table_index) {
-  int register_index = allocate_register();
-  set_variable_offset(symbol_table_index);
-  fprintf(output_file, "\tmov\t%s, r3\n", register_list[register_index]);
-  return register_index;
+  sorted_value = (int *) allocate_from_arena(function_arena, case_count * sizeof(int));
+  sorted_label = (int *) allocate_from_arena(function_arena, case_count * sizeof(int));
+  memcpy(sorted_value, instruction->case_value_list, case_count * sizeof(int));
+  memcpy(sorted_label, instruction->case_label_list, case_count * sizeof(int));
+  sort_switch_case(sorted_value, sorted_label, case_count);
+  range = sorted_value[case_count - 1];
+  range = range - sorted_value[0] + 1;
+
+  if (case_count < SWITCH_COMPARE_CHAIN_LIMIT)
+    switch_compare_chain(register_list[r], sorted_value, sorted_label, 0, case_count - 1, label_default);
+  else if (range <= case_count * SWITCH_JUMP_TABLE_DENSITY)
+    switch_jump_table(r, sorted_value, sorted_label, case_count, label_default);
+  else
+    switch_binary_search(register_list[r], sorted_value, sorted_label, 0, case_count - 1, label_default);
 }
 
-int register_dereference_pointer(int register_index, int primitive_type) {
-  char *r = register_list[register_index];
-  switch (primitive_type) {
-    case PRIMITIVE_CHAR_POINTER:
-      fprintf(output_file, "\tldrb\t%s, [%s]\n", r, r);
+// 翻译一条 IR
+static void generate_instruction(struct IRInstruction *instruction) {
+  int size, r;
+
+  switch (instruction->operation) {
+    case IR_LABEL:
+      emit_machine_label(instruction->label);
       break;
-    case PRIMITIVE_INT_POINTER:
-    case PRIMITIVE_LONG_POINTER:
-      fprintf(output_file, "\tldr\t%s, [%s]\n", r, r);
+    case IR_JUMP:
+      emit_jump(instruction->label);
       break;
-    default:
-      error_with_digital("Can't register_dereference_pointer on type:", primitive_type);
-  }
-  return register_index;
-}
-
-int register_store_dereference_pointer(int left_register, int right_register, int primitive_type) {
-  char *lr = register_list[left_register];
-  char *rr = register_list[right_register];
-  switch (primitive_type) {
-    case PRIMITIVE_CHAR:
-      fprintf(output_file, "\tstrb\t%s, [%s]\n", lr, rr);
+    case IR_BRANCH:
+      emit_compare(instruction);
+      emit_branch(branch_list[instruction->condition - AST_COMPARE_EQUALS], instruction->label);
+      break;
+    case IR_SWITCH:
+      emit_switch(instruction);
+      break;
+    case IR_CONSTANT:
+      r = get_destination_register(instruction->destination, X16_REGISTER);
+      emit_move_immediate(r, instruction->value);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_STRING:
+      r = get_destination_register(instruction->destination, X16_REGISTER);
+      emit_symbol_address(r, format_label_operand(instruction->value));
+      store_destination(instruction->destination, r);
+      break;
+    case IR_ADDRESS:
+      r = get_destination_register(instruction->destination, X16_REGISTER);
+      if (check_frame_variable(instruction->symbol))
+        emit_add_immediate(r, X29_REGISTER, instruction->symbol->symbol_table_position);
+      else
+        emit_symbol_address(r, instruction->symbol->name);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_COPY:
+      r = get_destination_register(instruction->destination, X16_REGISTER);
+      emit_extend(instruction->primitive_type, instruction->source1, r);
+      store_destination(instruction->destination, r);
+      break;
+    case IR_LOAD_VARIABLE:
+      size = register_get_primitive_type_size(instruction->primitive_type);
+      r = get_destination_register(instruction->destination, X16_REGISTER);
+      emit_instruction(load_instruction_list[get_size_index(size)],
+        get_load_register(r, size), get_variable_operand(instruction->symbol, r));
+      store_destination(instruction->destination, r);
       break;
-    case PRIMITIVE_INT:
-    case PRIMITIVE_LONG:
-      fprintf(output_file, "\tstr\t%s, [%s]\n", lr, rr);
+    case IR_STORE_VARIABLE:
+      size = register_get_primitive_type_size(instruction->primitive_type);
+      r = load_operand(instruction->source1, X16_REGISTER);
+      emit_instruction(store_instruction_list[get_size_index(size)],
+        get_sized_register(r, size), get_variable_operand(instruction->symbol, get_other_scratch(r)));
+      break;
+    case IR_LOAD:
+      emit_load(instruction);
+      break;
+    case IR_STORE:
+      emit_store(instruction);
+      break;
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+    case IR_MOD:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    case IR_SHIFT_LEFT:
+    case IR_SHIFT_RIGHT:
+      if (instruction->source2 == NO_REGISTER) emit_binary_constant(instruction);
+      else emit_binary(instruction);
+      break;
+    case IR_NEGATE:
+      emit_unary("neg", instruction);
+      break;
+    case IR_INVERT:
+      emit_unary("mvn", instruction);
+      break;
+    case IR_LOGIC_NOT:
+      emit_test_and_set("eq", instruction);
+      break;
+    case IR_TO_BOOLEAN:
+      emit_test_and_set("ne", instruction);
+      break;
+    case IR_COMPARE:
+      emit_compare(instruction);
+      emit_set(condition_list[instruction->condition - AST_COMPARE_EQUALS], instruction->destination);
+      break;
+    case IR_PARAMETER:
+      emit_parameter(instruction);
+      break;
+    case IR_ARGUMENT:
+      emit_argument(instruction);
+      break;
+    case IR_CALL:
+      emit_call(instruction);
+      break;
+    case IR_TAIL_CALL:
+      emit_tail_call(instruction);
+      break;
+    case IR_RETURN:
+      emit_return(instruction);
       break;
     default:
-      error_with_digital("Can't register_store_dereference_pointer on type:", primitive_type);
+      error_with_digital("Bad ir operation in generate_instruction:", instruction->operation);
   }
-  return left_register;
-}
-
-int register_shift_left_by_constant(int register_index, int value) {
-  char *r = register_list[register_index];
-  fprintf(output_file, "\tlsl\t%s, %s, #%d\n", r, r, value);
-  return register_index;
 }
 
 /**
- * 给定一个全局 string 的 label id，把它的地址加载进一个寄存器中
+ * 把一个函数的 IR 翻译成机器指令记录，写入 output_file
 */
-int register_load_global_string(int label) {
-  int register_index = allocate_register();
-  // fprintf(output_file, "\tleaq\tL%d(%%rip), %s\n", label, register_list[register_index]);
-  return register_index;
+void register_generate_function(struct IRFunction *function) {
+  int i;
+
+  current_ir_function = function;
+  register_text_section_flag();
+  layout_frame(function);
+
+  start_machine_function();
+  emit_function_prologue(function->symbol);
+  for (i = 0; i < function->instruction_number; i++)
+    generate_instruction(function->instruction_list[i]);
+  emit_function_epilogue();
+  emit_machine_instruction(MACHINE_RETURN, "ret", NULL, NULL);
+
+  print_machine_instructions(output_file, finish_machine_function());
+  current_ir_function = NULL;
+}
+
+void register_reset_local_variables() {
+  local_offset = 0;
+}
+
+void register_text_section_flag() {
+  if (current_section_flag == TEXT_SECTION_FLAG) return;
+  fputs("\t.text\n", output_file);
+  current_section_flag = TEXT_SECTION_FLAG;
+}
+
+void register_data_section_flag() {
+  if (current_section_flag == DATA_SECTION_FLAG) return;
+  fputs("\t.data\n", output_file);
+  current_section_flag = DATA_SECTION_FLAG;
+}
+
+// static 的函数和变量只在当前文件中可见，不导出
+void register_symbol_visibility(struct SymbolTable *t) {
+  if (t->storage_class == STORAGE_CLASS_STATIC)
+    fprintf(output_file, "\t.local\t%s\n", t->name);
+  else
+    fprintf(output_file, "\t.globl\t%s\n", t->name);
+}
+
+int register_align(int primitive_type, int offset, int direction) {
+  int alignment;
+
+  switch (primitive_type) {
+    case PRIMITIVE_CHAR: break;
+    default:
+      // int/long 间隔 4 字节
+      alignment = 4;
+      // direction -1 或者 1
+      offset = (offset + direction * (alignment - 1)) & ~(alignment - 1);
+  }
+
+  return (offset);
 }
@@ -6,6 +6,7 @@
 #include "data.h"
 #include "definations.h"
 #include "helper.h"
+#include "ast.h"
 
 static int dump_label_id = 1;
 static int generate_dump_label(void) {
@@ -111,7 +112,7 @@ void error_with_character(char *string, char character) {
 // 递归打印 ast
 void dump_ast(struct ASTNode *n, int label, int level) {
   int label_false, label_start, label_end;
-  struct SymbolTable *t = n->symbol_table;
+  struct SymbolTable *t = get_ast_symbol_table(n);
   int i;
 
   switch (n->operation) {
@@ -119,29 +120,29 @@ void dump_ast(struct ASTNode *n, int label, int level) {
       label_false = generate_dump_label();
       for (i = 0; i < level; i++) fprintf(stdout, " ");
       fprintf(stdout, "AST_IF");
-      if (n->right) {
+      if (get_ast_right(n)) {
         label_end = generate_dump_label();
         fprintf(stdout, ", end L%d", label_end);
       }
       fprintf(stdout, "\n");
-      dump_ast(n->left, label_false, level+2);
-      dump_ast(n->middle, NO_LABEL, level+2);
-      if (n->right) dump_ast(n->right, NO_LABEL, level+2);
+      dump_ast(get_ast_left(n), label_false, level+2);
+      dump_ast(get_ast_middle(n), NO_LABEL, level+2);
+      if (get_ast_right(n)) dump_ast(get_ast_right(n), NO_LABEL, level+2);
       return;
     case AST_WHILE:
       label_start = generate_dump_label();
       for (i = 0; i < level; i++) fprintf(stdout, " ");
       fprintf(stdout, "AST_WHILE, start L%d\n", label_start);
       label_end = generate_dump_label();
-      dump_ast(n->left, label_end, level+2);
-      dump_ast(n->right, NO_LABEL, level+2);
+      dump_ast(get_ast_left(n), label_end, level+2);
+      dump_ast(get_ast_right(n), NO_LABEL, level+2);
       return;
   }
 
   if (n->operation == AST_GLUE) level= -2;
 
-  if (n->left) dump_ast(n->left, NO_LABEL, level+2);
-  if (n->right) dump_ast(n->right, NO_LABEL, level+2);
+  if (get_ast_left(n)) dump_ast(get_ast_left(n), NO_LABEL, level+2);
+  if (get_ast_right(n)) dump_ast(get_ast_right(n), NO_LABEL, level+2);
 
 
   for (i = 0; i < level; i++) fprintf(stdout, " ");
@@ -203,9 +204,9 @@ void dump_ast(struct ASTNode *n, int label, int level) {
       fprintf(stdout, "AST_SCALE %d\n", n->ast_node_scale_size); return;
 
     case AST_PRE_INCREASE:
-      fprintf(stdout, "AST_PREINC %s\n", n->symbol_table->name); return;
+      fprintf(stdout, "AST_PREINC %s\n", get_ast_symbol_table(n)->name); return;
     case AST_PRE_DECREASE:
-      fprintf(stdout, "AST_PREDEC %s\n", n->symbol_table->name); return;
+      fprintf(stdout, "AST_PREDEC %s\n", get_ast_symbol_table(n)->name); return;
     case AST_POST_INCREASE:
       fprintf(stdout, "AST_POSTINC\n"); return;
     case AST_POST_DECREASE:
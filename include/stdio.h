@@ -18,6 +18,8 @@ FILE *fopen(char *pathname, char *mode);
 size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
 size_t fwrite(void *ptr, size_t size, size_t nmemb, FILE *stream);
 int fclose(FILE *stream);
+int fflush(FILE *stream);
+FILE *freopen(char *pathname, char *mode, FILE *stream);
 int printf(char *format);
 int fprintf(FILE *stream, char *format);
 int sprintf(char *str, char *format);
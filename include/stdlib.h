@@ -9,5 +9,6 @@ void free(void *ptr);
 void *calloc(int nmemb, int size);
 void *realloc(void *ptr, int size);
 int system(char *command);
+int atoi(char *nptr);
 
 #endif	// _STDLIB_H_
@@ -6,8 +6,12 @@
 char *strdup(char *s);
 char *strchr(char *s, int c);
 char *strrchr(char *s, int c);
+size_t strlen(char *s);
 int strcmp(char *s1, char *s2);
 int strncmp(char *s1, char *s2, size_t n);
+void *memcpy(void *dest, void *src, size_t n);
+void *memset(void *s, int c, size_t n);
+char *strncpy(char *dest, char *src, size_t n);
 char *strerror(int errnum);
 
 #endif	// _STRING_H_
@@ -3,5 +3,7 @@
 
 void _exit(int status);
 int unlink(char *pathname);
+int fork(void);
+int getpid(void);
 
 #endif	// _UNISTD_H_
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <string.h>
+#include "data.h"
+#include "definations.h"
+#include "arena.h"
+#include "ast.h"
+#include "types.h"
+#include "optimizer.h"
+#include "inliner.h"
+
+// 函数内联
+// 函数体只有一个 return (表达式) 的函数，或者只有一条表达式语句的 void 函数，
+// 表达式的节点个数不超过 inline_limit 时，把表达式复制到整个文件的节点表中(ast.c)，
+// 记在 inline_function_head 链表上
+// 之后同一个文件中调用它的地方，在解析时就换成这个表达式，参数换成实参，
+// 调用者的 optimise 会再对换进来的表达式做常量折叠
+//
+// 为了不改变求值顺序，要求
+//   1. 实参没有副作用；形参用了不止一次时实参只能是变量、常量或者地址，不会重复计算
+//   2. 有副作用的函数体只能是一次赋值或者一次函数调用，并且它的子树都没有副作用，
+//      这样对形参的读取都在唯一的写入之前，和调用时先求出实参的值一样
+//   3. 函数体中没有局部变量，形参只作为右值使用
+// 返回 char 的函数调用时会截断返回值，所以只内联不用截断的表达式
+
+#define MAX_INLINE_ARGUMENT_NUMBER 6
+
+static struct ASTNode *argument_list[MAX_INLINE_ARGUMENT_NUMBER];
+static int inlined_call_count;
+
+static int count_ast_node(struct ASTNode *node) {
+  if (!node) return (0);
+  return (
+    1 +
+    count_ast_node(get_ast_left(node)) +
+    count_ast_node(get_ast_middle(node)) +
+    count_ast_node(get_ast_right(node)));
+}
+
+// t 是函数 function 的第几个参数，不是时返回 -1
+static int find_parameter_index(struct SymbolTable *function, struct SymbolTable *t) {
+  struct SymbolTable *parameter;
+  int i = 0;
+
+  for (parameter = function->member; parameter; parameter = parameter->next) {
+    if (parameter == t) return (i);
+    i++;
+  }
+  return (-1);
+}
+
+// 函数体中只能用到全局的符号，以及作为右值的参数
+static int check_inline_symbol(struct ASTNode *node, struct SymbolTable *function, int parent_operation) {
+  struct SymbolTable *t;
+
+  if (!node) return (1);
+  t = get_ast_symbol_table(node);
+  if (t && t->storage_class == STORAGE_CLASS_FUNCTION_PARAMETER) {
+    if (find_parameter_index(function, t) < 0 || node->operation != AST_IDENTIFIER) return (0);
+    // *p 中的 p 没有标记为右值，但是同样只是读取 p 的值
+    if (!node->rvalue && parent_operation != AST_DEREFERENCE_POINTER) return (0);
+  } else if (t && t->storage_class == STORAGE_CLASS_LOCAL) {
+    return (0);
+  }
+  return (
+    check_inline_symbol(get_ast_left(node), function, node->operation) &&
+    check_inline_symbol(get_ast_middle(node), function, node->operation) &&
+    check_inline_symbol(get_ast_right(node), function, node->operation));
+}
+
+// 有副作用的函数体必须是没有其他副作用的一次赋值或者一次函数调用
+static int check_inline_side_effect(struct ASTNode *node) {
+  if (!check_side_effect(node)) return (1);
+  switch (node->operation) {
+    case AST_ASSIGN:
+    case AST_ASSIGN_PLUS:
+    case AST_ASSIGN_MINUS:
+    case AST_ASSIGN_MULTIPLY:
+    case AST_ASSIGN_DIVIDE:
+    case AST_ASSIGN_MOD:
+      return (!check_side_effect(get_ast_left(node)) && !check_side_effect(get_ast_right(node)));
+    case AST_FUNCTION_CALL:
+      return (!check_side_effect(get_ast_left(node)));
+  }
+  return (0);
+}
+
+/**
+ * 复制一棵表达式树
+ * is_translation_unit 为 1 时新的节点放在整个文件的节点表中，否则放在函数的节点表中
+ * function 不为 NULL 时把它的参数换成 argument_list 中对应实参的副本
+*/
+static struct ASTNode *copy_inline_tree(
+  struct ASTNode *node,
+  int is_translation_unit,
+  struct SymbolTable *function
+) {
+  struct ASTNode *copy;
+  int i;
+
+  if (!node) return (NULL);
+  if (function && node->operation == AST_IDENTIFIER && get_ast_symbol_table(node)) {
+    i = find_parameter_index(function, get_ast_symbol_table(node));
+    if (i >= 0) return (copy_inline_tree(argument_list[i], is_translation_unit, NULL));
+  }
+
+  copy = copy_ast_node(node, is_translation_unit);
+  set_ast_left(copy, copy_inline_tree(get_ast_left(node), is_translation_unit, function));
+  set_ast_middle(copy, copy_inline_tree(get_ast_middle(node), is_translation_unit, function));
+  set_ast_right(copy, copy_inline_tree(get_ast_right(node), is_translation_unit, function));
+  return (copy);
+}
+
+/**
+ * 函数定义的代码生成之前调用，函数可以内联时保存它的函数体表达式
+*/
+void record_inline_function(struct ASTNode *node) {
+  struct SymbolTable *t = get_ast_symbol_table(node);
+  struct ASTNode *body = get_ast_left(node);
+  struct InlineFunction *inline_function;
+
+  if (inline_limit <= 0 || !body) return;
+  if (t->element_number > MAX_INLINE_ARGUMENT_NUMBER) return;
+
+  if (body->operation == AST_RETURN) {
+    body = get_ast_left(body);
+    if (!body) return;
+    if (t->primitive_type == PRIMITIVE_CHAR &&
+        body->operation != AST_IDENTIFIER &&
+        body->operation != AST_DEREFERENCE_POINTER &&
+        body->operation != AST_INTEGER_LITERAL)
+      return;
+  } else {
+    if (t->primitive_type != PRIMITIVE_VOID) return;
+    if (!check_side_effect(body)) return;
+  }
+
+  if (count_ast_node(body) > inline_limit) return;
+  if (!check_inline_symbol(body, t, 0)) return;
+  if (!check_inline_side_effect(body)) return;
+
+  inline_function = (struct InlineFunction *)
+    allocate_from_arena(translation_unit_arena, sizeof(struct InlineFunction));
+  inline_function->function = t;
+  inline_function->body = copy_inline_tree(body, 1, NULL);
+  inline_function->next = inline_function_head;
+  inline_function_head = inline_function;
+}
+
+// 函数 t 可以内联时返回它的函数体表达式，否则返回 NULL
+static struct ASTNode *find_inline_body(struct SymbolTable *t) {
+  struct InlineFunction *inline_function;
+
+  for (inline_function = inline_function_head; inline_function; inline_function = inline_function->next) {
+    if (inline_function->function == t) return (inline_function->body);
+  }
+  return (NULL);
+}
+
+// 实参是不是可以直接复制多次的简单表达式
+static int check_simple_argument(struct ASTNode *node) {
+  // 小的整数常量是 char 类型，传给 int 参数时外面包了一层 AST_WIDEN
+  if (node->operation == AST_WIDEN) node = get_ast_left(node);
+  switch (node->operation) {
+    case AST_INTEGER_LITERAL:
+    case AST_IDENTIFIER:
+    case AST_IDENTIFIER_ADDRESS:
+    case AST_STRING_LITERAL:
+      return (1);
+  }
+  return (0);
+}
+
+// 参数 t 在函数体中出现的次数
+static int count_parameter_use(struct ASTNode *node, struct SymbolTable *t) {
+  int count = 0;
+
+  if (!node) return (0);
+  if (node->operation == AST_IDENTIFIER && get_ast_symbol_table(node) == t) count = 1;
+  return (
+    count +
+    count_parameter_use(get_ast_left(node), t) +
+    count_parameter_use(get_ast_middle(node), t) +
+    count_parameter_use(get_ast_right(node), t));
+}
+
+/**
+ * 解析完一个函数调用之后调用，可以内联时返回替换后的表达式，否则返回原来的调用
+*/
+struct ASTNode *inline_function_call(struct ASTNode *node) {
+  struct SymbolTable *t = get_ast_symbol_table(node), *parameter;
+  struct ASTNode *inline_body = find_inline_body(t);
+  struct ASTNode *glue, *argument, *body;
+  int i, argument_number = 0;
+
+  if (!inline_body) return (node);
+
+  // 实参按照从后往前的顺序挂在 AST_GLUE 上
+  for (glue = get_ast_left(node); glue; glue = get_ast_left(glue)) argument_number++;
+  if (argument_number != t->element_number) return (node);
+  i = argument_number;
+  for (glue = get_ast_left(node); glue; glue = get_ast_left(glue)) {
+    i--;
+    argument_list[i] = get_ast_right(glue);
+  }
+
+  i = 0;
+  for (parameter = t->member; parameter; parameter = parameter->next) {
+    argument = modify_type(argument_list[i], parameter->primitive_type, 0, parameter->composite_type);
+    if (!argument || check_side_effect(argument)) return (node);
+    if (!check_simple_argument(argument) && count_parameter_use(inline_body, parameter) > 1)
+      return (node);
+    argument_list[i] = argument;
+    i++;
+  }
+
+  body = copy_inline_tree(inline_body, 0, t);
+
+  // 指针类型的返回值可能是不同的指针类型，统一成函数的返回类型
+  if (t->primitive_type != PRIMITIVE_VOID && body->primitive_type != t->primitive_type) {
+    if (!check_pointer_type(body->primitive_type) || !check_pointer_type(t->primitive_type))
+      return (node);
+    body->primitive_type = (char) t->primitive_type;
+    set_ast_composite_type(body, t->composite_type);
+  }
+
+  inlined_call_count++;
+  return (body);
+}
+
+// -v 时输出内联的次数，之后清零，下一个文件重新计数
+void print_inline_statistics() {
+  printf("inliner: %d calls inlined\n", inlined_call_count);
+  inlined_call_count = 0;
+}
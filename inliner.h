@@ -0,0 +1,10 @@
+#ifndef __INLINER_H__
+#define __INLINER_H__
+
+#include "definations.h"
+
+void record_inline_function(struct ASTNode *node);
+struct ASTNode *inline_function_call(struct ASTNode *node);
+void print_inline_statistics();
+
+#endif
@@ -31,11 +31,11 @@
 int interpret_ast(struct ASTNode *node) {
   int left_value, right_value;
 
-  if (node->left) {
-    left_value = interpret_ast(node->left);
+  if (get_ast_left(node)) {
+    left_value = interpret_ast(get_ast_left(node));
   }
-  if (node->right) {
-    right_value = interpret_ast(node->right);
+  if (get_ast_right(node)) {
+    right_value = interpret_ast(get_ast_right(node));
   }
 
   switch (node->operation) {
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+#include "definations.h"
+#include "helper.h"
+#include "arena.h"
+#include "types.h"
+#include "linear_ir.h"
+#include "generator_core.h"
+#include "register_allocator.h"
+#include "value_numbering.h"
+
+// 三地址 IR
+// generator.c 遍历一个函数的 ast，通过下面的 emit_ir_xxx 把代码生成到一个指令数组中
+// 每条指令最多读两个虚拟寄存器、写一个虚拟寄存器，控制流只有 label 和显式的跳转
+// 函数结束时划分基本块，做局部值编号，分配寄存器，再交给后端(generator_core.c 或者 generator_core_arm.c)
+// 翻译成机器指令；-L 时按基本块输出 IR
+// 指令都从 function_arena 中分配，函数结束后一起释放
+
+#define IR_INITIAL_CAPACITY 256
+
+static struct IRFunction *ir_function;
+static int ir_capacity;
+
+/**
+ * 开始生成一个函数的 IR
+*/
+void start_function_linear_ir(struct SymbolTable *function) {
+  ir_function = (struct IRFunction *) allocate_from_arena(function_arena, sizeof(struct IRFunction));
+  ir_function->symbol = function;
+  ir_function->register_number = 1;
+  ir_function->tail_call_label = NO_LABEL;
+  ir_capacity = IR_INITIAL_CAPACITY;
+  ir_function->instruction_list = (struct IRInstruction **)
+    allocate_from_arena(function_arena, ir_capacity * sizeof(struct IRInstruction *));
+}
+
+// 新的虚拟寄存器
+int new_ir_register() {
+  int register_index = ir_function->register_number;
+
+  ir_function->register_number = register_index + 1;
+  return (register_index);
+}
+
+// 指令数组满了之后换一个两倍大的，旧的留在 arena 中一起释放
+static void grow_ir_instruction_list() {
+  struct IRInstruction **list;
+
+  list = (struct IRInstruction **)
+    allocate_from_arena(function_arena, 2 * ir_capacity * sizeof(struct IRInstruction *));
+  memcpy(list, ir_function->instruction_list, ir_capacity * sizeof(struct IRInstruction *));
+  ir_function->instruction_list = list;
+  ir_capacity = 2 * ir_capacity;
+}
+
+/**
+ * 在函数的末尾加上一条指令，返回这条指令，其余的字段由调用者填写
+*/
+struct IRInstruction *emit_ir(
+  int operation,
+  int primitive_type,
+  int destination,
+  int source1,
+  int source2
+) {
+  struct IRInstruction *instruction = (struct IRInstruction *)
+    allocate_from_arena(function_arena, sizeof(struct IRInstruction));
+
+  instruction->operation = (char) operation;
+  instruction->primitive_type = (char) primitive_type;
+  instruction->destination = destination;
+  instruction->source1 = source1;
+  instruction->source2 = source2;
+  instruction->index = NO_REGISTER;
+  instruction->label = NO_LABEL;
+  instruction->scale = 1;
+
+  if (ir_function->instruction_number >= ir_capacity) grow_ir_instruction_list();
+  ir_function->instruction_list[ir_function->instruction_number] = instruction;
+  ir_function->instruction_number = ir_function->instruction_number + 1;
+  return (instruction);
+}
+
+void emit_ir_label(int label) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_LABEL, PRIMITIVE_NONE, NO_REGISTER, NO_REGISTER, NO_REGISTER);
+
+  instruction->label = label;
+}
+
+void emit_ir_jump(int label) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_JUMP, PRIMITIVE_NONE, NO_REGISTER, NO_REGISTER, NO_REGISTER);
+
+  instruction->label = label;
+}
+
+/**
+ * source1 和 source2 按照 primitive_type 的宽度比较，condition 成立时跳转到 label
+ * source2 为 NO_REGISTER 时和立即数 value 比较
+*/
+void emit_ir_branch(
+  int condition,
+  int primitive_type,
+  int source1,
+  int source2,
+  int value,
+  int label
+) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_BRANCH, primitive_type, NO_REGISTER, source1, source2);
+
+  instruction->condition = (char) condition;
+  instruction->value = value;
+  instruction->label = label;
+}
+
+int emit_ir_constant(int destination, int value) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_CONSTANT, PRIMITIVE_LONG, destination, NO_REGISTER, NO_REGISTER);
+
+  instruction->value = value;
+  return (destination);
+}
+
+int emit_ir_copy(int primitive_type, int destination, int source) {
+  emit_ir(IR_COPY, primitive_type, destination, source, NO_REGISTER);
+  return (destination);
+}
+
+int emit_ir_unary(int operation, int source) {
+  int destination = new_ir_register();
+
+  emit_ir(operation, PRIMITIVE_LONG, destination, source, NO_REGISTER);
+  return (destination);
+}
+
+int emit_ir_binary(int operation, int primitive_type, int source1, int source2) {
+  int destination = new_ir_register();
+
+  emit_ir(operation, primitive_type, destination, source1, source2);
+  return (destination);
+}
+
+int emit_ir_binary_constant(int operation, int primitive_type, int source, int value) {
+  struct IRInstruction *instruction =
+    emit_ir(operation, primitive_type, new_ir_register(), source, NO_REGISTER);
+
+  instruction->value = value;
+  return (instruction->destination);
+}
+
+int emit_ir_compare(int condition, int primitive_type, int source1, int source2, int value) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_COMPARE, primitive_type, new_ir_register(), source1, source2);
+
+  instruction->condition = (char) condition;
+  instruction->value = value;
+  return (instruction->destination);
+}
+
+int emit_ir_string(int label) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_STRING, pointer_to(PRIMITIVE_CHAR), new_ir_register(), NO_REGISTER, NO_REGISTER);
+
+  instruction->value = label;
+  return (instruction->destination);
+}
+
+int emit_ir_address(struct SymbolTable *t, int destination) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_ADDRESS, PRIMITIVE_LONG, destination, NO_REGISTER, NO_REGISTER);
+
+  instruction->symbol = t;
+  return (destination);
+}
+
+int emit_ir_load_variable(struct SymbolTable *t) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_LOAD_VARIABLE, t->primitive_type, new_ir_register(), NO_REGISTER, NO_REGISTER);
+
+  instruction->symbol = t;
+  return (instruction->destination);
+}
+
+void emit_ir_store_variable(struct SymbolTable *t, int source) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_STORE_VARIABLE, t->primitive_type, NO_REGISTER, source, NO_REGISTER);
+
+  instruction->symbol = t;
+}
+
+// 读取 base + index * scale + offset 处 primitive_type 类型的值，index 为 NO_REGISTER 时没有下标
+int emit_ir_load(int primitive_type, int base, int index, int scale, int offset) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_LOAD, primitive_type, new_ir_register(), base, NO_REGISTER);
+
+  instruction->index = index;
+  instruction->scale = (char) scale;
+  instruction->value = offset;
+  return (instruction->destination);
+}
+
+void emit_ir_store(int primitive_type, int source, int base, int index, int scale, int offset) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_STORE, primitive_type, NO_REGISTER, base, source);
+
+  instruction->index = index;
+  instruction->scale = (char) scale;
+  instruction->value = offset;
+}
+
+int emit_ir_parameter(struct SymbolTable *t, int position, int destination) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_PARAMETER, t->primitive_type, destination, NO_REGISTER, NO_REGISTER);
+
+  instruction->symbol = t;
+  instruction->index = position;
+  return (destination);
+}
+
+void emit_ir_argument(int source, int position, int argument_number) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_ARGUMENT, PRIMITIVE_LONG, NO_REGISTER, source, NO_REGISTER);
+
+  instruction->index = position;
+  instruction->value = argument_number;
+}
+
+// 调用函数 t，返回放着返回值的虚拟寄存器
+int emit_ir_call(struct SymbolTable *t, int argument_number) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_CALL, t->primitive_type, new_ir_register(), NO_REGISTER, NO_REGISTER);
+
+  instruction->symbol = t;
+  instruction->value = argument_number;
+  return (instruction->destination);
+}
+
+void emit_ir_tail_call(struct SymbolTable *t, int label) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_TAIL_CALL, t->primitive_type, NO_REGISTER, NO_REGISTER, NO_REGISTER);
+
+  instruction->symbol = t;
+  instruction->label = label;
+}
+
+void emit_ir_return(int primitive_type, int source) {
+  emit_ir(IR_RETURN, primitive_type, NO_REGISTER, source, NO_REGISTER);
+}
+
+void emit_ir_switch(
+  int source,
+  int case_count,
+  int *case_label,
+  int *case_value,
+  int label_default
+) {
+  struct IRInstruction *instruction =
+    emit_ir(IR_SWITCH, PRIMITIVE_LONG, NO_REGISTER, source, NO_REGISTER);
+
+  instruction->value = case_count;
+  instruction->case_label_list = case_label;
+  instruction->case_value_list = case_value;
+  instruction->label = label_default;
+}
+
+// 之后的指令不会从这条指令顺序执行下去
+static int check_ir_block_end(struct IRInstruction *instruction) {
+  switch (instruction->operation) {
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_SWITCH:
+    case IR_TAIL_CALL:
+      return (1);
+  }
+  return (0);
+}
+
+// instruction 是不是一个新的基本块的第一条指令
+static int check_ir_block_start(struct IRInstruction *instruction, struct IRInstruction *previous) {
+  if (!previous) return (0);
+  if (check_ir_block_end(previous)) return (1);
+  return (instruction->operation == IR_LABEL && previous->operation != IR_LABEL);
+}
+
+/**
+ * 划分基本块
+ * label 开始一个新的块(连续的 label 属于同一个块)，跳转结束当前的块
+ * 同时记下每个 label 所在的块
+*/
+static void mark_ir_blocks(struct IRFunction *function) {
+  struct IRInstruction *instruction, *previous = NULL;
+  int i, block = 0, low = 0, high = -1;
+
+  function->block_start_list = (int *)
+    allocate_from_arena(function_arena, (function->instruction_number + 2) * sizeof(int));
+
+  for (i = 0; i < function->instruction_number; i++) {
+    instruction = function->instruction_list[i];
+    if (check_ir_block_start(instruction, previous)) {
+      block++;
+      function->block_start_list[block] = i;
+    }
+    instruction->block = block;
+    if (instruction->operation == IR_LABEL) {
+      if (high < low) {
+        low = instruction->label;
+        high = instruction->label;
+      }
+      if (instruction->label < low) low = instruction->label;
+      if (instruction->label > high) high = instruction->label;
+    }
+    previous = instruction;
+  }
+  function->block_number = 0;
+  if (function->instruction_number) function->block_number = block + 1;
+  function->block_start_list[function->block_number] = function->instruction_number;
+
+  function->label_base = low;
+  function->label_number = high - low + 1;
+  function->label_block_list = (int *)
+    allocate_from_arena(function_arena, (function->label_number + 1) * sizeof(int));
+  for (i = 0; i < function->instruction_number; i++) {
+    instruction = function->instruction_list[i];
+    if (instruction->operation == IR_LABEL)
+      function->label_block_list[instruction->label - low] = instruction->block;
+  }
+}
+
+static int get_ir_label_block(struct IRFunction *function, int label) {
+  return (function->label_block_list[label - function->label_base]);
+}
+
+int get_ir_block_start(struct IRFunction *function, int block) {
+  return (function->block_start_list[block]);
+}
+
+static struct IRInstruction *get_ir_block_last(struct IRFunction *function, int block) {
+  return (function->instruction_list[function->block_start_list[block + 1] - 1]);
+}
+
+// 基本块的后继的个数
+int get_ir_successor_number(struct IRFunction *function, int block) {
+  struct IRInstruction *instruction = get_ir_block_last(function, block);
+  int fall_through = (block + 1 < function->block_number);
+
+  switch (instruction->operation) {
+    case IR_JUMP: return (1);
+    case IR_BRANCH: return (1 + fall_through);
+    case IR_SWITCH: return (instruction->value + 1);
+    case IR_TAIL_CALL: return (instruction->label != NO_LABEL);
+  }
+  return (fall_through);
+}
+
+// 基本块的第 i 个后继
+int get_ir_successor(struct IRFunction *function, int block, int i) {
+  struct IRInstruction *instruction = get_ir_block_last(function, block);
+
+  switch (instruction->operation) {
+    case IR_JUMP:
+    case IR_TAIL_CALL:
+      return (get_ir_label_block(function, instruction->label));
+    case IR_BRANCH:
+      if (i == 0) return (get_ir_label_block(function, instruction->label));
+      return (block + 1);
+    case IR_SWITCH:
+      if (i < instruction->value)
+        return (get_ir_label_block(function, instruction->case_label_list[i]));
+      return (get_ir_label_block(function, instruction->label));
+  }
+  return (block + 1);
+}
+
+static char *ir_operation_name_list[] = {
+  "", "label", "goto", "if", "switch",
+  "constant", "string", "address", "copy", "load", "store", "load", "store",
+  "add", "subtract", "multiply", "divide", "mod",
+  "and", "or", "xor", "shift_left", "shift_right",
+  "negate", "invert", "logic_not", "to_boolean", "compare",
+  "parameter", "argument", "call", "tail_call", "return"
+};
+
+static char *ir_condition_name_list[] = { "==", "!=", "<", ">", "<=", ">=" };
+
+static void dump_ir_type(int primitive_type) {
+  int i;
+
+  switch (primitive_type & (~0xf)) {
+    case PRIMITIVE_VOID: printf("void"); break;
+    case PRIMITIVE_CHAR: printf("char"); break;
+    case PRIMITIVE_INT: printf("int"); break;
+    case PRIMITIVE_LONG: printf("long"); break;
+    default: printf("none");
+  }
+  for (i = 0; i < (primitive_type & 0xf); i++) printf("*");
+}
+
+// 第二个操作数，可能是立即数
+static void dump_ir_second_operand(struct IRInstruction *instruction) {
+  if (instruction->source2 == NO_REGISTER) printf("$%d", instruction->value);
+  else printf("v%d", instruction->source2);
+}
+
+// [vbase + vindex * scale + offset]
+static void dump_ir_address(struct IRInstruction *instruction) {
+  printf("[v%d", instruction->source1);
+  if (instruction->index != NO_REGISTER)
+    printf(" + v%d * %d", instruction->index, instruction->scale);
+  if (instruction->value) printf(" + %d", instruction->value);
+  printf("]");
+}
+
+static void dump_ir_instruction(struct IRInstruction *instruction) {
+  int operation = instruction->operation, i;
+
+  if (operation == IR_LABEL) {
+    printf("L%d:\n", instruction->label);
+    return;
+  }
+  printf("  ");
+  if (instruction->destination != NO_REGISTER)
+    printf("v%d = ", instruction->destination);
+  printf("%s", ir_operation_name_list[operation]);
+
+  switch (operation) {
+    case IR_JUMP:
+      printf(" L%d", instruction->label);
+      break;
+    case IR_BRANCH:
+      printf(" v%d %s ", instruction->source1, ir_condition_name_list[instruction->condition - AST_COMPARE_EQUALS]);
+      dump_ir_second_operand(instruction);
+      printf(" goto L%d", instruction->label);
+      break;
+    case IR_COMPARE:
+      printf(" v%d %s ", instruction->source1, ir_condition_name_list[instruction->condition - AST_COMPARE_EQUALS]);
+      dump_ir_second_operand(instruction);
+      break;
+    case IR_SWITCH:
+      printf(" v%d", instruction->source1);
+      for (i = 0; i < instruction->value; i++)
+        printf(" %d:L%d", instruction->case_value_list[i], instruction->case_label_list[i]);
+      printf(" default:L%d", instruction->label);
+      break;
+    case IR_CONSTANT:
+      printf(" %d", instruction->value);
+      break;
+    case IR_STRING:
+      printf(" L%d", instruction->value);
+      break;
+    case IR_ADDRESS:
+    case IR_LOAD_VARIABLE:
+      printf(" %s", instruction->symbol->name);
+      break;
+    case IR_STORE_VARIABLE:
+      printf(" %s = v%d", instruction->symbol->name, instruction->source1);
+      break;
+    case IR_LOAD:
+      printf(" ");
+      dump_ir_address(instruction);
+      break;
+    case IR_STORE:
+      printf(" ");
+      dump_ir_address(instruction);
+      printf(" = v%d", instruction->source2);
+      break;
+    case IR_PARAMETER:
+      printf(" %d %s", instruction->index, instruction->symbol->name);
+      break;
+    case IR_ARGUMENT:
+      printf(" %d/%d = v%d", instruction->index, instruction->value, instruction->source1);
+      break;
+    case IR_CALL:
+      printf(" %s/%d", instruction->symbol->name, instruction->value);
+      // 调用前后保存的 caller-saved 寄存器
+      for (i = 0; i < register_get_allocatable_register_number(); i++) {
+        if ((instruction->save_register_mask >> i) & 1)
+          printf(" save:%s", register_get_register_name(i));
+      }
+      break;
+    case IR_TAIL_CALL:
+      printf(" %s", instruction->symbol->name);
+      if (instruction->label != NO_LABEL) printf(" L%d", instruction->label);
+      break;
+    case IR_RETURN:
+      if (instruction->source1 != NO_REGISTER) printf(" v%d", instruction->source1);
+      break;
+    case IR_COPY:
+    case IR_NEGATE:
+    case IR_INVERT:
+    case IR_LOGIC_NOT:
+    case IR_TO_BOOLEAN:
+      printf(" v%d", instruction->source1);
+      break;
+    default:
+      printf(" v%d, ", instruction->source1);
+      dump_ir_second_operand(instruction);
+  }
+
+  switch (operation) {
+    case IR_BRANCH:
+    case IR_COMPARE:
+    case IR_COPY:
+    case IR_LOAD_VARIABLE:
+    case IR_STORE_VARIABLE:
+    case IR_LOAD:
+    case IR_STORE:
+    case IR_PARAMETER:
+    case IR_RETURN:
+      printf(" (");
+      dump_ir_type(instruction->primitive_type);
+      printf(")");
+  }
+  printf("\n");
+}
+
+// 每个虚拟寄存器分配到的寄存器或者栈槽，每行 8 个
+static void dump_ir_registers(struct IRFunction *function) {
+  int i;
+
+  for (i = 1; i < function->register_number; i++) {
+    if (i % 8 == 1) printf("registers:");
+    if (function->register_assignment[i] != NO_REGISTER)
+      printf(" v%d:%s", i, register_get_register_name(function->register_assignment[i]));
+    else if (function->spill_slot_list[i] >= 0)
+      printf(" v%d:slot%d", i, function->spill_slot_list[i]);
+    else
+      printf(" v%d:-", i);
+    if (i % 8 == 0 || i == function->register_number - 1) printf("\n");
+  }
+}
+
+// -L 时按基本块输出函数的三地址 IR，以及寄存器分配的结果
+static void dump_linear_ir(struct IRFunction *function) {
+  int i, block = -1;
+
+  printf("function %s\n", function->symbol->name);
+  for (i = 0; i < function->instruction_number; i++) {
+    if (function->instruction_list[i]->block != block) {
+      block = function->instruction_list[i]->block;
+      printf("block %d:\n", block);
+    }
+    dump_ir_instruction(function->instruction_list[i]);
+  }
+  dump_ir_registers(function);
+  printf("\n\n");
+}
+
+/**
+ * 函数的 IR 生成完毕，划分基本块、分配寄存器之后交给后端生成机器指令
+*/
+void finish_function_linear_ir(int tail_call_label) {
+  ir_function->tail_call_label = tail_call_label;
+  mark_ir_blocks(ir_function);
+  if (number_ir_values(ir_function)) mark_ir_blocks(ir_function);
+  allocate_ir_registers(ir_function);
+
+  if (output_dump_linear_ir) dump_linear_ir(ir_function);
+
+  register_generate_function(ir_function);
+  ir_function = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef __LINEAR_IR_H__
+#define __LINEAR_IR_H__
+
+#include "definations.h"
+
+void start_function_linear_ir(struct SymbolTable *function);
+void finish_function_linear_ir(int tail_call_label);
+int new_ir_register();
+struct IRInstruction *emit_ir(
+  int operation,
+  int primitive_type,
+  int destination,
+  int source1,
+  int source2
+);
+void emit_ir_label(int label);
+void emit_ir_jump(int label);
+void emit_ir_branch(
+  int condition,
+  int primitive_type,
+  int source1,
+  int source2,
+  int value,
+  int label
+);
+int emit_ir_constant(int destination, int value);
+int emit_ir_copy(int primitive_type, int destination, int source);
+int emit_ir_unary(int operation, int source);
+int emit_ir_binary(int operation, int primitive_type, int source1, int source2);
+int emit_ir_binary_constant(int operation, int primitive_type, int source, int value);
+int emit_ir_compare(int condition, int primitive_type, int source1, int source2, int value);
+int emit_ir_string(int label);
+int emit_ir_address(struct SymbolTable *t, int destination);
+int emit_ir_load_variable(struct SymbolTable *t);
+void emit_ir_store_variable(struct SymbolTable *t, int source);
+int emit_ir_load(int primitive_type, int base, int index, int scale, int offset);
+void emit_ir_store(int primitive_type, int source, int base, int index, int scale, int offset);
+int emit_ir_parameter(struct SymbolTable *t, int position, int destination);
+void emit_ir_argument(int source, int position, int argument_number);
+int emit_ir_call(struct SymbolTable *t, int argument_number);
+void emit_ir_tail_call(struct SymbolTable *t, int label);
+void emit_ir_return(int primitive_type, int source);
+void emit_ir_switch(
+  int source,
+  int case_count,
+  int *case_label,
+  int *case_value,
+  int label_default
+);
+int get_ir_successor_number(struct IRFunction *function, int block);
+int get_ir_successor(struct IRFunction *function, int block, int i);
+int get_ir_block_start(struct IRFunction *function, int block);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+#include "definations.h"
+#include "helper.h"
+#include "arena.h"
+#include "machine.h"
+
+// 机器指令记录
+// 后端把一个函数的三地址 IR 翻译成 x86-64 指令时，直接生成一条条 struct MachineInstruction，
+// 窥孔优化和省略栈帧指针都在这些记录上进行，最后一起写到 output_file
+// 记录都从 function_arena 中分配，函数结束后一起释放
+
+static char *machine_register_64_list[] = {
+  "%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%rbp", "%rsp",
+  "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
+};
+static char *machine_register_32_list[] = {
+  "%eax", "%ebx", "%ecx", "%edx", "%esi", "%edi", "%ebp", "%esp",
+  "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"
+};
+static char *machine_register_8_list[] = {
+  "%al", "%bl", "%cl", "%dl", "%sil", "%dil", "%bpl", "%spl",
+  "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"
+};
+
+static struct MachineInstruction *machine_head, *machine_tail;
+
+void start_machine_function() {
+  machine_head = NULL;
+  machine_tail = NULL;
+}
+
+// 返回这个函数的第一条记录
+struct MachineInstruction *finish_machine_function() {
+  return (machine_head);
+}
+
+// 形如 L12 的 label 返回 12，其余的返回 NO_LABEL
+static int get_machine_label_number(char *name) {
+  int i;
+
+  if (name[0] != 'L' || !name[1]) return (NO_LABEL);
+  for (i = 1; name[i]; i++) {
+    if (name[i] < '0' || name[i] > '9') return (NO_LABEL);
+  }
+  return (atoi(name + 1));
+}
+
+/**
+ * 在当前函数的末尾加上一条记录，operand0 是源操作数，没有的操作数为 NULL
+ * 跳转指令的目标是 Lx 时记下 x
+*/
+struct MachineInstruction *emit_machine_instruction(
+  int kind,
+  char *opcode,
+  char *operand0,
+  char *operand1
+) {
+  struct MachineInstruction *instruction = (struct MachineInstruction *)
+    allocate_from_arena(function_arena, sizeof(struct MachineInstruction));
+
+  instruction->operand_list =
+    (char **) allocate_from_arena(function_arena, MACHINE_MAX_OPERAND_NUMBER * sizeof(char *));
+  instruction->kind = (char) kind;
+  instruction->opcode = opcode;
+  instruction->label = NO_LABEL;
+  if (operand0) {
+    instruction->operand_list[0] = operand0;
+    instruction->operand_number = 1;
+  }
+  if (operand1) {
+    instruction->operand_list[1] = operand1;
+    instruction->operand_number = 2;
+  }
+  if ((kind == MACHINE_JUMP || kind == MACHINE_BRANCH) && operand0)
+    instruction->label = get_machine_label_number(operand0);
+
+  instruction->prev = machine_tail;
+  if (machine_tail) machine_tail->next = instruction;
+  else machine_head = instruction;
+  machine_tail = instruction;
+  return (instruction);
+}
+
+void emit_machine_label(int label) {
+  struct MachineInstruction *instruction =
+    emit_machine_instruction(MACHINE_LABEL, format_label_operand(label), NULL, NULL);
+  instruction->label = label;
+}
+
+void emit_machine_directive(char *opcode, char *operand) {
+  emit_machine_instruction(MACHINE_DIRECTIVE, opcode, operand, NULL);
+}
+
+// 按照 format 格式化一个整数，结果放在 function_arena 中
+char *format_machine_text(char *format, long value) {
+  char *s = (char *) allocate_from_arena(function_arena, 32);
+
+  snprintf(s, 32, format, value);
+  return (s);
+}
+
+char *format_label_operand(int label) {
+  return (format_machine_text("L%ld", label));
+}
+
+static void print_machine_instruction(FILE *file, struct MachineInstruction *instruction) {
+  int i;
+
+  if (instruction->kind == MACHINE_LABEL) {
+    fprintf(file, "%s:\n", instruction->opcode);
+    return;
+  }
+
+  fprintf(file, "\t%s", instruction->opcode);
+  for (i = 0; i < instruction->operand_number; i++) {
+    if (i == 0) fputc('\t', file);
+    else fputs(", ", file);
+    fputs(instruction->operand_list[i], file);
+  }
+  fputc('\n', file);
+}
+
+void print_machine_instructions(FILE *file, struct MachineInstruction *head) {
+  struct MachineInstruction *instruction;
+
+  for (instruction = head; instruction; instruction = instruction->next)
+    print_machine_instruction(file, instruction);
+}
+
+/**
+ * 返回 size 字节宽的寄存器名字对应的编号(0 到 15)，不是这个宽度的寄存器返回 -1
+ * 同一个寄存器不同宽度的名字编号相同
+*/
+int find_machine_register(char *name, int size) {
+  char **list;
+  int i;
+
+  if (name[0] != '%') return (-1);
+  if (size == 1) list = machine_register_8_list;
+  else if (size == 4) list = machine_register_32_list;
+  else list = machine_register_64_list;
+  for (i = 0; i < MACHINE_REGISTER_NUMBER; i++) {
+    if (!strcmp(name, list[i])) return (i);
+  }
+  return (-1);
+}
@@ -0,0 +1,24 @@
+#ifndef __MACHINE_H__
+#define __MACHINE_H__
+
+#include <stdio.h>
+#include "definations.h"
+
+#define MACHINE_REGISTER_NUMBER 16
+
+void start_machine_function();
+struct MachineInstruction *finish_machine_function();
+struct MachineInstruction *emit_machine_instruction(
+  int kind,
+  char *opcode,
+  char *operand0,
+  char *operand1
+);
+void emit_machine_label(int label);
+void emit_machine_directive(char *opcode, char *operand);
+char *format_machine_text(char *format, long value);
+char *format_label_operand(int label);
+void print_machine_instructions(FILE *file, struct MachineInstruction *head);
+int find_machine_register(char *name, int size);
+
+#endif
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 #define extern_
   #include "data.h"
@@ -13,13 +15,25 @@
 #include "parser.h"
 #include "interpreter.h"
 #include "generator.h"
+#include "generator_core.h"
 #include "statement.h"
 #include "helper.h"
 #include "declaration.h"
 #include "symbol_table.h"
+#include "assembler.h"
+#include "preprocess.h"
+#include "arena.h"
+#include "peephole.h"
+#include "inliner.h"
+#include "frame.h"
+#include "register_allocator.h"
+#include "value_numbering.h"
 
 #define MAX_OBJECT_FILE_NUMBER 100
 
+// -j 选项，同时编译的文件个数，1 表示按顺序逐个编译
+static int parallel_job_number;
+
 static void init() {
   output_dump_ast = 0;
   output_keep_object_file = 0;
@@ -27,16 +41,24 @@ static void init() {
   output_binary_file = 1;
   output_verbose = 0;
   output_dump_symbol_table = 0;
+  output_dump_linear_ir = 0;
+  inline_limit = 16;
+  no_plt = 0;
+  parallel_job_number = 1;
 }
 
 static void usage_info(char *info) {
-  fprintf(stderr, "Usage: %s [-vcSTM] [-o output file] file [file ...]\n", info);
+  fprintf(stderr, "Usage: %s [-vcSTML] [-j jobs] [-fno-plt] [-finline-limit=n] [-o output file] file [file ...]\n", info);
   fprintf(stderr, "       -c generate object files but don't link them\n");
   fprintf(stderr, "       -S generate assembly files but don't link them\n");
   fprintf(stderr, "       -T dump the AST trees for each input file\n");
   fprintf(stderr, "       -o output file, produce the output file executable file\n");
   fprintf(stderr, "       -v give verbose output of the compilation stages\n");
   fprintf(stderr, "       -M dump the symbol table for each input file\n");
+  fprintf(stderr, "       -L dump the linear IR for each function\n");
+  fprintf(stderr, "       -j compile up to jobs files at once, one process per file\n");
+  fprintf(stderr, "       -fno-plt call external functions through the GOT instead of the PLT\n");
+  fprintf(stderr, "       -finline-limit=n inline functions with at most n AST nodes, 0 disables inlining\n");
   exit(1);
 }
 
@@ -85,9 +107,24 @@ void clear_all_static_symbol() {
   prev_symbol_table = current_symbol_table;
 }
 
+// -v 时输出内存的使用情况
+// allocated 是从 arena 分配出去的字节数，reserved 是 arena 向系统申请的字节数
+static void print_memory_statistics() {
+  struct rusage *usage = (struct rusage *) malloc(sizeof(struct rusage));
+
+  printf("arena: %ld bytes allocated for functions, %ld bytes reserved\n",
+    function_arena->allocated_bytes, function_arena->reserved_bytes);
+  printf("arena: %ld bytes allocated for the translation unit, %ld bytes reserved\n",
+    translation_unit_arena->allocated_bytes, translation_unit_arena->reserved_bytes);
+  if (!getrusage(RUSAGE_SELF, usage))
+    printf("peak RSS: %ld KB\n", usage->ru_maxrss);
+  free(usage);
+}
+
 // 编译成汇编代码
 static char *do_compile(char *filename) {
-  char cmd[TEXT_LENGTH];
+  char *preprocessed_text;
+  int preprocessed_length;
 
   global_output_filename = modify_string_suffix(filename, 's');
   if (!global_output_filename) {
@@ -95,13 +132,15 @@ static char *do_compile(char *filename) {
     exit(1);
   }
 
-  // 先生成一个预处理器的命令行
+  // 用内置的预处理器把源文件展开到内存中，再交给 scan.c 读取
   // INCLUDE_DIRECTORY 在 Makefile 里面找到
-  snprintf(cmd, TEXT_LENGTH, "%s %s %s", CPP_CMD, INCDIR, filename);
-  if (!(input_file = popen(cmd, "r"))) {
+  // 预处理的结果已经在内存中，scan.c 直接在这块缓冲区上扫描
+  preprocessed_text = preprocess_file(filename, INCDIR, &preprocessed_length);
+  if (!preprocessed_text) {
     fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
     exit(1);
   }
+  input_pointer = preprocessed_text;
   global_input_filename = filename;
 
   // 用 output_file 来模拟一个被生成的汇编文件
@@ -126,8 +165,8 @@ static char *do_compile(char *filename) {
   generate_postamble_code();
 
   // 关闭文件
-  fclose(input_file);
   fclose(output_file);
+  free(preprocessed_text);
 
   if (output_dump_symbol_table) {
     printf("Symbols for %s\n", filename);
@@ -137,6 +176,16 @@ static char *do_compile(char *filename) {
 
   clear_all_static_symbol();
 
+  if (output_verbose) {
+    print_memory_statistics();
+    print_inline_statistics();
+    print_tail_call_statistics();
+    print_value_numbering_statistics();
+    print_register_allocation_statistics();
+    print_peephole_statistics();
+    print_frame_statistics();
+  }
+
   return (global_output_filename);
 }
 
@@ -150,6 +199,17 @@ char *do_assemble(char *filename) {
     exit(1);
   }
 
+  // 先用集成汇编器，遇到它不认识的写法再交给外部的 as
+  // 集成汇编器只认识 x86-64，其它后端直接用 as
+  if (register_use_integrated_assembler()) {
+    if (!assemble_file(filename, output_filename)) {
+      if (output_verbose) printf("assembled %s with the integrated assembler\n", filename);
+      return (output_filename);
+    }
+    if (output_verbose)
+      printf("integrated assembler: %s, falling back to as\n", get_assembler_error());
+  }
+
   snprintf(cmd, TEXT_LENGTH, "%s %s %s", AS_CMD, output_filename, filename);
   if (output_verbose) printf("%s\n", cmd);
   error = system(cmd);
@@ -190,11 +250,124 @@ void do_unlink(char *filename) {
   unlink(filename);
 }
 
+// 编译单个文件，按需汇编，返回 object 文件名
+// 如果不需要生成 object 文件则返回 NULL
+static char *do_compile_single_file(char *filename) {
+  char *assembly_file, *object_file = NULL;
+
+  assembly_file = do_compile(filename);
+  if (output_binary_file || output_keep_object_file)
+    object_file = do_assemble(assembly_file);
+  if (!output_keep_assembly_file) do_unlink(assembly_file);
+  return (object_file);
+}
+
+// 子进程的 stdout/stderr 会先写到日志文件中，等父进程按文件顺序收集时再回放
+// 这样 -v/-T/-M 的输出以及错误信息跟顺序编译时是一样的
+static char *get_job_log_filename(int parent_pid, int index, char *suffix) {
+  char buffer[TEXT_LENGTH];
+  snprintf(buffer, TEXT_LENGTH, "/tmp/zcc-%d-%d.%s", parent_pid, index, suffix);
+  return (strdup(buffer));
+}
+
+static void replay_job_log(char *log_filename, FILE *stream) {
+  FILE *log_file;
+  int c;
+
+  if ((log_file = fopen(log_filename, "r"))) {
+    while ((c = fgetc(log_file)) != EOF) fputc(c, stream);
+    fclose(log_file);
+  }
+  fflush(stream);
+  do_unlink(log_filename);
+}
+
+// fork 一个子进程去编译第 index 个文件，返回子进程的 pid
+static int spawn_compile_job(char *filename, int index, int parent_pid) {
+  int pid;
+
+  // fork 之前要把缓冲区清掉，不然子进程会把父进程还没输出的内容再输出一遍
+  fflush(stdout);
+  fflush(stderr);
+
+  pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Unable to fork for %s: %s\n", filename, strerror(errno));
+    exit(1);
+  }
+  if (pid) return (pid);
+
+  // 子进程
+  if (!freopen(get_job_log_filename(parent_pid, index, "out"), "w", stdout) ||
+      !freopen(get_job_log_filename(parent_pid, index, "err"), "w", stderr))
+    exit(1);
+  do_compile_single_file(filename);
+  exit(0);
+  return (0);
+}
+
+// 收集第 index 个文件的编译结果，回放它的输出
+// 返回 1 表示编译成功，0 表示失败
+static int collect_compile_job(int pid, int index, int parent_pid, int replay) {
+  int status = 0;
+  char *out_log = get_job_log_filename(parent_pid, index, "out");
+  char *err_log = get_job_log_filename(parent_pid, index, "err");
+
+  waitpid(pid, &status, 0);
+  if (replay) {
+    replay_job_log(out_log, stdout);
+    replay_job_log(err_log, stderr);
+  } else {
+    do_unlink(out_log);
+    do_unlink(err_log);
+  }
+  return (status == 0);
+}
+
+// 同时最多跑 parallel_job_number 个子进程，每个子进程编译一个文件
+// 总是按照命令行的顺序收集结果，所以 object 文件列表以及第一个报错的文件都是确定的
+// 一旦某个文件编译失败，后面的文件的输出就丢掉，并清理它们生成的文件，跟顺序编译时的行为一致
+static int do_parallel_compile(char **filename_list, int count, char **object_file_list) {
+  int *pid_list;
+  int parent_pid = getpid();
+  int next_spawn = 0, next_collect = 0, failed = 0, object_file_count = 0;
+
+  pid_list = (int *) malloc(count * sizeof(int));
+
+  while (next_collect < count) {
+    // 窗口内还有空位就继续派发
+    if (!failed &&
+        next_spawn < count &&
+        next_spawn - next_collect < parallel_job_number) {
+      pid_list[next_spawn] = spawn_compile_job(filename_list[next_spawn], next_spawn, parent_pid);
+      next_spawn++;
+    } else {
+      if (!collect_compile_job(pid_list[next_collect], next_collect, parent_pid, !failed)) {
+        failed = 1;
+      } else if (failed) {
+        // 失败之后编译出来的文件顺序编译时本来不会生成，这里要删掉
+        if (output_binary_file || output_keep_object_file)
+          do_unlink(modify_string_suffix(filename_list[next_collect], 'o'));
+        if (output_keep_assembly_file)
+          do_unlink(modify_string_suffix(filename_list[next_collect], 's'));
+      } else if (output_binary_file) {
+        object_file_list[object_file_count++] = modify_string_suffix(filename_list[next_collect], 'o');
+      }
+      next_collect++;
+      // 失败之后不再派发新的子进程，只等已经派发的跑完
+      if (failed && next_collect >= next_spawn) break;
+    }
+  }
 
+  if (failed) exit(1);
+
+  object_file_list[object_file_count] = NULL;
+  return (object_file_count);
+}
 
 int main(int argc, char **argv) {
   char *output_filename = A_OUT;
-  char *assembly_file, *object_file;
+  char *object_file;
   char *object_file_list[MAX_OBJECT_FILE_NUMBER];
   int i, j, object_file_count = 0;
 
@@ -219,6 +392,25 @@ int main(int argc, char **argv) {
           break;
         case 'v': output_verbose = 1; break;
         case 'M': output_dump_symbol_table = 1; break;
+        case 'L': output_dump_linear_ir = 1; break;
+        case 'j':
+          // -j4 和 -j 4 都可以
+          if (argv[i][j + 1]) {
+            parallel_job_number = atoi(argv[i] + j + 1);
+            j = (int) strlen(argv[i]) - 1;
+          } else {
+            if (i + 1 >= argc) usage_info(argv[0]);
+            parallel_job_number = atoi(argv[++i]);
+          }
+          if (parallel_job_number < 1) usage_info(argv[0]);
+          break;
+        case 'f':
+          if (!strcmp(argv[i] + j, "fno-plt")) no_plt = 1;
+          else if (!strncmp(argv[i] + j, "finline-limit=", 14)) inline_limit = atoi(argv[i] + j + 14);
+          else usage_info(argv[0]);
+          // 整个参数都已经处理完了
+          j = (int) strlen(argv[i]) - 1;
+          break;
         default: usage_info(argv[0]);
       }
     }
@@ -226,22 +418,25 @@ int main(int argc, char **argv) {
 
   if (i >= argc) usage_info(argv[0]);
 
-  // 轮流编译文件
-  while (i < argc) {
-    assembly_file = do_compile(argv[i]);
+  // 只有链接时才要把 object 文件名都记下来
+  if (output_binary_file && argc - i > MAX_OBJECT_FILE_NUMBER - 2) {
+    fprintf(stderr, "Too many object files for the compiler to handle\n");
+    exit(1);
+  }
 
-    if (output_binary_file || output_keep_object_file) {
-      object_file = do_assemble(assembly_file);
-      if (object_file_count == (MAX_OBJECT_FILE_NUMBER - 2)) {
-        fprintf(stderr, "Too many object files for the compiler to handle\n");
-        exit(1);
+  if (parallel_job_number > 1 && argc - i > 1) {
+    // 并行编译
+    object_file_count = do_parallel_compile(argv + i, argc - i, object_file_list);
+  } else {
+    // 轮流编译文件
+    while (i < argc) {
+      object_file = do_compile_single_file(argv[i]);
+      if (object_file && output_binary_file) {
+        object_file_list[object_file_count++] = object_file;
+        object_file_list[object_file_count] = NULL;
       }
-      object_file_list[object_file_count++] = object_file;
-      object_file_list[object_file_count] = NULL;
+      i++;
     }
-
-    if (!output_keep_assembly_file) do_unlink(assembly_file);
-    i++;
   }
 
   if (output_binary_file) {
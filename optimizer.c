@@ -2,36 +2,137 @@
 #include "definations.h"
 #include "declaration.h"
 #include "ast.h"
+#include "types.h"
+#include "arena.h"
 
-static struct ASTNode *fold_2_children(struct ASTNode *node) {
-  int value, left_value, right_value;
+// 常量折叠和代数化简
+//
+// 生成的代码里 char/int/long 的运算都是在 64 位寄存器里面做的，
+// 折叠时也先按 long 计算，再按节点的类型截断：
+// char 和 int 截断成 int，与寄存器的低 32 位一致
+// long 和指针的结果如果放不进 int 的字面量里，就不折叠，留给运行时计算
+
+static int check_fit_in_int(long value) {
+  return (value >= -2147483647 - 1 && value <= 2147483647);
+}
+
+// 折叠之后的节点原地改成整数字面量，不再新建节点，
+// 省掉一次 arena 分配，父节点的指针也不用变
+static struct ASTNode *make_integer_literal(struct ASTNode *node, long value) {
+  if (node->primitive_type == PRIMITIVE_LONG ||
+      check_pointer_type(node->primitive_type)) {
+    if (!check_fit_in_int(value)) return (node);
+  }
+
+  node->operation = (char) AST_INTEGER_LITERAL;
+  node->ast_node_integer_value = (int) value;
+  set_ast_left(node, NULL);
+  set_ast_middle(node, NULL);
+  set_ast_right(node, NULL);
+  set_ast_symbol_table(node, NULL);
+  set_ast_composite_type(node, NULL);
+  return (node);
+}
+
+static int check_integer_literal(struct ASTNode *node, int value) {
+  return (node &&
+    node->operation == AST_INTEGER_LITERAL &&
+    node->ast_node_integer_value == value);
+}
 
-  left_value = node->left->ast_node_integer_value;
-  right_value = node->right->ast_node_integer_value;
+// 子树里有没有赋值、函数调用、自增自减这种有副作用的节点
+int check_side_effect(struct ASTNode *node) {
+  if (!node) return (0);
 
   switch (node->operation) {
-    case AST_PLUS:
-      value = left_value + right_value;
+    case AST_ASSIGN:
+    case AST_ASSIGN_PLUS:
+    case AST_ASSIGN_MINUS:
+    case AST_ASSIGN_MULTIPLY:
+    case AST_ASSIGN_DIVIDE:
+    case AST_ASSIGN_MOD:
+    case AST_FUNCTION_CALL:
+    case AST_PRE_INCREASE:
+    case AST_PRE_DECREASE:
+    case AST_POST_INCREASE:
+    case AST_POST_DECREASE:
+      return (1);
+  }
+
+  return (
+    check_side_effect(get_ast_left(node)) ||
+    check_side_effect(get_ast_middle(node)) ||
+    check_side_effect(get_ast_right(node))
+  );
+}
+
+// 计算两个常量的二元运算，不能在编译时计算的返回 0
+// is_wide 表示结果是 long 或者指针
+static int calculate_binary_operation(
+  int operation,
+  long left_value,
+  long right_value,
+  int is_wide,
+  long *value
+) {
+  switch (operation) {
+    case AST_PLUS: *value = left_value + right_value; break;
+    case AST_MINUS: *value = left_value - right_value; break;
+    case AST_MULTIPLY: *value = left_value * right_value; break;
+    case AST_DIVIDE:
+      if (!right_value) return (0);
+      *value = left_value / right_value;
       break;
-    case AST_MINUS:
-      value = left_value - right_value;
+    case AST_MOD:
+      if (!right_value) return (0);
+      *value = left_value % right_value;
       break;
-    case AST_MULTIPLY:
-      value = left_value * right_value;
+    case AST_AMPERSAND: *value = left_value & right_value; break;
+    case AST_OR: *value = left_value | right_value; break;
+    case AST_XOR: *value = left_value ^ right_value; break;
+    // 移位用的是 %cl，只有低 6 位有效
+    case AST_LEFT_SHIFT:
+      if (right_value < 0 || right_value > 63) return (0);
+      *value = left_value << right_value;
       break;
-    case AST_DIVIDE:
-      if (!right_value) return (node);
-      value = left_value / right_value;
+    // 运行时是 64 位的逻辑右移，负数只有在截断成 int 之后才和算术右移一致
+    case AST_RIGHT_SHIFT:
+      if (right_value < 0 || right_value > 63) return (0);
+      if (left_value < 0 && (is_wide || right_value > 31)) return (0);
+      *value = left_value >> right_value;
       break;
+    case AST_COMPARE_EQUALS: *value = left_value == right_value; break;
+    case AST_COMPARE_NOT_EQUALS: *value = left_value != right_value; break;
+    case AST_COMPARE_LESS_THAN: *value = left_value < right_value; break;
+    case AST_COMPARE_GREATER_THAN: *value = left_value > right_value; break;
+    case AST_COMPARE_LESS_EQUALS: *value = left_value <= right_value; break;
+    case AST_COMPARE_GREATER_EQUALS: *value = left_value >= right_value; break;
+    case AST_LOGIC_AND: *value = left_value && right_value; break;
+    case AST_LOGIC_OR: *value = left_value || right_value; break;
     default:
-      return (node);
+      return (0);
   }
+  return (1);
+}
+
+static struct ASTNode *fold_2_children(struct ASTNode *node) {
+  long value;
+  int is_wide = node->primitive_type == PRIMITIVE_LONG ||
+    check_pointer_type(node->primitive_type);
+
+  if (!calculate_binary_operation(
+      node->operation,
+      get_ast_left(node)->ast_node_integer_value,
+      get_ast_right(node)->ast_node_integer_value,
+      is_wide,
+      &value))
+    return (node);
 
-  return (create_ast_leaf(AST_INTEGER_LITERAL, node->primitive_type, value, NULL, NULL));
+  return (make_integer_literal(node, value));
 }
 
 static struct ASTNode *fold_1_children(struct ASTNode *node) {
-  int value = node->left->ast_node_integer_value;
+  long value = get_ast_left(node)->ast_node_integer_value;
 
   switch (node->operation) {
     // 如果是 x = 3000 + 1;
@@ -39,27 +140,289 @@ static struct ASTNode *fold_1_children(struct ASTNode *node) {
     case AST_WIDEN: break;
     case AST_INVERT: value = ~value; break;
     case AST_LOGIC_NOT: value = !value; break;
+    case AST_NEGATE: value = -value; break;
+    case AST_TO_BE_BOOLEAN: value = value != 0; break;
+    case AST_SCALE: value = value * node->ast_node_scale_size; break;
+    // char 是按无符号的方式读取的
+    case AST_TYPE_CASTING:
+      if (node->primitive_type == PRIMITIVE_CHAR) value = value & 255;
+      break;
     default: return (node);
   }
 
-  return (create_ast_leaf(AST_INTEGER_LITERAL, node->primitive_type, value, NULL, NULL));
+  return (make_integer_literal(node, value));
+}
+
+// 用子节点替换 node，类型不一致时不能替换
+// 比如访问 struct 成员时，struct 的基地址加上 0 偏移量的节点类型是成员的指针
+// 替换是把子节点的内容复制到 node 中，node 的下标不变，父节点不用修改
+static struct ASTNode *replace_with_child(struct ASTNode *node, struct ASTNode *child) {
+  if (child->primitive_type != node->primitive_type ||
+      get_ast_composite_type(child) != get_ast_composite_type(node))
+    return (node);
+
+  node->operation = child->operation;
+  node->rvalue = child->rvalue;
+  node->ast_node_integer_value = child->ast_node_integer_value;
+  node->left_index = child->left_index;
+  node->middle_index = child->middle_index;
+  node->right_index = child->right_index;
+  set_ast_symbol_table(node, get_ast_symbol_table(child));
+  return (node);
+}
+
+// 只有一边是常量时的代数化简，返回化简之后的节点
+static struct ASTNode *simplify(struct ASTNode *node) {
+  struct ASTNode *left = get_ast_left(node), *right = get_ast_right(node);
+
+  switch (node->operation) {
+    case AST_PLUS:
+    case AST_OR:
+    case AST_XOR:
+      if (check_integer_literal(right, 0)) return (replace_with_child(node, left));
+      if (check_integer_literal(left, 0)) return (replace_with_child(node, right));
+      break;
+    case AST_MINUS:
+    case AST_LEFT_SHIFT:
+    case AST_RIGHT_SHIFT:
+      if (check_integer_literal(right, 0)) return (replace_with_child(node, left));
+      break;
+    case AST_DIVIDE:
+      if (check_integer_literal(right, 1)) return (replace_with_child(node, left));
+      break;
+    case AST_MULTIPLY:
+      if (check_integer_literal(right, 1)) return (replace_with_child(node, left));
+      if (check_integer_literal(left, 1)) return (replace_with_child(node, right));
+      // x * 0 只有在 x 没有副作用的时候才能去掉
+      if (check_integer_literal(right, 0) && !check_side_effect(left))
+        return (make_integer_literal(node, 0));
+      if (check_integer_literal(left, 0) && !check_side_effect(right))
+        return (make_integer_literal(node, 0));
+      break;
+    case AST_AMPERSAND:
+      if (check_integer_literal(right, -1)) return (replace_with_child(node, left));
+      if (check_integer_literal(left, -1)) return (replace_with_child(node, right));
+      if (check_integer_literal(right, 0) && !check_side_effect(left))
+        return (make_integer_literal(node, 0));
+      if (check_integer_literal(left, 0) && !check_side_effect(right))
+        return (make_integer_literal(node, 0));
+      break;
+    // -(-x) 和 ~(~x)
+    case AST_NEGATE:
+    case AST_INVERT:
+      if (left->operation == node->operation) return (replace_with_child(node, get_ast_left(left)));
+      break;
+    // 短路求值，右边本来就不会执行
+    case AST_LOGIC_AND:
+      if (check_integer_literal(left, 0)) return (make_integer_literal(node, 0));
+      break;
+    case AST_LOGIC_OR:
+      if (left->operation == AST_INTEGER_LITERAL && left->ast_node_integer_value)
+        return (make_integer_literal(node, 1));
+      break;
+  }
+
+  return (node);
+}
+
+// 条件是否是常量，是的话把它的真假放到 value 里面
+// 条件节点本身不会被修改
+static int check_constant_condition(struct ASTNode *node, int *value) {
+  long result;
+
+  if (!node) return (0);
+  if (node->operation == AST_TO_BE_BOOLEAN) node = get_ast_left(node);
+
+  if (node->operation == AST_INTEGER_LITERAL) {
+    *value = node->ast_node_integer_value != 0;
+    return (1);
+  }
+
+  if (node->operation >= AST_COMPARE_EQUALS &&
+      node->operation <= AST_COMPARE_GREATER_EQUALS &&
+      get_ast_left(node)->operation == AST_INTEGER_LITERAL &&
+      get_ast_right(node)->operation == AST_INTEGER_LITERAL &&
+      calculate_binary_operation(
+        node->operation,
+        get_ast_left(node)->ast_node_integer_value,
+        get_ast_right(node)->ast_node_integer_value,
+        0,
+        &result)) {
+    *value = result != 0;
+    return (1);
+  }
+  return (0);
+}
+
+// 折叠时每个节点的标记
+#define FOLD_CONDITION 1  // if/while/三元表达式的条件节点
+#define FOLD_VISITED 2    // 已经折叠过
+
+static char *fold_flag_list;
+static int fold_start_index;
+static int fold_end_index;
+
+// 子树已经折叠完的节点：不在这次折叠的范围内，或者已经折叠过
+static int check_node_folded(int index) {
+  if (index < fold_start_index || index >= fold_end_index) return (1);
+  return (fold_flag_list[index - fold_start_index] & FOLD_VISITED);
 }
 
-static struct ASTNode *fold(struct ASTNode *node) {
+static void fold_node(int index);
+
+// 折叠一个节点，子节点都已经折叠过
+static void fold_children_folded(struct ASTNode *node, int flag) {
+  struct ASTNode *left = get_ast_left(node), *right = get_ast_right(node);
+  struct ASTNode *branch;
+  int value;
+
+  switch (node->operation) {
+    case AST_IF:
+    case AST_WHILE:
+      return;
+    // 条件是常量的三元表达式，直接换成对应的分支
+    case AST_TERNARY:
+      if (check_constant_condition(left, &value)) {
+        branch = right;
+        if (value) branch = get_ast_middle(node);
+        replace_with_child(node, branch);
+      }
+      return;
+  }
+
+  // if/while/三元表达式的条件节点要保留下来，生成器靠它产生条件跳转，
+  // 所以条件节点只折叠它的子树
+  if (flag & FOLD_CONDITION) {
+    if (node->operation >= AST_COMPARE_EQUALS && node->operation <= AST_COMPARE_GREATER_EQUALS)
+      return;
+    if (node->operation == AST_TO_BE_BOOLEAN) return;
+  }
+
+  if (left && left->operation == AST_INTEGER_LITERAL) {
+    if (right && right->operation == AST_INTEGER_LITERAL) {
+      fold_2_children(node);
+      return;
+    }
+    if (!right) {
+      fold_1_children(node);
+      return;
+    }
+  }
+
+  if (left) simplify(node);
+}
+
+// 子节点的下标一般比父节点小，按下标的顺序折叠时已经折叠过了
+// 内联展开的表达式和 switch 的 case 链表是先建父节点的，这时先折叠子节点
+static void fold_node(int index) {
+  struct ASTNode *node = get_ast_node(index);
+  int i = index - fold_start_index;
+
+  fold_flag_list[i] = (char) (fold_flag_list[i] | FOLD_VISITED);
+  if (!check_node_folded(node->left_index)) fold_node(node->left_index);
+  if (!check_node_folded(node->middle_index)) fold_node(node->middle_index);
+  if (!check_node_folded(node->right_index)) fold_node(node->right_index);
+  fold_children_folded(node, fold_flag_list[i]);
+}
+
+/**
+ * 常量折叠，按下标的顺序扫描上次折叠之后新建的节点，而不是递归地遍历树
+ * 节点都是原地修改的，所以不在树上的节点也折叠了也没有关系
+*/
+static void fold() {
+  struct ASTNode *node;
+  int i;
+
+  fold_start_index = get_new_ast_node_start();
+  fold_end_index = get_ast_node_number();
+  if (fold_start_index >= fold_end_index) return;
+  fold_flag_list = (char *) allocate_from_arena(function_arena, fold_end_index - fold_start_index);
+
+  for (i = fold_start_index; i < fold_end_index; i++) {
+    node = get_ast_node(i);
+    if (node->operation == AST_IF || node->operation == AST_WHILE || node->operation == AST_TERNARY) {
+      if (!check_node_folded(node->left_index))
+        fold_flag_list[node->left_index - fold_start_index] = (char) FOLD_CONDITION;
+    }
+  }
+
+  for (i = fold_start_index; i < fold_end_index; i++) {
+    if (!check_node_folded(i)) fold_node(i);
+  }
+}
+
+// 能否从这条语句的后面继续往下执行
+// return/break/continue 之后不能，if 的两个分支都不能继续执行时也不能
+// 结果由 eliminate_dead_code 记在节点上，这里不再遍历子树
+int check_terminal_statement(struct ASTNode *node) {
+  if (!node) return (0);
+  return (node->terminal);
+}
+
+// 死代码消除，node 是一条语句，返回删除之后的语句，整条语句都删除时返回 NULL
+// 1. AST_GLUE 中 return/break/continue 之后的语句执行不到
+// 2. 条件是常量的 if 只保留一个分支，while (0) 整个删除，while (1) 不再判断条件
+// 3. 没有副作用的表达式语句，比如 x + 1;
+// 返回的语句上记下 terminal，后面的 AST_GLUE 和代码生成直接读取
+static struct ASTNode *eliminate_dead_code(struct ASTNode *node) {
+  struct ASTNode *c;
+  int value;
+
   if (!node) return (NULL);
 
-  node->left = fold(node->left);
-  node->right = fold(node->right);
+  switch (node->operation) {
+    case AST_GLUE:
+      set_ast_left(node, eliminate_dead_code(get_ast_left(node)));
+      if (check_terminal_statement(get_ast_left(node))) return (get_ast_left(node));
+      set_ast_right(node, eliminate_dead_code(get_ast_right(node)));
+      if (!get_ast_left(node)) return (get_ast_right(node));
+      if (!get_ast_right(node)) return (get_ast_left(node));
+      node->terminal = (char) check_terminal_statement(get_ast_right(node));
+      return (node);
+
+    case AST_IF:
+      if (check_constant_condition(get_ast_left(node), &value)) {
+        if (value) return (eliminate_dead_code(get_ast_middle(node)));
+        return (eliminate_dead_code(get_ast_right(node)));
+      }
+      set_ast_middle(node, eliminate_dead_code(get_ast_middle(node)));
+      set_ast_right(node, eliminate_dead_code(get_ast_right(node)));
+      if (!get_ast_middle(node) && !get_ast_right(node) && !check_side_effect(get_ast_left(node)))
+        return (NULL);
+      node->terminal = (char) (
+        check_terminal_statement(get_ast_middle(node)) &&
+        check_terminal_statement(get_ast_right(node))
+      );
+      return (node);
 
-  if (node->left && node->left->operation == AST_INTEGER_LITERAL)
-    if (node->right && node->right->operation == AST_INTEGER_LITERAL)
-      node = fold_2_children(node);
-    else
-      node = fold_1_children(node);
+    case AST_WHILE:
+      if (check_constant_condition(get_ast_left(node), &value)) {
+        if (!value) return (NULL);
+        set_ast_left(node, NULL);
+      }
+      set_ast_right(node, eliminate_dead_code(get_ast_right(node)));
+      return (node);
 
+    case AST_SWITCH:
+      for (c = get_ast_right(node); c; c = get_ast_right(c))
+        set_ast_left(c, eliminate_dead_code(get_ast_left(c)));
+      return (node);
+
+    case AST_RETURN:
+    case AST_BREAK:
+    case AST_CONTINUE:
+      node->terminal = 1;
+      return (node);
+  }
+
+  if (!check_side_effect(node)) return (NULL);
   return (node);
 }
 
 struct ASTNode *optimise(struct ASTNode *node) {
-  return (fold(node));
+  fold();
+  // 函数体才做死代码消除，全局变量的初始值也会经过这里
+  if (node && node->operation == AST_FUNCTION)
+    set_ast_left(node, eliminate_dead_code(get_ast_left(node)));
+  return (node);
 }
@@ -2,5 +2,7 @@
 #define __OPTIMIZER_H__
 
 struct ASTNode *optimise(struct ASTNode *node);
+int check_terminal_statement(struct ASTNode *node);
+int check_side_effect(struct ASTNode *node);
 
 #endif
@@ -12,6 +12,7 @@
 #include "parser.h"
 #include "generator.h"
 #include "declaration.h"
+#include "inliner.h"
 
 static struct ASTNode *parse_paren_expression(int previous_token_precedence);
 
@@ -179,7 +180,7 @@ static struct ASTNode *create_ast_node_from_expression(int previous_token_preced
       break;
 
     case TOKEN_IDENTIFIER:
-      enum_pointer = find_enum_value_symbol(text_buffer);
+      enum_pointer = find_enum_value_symbol(interned_text_buffer);
       if (enum_pointer) {
         node = create_ast_leaf(
           AST_INTEGER_LITERAL,
@@ -189,7 +190,7 @@ static struct ASTNode *create_ast_node_from_expression(int previous_token_preced
           NULL);
         break;
       }
-      var_pointer = find_symbol(text_buffer);
+      var_pointer = find_symbol(interned_text_buffer);
       if (!var_pointer)
         error_with_message("Unknown variable or function", text_buffer);
       switch (var_pointer->structural_type) {
@@ -245,7 +246,7 @@ static struct ASTNode *parse_paren_expression(int previous_token_precedence) {
 
   switch (token_from_file.token) {
     case TOKEN_IDENTIFIER:
-      if (!find_typedef_symbol(text_buffer)) {
+      if (!find_typedef_symbol(interned_text_buffer)) {
         tree = converse_token_2_ast(0);
         break;
       }
@@ -383,6 +384,8 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
         // ;
         verify_colon();
         left_temp = converse_token_2_ast(0);
+        // 条件部分的值要被读出来判断
+        left->rvalue = 1;
         return (
           create_ast_node(
             AST_TERNARY,
@@ -392,13 +395,13 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
             left_temp, // false_expression
             0,
             NULL,
-            right->composite_type)
+            get_ast_composite_type(right))
         );
       case AST_ASSIGN:
         right->rvalue = 1;
 
         // 确保 right 和 left 的类型匹配
-        right = modify_type(right, left->primitive_type, 0, left->composite_type);
+        right = modify_type(right, left->primitive_type, 0, get_ast_composite_type(left));
         if (!right) error("Incompatible expression in assignment");
 
         // 交换 left 和 right，确保 right 汇编语句能在 left 之前生成
@@ -411,8 +414,8 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
 
         // 检查 left 和 right 节点的 primitive_type 是否兼容
         // 这里同时判断了指针的类型
-        left_temp = modify_type(left, right->primitive_type, ast_operation_type, right->composite_type);
-        right_temp = modify_type(right, left->primitive_type, ast_operation_type, left->composite_type);
+        left_temp = modify_type(left, right->primitive_type, ast_operation_type, get_ast_composite_type(right));
+        right_temp = modify_type(right, left->primitive_type, ast_operation_type, get_ast_composite_type(left));
         if (!left_temp && !right_temp) error("Incompatible types in binary expression");
         if (left_temp) left = left_temp;
         if (right_temp) right = right_temp;
@@ -427,7 +430,7 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
       right,
       0,
       NULL,
-      left->composite_type);
+      get_ast_composite_type(left));
 
     switch (ast_operation_type) {
       case AST_LOGIC_OR:
@@ -438,7 +441,7 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
       case AST_COMPARE_GREATER_THAN:
       case AST_COMPARE_LESS_EQUALS:
       case AST_COMPARE_GREATER_EQUALS:
-        left->primitive_type = PRIMITIVE_INT;
+        left->primitive_type = (char) PRIMITIVE_INT;
     }
 
     node_operation_type = token_from_file.token;
@@ -459,7 +462,7 @@ struct ASTNode *converse_token_2_ast(int previous_token_precedence) {
 
 struct ASTNode *convert_function_call_2_ast() {
   struct ASTNode *tree;
-  struct SymbolTable *t = find_symbol(text_buffer);
+  struct SymbolTable *t = find_symbol(interned_text_buffer);
   // 解析类似于 xxx(1); 这样的函数调用
 
   // 检查是否未声明
@@ -485,7 +488,8 @@ struct ASTNode *convert_function_call_2_ast() {
   // 解析右 )
   verify_right_paren();
 
-  return (tree);
+  // 同一个文件中定义过的小函数，直接换成它的函数体
+  return (inline_function_call(tree));
 }
 
 struct ASTNode *convert_array_access_2_ast(struct ASTNode *left) {
@@ -511,12 +515,12 @@ struct ASTNode *convert_array_access_2_ast(struct ASTNode *left) {
 
   // 对于 int a[20]; 数组索引 a[12] 来说，需要用 int 类型(4) 来扩展 数组索引(12)
   // 以便在生成汇编代码时增加偏移量
-  right = modify_type(right, left->primitive_type, AST_PLUS, left->composite_type);
+  right = modify_type(right, left->primitive_type, AST_PLUS, get_ast_composite_type(left));
 
   // 返回一个 AST 树，其中数组的基添加了偏移量
-  left = create_ast_node(AST_PLUS, left->primitive_type, left, NULL, right, 0, NULL, left->composite_type);
+  left = create_ast_node(AST_PLUS, left->primitive_type, left, NULL, right, 0, NULL, get_ast_composite_type(left));
   // 这个时候也必须要解除引用，因为可能后面会有 a[12] = 100; 这样的语句出现，所以把它看作左值 lvalue
-  left = create_ast_left_node(AST_DEREFERENCE_POINTER, value_at(left->primitive_type), left, 0, NULL, left->composite_type);
+  left = create_ast_left_node(AST_DEREFERENCE_POINTER, value_at(left->primitive_type), left, 0, NULL, get_ast_composite_type(left));
 
   return (left);
 }
@@ -534,12 +538,12 @@ struct ASTNode *convert_member_access_2_ast(int with_pointer, struct ASTNode *le
   if (!with_pointer) {
     if (left->primitive_type == PRIMITIVE_STRUCT ||
         left->primitive_type == PRIMITIVE_UNION)
-      left->operation = AST_IDENTIFIER_ADDRESS;
+      left->operation = (char) AST_IDENTIFIER_ADDRESS;
     else
       error("Expression is not a struct/union");
   }
 
-  type_pointer = left->composite_type;
+  type_pointer = get_ast_composite_type(left);
 
   // 跳过 '.' 或者 '->'
   scan(&token_from_file);
@@ -547,7 +551,7 @@ struct ASTNode *convert_member_access_2_ast(int with_pointer, struct ASTNode *le
 
   // 在 type_pointer 指向的 symbol table 中寻找 'xxx.a' 或者 'xxx->a' 中的 'a'
   for (member = type_pointer->member; member; member = member->next)
-    if (!strcmp(member->name, text_buffer)) break;
+    if (member->name == interned_text_buffer) break;
 
   // 没找到 'a' 直接退出
   if (!member) error_with_message("No member found in struct/union", text_buffer);
@@ -574,11 +578,11 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
 
       if (tree->operation != AST_IDENTIFIER)
         error("& operator must be followed by an identifier");
-      if (tree->symbol_table->structural_type == STRUCTURAL_ARRAY)
+      if (get_ast_symbol_table(tree)->structural_type == STRUCTURAL_ARRAY)
         error("& operator cannot be performed on an array");
 
-      tree->operation = AST_IDENTIFIER_ADDRESS;
-      tree->primitive_type = pointer_to(tree->primitive_type);
+      tree->operation = (char) AST_IDENTIFIER_ADDRESS;
+      tree->primitive_type = (char) pointer_to(tree->primitive_type);
       break;
     case TOKEN_MULTIPLY:
       // 解析类似于 x= ***y;
@@ -595,7 +599,7 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
         tree,
         0,
         NULL,
-        tree->composite_type);
+        get_ast_composite_type(tree));
       break;
     case TOKEN_MINUS:
       // 解析类似 x = -y; 这样的表达式
@@ -604,9 +608,9 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
 
       tree->rvalue = 1;
       if (tree->primitive_type == PRIMITIVE_CHAR)
-        tree->primitive_type = PRIMITIVE_INT;
+        tree->primitive_type = (char) PRIMITIVE_INT;
 
-      tree = create_ast_left_node(AST_NEGATE, tree->primitive_type, tree, 0, NULL, tree->composite_type);
+      tree = create_ast_left_node(AST_NEGATE, tree->primitive_type, tree, 0, NULL, get_ast_composite_type(tree));
       break;
     case TOKEN_INVERT:
       // 解析类似 x = ~y; 这样的表达式
@@ -614,7 +618,7 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
       tree = convert_prefix_expression_2_ast(previous_token_precedence);
 
       tree->rvalue = 1;
-      tree = create_ast_left_node(AST_INVERT, tree->primitive_type, tree, 0, NULL, tree->composite_type);
+      tree = create_ast_left_node(AST_INVERT, tree->primitive_type, tree, 0, NULL, get_ast_composite_type(tree));
       break;
     case TOKEN_LOGIC_NOT:
       // 解析类似 x = !y; 这样的表达式
@@ -622,7 +626,7 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
       tree = convert_prefix_expression_2_ast(previous_token_precedence);
 
       tree->rvalue = 1;
-      tree = create_ast_left_node(AST_LOGIC_NOT, tree->primitive_type, tree, 0, NULL, tree->composite_type);
+      tree = create_ast_left_node(AST_LOGIC_NOT, tree->primitive_type, tree, 0, NULL, get_ast_composite_type(tree));
       break;
     case TOKEN_INCREASE:
       // 解析类似 x = ++y; 这样的表达式
@@ -632,7 +636,7 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
       if (tree->operation != AST_IDENTIFIER)
         error("++ operator must be followed by an identifier");
 
-      tree = create_ast_left_node(AST_PRE_INCREASE, tree->primitive_type, tree, 0, NULL, tree->composite_type);
+      tree = create_ast_left_node(AST_PRE_INCREASE, tree->primitive_type, tree, 0, NULL, get_ast_composite_type(tree));
       break;
     case TOKEN_DECREASE:
       // 解析类似 x = --y; 这样的表达式
@@ -642,7 +646,7 @@ struct ASTNode *convert_prefix_expression_2_ast(int previous_token_precedence) {
       if (tree->operation != AST_IDENTIFIER)
         error("-- operator must be followed by an identifier");
 
-      tree = create_ast_left_node(AST_PRE_DECREASE, tree->primitive_type, tree, 0, NULL, tree->composite_type);
+      tree = create_ast_left_node(AST_PRE_DECREASE, tree->primitive_type, tree, 0, NULL, get_ast_composite_type(tree));
       break;
     default:
       tree = convert_postfix_expression_2_ast(previous_token_precedence);
@@ -681,7 +685,7 @@ struct ASTNode *convert_postfix_expression_2_ast(int previous_token_precedence)
         if (tree->operation == AST_POST_INCREASE ||
             tree->operation == AST_POST_DECREASE)
           error("Cannot ++ and/or -- more than once");
-        tree->operation = AST_POST_INCREASE;
+        tree->operation = (char) AST_POST_INCREASE;
         break;
       case TOKEN_DECREASE:
         if (tree->rvalue)
@@ -693,7 +697,7 @@ struct ASTNode *convert_postfix_expression_2_ast(int previous_token_precedence)
             tree->operation == AST_POST_DECREASE)
           error("Cannot ++ and/or -- more than once");
 
-        tree->operation = AST_POST_DECREASE;
+        tree->operation = (char) AST_POST_DECREASE;
         break;
 
       default: return (tree);
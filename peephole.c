@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include "definations.h"
+#include "machine.h"
+#include "peephole.h"
+
+// 窥孔优化
+// 在一个函数的机器指令记录上匹配下面表中的模式，直到没有可以改写的地方
+// 每个模式只看相邻的几条记录，label 会打断匹配，所以不会跨越跳转目标
+
+enum {
+  PEEPHOLE_JUMP_TO_NEXT_LABEL,   // jmp Lx; Lx:
+  PEEPHOLE_UNREACHABLE_CODE,     // jmp/ret 之后、下一个 label 之前的指令
+  PEEPHOLE_STORE_RELOAD,         // movq %r10, -8(%rbp); movq -8(%rbp), %r11
+  PEEPHOLE_MOVE_BACK,            // movq %rax, %r10; movq %r10, %rax
+  PEEPHOLE_SELF_MOVE,            // movq %r10, %r10
+  PEEPHOLE_ZERO_STACK_ADJUST,    // addq $0, %rsp
+  PEEPHOLE_PUSH_POP,             // pushq %r10; popq %r11
+  PEEPHOLE_PATTERN_NUMBER
+};
+
+static char *peephole_pattern_name_list[] = {
+  "jump to next label",
+  "unreachable code",
+  "store and reload",
+  "move back",
+  "self move",
+  "zero stack adjust",
+  "push and pop"
+};
+
+static int peephole_rewrite_count_list[PEEPHOLE_PATTERN_NUMBER];
+
+static int check_instruction(struct MachineInstruction *instruction, char *opcode, int operand_number) {
+  return (instruction &&
+          instruction->kind == MACHINE_INSTRUCTION &&
+          instruction->operand_number == operand_number &&
+          !strcmp(instruction->opcode, opcode));
+}
+
+static struct MachineInstruction *peephole_head;
+
+static void remove_instruction(struct MachineInstruction *instruction) {
+  if (instruction->prev) instruction->prev->next = instruction->next;
+  else peephole_head = instruction->next;
+  if (instruction->next) instruction->next->prev = instruction->prev;
+}
+
+// jmp 的目标就是紧跟着的某个 label，跳转可以去掉
+static int remove_jump_to_next_label(struct MachineInstruction *instruction) {
+  struct MachineInstruction *next;
+
+  if (instruction->kind != MACHINE_JUMP && instruction->kind != MACHINE_BRANCH) return (0);
+  if (instruction->label == NO_LABEL) return (0);
+  for (next = instruction->next; next && next->kind == MACHINE_LABEL; next = next->next) {
+    if (next->label == instruction->label) {
+      remove_instruction(instruction);
+      return (1);
+    }
+  }
+  return (0);
+}
+
+// jmp 和 ret 之后的指令在遇到 label 之前都不会被执行
+static int remove_unreachable_code(struct MachineInstruction *instruction) {
+  struct MachineInstruction *next = instruction->next;
+
+  if (instruction->kind != MACHINE_JUMP && instruction->kind != MACHINE_RETURN) return (0);
+  if (!next) return (0);
+  if (next->kind == MACHINE_LABEL || next->kind == MACHINE_DIRECTIVE)
+    return (0);
+  remove_instruction(next);
+  return (1);
+}
+
+/**
+ * 把值存入内存之后马上又从同一个位置读出来，读的时候直接用寄存器中的值
+ * movb/movl/movq 分别对应 movzbq/movslq/movq 的读取
+*/
+static int rewrite_store_reload(struct MachineInstruction *instruction) {
+  struct MachineInstruction *next = instruction->next;
+  char *extend;
+  int source, destination, size;
+
+  if (!next || next->kind != MACHINE_INSTRUCTION || next->operand_number != 2) return (0);
+  if (instruction->kind != MACHINE_INSTRUCTION || instruction->operand_number != 2) return (0);
+  if (strcmp(instruction->operand_list[1], next->operand_list[0])) return (0);
+  // 只处理存入内存的情况，寄存器之间的 movq 改写后可能又组成同样的模式
+  if (find_machine_register(instruction->operand_list[1], 8) >= 0) return (0);
+
+  if (!strcmp(instruction->opcode, "movb") && !strcmp(next->opcode, "movzbq")) {
+    extend = "movzbq";
+    size = 1;
+  } else if (!strcmp(instruction->opcode, "movl") && !strcmp(next->opcode, "movslq")) {
+    extend = "movslq";
+    size = 4;
+  } else if (!strcmp(instruction->opcode, "movq") && !strcmp(next->opcode, "movq")) {
+    extend = "movq";
+    size = 8;
+  } else return (0);
+
+  source = find_machine_register(instruction->operand_list[0], size);
+  destination = find_machine_register(next->operand_list[1], 8);
+  if (source < 0 || destination < 0) return (0);
+
+  // 同一个寄存器的 64 位读取什么都不用做
+  if (source == destination && size == 8) {
+    remove_instruction(next);
+    return (1);
+  }
+  next->opcode = extend;
+  next->operand_list[0] = instruction->operand_list[0];
+  return (1);
+}
+
+// movq %a, %b; movq %b, %a 中的第二条是多余的
+static int remove_move_back(struct MachineInstruction *instruction) {
+  struct MachineInstruction *next = instruction->next;
+
+  if (!check_instruction(instruction, "movq", 2) || !check_instruction(next, "movq", 2))
+    return (0);
+  if (find_machine_register(instruction->operand_list[0], 8) < 0 ||
+      find_machine_register(instruction->operand_list[1], 8) < 0)
+    return (0);
+  if (strcmp(instruction->operand_list[0], next->operand_list[1]) ||
+      strcmp(instruction->operand_list[1], next->operand_list[0]))
+    return (0);
+  remove_instruction(next);
+  return (1);
+}
+
+static int remove_self_move(struct MachineInstruction *instruction) {
+  if (!check_instruction(instruction, "movq", 2)) return (0);
+  if (find_machine_register(instruction->operand_list[0], 8) < 0) return (0);
+  if (strcmp(instruction->operand_list[0], instruction->operand_list[1])) return (0);
+  remove_instruction(instruction);
+  return (1);
+}
+
+static int remove_zero_stack_adjust(struct MachineInstruction *instruction) {
+  if (!check_instruction(instruction, "addq", 2) && !check_instruction(instruction, "subq", 2))
+    return (0);
+  if (strcmp(instruction->operand_list[0], "$0") || strcmp(instruction->operand_list[1], "%rsp"))
+    return (0);
+  remove_instruction(instruction);
+  return (1);
+}
+
+// pushq %a; popq %b 换成 movq %a, %b，a 和 b 相同时都去掉
+static int rewrite_push_pop(struct MachineInstruction *instruction) {
+  struct MachineInstruction *next = instruction->next;
+
+  if (!check_instruction(instruction, "pushq", 1) || !check_instruction(next, "popq", 1))
+    return (0);
+  if (find_machine_register(instruction->operand_list[0], 8) < 0) return (0);
+  if (!strcmp(instruction->operand_list[0], next->operand_list[0])) {
+    remove_instruction(next);
+    remove_instruction(instruction);
+    return (1);
+  }
+  next->opcode = "movq";
+  next->operand_list[1] = next->operand_list[0];
+  next->operand_list[0] = instruction->operand_list[0];
+  next->operand_number = 2;
+  remove_instruction(instruction);
+  return (1);
+}
+
+static int apply_peephole_pattern(int pattern, struct MachineInstruction *instruction) {
+  switch (pattern) {
+    case PEEPHOLE_JUMP_TO_NEXT_LABEL: return (remove_jump_to_next_label(instruction));
+    case PEEPHOLE_UNREACHABLE_CODE: return (remove_unreachable_code(instruction));
+    case PEEPHOLE_STORE_RELOAD: return (rewrite_store_reload(instruction));
+    case PEEPHOLE_MOVE_BACK: return (remove_move_back(instruction));
+    case PEEPHOLE_SELF_MOVE: return (remove_self_move(instruction));
+    case PEEPHOLE_ZERO_STACK_ADJUST: return (remove_zero_stack_adjust(instruction));
+    case PEEPHOLE_PUSH_POP: return (rewrite_push_pop(instruction));
+  }
+  return (0);
+}
+
+/**
+ * 对一个函数的机器指令记录做窥孔优化，返回新的第一条记录
+ * 改写成功后退回到前一条记录重新匹配，因为改写后前后的记录可能组成新的模式
+ * 模式只会删除当前记录或者它后面的记录，所以前一条记录总是还在链表中
+*/
+struct MachineInstruction *peephole_optimise(struct MachineInstruction *head) {
+  struct MachineInstruction *instruction, *next;
+  int pattern;
+
+  peephole_head = head;
+  for (instruction = peephole_head; instruction; instruction = next) {
+    next = instruction->next;
+    for (pattern = 0; pattern < PEEPHOLE_PATTERN_NUMBER; pattern++) {
+      if (apply_peephole_pattern(pattern, instruction)) {
+        peephole_rewrite_count_list[pattern] = peephole_rewrite_count_list[pattern] + 1;
+        if (instruction->prev) next = instruction->prev;
+        else next = peephole_head;
+        break;
+      }
+    }
+  }
+  return (peephole_head);
+}
+
+// -v 时输出每个模式改写的次数，之后清零，下一个文件重新计数
+void print_peephole_statistics() {
+  int i, total = 0;
+
+  for (i = 0; i < PEEPHOLE_PATTERN_NUMBER; i++)
+    total = total + peephole_rewrite_count_list[i];
+  printf("peephole: %d rewrites\n", total);
+  for (i = 0; i < PEEPHOLE_PATTERN_NUMBER; i++) {
+    if (peephole_rewrite_count_list[i])
+      printf("  %s: %d\n", peephole_pattern_name_list[i], peephole_rewrite_count_list[i]);
+    peephole_rewrite_count_list[i] = 0;
+  }
+}
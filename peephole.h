@@ -0,0 +1,9 @@
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include "definations.h"
+
+struct MachineInstruction *peephole_optimise(struct MachineInstruction *head);
+void print_peephole_statistics();
+
+#endif
@@ -0,0 +1,1311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "data.h"
+#include "definations.h"
+#include "preprocess.h"
+
+// 内置预处理器
+// 取代原来用 popen 调用外部 cpp 的做法，在进程内把源文件展开到内存中
+// 输出格式与 cpp 一致，进入和离开头文件时插入 # 行号 "文件名" 标记，
+// 被删掉的注释、指令和条件编译跳过的行都保留为空行，这样 scan.c 里的行号不受影响
+// 支持 #include、#define（对象宏、函数宏以及 # 和 ##）、#undef、
+// #if/#ifdef/#ifndef/#elif/#else/#endif 和 #error，#pragma 和 #line 直接忽略
+// 读过的头文件会缓存起来，同一个进程里再次 #include 时不用重新读文件；
+// 如果头文件整个被 include guard 包住，并且这个宏已经定义了，就直接跳过这个头文件
+
+#define MACRO_HASH_SIZE 256
+#define MAX_MACRO_PARAMETER_NUMBER 32
+#define MAX_CONDITION_DEPTH 64
+#define MAX_INCLUDE_DEPTH 200
+
+// include guard 的识别状态
+enum {
+  GUARD_NOT_STARTED,        // 还没遇到任何有效内容
+  GUARD_INSIDE,             // 第一条指令是 #ifndef X，正在 guard 内部
+  GUARD_FINISHED,           // 与之配对的 #endif 已经出现
+  GUARD_INVALID             // guard 外面还有别的内容
+};
+
+struct PreprocessBuffer {
+  char *data;
+  int size;
+  int capacity;
+};
+
+struct Macro {
+  char *name;
+  char *body;               // 替换列表，首尾空白已经去掉
+  int is_function;
+  int parameter_number;
+  char **parameter_list;
+  int is_disabled;          // 展开自身的过程中不能再次展开
+  int disabled_end;         // 重新扫描时，扫描到这个位置之后才能再次展开
+  struct Macro *disabled_next;
+  struct Macro *next;
+};
+
+// 缓存的头文件
+struct IncludeFile {
+  char *path;
+  char *content;
+  char *guard;              // include guard 的宏名，没有则为 NULL
+  struct IncludeFile *next;
+};
+
+// 正在处理的源文件
+struct SourceFile {
+  struct IncludeFile *include_file;
+  int position;
+  int line;                 // 下一行的行号
+  int start_depth;          // 进入文件时条件编译的层数
+  int guard_state;
+  char *guard_name;
+};
+
+static struct Macro **macro_hash;
+static struct IncludeFile *include_file_head;
+static struct PreprocessBuffer *preprocess_output;
+static struct PreprocessBuffer *logical_line;
+static char *system_include_directory;
+static int include_depth;
+
+static char *current_filename;
+static int current_line;
+
+// 条件编译栈
+static int condition_depth;
+static int condition_parent_active_list[MAX_CONDITION_DEPTH];
+static int condition_active_list[MAX_CONDITION_DEPTH];
+static int condition_taken_list[MAX_CONDITION_DEPTH];
+static int condition_else_list[MAX_CONDITION_DEPTH];
+
+// #if 表达式求值时的当前位置
+static char *expression_pointer;
+
+static void process_source_file(struct SourceFile *source);
+static void expand_text(char *text, struct PreprocessBuffer *out);
+static long evaluate_expression();
+
+static void preprocess_error(char *message) {
+  fprintf(stderr, "%s on line %d of %s\n", message, current_line, current_filename);
+  exit(1);
+}
+
+static void preprocess_error_with_message(char *message, char *detail) {
+  fprintf(stderr, "%s:%s on line %d of %s\n", message, detail, current_line, current_filename);
+  exit(1);
+}
+
+static struct PreprocessBuffer *new_preprocess_buffer() {
+  struct PreprocessBuffer *b = (struct PreprocessBuffer *) malloc(sizeof(struct PreprocessBuffer));
+  b->capacity = 256;
+  b->size = 0;
+  b->data = (char *) malloc(b->capacity);
+  return (b);
+}
+
+static void free_preprocess_buffer(struct PreprocessBuffer *b) {
+  free(b->data);
+  free(b);
+}
+
+static void reserve_preprocess_buffer(struct PreprocessBuffer *b, int size) {
+  if (b->size + size < b->capacity) return;
+  while (b->size + size >= b->capacity) b->capacity = b->capacity * 2;
+  b->data = (char *) realloc(b->data, b->capacity);
+}
+
+static void preprocess_put_character(struct PreprocessBuffer *b, int c) {
+  if (b->size + 1 >= b->capacity) reserve_preprocess_buffer(b, 1);
+  b->data[b->size] = (char) c;
+  b->size = b->size + 1;
+}
+
+static void preprocess_put_text(struct PreprocessBuffer *b, char *s, int length) {
+  int i;
+  reserve_preprocess_buffer(b, length);
+  for (i = 0; i < length; i++) b->data[b->size + i] = s[i];
+  b->size = b->size + length;
+}
+
+static void preprocess_put_string(struct PreprocessBuffer *b, char *s) {
+  while (*s) {
+    preprocess_put_character(b, *s);
+    s++;
+  }
+}
+
+// 返回以 '\0' 结尾的内容，'\0' 不计入 size
+static char *get_preprocess_text(struct PreprocessBuffer *b) {
+  reserve_preprocess_buffer(b, 1);
+  b->data[b->size] = 0;
+  return (b->data);
+}
+
+static int check_preprocess_space(int c) {
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v');
+}
+
+static int check_preprocess_digit(int c) {
+  return (c >= '0' && c <= '9');
+}
+
+static int check_preprocess_identifier_start(int c) {
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_');
+}
+
+static int check_preprocess_identifier_character(int c) {
+  return (check_preprocess_identifier_start(c) || check_preprocess_digit(c));
+}
+
+static char *skip_preprocess_space(char *p) {
+  while (check_preprocess_space(*p)) p++;
+  return (p);
+}
+
+static char *copy_preprocess_text(char *s, int length) {
+  char *p = (char *) malloc(length + 1);
+  strncpy(p, s, length);
+  p[length] = 0;
+  return (p);
+}
+
+// 复制去掉首尾空白之后的内容
+static char *copy_trimmed_text(char *s, int length) {
+  while (length > 0 && (check_preprocess_space(*s) || *s == '\n')) {
+    s++;
+    length--;
+  }
+  while (length > 0 && (check_preprocess_space(s[length - 1]) || s[length - 1] == '\n'))
+    length--;
+  return (copy_preprocess_text(s, length));
+}
+
+static int hash_macro_name(char *name, int length) {
+  int h = 0;
+  int i;
+  for (i = 0; i < length; i++) h = (h * 31 + name[i]) & (MACRO_HASH_SIZE - 1);
+  return (h);
+}
+
+static struct Macro *find_macro(char *name, int length) {
+  struct Macro *m;
+  for (m = macro_hash[hash_macro_name(name, length)]; m; m = m->next) {
+    if (!strncmp(m->name, name, length) && m->name[length] == 0) return (m);
+  }
+  return (NULL);
+}
+
+static void free_macro(struct Macro *m) {
+  int i;
+  for (i = 0; i < m->parameter_number; i++) free(m->parameter_list[i]);
+  free(m->parameter_list);
+  free(m->name);
+  free(m->body);
+  free(m);
+}
+
+static void undefine_macro(char *name, int length) {
+  struct Macro *m, *previous = NULL;
+  int h = hash_macro_name(name, length);
+
+  for (m = macro_hash[h]; m; m = m->next) {
+    if (!strncmp(m->name, name, length) && m->name[length] == 0) {
+      if (previous) previous->next = m->next;
+      else macro_hash[h] = m->next;
+      free_macro(m);
+      return;
+    }
+    previous = m;
+  }
+}
+
+static void define_macro(
+  char *name,
+  int length,
+  int is_function,
+  char **parameter_list,
+  int parameter_number,
+  char *body
+) {
+  struct Macro *m;
+  int h;
+
+  // 重复定义时以最后一次为准
+  undefine_macro(name, length);
+  h = hash_macro_name(name, length);
+  m = (struct Macro *) malloc(sizeof(struct Macro));
+  m->name = copy_preprocess_text(name, length);
+  m->body = body;
+  m->is_function = is_function;
+  m->parameter_number = parameter_number;
+  m->parameter_list = parameter_list;
+  m->is_disabled = 0;
+  m->next = macro_hash[h];
+  macro_hash[h] = m;
+}
+
+static void clear_all_macros() {
+  struct Macro *m, *next;
+  int i;
+
+  if (!macro_hash) {
+    macro_hash = (struct Macro **) malloc(MACRO_HASH_SIZE * sizeof(struct Macro *));
+    for (i = 0; i < MACRO_HASH_SIZE; i++) macro_hash[i] = NULL;
+    return;
+  }
+  for (i = 0; i < MACRO_HASH_SIZE; i++) {
+    for (m = macro_hash[i]; m; m = next) {
+      next = m->next;
+      free_macro(m);
+    }
+    macro_hash[i] = NULL;
+  }
+}
+
+// 复制一个字符串或字符常量，返回常量之后的位置，out 为 NULL 时只跳过
+static int copy_literal(char *text, int i, struct PreprocessBuffer *out) {
+  int quote = text[i];
+  int c;
+
+  if (out) preprocess_put_character(out, quote);
+  i++;
+  while ((c = text[i]) && c != quote && c != '\n') {
+    if (c == '\\' && text[i + 1]) {
+      if (out) preprocess_put_text(out, text + i, 2);
+      i = i + 2;
+      continue;
+    }
+    if (out) preprocess_put_character(out, c);
+    i++;
+  }
+  if (c == quote) {
+    if (out) preprocess_put_character(out, c);
+    i++;
+  }
+  return (i);
+}
+
+/**
+ * 从源文件中读出一个逻辑行追加到 logical_line 中
+ * 合并以 '\' 结尾的续行，注释替换成一个空格
+ * 返回这个逻辑行占用的物理行数，文件结束时返回 0
+*/
+static int append_logical_line(struct SourceFile *source) {
+  char *content = source->include_file->content;
+  int i = source->position;
+  int lines = 1;
+  int c;
+
+  if (!content[i]) return (0);
+
+  while ((c = content[i])) {
+    if (c == '\n') {
+      i++;
+      break;
+    }
+    if (c == '\\' && content[i + 1] == '\n') {
+      i = i + 2;
+      lines++;
+      continue;
+    }
+    if (c == '\\' && content[i + 1] == '\r' && content[i + 2] == '\n') {
+      i = i + 3;
+      lines++;
+      continue;
+    }
+    if (c == '/' && content[i + 1] == '/') {
+      while (content[i] && content[i] != '\n') i++;
+      continue;
+    }
+    if (c == '/' && content[i + 1] == '*') {
+      i = i + 2;
+      while (content[i] && !(content[i] == '*' && content[i + 1] == '/')) {
+        if (content[i] == '\n') lines++;
+        i++;
+      }
+      if (!content[i]) {
+        current_line = source->line;
+        preprocess_error("Unterminated comment");
+      }
+      i = i + 2;
+      preprocess_put_character(logical_line, ' ');
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      i = copy_literal(content, i, logical_line);
+      continue;
+    }
+    preprocess_put_character(logical_line, c);
+    i++;
+  }
+
+  get_preprocess_text(logical_line);
+  source->position = i;
+  return (lines);
+}
+
+static int read_logical_line(struct SourceFile *source) {
+  logical_line->size = 0;
+  return (append_logical_line(source));
+}
+
+static void emit_line_marker(int line_number, char *filename) {
+  char number[32];
+  snprintf(number, 32, "# %d ", line_number);
+  preprocess_put_string(preprocess_output, number);
+  preprocess_put_character(preprocess_output, '"');
+  preprocess_put_string(preprocess_output, filename);
+  preprocess_put_character(preprocess_output, '"');
+  preprocess_put_character(preprocess_output, '\n');
+}
+
+static void emit_newlines(int lines) {
+  int i;
+  for (i = 0; i < lines; i++) preprocess_put_character(preprocess_output, '\n');
+}
+
+// __FILE__ 和 __LINE__，展开了返回 1
+static int expand_builtin_macro(char *name, int length, struct PreprocessBuffer *out) {
+  char number[32];
+
+  if (length == 8 && !strncmp(name, "__FILE__", 8)) {
+    preprocess_put_character(out, '"');
+    preprocess_put_string(out, current_filename);
+    preprocess_put_character(out, '"');
+    return (1);
+  }
+  if (length == 8 && !strncmp(name, "__LINE__", 8)) {
+    snprintf(number, 32, "%d", current_line);
+    preprocess_put_string(out, number);
+    return (1);
+  }
+  return (0);
+}
+
+static int find_macro_parameter(struct Macro *m, char *name, int length) {
+  int i;
+  for (i = 0; i < m->parameter_number; i++) {
+    if (!strncmp(m->parameter_list[i], name, length) && m->parameter_list[i][length] == 0)
+      return (i);
+  }
+  return (-1);
+}
+
+// # 运算符，把实参变成字符串常量
+static void stringify_argument(char *argument, struct PreprocessBuffer *out) {
+  int c, quote = 0, space_pending = 0;
+
+  preprocess_put_character(out, '"');
+  while ((c = *argument)) {
+    argument++;
+    if (!quote && (check_preprocess_space(c) || c == '\n')) {
+      space_pending = 1;
+      continue;
+    }
+    if (space_pending) {
+      preprocess_put_character(out, ' ');
+      space_pending = 0;
+    }
+    if (c == '"' || (quote && c == '\\')) preprocess_put_character(out, '\\');
+    preprocess_put_character(out, c);
+    if (quote && c == '\\' && *argument) {
+      // 转义字符原样保留，包括转义的引号
+      if (*argument == '"' || *argument == '\\') preprocess_put_character(out, '\\');
+      preprocess_put_character(out, *argument);
+      argument++;
+      continue;
+    }
+    if (!quote && (c == '"' || c == '\'')) quote = c;
+    else if (quote && c == quote) quote = 0;
+  }
+  preprocess_put_character(out, '"');
+}
+
+// 用实参替换宏的替换列表，结果由 expand_text 和后面的文本一起重新扫描
+static void substitute_macro(struct Macro *m, char **argument_list, struct PreprocessBuffer *out) {
+  char *body = m->body;
+  int i = 0, j, k, c, length, is_pasting = 0;
+
+  while ((c = body[i])) {
+    if (c == '"' || c == '\'') {
+      i = copy_literal(body, i, out);
+      is_pasting = 0;
+      continue;
+    }
+
+    // ## 运算符，去掉两边的空白，前后两个记号直接拼到一起
+    if (c == '#' && body[i + 1] == '#') {
+      while (out->size > 0 && check_preprocess_space(out->data[out->size - 1]))
+        out->size = out->size - 1;
+      i = i + 2;
+      while (check_preprocess_space(body[i])) i++;
+      is_pasting = 1;
+      continue;
+    }
+
+    // # 运算符
+    if (c == '#' && m->is_function) {
+      j = i + 1;
+      while (check_preprocess_space(body[j])) j++;
+      length = 0;
+      while (check_preprocess_identifier_character(body[j + length])) length++;
+      if (length && (k = find_macro_parameter(m, body + j, length)) >= 0) {
+        stringify_argument(argument_list[k], out);
+        i = j + length;
+        is_pasting = 0;
+        continue;
+      }
+    }
+
+    if (check_preprocess_digit(c)) {
+      while (check_preprocess_identifier_character(body[i]) || body[i] == '.') {
+        preprocess_put_character(out, body[i]);
+        i++;
+      }
+      is_pasting = 0;
+      continue;
+    }
+
+    if (check_preprocess_identifier_start(c)) {
+      j = i;
+      while (check_preprocess_identifier_character(body[i])) i++;
+      length = i - j;
+      k = -1;
+      if (m->is_function) k = find_macro_parameter(m, body + j, length);
+      if (k < 0) {
+        preprocess_put_text(out, body + j, length);
+      } else {
+        // ## 两边的实参不展开，其余的实参先完全展开再代入
+        j = i;
+        while (check_preprocess_space(body[j])) j++;
+        if (is_pasting || (body[j] == '#' && body[j + 1] == '#'))
+          preprocess_put_string(out, argument_list[k]);
+        else
+          expand_text(argument_list[k], out);
+      }
+      is_pasting = 0;
+      continue;
+    }
+
+    preprocess_put_character(out, c);
+    i++;
+    if (!check_preprocess_space(c)) is_pasting = 0;
+  }
+}
+
+/**
+ * 收集函数宏的实参，text[*position] 是 '('
+ * 返回实参列表，*position 更新为 ')' 之后的位置
+*/
+static char **collect_macro_arguments(struct Macro *m, char *text, int *position) {
+  char **argument_list;
+  int argument_number = 0;
+  int i = *position + 1;
+  int start = i, depth = 0;
+  int c;
+
+  argument_list = (char **) malloc((m->parameter_number + 1) * sizeof(char *));
+  while (1) {
+    c = text[i];
+    if (!c) preprocess_error_with_message("Unterminated argument list invoking macro", m->name);
+    if (c == '"' || c == '\'') {
+      i = copy_literal(text, i, NULL);
+      continue;
+    }
+    if (c == '(') {
+      depth++;
+    } else if ((c == ')' && !depth) || (c == ',' && !depth)) {
+      if (argument_number > m->parameter_number)
+        preprocess_error_with_message("Too many arguments to macro", m->name);
+      argument_list[argument_number] = copy_trimmed_text(text + start, i - start);
+      argument_number++;
+      start = i + 1;
+      if (c == ')') break;
+    } else if (c == ')') {
+      depth--;
+    }
+    i++;
+  }
+  *position = i + 1;
+
+  // f() 调用无参数的宏时会收集到一个空的实参
+  if (!m->parameter_number && argument_number == 1 && !argument_list[0][0]) {
+    free(argument_list[0]);
+    argument_number = 0;
+  }
+  if (argument_number != m->parameter_number)
+    preprocess_error_with_message("Wrong number of arguments to macro", m->name);
+  return (argument_list);
+}
+
+// 跳过 text[i] 处 '(' 开始的函数宏实参，返回 ')' 之后的位置，没有 ')' 时返回 -1
+static int skip_macro_arguments(char *text, int i) {
+  int depth = 0;
+  int c;
+
+  while ((c = text[i])) {
+    if (c == '"' || c == '\'') {
+      i = copy_literal(text, i, NULL);
+      continue;
+    }
+    if (c == '(') depth++;
+    if (c == ')') {
+      depth--;
+      if (!depth) return (i + 1);
+    }
+    i++;
+  }
+  return (-1);
+}
+
+// text 中有函数宏的实参还没有读到 ')' 时返回 1，说明实参跨行了
+static int check_unterminated_macro_call(char *text) {
+  struct Macro *m;
+  int i = 0, start, c;
+
+  while ((c = text[i])) {
+    if (c == '"' || c == '\'') {
+      i = copy_literal(text, i, NULL);
+      continue;
+    }
+    if (check_preprocess_digit(c)) {
+      while (check_preprocess_identifier_character(text[i]) || text[i] == '.') i++;
+      continue;
+    }
+    if (!check_preprocess_identifier_start(c)) {
+      i++;
+      continue;
+    }
+
+    start = i;
+    while (check_preprocess_identifier_character(text[i])) i++;
+    m = find_macro(text + start, i - start);
+    if (m && m->is_function) {
+      while (check_preprocess_space(text[i])) i++;
+      if (text[i] == '(') {
+        i = skip_macro_arguments(text, i);
+        if (i < 0) return (1);
+      }
+    }
+  }
+  return (0);
+}
+
+// 扫描位置已经到了 position 时，替换结果已经扫描完的宏重新允许展开
+static struct Macro *enable_scanned_macros(struct Macro *disabled_head, int position) {
+  while (disabled_head && disabled_head->disabled_end <= position) {
+    disabled_head->is_disabled = 0;
+    disabled_head = disabled_head->disabled_next;
+  }
+  return (disabled_head);
+}
+
+/**
+ * 展开 text 中的宏，结果追加到 out 中
+ * 宏替换的结果接上后面还没有扫描的文本，作为新的输入重新扫描(C11 6.10.3.4)，
+ * 这样结果末尾的函数宏名可以用后面文本中的实参，比如 #define F G 之后的 F(3)
+ * 宏在它的替换结果扫描完之前禁止展开，disabled_head 按 disabled_end 从小到大排列
+*/
+static void expand_text(char *text, struct PreprocessBuffer *out) {
+  struct Macro *m, *d, *disabled_head = NULL;
+  struct PreprocessBuffer *input = NULL, *result;
+  char **argument_list;
+  int i = 0, j, start, length, c;
+
+  while ((c = text[i])) {
+    if (c == '"' || c == '\'') {
+      i = copy_literal(text, i, out);
+      continue;
+    }
+
+    // 数字里的字母，比如 0x1f、10L，不能当成宏
+    if (check_preprocess_digit(c)) {
+      while (check_preprocess_identifier_character(text[i]) || text[i] == '.') {
+        preprocess_put_character(out, text[i]);
+        i++;
+      }
+      continue;
+    }
+
+    if (!check_preprocess_identifier_start(c)) {
+      preprocess_put_character(out, c);
+      i++;
+      continue;
+    }
+
+    start = i;
+    disabled_head = enable_scanned_macros(disabled_head, start);
+    while (check_preprocess_identifier_character(text[i])) i++;
+    length = i - start;
+    if (expand_builtin_macro(text + start, length, out)) continue;
+
+    m = find_macro(text + start, length);
+    if (!m || m->is_disabled) {
+      preprocess_put_text(out, text + start, length);
+      continue;
+    }
+
+    argument_list = NULL;
+    if (m->is_function) {
+      // 函数宏后面不是 '(' 时按普通标识符处理
+      j = i;
+      while (check_preprocess_space(text[j]) || text[j] == '\n') j++;
+      if (text[j] != '(') {
+        preprocess_put_text(out, text + start, length);
+        continue;
+      }
+      argument_list = collect_macro_arguments(m, text, &j);
+      i = j;
+    }
+
+    result = new_preprocess_buffer();
+    substitute_macro(m, argument_list, result);
+    if (argument_list) {
+      for (j = 0; j < m->parameter_number; j++) free(argument_list[j]);
+      free(argument_list);
+    }
+
+    // 替换结果之后是原来 i 处的文本，禁止展开的位置跟着移动
+    disabled_head = enable_scanned_macros(disabled_head, i);
+    for (d = disabled_head; d; d = d->disabled_next)
+      d->disabled_end = d->disabled_end - i + result->size;
+    m->is_disabled = 1;
+    m->disabled_end = result->size;
+    m->disabled_next = disabled_head;
+    disabled_head = m;
+    preprocess_put_string(result, text + i);
+    text = get_preprocess_text(result);
+    if (input) free_preprocess_buffer(input);
+    input = result;
+    i = 0;
+  }
+
+  enable_scanned_macros(disabled_head, i);
+  if (input) free_preprocess_buffer(input);
+}
+
+// 把 defined X 和 defined(X) 替换成 1 或 0
+static void replace_defined_operator(char *text, struct PreprocessBuffer *out) {
+  int i = 0, start, length, c, has_paren;
+
+  while ((c = text[i])) {
+    if (c == '"' || c == '\'') {
+      i = copy_literal(text, i, out);
+      continue;
+    }
+    if (!check_preprocess_identifier_character(c)) {
+      preprocess_put_character(out, c);
+      i++;
+      continue;
+    }
+    start = i;
+    while (check_preprocess_identifier_character(text[i])) i++;
+    length = i - start;
+    if (length != 7 || strncmp(text + start, "defined", 7)) {
+      preprocess_put_text(out, text + start, length);
+      continue;
+    }
+
+    while (check_preprocess_space(text[i])) i++;
+    has_paren = 0;
+    if (text[i] == '(') {
+      has_paren = 1;
+      i++;
+      while (check_preprocess_space(text[i])) i++;
+    }
+    start = i;
+    while (check_preprocess_identifier_character(text[i])) i++;
+    length = i - start;
+    if (!length) preprocess_error("Operator defined requires an identifier");
+    if (has_paren) {
+      while (check_preprocess_space(text[i])) i++;
+      if (text[i] != ')') preprocess_error("Missing ')' after defined");
+      i++;
+    }
+    if (find_macro(text + start, length)) preprocess_put_character(out, '1');
+    else preprocess_put_character(out, '0');
+  }
+}
+
+static void skip_expression_space() {
+  while (check_preprocess_space(*expression_pointer)) expression_pointer++;
+}
+
+static long evaluate_number() {
+  long value = 0;
+  int c, digit, radix = 10;
+
+  if (*expression_pointer == '0') {
+    radix = 8;
+    expression_pointer++;
+    if (*expression_pointer == 'x' || *expression_pointer == 'X') {
+      radix = 16;
+      expression_pointer++;
+    }
+  }
+  while (1) {
+    c = *expression_pointer;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else break;
+    if (digit >= radix) preprocess_error("Invalid digit in #if expression");
+    value = value * radix + digit;
+    expression_pointer++;
+  }
+  // 跳过 U、L 后缀
+  while (*expression_pointer == 'u' || *expression_pointer == 'U' ||
+         *expression_pointer == 'l' || *expression_pointer == 'L')
+    expression_pointer++;
+  return (value);
+}
+
+static long evaluate_character() {
+  long value;
+  int c;
+
+  expression_pointer++;
+  c = *expression_pointer;
+  if (c == '\\') {
+    expression_pointer++;
+    c = *expression_pointer;
+    if (c == 'n') c = '\n';
+    else if (c == 't') c = '\t';
+    else if (c == 'r') c = '\r';
+    else if (c == '0') c = 0;
+  }
+  value = c;
+  expression_pointer++;
+  if (*expression_pointer != '\'') preprocess_error("Bad character constant in #if expression");
+  expression_pointer++;
+  return (value);
+}
+
+static long evaluate_primary() {
+  long value;
+  int c;
+
+  skip_expression_space();
+  c = *expression_pointer;
+  if (c == '(') {
+    expression_pointer++;
+    value = evaluate_expression();
+    skip_expression_space();
+    if (*expression_pointer != ')') preprocess_error("Missing ')' in #if expression");
+    expression_pointer++;
+    return (value);
+  }
+  if (c == '!') {
+    expression_pointer++;
+    return (!evaluate_primary());
+  }
+  if (c == '~') {
+    expression_pointer++;
+    return (~evaluate_primary());
+  }
+  if (c == '-') {
+    expression_pointer++;
+    return (-evaluate_primary());
+  }
+  if (c == '+') {
+    expression_pointer++;
+    return (evaluate_primary());
+  }
+  if (check_preprocess_digit(c)) return (evaluate_number());
+  if (c == '\'') return (evaluate_character());
+  // 展开之后剩下的标识符都当作 0
+  if (check_preprocess_identifier_start(c)) {
+    while (check_preprocess_identifier_character(*expression_pointer)) expression_pointer++;
+    return (0);
+  }
+  preprocess_error("Bad #if expression");
+  return (0);
+}
+
+/**
+ * 查看当前位置的二元运算符，返回运算符的编码，没有则返回 0
+ * 优先级和运算符长度通过参数带回
+*/
+static int peek_expression_operator(int *precedence, int *length) {
+  int c, d;
+
+  skip_expression_space();
+  c = expression_pointer[0];
+  d = expression_pointer[1];
+  *length = 2;
+  if (c == '|' && d == '|') { *precedence = 1; return ('o'); }
+  if (c == '&' && d == '&') { *precedence = 2; return ('a'); }
+  if (c == '=' && d == '=') { *precedence = 6; return ('e'); }
+  if (c == '!' && d == '=') { *precedence = 6; return ('n'); }
+  if (c == '<' && d == '=') { *precedence = 7; return ('l'); }
+  if (c == '>' && d == '=') { *precedence = 7; return ('g'); }
+  if (c == '<' && d == '<') { *precedence = 8; return ('L'); }
+  if (c == '>' && d == '>') { *precedence = 8; return ('R'); }
+  *length = 1;
+  if (c == '|') { *precedence = 3; return (c); }
+  if (c == '^') { *precedence = 4; return (c); }
+  if (c == '&') { *precedence = 5; return (c); }
+  if (c == '<' || c == '>') { *precedence = 7; return (c); }
+  if (c == '+' || c == '-') { *precedence = 9; return (c); }
+  if (c == '*' || c == '/' || c == '%') { *precedence = 10; return (c); }
+  return (0);
+}
+
+static long apply_expression_operator(int operator, long left, long right) {
+  switch (operator) {
+    case 'o': return (left || right);
+    case 'a': return (left && right);
+    case 'e': return (left == right);
+    case 'n': return (left != right);
+    case 'l': return (left <= right);
+    case 'g': return (left >= right);
+    case 'L': return (left << right);
+    case 'R': return (left >> right);
+    case '|': return (left | right);
+    case '^': return (left ^ right);
+    case '&': return (left & right);
+    case '<': return (left < right);
+    case '>': return (left > right);
+    case '+': return (left + right);
+    case '-': return (left - right);
+    case '*': return (left * right);
+  }
+  if (!right) preprocess_error("Division by zero in #if expression");
+  if (operator == '/') return (left / right);
+  return (left % right);
+}
+
+static long evaluate_binary(int minimum_precedence) {
+  long left, right;
+  int operator, precedence, length;
+
+  left = evaluate_primary();
+  while (1) {
+    operator = peek_expression_operator(&precedence, &length);
+    if (!operator || precedence < minimum_precedence) break;
+    expression_pointer = expression_pointer + length;
+    right = evaluate_binary(precedence + 1);
+    left = apply_expression_operator(operator, left, right);
+  }
+  return (left);
+}
+
+static long evaluate_expression() {
+  long condition, left, right;
+
+  condition = evaluate_binary(1);
+  skip_expression_space();
+  if (*expression_pointer != '?') return (condition);
+  expression_pointer++;
+  left = evaluate_expression();
+  skip_expression_space();
+  if (*expression_pointer != ':') preprocess_error("Missing ':' in #if expression");
+  expression_pointer++;
+  right = evaluate_expression();
+  if (condition) return (left);
+  return (right);
+}
+
+static int evaluate_condition(char *text) {
+  struct PreprocessBuffer *defined_text = new_preprocess_buffer();
+  struct PreprocessBuffer *expanded_text = new_preprocess_buffer();
+  long value;
+
+  replace_defined_operator(text, defined_text);
+  expand_text(get_preprocess_text(defined_text), expanded_text);
+  expression_pointer = get_preprocess_text(expanded_text);
+  skip_expression_space();
+  if (!*expression_pointer) preprocess_error("#if with no expression");
+  value = evaluate_expression();
+  skip_expression_space();
+  if (*expression_pointer) preprocess_error("Junk at end of #if expression");
+
+  free_preprocess_buffer(defined_text);
+  free_preprocess_buffer(expanded_text);
+  return (value != 0);
+}
+
+static int check_condition_active() {
+  if (!condition_depth) return (1);
+  return (condition_active_list[condition_depth - 1]);
+}
+
+static void push_condition(int parent_active, int value) {
+  if (condition_depth >= MAX_CONDITION_DEPTH) preprocess_error("Conditional directives nested too deeply");
+  condition_parent_active_list[condition_depth] = parent_active;
+  condition_active_list[condition_depth] = parent_active && value;
+  condition_taken_list[condition_depth] = value;
+  condition_else_list[condition_depth] = 0;
+  condition_depth++;
+}
+
+// 读取指令后面的宏名
+static int scan_macro_name(char **p) {
+  int length = 0;
+  *p = skip_preprocess_space(*p);
+  if (!check_preprocess_identifier_start(**p)) preprocess_error("Macro names must be identifiers");
+  while (check_preprocess_identifier_character((*p)[length])) length++;
+  return (length);
+}
+
+static void handle_define(char *p) {
+  char *name;
+  char **parameter_list = NULL;
+  int length, parameter_length, parameter_number = 0, is_function = 0;
+
+  length = scan_macro_name(&p);
+  name = p;
+  p = p + length;
+
+  // 宏名后面紧跟 '(' 才是函数宏
+  if (*p == '(') {
+    is_function = 1;
+    parameter_list = (char **) malloc(MAX_MACRO_PARAMETER_NUMBER * sizeof(char *));
+    p = skip_preprocess_space(p + 1);
+    if (*p != ')') {
+      while (1) {
+        p = skip_preprocess_space(p);
+        parameter_length = 0;
+        while (check_preprocess_identifier_character(p[parameter_length])) parameter_length++;
+        if (!parameter_length || !check_preprocess_identifier_start(*p))
+          preprocess_error("Bad macro parameter list");
+        if (parameter_number >= MAX_MACRO_PARAMETER_NUMBER)
+          preprocess_error("Too many macro parameters");
+        parameter_list[parameter_number] = copy_preprocess_text(p, parameter_length);
+        parameter_number++;
+        p = skip_preprocess_space(p + parameter_length);
+        if (*p == ')') break;
+        if (*p != ',') preprocess_error("Bad macro parameter list");
+        p++;
+      }
+    }
+    p++;
+  }
+
+  define_macro(name, length, is_function, parameter_list, parameter_number,
+    copy_trimmed_text(p, (int) strlen(p)));
+}
+
+// 按目录拼出头文件的路径
+static char *join_include_path(char *directory, int directory_length, char *name) {
+  int name_length = (int) strlen(name);
+  char *path;
+
+  if (name[0] == '/' || !directory_length) return (copy_preprocess_text(name, name_length));
+  path = (char *) malloc(directory_length + name_length + 2);
+  strncpy(path, directory, directory_length);
+  path[directory_length] = '/';
+  strncpy(path + directory_length + 1, name, name_length);
+  path[directory_length + name_length + 1] = 0;
+  return (path);
+}
+
+// 把整个文件读到内存里，文件不存在时返回 NULL
+static char *read_source_file(char *path) {
+  struct PreprocessBuffer *b;
+  char *content;
+  FILE *f;
+  int count;
+
+  if (!(f = fopen(path, "r"))) return (NULL);
+  b = new_preprocess_buffer();
+  while (1) {
+    reserve_preprocess_buffer(b, 4096);
+    count = (int) fread(b->data + b->size, 1, 4096, f);
+    if (count <= 0) break;
+    b->size = b->size + count;
+  }
+  fclose(f);
+
+  // 最后一行没有换行时补一个
+  if (b->size && b->data[b->size - 1] != '\n') preprocess_put_character(b, '\n');
+  content = get_preprocess_text(b);
+  free(b);
+  return (content);
+}
+
+// 先查缓存，缓存里没有再去读文件
+static struct IncludeFile *find_include_file(char *path) {
+  struct IncludeFile *f;
+  char *content;
+
+  for (f = include_file_head; f; f = f->next) {
+    if (!strcmp(f->path, path)) return (f);
+  }
+  if (!(content = read_source_file(path))) return (NULL);
+
+  f = (struct IncludeFile *) malloc(sizeof(struct IncludeFile));
+  f->path = strdup(path);
+  f->content = content;
+  f->guard = NULL;
+  f->next = include_file_head;
+  include_file_head = f;
+  return (f);
+}
+
+static void process_include_file(struct IncludeFile *f) {
+  struct SourceFile *source;
+  char *saved_filename = current_filename;
+  int saved_line = current_line;
+
+  if (include_depth >= MAX_INCLUDE_DEPTH) preprocess_error("#include nested too deeply");
+
+  source = (struct SourceFile *) malloc(sizeof(struct SourceFile));
+  source->include_file = f;
+  source->position = 0;
+  source->line = 1;
+  include_depth++;
+  process_source_file(source);
+  include_depth--;
+  free(source);
+
+  current_filename = saved_filename;
+  current_line = saved_line;
+}
+
+// 处理 #include，真正读入了头文件时返回 1
+static int handle_include(char *p) {
+  struct PreprocessBuffer *expanded = NULL;
+  struct IncludeFile *f = NULL;
+  char *name, *path;
+  int close, length, directory_length, i;
+
+  p = skip_preprocess_space(p);
+  // #include MACRO 的形式，先展开
+  if (*p != '"' && *p != '<') {
+    expanded = new_preprocess_buffer();
+    expand_text(p, expanded);
+    p = skip_preprocess_space(get_preprocess_text(expanded));
+  }
+  if (*p == '"') close = '"';
+  else if (*p == '<') close = '>';
+  else preprocess_error("#include expects a filename");
+
+  p++;
+  length = 0;
+  while (p[length] && p[length] != close) length++;
+  if (!p[length]) preprocess_error("Missing terminating character in #include");
+  name = copy_preprocess_text(p, length);
+  if (expanded) free_preprocess_buffer(expanded);
+
+  // "" 先在当前文件所在的目录找，然后与 <> 一样在系统头文件目录中找
+  if (close == '"') {
+    directory_length = 0;
+    for (i = 0; current_filename[i]; i++)
+      if (current_filename[i] == '/') directory_length = i;
+    path = join_include_path(current_filename, directory_length, name);
+    f = find_include_file(path);
+    free(path);
+  }
+  if (!f) {
+    path = join_include_path(system_include_directory, (int) strlen(system_include_directory), name);
+    f = find_include_file(path);
+    free(path);
+  }
+  if (!f) preprocess_error_with_message("Unable to open include file", name);
+  free(name);
+
+  // 有 include guard 并且已经定义过了，整个头文件都不需要了
+  if (f->guard && find_macro(f->guard, (int) strlen(f->guard))) return (0);
+
+  process_include_file(f);
+  return (1);
+}
+
+/**
+ * 处理一条预处理指令，p 指向 '#' 之后
+ * 读入了头文件时返回 1，调用方需要输出行号标记
+*/
+static int handle_directive(struct SourceFile *source, char *p) {
+  char *name;
+  int length, active = check_condition_active();
+  int value;
+
+  p = skip_preprocess_space(p);
+  name = p;
+  length = 0;
+  while (check_preprocess_identifier_character(p[length])) length++;
+  p = p + length;
+
+  // 单独一个 '#' 是空指令
+  if (!length) {
+    if (source->guard_state == GUARD_NOT_STARTED || source->guard_state == GUARD_FINISHED)
+      source->guard_state = GUARD_INVALID;
+    return (0);
+  }
+
+  if ((length == 6 && !strncmp(name, "ifndef", 6)) ||
+      (length == 5 && !strncmp(name, "ifdef", 5))) {
+    length = scan_macro_name(&p);
+    value = (find_macro(p, length) != NULL);
+    if (name[2] == 'n') value = !value;
+    // 文件的第一条指令是 #ifndef，可能是 include guard
+    if (source->guard_state == GUARD_NOT_STARTED) {
+      source->guard_state = GUARD_INVALID;
+      if (name[2] == 'n' && condition_depth == source->start_depth) {
+        source->guard_state = GUARD_INSIDE;
+        source->guard_name = copy_preprocess_text(p, length);
+      }
+    } else if (source->guard_state == GUARD_FINISHED) {
+      source->guard_state = GUARD_INVALID;
+    }
+    push_condition(active, value);
+    return (0);
+  }
+
+  if (source->guard_state == GUARD_NOT_STARTED || source->guard_state == GUARD_FINISHED)
+    source->guard_state = GUARD_INVALID;
+
+  if (length == 2 && !strncmp(name, "if", 2)) {
+    value = 0;
+    if (active) value = evaluate_condition(p);
+    push_condition(active, value);
+    return (0);
+  }
+
+  if ((length == 4 && !strncmp(name, "elif", 4)) ||
+      (length == 4 && !strncmp(name, "else", 4))) {
+    if (condition_depth <= source->start_depth)
+      preprocess_error_with_message("Directive without #if", name[2] == 'i' ? "#elif" : "#else");
+    if (condition_else_list[condition_depth - 1])
+      preprocess_error("#else or #elif after #else");
+    if (condition_depth == source->start_depth + 1 && source->guard_state == GUARD_INSIDE)
+      source->guard_state = GUARD_INVALID;
+
+    value = 0;
+    if (condition_parent_active_list[condition_depth - 1] && !condition_taken_list[condition_depth - 1]) {
+      if (name[2] == 'i') value = evaluate_condition(p);
+      else value = 1;
+    }
+    if (name[2] == 's') condition_else_list[condition_depth - 1] = 1;
+    condition_active_list[condition_depth - 1] = value;
+    if (value) condition_taken_list[condition_depth - 1] = 1;
+    return (0);
+  }
+
+  if (length == 5 && !strncmp(name, "endif", 5)) {
+    if (condition_depth <= source->start_depth) preprocess_error("#endif without #if");
+    condition_depth--;
+    if (condition_depth == source->start_depth && source->guard_state == GUARD_INSIDE)
+      source->guard_state = GUARD_FINISHED;
+    return (0);
+  }
+
+  // 以下的指令在被跳过的代码中不起作用
+  if (!active) return (0);
+
+  if (length == 7 && !strncmp(name, "include", 7)) return (handle_include(p));
+  if (length == 6 && !strncmp(name, "define", 6)) {
+    handle_define(p);
+    return (0);
+  }
+  if (length == 5 && !strncmp(name, "undef", 5)) {
+    length = scan_macro_name(&p);
+    undefine_macro(p, length);
+    return (0);
+  }
+  if (length == 5 && !strncmp(name, "error", 5))
+    preprocess_error_with_message("#error", skip_preprocess_space(p));
+  if ((length == 6 && !strncmp(name, "pragma", 6)) ||
+      (length == 4 && !strncmp(name, "line", 4)))
+    return (0);
+
+  preprocess_error_with_message("Invalid preprocessing directive", copy_preprocess_text(name, length));
+  return (0);
+}
+
+// 在 logical_line 后面接上下一个逻辑行，中间用空格隔开
+static int append_next_line(struct SourceFile *source) {
+  preprocess_put_character(logical_line, ' ');
+  return (append_logical_line(source));
+}
+
+static void process_source_file(struct SourceFile *source) {
+  char *p;
+  int lines, more;
+
+  current_filename = source->include_file->path;
+  source->start_depth = condition_depth;
+  source->guard_state = GUARD_NOT_STARTED;
+  source->guard_name = NULL;
+  emit_line_marker(1, current_filename);
+
+  while ((lines = read_logical_line(source))) {
+    current_line = source->line;
+    p = skip_preprocess_space(logical_line->data);
+
+    // 函数宏的实参跨行时把后面的行接到这一行上，展开之后再补上同样多的空行，行号不会错位
+    if (*p != '#' && check_condition_active()) {
+      while (check_unterminated_macro_call(logical_line->data) && (more = append_next_line(source)))
+        lines = lines + more;
+      p = skip_preprocess_space(logical_line->data);
+    }
+    source->line = source->line + lines;
+
+    if (*p == '#') {
+      // 读入头文件之后要用行号标记回到当前文件
+      if (handle_directive(source, p + 1)) {
+        current_filename = source->include_file->path;
+        emit_line_marker(source->line, current_filename);
+      } else {
+        emit_newlines(lines);
+      }
+      continue;
+    }
+
+    if (*p && (source->guard_state == GUARD_NOT_STARTED || source->guard_state == GUARD_FINISHED))
+      source->guard_state = GUARD_INVALID;
+    if (check_condition_active()) expand_text(logical_line->data, preprocess_output);
+    emit_newlines(lines);
+  }
+
+  current_line = source->line;
+  if (condition_depth != source->start_depth) preprocess_error("Unterminated conditional directive");
+  if (source->guard_state == GUARD_FINISHED && !source->include_file->guard)
+    source->include_file->guard = source->guard_name;
+  else if (source->guard_name)
+    free(source->guard_name);
+}
+
+/**
+ * 预处理 filename，返回展开后的内容，长度放在 *length 中
+ * 内容之后至少有 PREPROCESS_PADDING 个 '\0'
+ * include_directory 是 <> 头文件的查找目录
+ * 文件打不开时返回 NULL
+*/
+char *preprocess_file(char *filename, char *include_directory, int *length) {
+  struct IncludeFile *f;
+  struct SourceFile *source;
+  char *content;
+  int i;
+
+  if (!(f = find_include_file(filename))) return (NULL);
+
+  clear_all_macros();
+  system_include_directory = include_directory;
+  include_depth = 0;
+  condition_depth = 0;
+  current_filename = filename;
+  current_line = 0;
+  preprocess_output = new_preprocess_buffer();
+  if (!logical_line) logical_line = new_preprocess_buffer();
+
+  source = (struct SourceFile *) malloc(sizeof(struct SourceFile));
+  source->include_file = f;
+  source->position = 0;
+  source->line = 1;
+  process_source_file(source);
+  free(source);
+
+  // 末尾多留一些 '\0'，scan.c 一次读多个字节时不会越界
+  *length = preprocess_output->size;
+  reserve_preprocess_buffer(preprocess_output, PREPROCESS_PADDING);
+  for (i = 0; i < PREPROCESS_PADDING; i++) preprocess_output->data[preprocess_output->size + i] = 0;
+  content = preprocess_output->data;
+  free(preprocess_output);
+  preprocess_output = NULL;
+  return (content);
+}
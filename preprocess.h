@@ -0,0 +1,9 @@
+#ifndef __PREPROCESS_H__
+#define __PREPROCESS_H__
+
+// preprocess_file 返回的内容末尾补上的 '\0' 个数
+#define PREPROCESS_PADDING 32
+
+char *preprocess_file(char *filename, char *include_directory, int *length);
+
+#endif
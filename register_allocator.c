@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include "data.h"
+#include "definations.h"
+#include "arena.h"
+#include "generator_core.h"
+#include "linear_ir.h"
+#include "register_allocator.h"
+
+// 寄存器分配
+// 决定三地址 IR 中的每个虚拟寄存器放在哪个物理寄存器，或者放在栈上的哪个栈槽
+// 1. 按基本块做活跃变量分析，得到每个块入口和出口活跃的虚拟寄存器
+// 2. 指令按数组中的顺序编号，每个虚拟寄存器的生存区间是从第一次到最后一次活跃的位置，中间不留空洞
+// 3. 按区间的起点做 linear scan，寄存器不够时把使用权重最低的区间放到栈上
+// 4. 放到栈上的区间按同样的方法共用栈槽，生存区间不重叠的虚拟寄存器可以用同一个栈槽
+// 调用函数时 caller-saved 寄存器会被改掉，跨过调用的区间放在 caller-saved 寄存器中时，
+// 后端只在调用前后保存和恢复这些还活跃的寄存器
+// 跨过调用的区间优先用 callee-saved 寄存器，其他区间优先用 caller-saved 寄存器，
+// 这样叶子函数不用在开头和结尾保存 callee-saved 寄存器
+// 后端通过 generator_core.h 中的函数告诉分配器传参的寄存器和会被指令改掉的寄存器
+
+// 活跃变量的位集合中每个 int 用的位数
+#define LIVE_WORD_BITS 31
+// 循环中的使用次数乘以 LOOP_WEIGHT，权重最多到 MAX_LOOP_WEIGHT
+#define LOOP_WEIGHT 8
+#define MAX_LOOP_WEIGHT 4096
+// 一个区间的权重最多到这么多，计算密度时不会溢出
+#define MAX_INTERVAL_WEIGHT 1048576
+
+static struct IRFunction *allocator_function;
+static int live_word_number;
+// 每个基本块 live_word_number 个 int，第 b 个块从 b * live_word_number 开始
+static int *live_in_list;
+static int *live_out_list;
+static int *live_use_list;
+static int *live_def_list;
+static int *block_weight_list;
+
+// 每个虚拟寄存器的生存区间 [start, end]，没有用到的虚拟寄存器 end 为 -1
+static int *interval_start_list;
+static int *interval_end_list;
+static int *interval_weight_list;
+// 不能分配给这个区间的寄存器，第 r 位对应寄存器 r
+static int *forbidden_mask_list;
+// 区间中间有没有函数调用
+static int *cross_call_list;
+// 区间最好使用的寄存器，形参和实参用传参的寄存器，可以省掉一次 mov
+static int *hint_register_list;
+
+static int allocated_register_count;
+static int spilled_register_count;
+static int spill_slot_count;
+
+static int *allocate_int_list(int n) {
+  return ((int *) allocate_from_arena(function_arena, n * sizeof(int)));
+}
+
+static int check_live_bit(int *list, int block, int register_index) {
+  int word = list[block * live_word_number + register_index / LIVE_WORD_BITS];
+
+  return ((word >> (register_index % LIVE_WORD_BITS)) & 1);
+}
+
+static void set_live_bit(int *list, int block, int register_index) {
+  int i = block * live_word_number + register_index / LIVE_WORD_BITS;
+
+  list[i] = list[i] | (1 << (register_index % LIVE_WORD_BITS));
+}
+
+/**
+ * 指令读到的第 i 个虚拟寄存器(i 为 0 到 2)，没有时返回 NO_REGISTER
+ * 参数和实参指令的 index 是参数的位置，不是虚拟寄存器
+*/
+static int get_ir_use(struct IRInstruction *instruction, int i) {
+  int register_index = NO_REGISTER;
+
+  if (i == 0) register_index = instruction->source1;
+  else if (i == 1) register_index = instruction->source2;
+  else if (instruction->operation == IR_LOAD || instruction->operation == IR_STORE)
+    register_index = instruction->index;
+  if (register_index <= 0) return (NO_REGISTER);
+  return (register_index);
+}
+
+static int get_ir_definition(struct IRInstruction *instruction) {
+  if (instruction->destination <= 0) return (NO_REGISTER);
+  return (instruction->destination);
+}
+
+// 每个块中先读后写的虚拟寄存器放入 use，写过的放入 def
+static void compute_local_liveness() {
+  struct IRInstruction *instruction;
+  int i, j, block, register_index;
+
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    instruction = allocator_function->instruction_list[i];
+    block = instruction->block;
+    for (j = 0; j < 3; j++) {
+      register_index = get_ir_use(instruction, j);
+      if (register_index != NO_REGISTER && !check_live_bit(live_def_list, block, register_index))
+        set_live_bit(live_use_list, block, register_index);
+    }
+    register_index = get_ir_definition(instruction);
+    if (register_index != NO_REGISTER) set_live_bit(live_def_list, block, register_index);
+  }
+}
+
+/**
+ * 活跃变量分析
+ * out[b] 是所有后继的 in 的并集，in[b] = use[b] | (out[b] & ~def[b])
+ * 从后往前反复计算，直到没有变化
+*/
+static void compute_global_liveness() {
+  int changed = 1, block, i, j, n, successor, word, start;
+
+  while (changed) {
+    changed = 0;
+    for (block = allocator_function->block_number - 1; block >= 0; block--) {
+      start = block * live_word_number;
+      n = get_ir_successor_number(allocator_function, block);
+      for (i = 0; i < n; i++) {
+        successor = get_ir_successor(allocator_function, block, i) * live_word_number;
+        for (j = 0; j < live_word_number; j++)
+          live_out_list[start + j] = live_out_list[start + j] | live_in_list[successor + j];
+      }
+      for (j = 0; j < live_word_number; j++) {
+        word = live_use_list[start + j] | (live_out_list[start + j] & ~live_def_list[start + j]);
+        if (word != live_in_list[start + j]) {
+          live_in_list[start + j] = word;
+          changed = 1;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * 基本块的循环权重
+ * 块按源代码的顺序排列，跳回到前面(或者自己)的边 t -> h 围成一个循环，
+ * h 到 t 之间的块的循环深度加一，权重是 LOOP_WEIGHT 的深度次方
+*/
+static void compute_block_weight() {
+  int *depth_list = allocate_int_list(allocator_function->block_number + 1);
+  int block, i, n, head, b, weight;
+
+  for (block = 0; block < allocator_function->block_number; block++) {
+    n = get_ir_successor_number(allocator_function, block);
+    for (i = 0; i < n; i++) {
+      head = get_ir_successor(allocator_function, block, i);
+      if (head <= block) {
+        for (b = head; b <= block; b++) depth_list[b] = depth_list[b] + 1;
+      }
+    }
+  }
+
+  for (block = 0; block < allocator_function->block_number; block++) {
+    weight = 1;
+    for (i = 0; i < depth_list[block] && weight < MAX_LOOP_WEIGHT; i++) weight = weight * LOOP_WEIGHT;
+    block_weight_list[block] = weight;
+  }
+}
+
+// 区间延伸到 position
+static void extend_interval(int register_index, int position) {
+  if (position < interval_start_list[register_index]) interval_start_list[register_index] = position;
+  if (position > interval_end_list[register_index]) interval_end_list[register_index] = position;
+}
+
+static void add_interval_weight(int register_index, int weight) {
+  weight = interval_weight_list[register_index] + weight;
+  if (weight > MAX_INTERVAL_WEIGHT) weight = MAX_INTERVAL_WEIGHT;
+  interval_weight_list[register_index] = weight;
+}
+
+/**
+ * 计算生存区间
+ * 块入口活跃的虚拟寄存器延伸到块的第一条指令，出口活跃的延伸到块的最后一条指令，
+ * 再加上每次读写的位置
+*/
+static void build_intervals() {
+  struct IRInstruction *instruction;
+  int i, j, block, first, last, register_index;
+
+  for (i = 0; i < allocator_function->register_number; i++) {
+    interval_start_list[i] = allocator_function->instruction_number;
+    interval_end_list[i] = -1;
+  }
+
+  for (block = 0; block < allocator_function->block_number; block++) {
+    first = get_ir_block_start(allocator_function, block);
+    last = get_ir_block_start(allocator_function, block + 1) - 1;
+    for (register_index = 1; register_index < allocator_function->register_number; register_index++) {
+      if (check_live_bit(live_in_list, block, register_index)) extend_interval(register_index, first);
+      if (check_live_bit(live_out_list, block, register_index)) extend_interval(register_index, last);
+    }
+  }
+
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    instruction = allocator_function->instruction_list[i];
+    for (j = 0; j < 3; j++) {
+      register_index = get_ir_use(instruction, j);
+      if (register_index != NO_REGISTER) {
+        extend_interval(register_index, i);
+        add_interval_weight(register_index, block_weight_list[instruction->block]);
+      }
+    }
+    register_index = get_ir_definition(instruction);
+    if (register_index != NO_REGISTER) {
+      extend_interval(register_index, i);
+      add_interval_weight(register_index, block_weight_list[instruction->block]);
+    }
+  }
+}
+
+/**
+ * 寄存器 r 在 (from, to) 中被占用或者被改掉，
+ * 和这段位置重叠的区间(起点在 to 之前、终点在 from 之后)都不能用 r
+ * 终点正好在 from 的区间在这之前已经读完了，起点正好在 to 的区间在这之后才写入
+*/
+static void reserve_register(int r, int from, int to) {
+  int i;
+
+  if (r == NO_REGISTER) return;
+  for (i = 1; i < allocator_function->register_number; i++) {
+    if (interval_start_list[i] < to && interval_end_list[i] > from)
+      forbidden_mask_list[i] = forbidden_mask_list[i] | (1 << r);
+  }
+}
+
+// 实参指令之后的调用，参数寄存器一直占用到这里
+static int find_call_position(int position) {
+  struct IRInstruction *instruction;
+
+  while (position < allocator_function->instruction_number) {
+    instruction = allocator_function->instruction_list[position];
+    if (instruction->operation == IR_CALL || instruction->operation == IR_TAIL_CALL) return (position);
+    position++;
+  }
+  return (position);
+}
+
+/**
+ * 根据指令对寄存器的要求，算出每个区间不能使用的寄存器
+ * 1. 第 p 个形参在读出来之前一直占用第 p 个参数寄存器
+ * 2. 第 p 个实参从写入参数寄存器开始占用这个寄存器，直到调用
+ * 3. 后端翻译某些指令时要用到的寄存器，例如 x86-64 除法的 %rdx
+*/
+static void compute_register_constraints() {
+  struct IRInstruction *instruction;
+  int i;
+
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    instruction = allocator_function->instruction_list[i];
+    if (instruction->operation == IR_PARAMETER)
+      reserve_register(register_get_argument_register(instruction->index), -1, i);
+    if (instruction->operation == IR_ARGUMENT)
+      reserve_register(register_get_argument_register(instruction->index), i, find_call_position(i));
+    reserve_register(register_get_clobbered_register(instruction), i, i);
+  }
+}
+
+/**
+ * 标记中间有函数调用的区间，call_count_list[p] 是 p 之前的调用个数
+ * 调用正好在区间的起点或终点时，调用的结果写入区间或者区间在调用时读完，不算跨过
+*/
+static void mark_cross_call_intervals() {
+  int *call_count_list = allocate_int_list(allocator_function->instruction_number + 1);
+  int i, start, end;
+
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    call_count_list[i + 1] = call_count_list[i];
+    if (allocator_function->instruction_list[i]->operation == IR_CALL)
+      call_count_list[i + 1] = call_count_list[i] + 1;
+  }
+  for (i = 1; i < allocator_function->register_number; i++) {
+    start = interval_start_list[i];
+    end = interval_end_list[i];
+    if (end > start && call_count_list[end] > call_count_list[start + 1])
+      cross_call_list[i] = 1;
+  }
+}
+
+// 形参从传参的寄存器中读出来，实参要写到传参的寄存器中，这些区间优先用这个寄存器
+static void compute_register_hints() {
+  struct IRInstruction *instruction;
+  int i, register_index;
+
+  for (i = 1; i < allocator_function->register_number; i++)
+    hint_register_list[i] = NO_REGISTER;
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    instruction = allocator_function->instruction_list[i];
+    register_index = NO_REGISTER;
+    if (instruction->operation == IR_PARAMETER) register_index = instruction->destination;
+    if (instruction->operation == IR_ARGUMENT) register_index = instruction->source1;
+    if (register_index != NO_REGISTER && hint_register_list[register_index] == NO_REGISTER)
+      hint_register_list[register_index] = register_get_argument_register(instruction->index);
+  }
+}
+
+// 区间按起点排序之后的顺序，起点相同时按编号，没有用到的虚拟寄存器不在里面，返回区间个数
+static int sort_intervals(int *order_list) {
+  int *count_list = allocate_int_list(allocator_function->instruction_number + 2);
+  int i, n = 0, start;
+
+  for (i = 1; i < allocator_function->register_number; i++) {
+    if (interval_end_list[i] >= 0) {
+      start = interval_start_list[i] + 1;
+      count_list[start] = count_list[start] + 1;
+      n++;
+    }
+  }
+  for (i = 1; i <= allocator_function->instruction_number; i++)
+    count_list[i] = count_list[i] + count_list[i - 1];
+  for (i = 1; i < allocator_function->register_number; i++) {
+    if (interval_end_list[i] >= 0) {
+      start = interval_start_list[i];
+      order_list[count_list[start]] = i;
+      count_list[start] = count_list[start] + 1;
+    }
+  }
+  return (n);
+}
+
+/**
+ * 给区间从可以使用的寄存器 allowed_mask 中选一个
+ * 1. 不跨过调用的区间在提示的寄存器可以用时直接用它
+ * 2. 跨过调用的区间先找 callee-saved 寄存器，它们只在函数开头和结尾保存和恢复一次，调用前后不用再保存
+ * 3. 其他区间先找 caller-saved 寄存器，用了 callee-saved 寄存器就要在函数开头和结尾保存和恢复
+*/
+static int choose_register(int register_index, int allowed_mask) {
+  int n = register_get_allocatable_register_number(), r;
+  int prefer_callee_saved = cross_call_list[register_index];
+
+  r = hint_register_list[register_index];
+  if (r != NO_REGISTER && !prefer_callee_saved && ((allowed_mask >> r) & 1)) return (r);
+  for (r = 0; r < n; r++) {
+    if (((allowed_mask >> r) & 1) && register_check_callee_saved(r) == prefer_callee_saved) return (r);
+  }
+  for (r = 0; r < n; r++) {
+    if ((allowed_mask >> r) & 1) return (r);
+  }
+  return (NO_REGISTER);
+}
+
+// 区间的使用密度，越小越适合放到栈上
+static long get_spill_weight(int register_index) {
+  long weight = interval_weight_list[register_index];
+  int length = interval_end_list[register_index] - interval_start_list[register_index] + 1;
+
+  return (weight * 64 / length);
+}
+
+/**
+ * linear scan
+ * owner_list[r] 是当前占用寄存器 r 的虚拟寄存器，处理一个区间之前先释放已经结束的区间
+ * 没有空闲的寄存器时，在当前区间和占用着它可以用的寄存器的区间中选使用密度最低的放到栈上
+*/
+static void scan_intervals(int *order_list, int interval_number) {
+  int owner_list[32];
+  int n = register_get_allocatable_register_number();
+  int i, r, register_index, owner, occupied_mask, victim, victim_register;
+
+  for (r = 0; r < n; r++) owner_list[r] = 0;
+
+  for (i = 0; i < interval_number; i++) {
+    register_index = order_list[i];
+    occupied_mask = 0;
+    for (r = 0; r < n; r++) {
+      owner = owner_list[r];
+      if (owner && interval_end_list[owner] <= interval_start_list[register_index]) owner_list[r] = 0;
+      if (owner_list[r]) occupied_mask = occupied_mask | (1 << r);
+    }
+
+    r = choose_register(register_index, ~(occupied_mask | forbidden_mask_list[register_index]));
+    if (r == NO_REGISTER) {
+      victim = register_index;
+      victim_register = NO_REGISTER;
+      for (r = 0; r < n; r++) {
+        owner = owner_list[r];
+        if (owner && !((forbidden_mask_list[register_index] >> r) & 1) &&
+            get_spill_weight(owner) < get_spill_weight(victim)) {
+          victim = owner;
+          victim_register = r;
+        }
+      }
+      allocator_function->register_assignment[victim] = NO_REGISTER;
+      r = victim_register;
+    }
+    if (r != NO_REGISTER) {
+      owner_list[r] = register_index;
+      allocator_function->register_assignment[register_index] = r;
+    }
+  }
+}
+
+/**
+ * 给放在栈上的区间分配栈槽，按起点的顺序，结束了的区间的栈槽可以给后面的区间用
+*/
+static void assign_spill_slots(int *order_list, int interval_number) {
+  int *slot_end_list = allocate_int_list(interval_number + 1);
+  int i, slot, register_index;
+
+  allocator_function->spill_slot_number = 0;
+  for (i = 0; i < interval_number; i++) {
+    register_index = order_list[i];
+    if (allocator_function->register_assignment[register_index] == NO_REGISTER) {
+      slot = 0;
+      while (slot < allocator_function->spill_slot_number &&
+             slot_end_list[slot] > interval_start_list[register_index])
+        slot++;
+      if (slot == allocator_function->spill_slot_number)
+        allocator_function->spill_slot_number = slot + 1;
+      slot_end_list[slot] = interval_end_list[register_index];
+      allocator_function->spill_slot_list[register_index] = slot;
+      spilled_register_count++;
+    } else {
+      allocated_register_count++;
+    }
+  }
+  spill_slot_count = spill_slot_count + allocator_function->spill_slot_number;
+}
+
+// 每个调用前后要保存的 caller-saved 寄存器：分到了这些寄存器并且跨过这次调用的区间
+static void compute_call_save_masks() {
+  struct IRInstruction *instruction;
+  int i, j, r;
+
+  for (i = 0; i < allocator_function->instruction_number; i++) {
+    instruction = allocator_function->instruction_list[i];
+    if (instruction->operation == IR_CALL) {
+      for (j = 1; j < allocator_function->register_number; j++) {
+        r = allocator_function->register_assignment[j];
+        if (r != NO_REGISTER && !register_check_callee_saved(r) &&
+            interval_start_list[j] < i && interval_end_list[j] > i)
+          instruction->save_register_mask = instruction->save_register_mask | (1 << r);
+      }
+    }
+  }
+}
+
+/**
+ * 给函数中的虚拟寄存器分配位置
+*/
+void allocate_ir_registers(struct IRFunction *function) {
+  int n = function->register_number, blocks = function->block_number + 1;
+  int *order_list, interval_number, i;
+
+  allocator_function = function;
+  function->register_assignment = allocate_int_list(n);
+  function->spill_slot_list = allocate_int_list(n);
+  for (i = 0; i < n; i++) {
+    function->register_assignment[i] = NO_REGISTER;
+    function->spill_slot_list[i] = -1;
+  }
+
+  live_word_number = n / LIVE_WORD_BITS + 1;
+  live_in_list = allocate_int_list(blocks * live_word_number);
+  live_out_list = allocate_int_list(blocks * live_word_number);
+  live_use_list = allocate_int_list(blocks * live_word_number);
+  live_def_list = allocate_int_list(blocks * live_word_number);
+  block_weight_list = allocate_int_list(blocks);
+  interval_start_list = allocate_int_list(n);
+  interval_end_list = allocate_int_list(n);
+  interval_weight_list = allocate_int_list(n);
+  forbidden_mask_list = allocate_int_list(n);
+  cross_call_list = allocate_int_list(n);
+  hint_register_list = allocate_int_list(n);
+  order_list = allocate_int_list(n);
+
+  compute_local_liveness();
+  compute_global_liveness();
+  compute_block_weight();
+  build_intervals();
+  compute_register_constraints();
+  mark_cross_call_intervals();
+  compute_register_hints();
+
+  interval_number = sort_intervals(order_list);
+  scan_intervals(order_list, interval_number);
+  assign_spill_slots(order_list, interval_number);
+  compute_call_save_masks();
+  allocator_function = NULL;
+}
+
+// -v 时输出寄存器分配的结果，之后清零，下一个文件重新计数
+void print_register_allocation_statistics() {
+  printf("register allocation: %d in registers, %d spilled into %d slots\n",
+    allocated_register_count, spilled_register_count, spill_slot_count);
+  allocated_register_count = 0;
+  spilled_register_count = 0;
+  spill_slot_count = 0;
+}
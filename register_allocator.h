@@ -0,0 +1,9 @@
+#ifndef __REGISTER_ALLOCATOR_H__
+#define __REGISTER_ALLOCATOR_H__
+
+#include "definations.h"
+
+void allocate_ir_registers(struct IRFunction *function);
+void print_register_allocation_statistics();
+
+#endif
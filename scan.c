@@ -7,6 +7,12 @@
 #include "scan.h"
 #include "helper.h"
 
+// 有 SSE2 时一次比较 16 个字节，zcc 自举时没有 __SSE2__，只用下面的标量循环
+// 预处理的结果末尾留有 PREPROCESS_PADDING 个 '\0'，一次多读 15 个字节不会越界
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 char *token_strings[] = {
   "EOF", "=", "+=", "-=", "*=", "/=", "%=", "?",
   "&&", "||", "|", "^", "&",
@@ -22,7 +28,8 @@ char *token_strings[] = {
   "->", ":"
 };
 
-// 从文件中读取下一个字符
+// 从输入缓冲区中读取下一个字符
+// 预处理之后的内容整个放在以 '\0' 结尾的内存中，input_pointer 指向下一个要读的字符
 static int next(void) {
   int c;
   int l;
@@ -34,8 +41,12 @@ static int next(void) {
     return (c);
   }
 
-  // 返回了上一次读取后的值之后，再次从文件刚刚的位置的下一位读取
-  c = fgetc(input_file);
+  // 返回了上一次读取后的值之后，再次从缓冲区刚刚的位置的下一位读取
+  // 读到 '\0' 表示结束，input_pointer 停在这里不动，之后再读也还是 EOF
+  c = *input_pointer;
+  c = c & 0xff;
+  if (!c) return (EOF);
+  input_pointer++;
   // 处理预编译处理过后的头文件，这些头文件会加载到 main.c 中
   // 这些头文件一般长这样
   // # 1 "z.c"
@@ -76,8 +87,12 @@ static int next(void) {
     }
 
     // 跳过行尾继续下一个
-    while ((c = fgetc(input_file) != '\n'));
-    c = fgetc(input_file);
+    while (*input_pointer && *input_pointer != '\n') input_pointer++;
+    if (*input_pointer) input_pointer++;
+    c = *input_pointer;
+    c = c & 0xff;
+    if (!c) return (EOF);
+    input_pointer++;
     start_line = 1;
   }
 
@@ -95,9 +110,111 @@ static void put_back(int c) {
   putback_buffer = c;
 }
 
+// 返回从 p 开始连续的空白字符个数，其中的换行个数通过 newline_count 带回
+static int scan_whitespace_run(char *p, int *newline_count) {
+  int i = 0, c, newlines = 0;
+#ifdef __SSE2__
+  __m128i chunk;
+  int mask, newline_mask, stop;
+
+  while (1) {
+    chunk = _mm_loadu_si128((__m128i *) (p + i));
+    newline_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+    mask = newline_mask
+      | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')))
+      | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')))
+      | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')))
+      | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\f')));
+    if (mask != 0xffff) {
+      stop = __builtin_ctz(~mask);
+      *newline_count = newlines + __builtin_popcount(newline_mask & ((1 << stop) - 1));
+      return (i + stop);
+    }
+    newlines += __builtin_popcount(newline_mask);
+    i += 16;
+  }
+#endif
+
+  while (1) {
+    c = p[i];
+    if (c == '\n') newlines++;
+    else if (c != ' ' && c != '\t' && c != '\r' && c != '\f') break;
+    i++;
+  }
+  *newline_count = newlines;
+  return (i);
+}
+
+// 返回从 p 开始连续的标识符字符(字母、数字和 '_')个数
+static int scan_identifier_run(char *p) {
+  int i = 0, c;
+#ifdef __SSE2__
+  __m128i chunk, lower, upper, digit, underline;
+  int mask;
+
+  while (1) {
+    chunk = _mm_loadu_si128((__m128i *) (p + i));
+    // 非 ASCII 字符按有符号比较是负数，不会落在这些范围内
+    lower = _mm_and_si128(
+      _mm_cmpgt_epi8(chunk, _mm_set1_epi8('a' - 1)),
+      _mm_cmplt_epi8(chunk, _mm_set1_epi8('z' + 1)));
+    upper = _mm_and_si128(
+      _mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)),
+      _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+    digit = _mm_and_si128(
+      _mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+      _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+    underline = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+    mask = _mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(lower, upper), _mm_or_si128(digit, underline)));
+    if (mask != 0xffff) return (i + __builtin_ctz(~mask));
+    i += 16;
+  }
+#endif
+
+  while (1) {
+    c = p[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+      break;
+    i++;
+  }
+  return (i);
+}
+
+// 返回从 p 开始字符串中可以原样复制的字符个数
+// 遇到 '"'、'\\'、换行或者 '\0' 时停下，这些字符交给 escape_character 处理
+static int scan_string_run(char *p) {
+  int i = 0, c;
+#ifdef __SSE2__
+  __m128i chunk;
+  int mask;
+
+  while (1) {
+    chunk = _mm_loadu_si128((__m128i *) (p + i));
+    mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(
+        _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')),
+        _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+      _mm_or_si128(
+        _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')),
+        _mm_cmpeq_epi8(chunk, _mm_setzero_si128()))));
+    if (mask) return (i + __builtin_ctz(mask));
+    i += 16;
+  }
+#endif
+
+  while (1) {
+    c = p[i];
+    if (!c || c == '"' || c == '\\' || c == '\n') break;
+    i++;
+  }
+  return (i);
+}
+
 // 白名单，遇到如下的字符就跳过
 static int skip(void) {
   int c = next();
+  int length, newlines;
 
   while (
     ' ' == c ||
@@ -106,6 +223,13 @@ static int skip(void) {
     '\r' == c ||
     '\f' == c
   ) {
+    // 连续的空白直接在缓冲区里跳过，不用每个字符都调用一次 next
+    length = scan_whitespace_run(input_pointer, &newlines);
+    if (length) {
+      line = line + newlines;
+      start_line = (input_pointer[length - 1] == '\n');
+      input_pointer = input_pointer + length;
+    }
     // 遇到以上的字符就继续读取
     c = next();
   }
@@ -123,52 +247,55 @@ static int get_the_position_of_the_charater(char *s, int c) {
   return (-1);
 }
 
-// 从输入的 file 中扫描并返回一个 integer 字符
+// 从输入缓冲区中扫描并返回一个 integer 字符
+// c 是已经读到的第一个数字，后面的数字直接在缓冲区里扫描
 static int scan_integer(int c) {
   // 默认 10 进制
   int k, value = 0, radix = 10;
 
   if (c == '0') {
-    if ((c = next()) == 'x') {
+    // 8 进制
+    radix = 8;
+    if (*input_pointer == 'x') {
       // 16 进制
       radix = 16;
-      c = next();
-    } else
-      // 8 进制
-      radix = 8;
+      input_pointer++;
+    }
+  } else {
+    value = c - '0';
   }
 
-  while (((k = get_the_position_of_the_charater("0123456789abcdef", tolower(c))) >= 0)) {
+  while (1) {
+    c = *input_pointer;
+    if (c >= '0' && c <= '9') k = c - '0';
+    else if (c >= 'a' && c <= 'f') k = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') k = c - 'A' + 10;
+    else break;
     if (k >= radix)
       error_with_character("invalid digit in integer literal", c);
     value = value * radix + k;
     // 如果是数字，继续扫描
-    c = next();
+    input_pointer++;
   }
 
-  // 如果不是数字，则将读取到的字符放到 put buffer 中
-  // 准备下一次读取
-  // put buffer 在这里可以理解为一个读取完一个 interger 之后的状态
-  put_back(c);
+  // 不是数字的字符还留在缓冲区中，不需要 put_back
   return (value);
 }
 
 // 扫描标识符，并将其存入 buffer 中，最终返回是这个标识符的长度
 // 这个标识符是类似于 printf 之类的函数名称或者其他的变量
+// c 是已经读到的第一个字符，后面的字符直接在缓冲区里扫描
 static int scan_identifier(int c, char *buffer, int limit_length) {
-  int length = 0;
+  int length;
 
-  // 如果是 字母 | 数字 | _
-  while(isalpha(c) || isdigit(c) || '_' == c) {
-    if (length >= limit_length - 1) {
-      error("identifier too long on line");
-    }
-    buffer[length ++] = (char)c;
-    c = next();
+  // c 已经确定是字母或者 '_'，它后面的部分一次找出来
+  length = scan_identifier_run(input_pointer) + 1;
+  if (length >= limit_length) {
+    error("identifier too long on line");
   }
-
-  // 跳出循环时，最后一个通过 next 得到的 c 是无效的，所以这里需要 put_back
-  put_back(c);
+  buffer[0] = (char)c;
+  memcpy(buffer + 1, input_pointer, length - 1);
+  input_pointer = input_pointer + length - 1;
 
   // 在最后要加结尾符
   buffer[length] = '\0';
@@ -241,8 +368,17 @@ static int escape_character() {
 // 扫描 sting，并存入 text_buffer 中
 // 返回 string 的长度
 static int scan_string(char *buffer) {
-  int i, c;
+  int i, c, length;
   for (i = 0; i < TEXT_LENGTH - 1; i++) {
+    // 普通字符成段地直接复制，引号、转义和换行才逐个字符处理
+    if (!putback_buffer) {
+      length = scan_string_run(input_pointer);
+      if (length > TEXT_LENGTH - 1 - i) length = TEXT_LENGTH - 1 - i;
+      memcpy(buffer + i, input_pointer, length);
+      input_pointer = input_pointer + length;
+      i = i + length;
+      if (i >= TEXT_LENGTH - 1) break;
+    }
     if ((c = escape_character()) == '"') {
       buffer[i] = 0;
       return (i);
@@ -253,63 +389,151 @@ static int scan_string(char *buffer) {
   return (0);
 }
 
-// 这里只做简单的判断，如果首字母是对应关键字的首字母，则直接返回关键字
-static int get_keyword(char *s) {
-  switch (*s) {
-    case 'c':
-      if (!strcmp(s, "char")) return (TOKEN_CHAR);
-      else if (!strcmp(s, "continue")) return (TOKEN_CONTINUE);
-      else if (!strcmp(s, "case")) return (TOKEN_CASE);
-      break;
-    case 'l':
-      if (!strcmp(s, "long")) return (TOKEN_LONG);
-    case 'i':
-      if (!strcmp(s, "if")) return (TOKEN_IF);
-      else if (!strcmp(s, "int")) return (TOKEN_INT);
-      break;
-    case 'e':
-      if (!strcmp(s, "else")) return (TOKEN_ELSE);
-      else if (!strcmp(s, "enum")) return (TOKEN_ENUM);
-      else if (!strcmp(s, "extern")) return (TOKEN_EXTERN);
-      break;
-    case 'w':
-      if (!strcmp(s, "while")) return (TOKEN_WHILE);
-      break;
-    case 'f':
-      if (!strcmp(s, "for")) return (TOKEN_FOR);
-      break;
-    case 'r':
-      if (!strcmp(s, "return")) return (TOKEN_RETURN);
-    case 'v':
-      if (!strcmp(s, "void")) return (TOKEN_VOID);
-      break;
-    case 's':
-      if (!strcmp(s, "struct")) return (TOKEN_STRUCT);
-      else if (!strcmp(s, "switch")) return (TOKEN_SWITCH);
-      else if (!strcmp(s, "sizeof")) return (TOKEN_SIZEOF);
-      else if (!strcmp(s, "static")) return (TOKEN_STATIC);
-      break;
-    case 'u':
-      if (!strcmp(s, "union")) return (TOKEN_UNION);
-      break;
-    case 't':
-      if (!strcmp(s, "typedef")) return (TOKEN_TYPEDEF);
-      break;
-    case 'b':
-      if (!strcmp(s, "break")) return (TOKEN_BREAK);
-      break;
-    case 'd':
-      if (!strcmp(s, "default")) return (TOKEN_DEFAULT);
-      break;
+// 标识符的驻留表
+// 同样内容的标识符只保存一份，intern_string 总是返回同一个指针，
+// 所以符号表里的名字可以直接比较指针，不需要 strdup 和 strcmp
+#define INTERN_HASH_INITIAL_SIZE 1024
+
+struct InternedString {
+  char *name;
+  int length;
+  int hash;
+  struct InternedString *next;
+};
+
+static struct InternedString **intern_hash_list;
+static int intern_hash_size;
+static int intern_string_count;
+
+static int hash_intern_string(char *s, int length) {
+  int h = 0, i, c;
+  for (i = 0; i < length; i++) {
+    c = s[i];
+    h = (h * 31 + c) & 0xffffff;
   }
-  return (0);
+  return (h);
+}
+
+// 驻留的字符串多于桶的个数时，桶的个数翻倍
+static void grow_intern_hash_list() {
+  struct InternedString **old_list = intern_hash_list;
+  struct InternedString *node, *next;
+  int old_size = intern_hash_size, i, bucket;
+
+  if (intern_hash_size) intern_hash_size = intern_hash_size * 2;
+  else intern_hash_size = INTERN_HASH_INITIAL_SIZE;
+  intern_hash_list = (struct InternedString **) malloc(intern_hash_size * sizeof(struct InternedString *));
+  for (i = 0; i < intern_hash_size; i++) intern_hash_list[i] = NULL;
+
+  for (i = 0; i < old_size; i++) {
+    for (node = old_list[i]; node; node = next) {
+      next = node->next;
+      bucket = node->hash & (intern_hash_size - 1);
+      node->next = intern_hash_list[bucket];
+      intern_hash_list[bucket] = node;
+    }
+  }
+  if (old_list) free(old_list);
+}
+
+// 返回 s 前 length 个字符对应的唯一指针
+char *intern_string(char *s, int length) {
+  struct InternedString *node;
+  int h = hash_intern_string(s, length), bucket;
+
+  if (intern_string_count >= intern_hash_size) grow_intern_hash_list();
+
+  bucket = h & (intern_hash_size - 1);
+  for (node = intern_hash_list[bucket]; node; node = node->next) {
+    if (node->hash == h && node->length == length && !strncmp(node->name, s, length))
+      return (node->name);
+  }
+
+  node = (struct InternedString *) malloc(sizeof(struct InternedString));
+  node->name = (char *) malloc(length + 1);
+  memcpy(node->name, s, length);
+  node->name[length] = 0;
+  node->length = length;
+  node->hash = h;
+  node->next = intern_hash_list[bucket];
+  intern_hash_list[bucket] = node;
+  intern_string_count++;
+  return (node->name);
+}
+
+// 关键字的完美哈希表
+// 哈希值只用到标识符的长度和首尾两个字符，对现有的关键字没有冲突，
+// 所以判断一个标识符是不是关键字只需要算一次哈希再比较一次
+#define KEYWORD_HASH_SIZE 64
+#define MAX_KEYWORD_LENGTH 8
+
+static char *keyword_hash_name_list[KEYWORD_HASH_SIZE];
+static int keyword_hash_token_list[KEYWORD_HASH_SIZE];
+static int keyword_hash_ready;
+
+static int hash_keyword(char *s, int length) {
+  int first = s[0];
+  int last = s[length - 1];
+  return ((length * 4 + first + last) & (KEYWORD_HASH_SIZE - 1));
+}
+
+static void add_keyword(char *name, int token) {
+  int h = hash_keyword(name, (int) strlen(name));
+  // 新增的关键字如果冲突了，需要重新选择 hash_keyword 中的系数
+  if (keyword_hash_name_list[h]) {
+    fprintf(stderr, "keyword hash collision between %s and %s\n", name, keyword_hash_name_list[h]);
+    exit(1);
+  }
+  keyword_hash_name_list[h] = name;
+  keyword_hash_token_list[h] = token;
+}
+
+static void init_keyword_hash() {
+  add_keyword("char", TOKEN_CHAR);
+  add_keyword("continue", TOKEN_CONTINUE);
+  add_keyword("case", TOKEN_CASE);
+  add_keyword("long", TOKEN_LONG);
+  add_keyword("if", TOKEN_IF);
+  add_keyword("int", TOKEN_INT);
+  add_keyword("else", TOKEN_ELSE);
+  add_keyword("enum", TOKEN_ENUM);
+  add_keyword("extern", TOKEN_EXTERN);
+  add_keyword("while", TOKEN_WHILE);
+  add_keyword("for", TOKEN_FOR);
+  add_keyword("return", TOKEN_RETURN);
+  add_keyword("void", TOKEN_VOID);
+  add_keyword("struct", TOKEN_STRUCT);
+  add_keyword("switch", TOKEN_SWITCH);
+  add_keyword("sizeof", TOKEN_SIZEOF);
+  add_keyword("static", TOKEN_STATIC);
+  add_keyword("union", TOKEN_UNION);
+  add_keyword("typedef", TOKEN_TYPEDEF);
+  add_keyword("break", TOKEN_BREAK);
+  add_keyword("default", TOKEN_DEFAULT);
+  keyword_hash_ready = 1;
+}
+
+// 如果 s 是关键字则返回对应的 token，否则返回 0
+// length 是 scan_identifier 已经算出来的长度，这里不需要再遍历一遍 s
+static int get_keyword(char *s, int length) {
+  char *keyword;
+  int h;
+
+  if (length < 2 || length > MAX_KEYWORD_LENGTH) return (0);
+  if (!keyword_hash_ready) init_keyword_hash();
+
+  h = hash_keyword(s, length);
+  keyword = keyword_hash_name_list[h];
+  if (!keyword || keyword[0] != s[0]) return (0);
+  if (strncmp(keyword, s, length) || keyword[length]) return (0);
+  return (keyword_hash_token_list[h]);
 }
 
 // 扫描 tokens
 // 只有扫描到文件尾时返回 0，表示扫描结束
 // 其他情况均在扫描中
 int scan(struct Token *t) {
-  int c, token_type;
+  int c, token_type, length;
 
   // 如果提前找到了 token，就直接返回这个 token
   if (look_ahead_token.token) {
@@ -489,15 +713,16 @@ int scan(struct Token *t) {
         break;
       } else if (isalpha(c) || '_' == c) {
         // 如果遇到是一个字母开头的，则将其视为标识符扫描
-        scan_identifier(c, text_buffer, TEXT_LENGTH);
+        length = scan_identifier(c, text_buffer, TEXT_LENGTH);
 
-        int token = get_keyword(text_buffer);
-        if (token) {
-          t->token = token;
+        token_type = get_keyword(text_buffer, length);
+        if (token_type) {
+          t->token = token_type;
           break;
         }
         // 如果都不是关键字，则只能说明是个标识符
         t->token = TOKEN_IDENTIFIER;
+        interned_text_buffer = intern_string(text_buffer, length);
         break;
       }
       error_with_character("Unrecognised character", c);
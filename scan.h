@@ -5,5 +5,6 @@
 #include "definations.h"
 
 int scan(struct Token *t);
+char *intern_string(char *s, int length);
 
 #endif
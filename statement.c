@@ -82,7 +82,7 @@ static struct ASTNode *parse_switch_statement() {
 
           // 遍历所有的 case value 列表，检查是否有重复的 case value
           // 比如 case a: 后面又有一个 case a:
-          for (c = case_tree; c; c = c->right)
+          for (c = case_tree; c; c = get_ast_right(c))
             if (case_value == c->ast_node_integer_value)
               error("Duplicate case value");
         }
@@ -104,8 +104,8 @@ static struct ASTNode *parse_switch_statement() {
         if (!case_tree) {
           case_tree = case_tail = create_ast_left_node(ast_operation, 0, left, case_value, NULL, NULL);
         } else {
-          case_tail->right = create_ast_left_node(ast_operation, 0, left, case_value, NULL, NULL);
-          case_tail = case_tail->right;
+          set_ast_right(case_tail, create_ast_left_node(ast_operation, 0, left, case_value, NULL, NULL));
+          case_tail = get_ast_right(case_tail);
         }
         break;
       default:
@@ -116,7 +116,7 @@ static struct ASTNode *parse_switch_statement() {
 
   // 解析 case 完之后给初始 node 赋值
   node->ast_node_integer_value = case_count;
-  node->right = case_tree;
+  set_ast_right(node, case_tree);
 
   // 跳过 '}'
   verify_right_brace();
@@ -140,7 +140,7 @@ static struct ASTNode *parse_single_statement() {
       return (statement);
     case TOKEN_IDENTIFIER:
       // 检查是否被 typedef 定义过
-      if (!find_typedef_symbol(text_buffer)) {
+      if (!find_typedef_symbol(interned_text_buffer)) {
         statement = converse_token_2_ast(0);
         verify_semicolon();
         return (statement);
@@ -201,7 +201,7 @@ struct ASTNode *parse_if_statement() {
         condition_node,
         0,
         NULL,
-        condition_node->composite_type);
+        get_ast_composite_type(condition_node));
   verify_right_paren();
 
   // 为复合语句创建 ast
@@ -244,7 +244,7 @@ struct ASTNode *parse_while_statement() {
         condition_node,
         0,
         NULL,
-        condition_node->composite_type);
+        get_ast_composite_type(condition_node));
 
   verify_right_paren();
 
@@ -294,7 +294,7 @@ struct ASTNode *parse_for_statement() {
         condition_node,
         0,
         NULL,
-        condition_node->composite_type);
+        get_ast_composite_type(condition_node));
   verify_semicolon();
 
   // 解析 i = i+1)
@@ -6,6 +6,116 @@
 #include "symbol_table.h"
 #include "definations.h"
 #include "types.h"
+#include "arena.h"
+#include "ast.h"
+
+// 符号的哈希索引
+// 链表仍然保留，用来按声明的顺序生成代码和 -M 输出，哈希表只负责查找
+// 每个命名空间一个开放地址法的哈希表，键是经过 intern_string 驻留的名字指针
+// 同名的符号只索引第一个，与原来沿着链表查找的结果一致
+#define SYMBOL_HASH_INITIAL_SIZE 64
+
+// 符号从 arena 分配，AST 节点在 ast.c 的节点表中
+// 局部变量和函数生成代码时的临时数据放在 function_arena 里，函数生成完代码之后整体回收
+// 其余的符号放在 translation_unit_arena 里，编译下一个源文件时整体回收
+#define FUNCTION_ARENA_BLOCK_SIZE (64 * 1024)
+#define TRANSLATION_UNIT_ARENA_BLOCK_SIZE (256 * 1024)
+
+struct SymbolHash {
+  struct SymbolTable **slot_list;
+  int size;
+  int count;
+  // 按插入顺序记录索引过的符号，扩容时按这个顺序重新插入，
+  // 清空时逆序删除，这样不会打断其他符号的探测序列
+  struct SymbolTable **undo_list;
+  int undo_capacity;
+};
+
+static struct SymbolHash *global_symbol_hash;
+static struct SymbolHash *local_symbol_hash;
+static struct SymbolHash *struct_symbol_hash;
+static struct SymbolHash *union_symbol_hash;
+static struct SymbolHash *enum_type_symbol_hash;
+static struct SymbolHash *enum_value_symbol_hash;
+static struct SymbolHash *typedef_symbol_hash;
+
+static struct SymbolHash *new_symbol_hash() {
+  struct SymbolHash *hash = (struct SymbolHash *) malloc(sizeof(struct SymbolHash));
+  int i;
+
+  hash->size = SYMBOL_HASH_INITIAL_SIZE;
+  hash->count = 0;
+  hash->slot_list = (struct SymbolTable **) malloc(hash->size * sizeof(struct SymbolTable *));
+  for (i = 0; i < hash->size; i++) hash->slot_list[i] = NULL;
+  hash->undo_capacity = SYMBOL_HASH_INITIAL_SIZE;
+  hash->undo_list = (struct SymbolTable **) malloc(hash->undo_capacity * sizeof(struct SymbolTable *));
+  return (hash);
+}
+
+static int get_symbol_hash_slot(struct SymbolHash *hash, char *name) {
+  long h = (long) name;
+  h = (h >> 3) * 40503;
+  return ((int) (h & (hash->size - 1)));
+}
+
+// 返回 name 所在的槽位，不存在时返回探测结束的空槽位
+static int find_symbol_hash_slot(struct SymbolHash *hash, char *name) {
+  int i = get_symbol_hash_slot(hash, name);
+  struct SymbolTable *t;
+
+  while ((t = hash->slot_list[i])) {
+    if (t->name == name) return (i);
+    i = (i + 1) & (hash->size - 1);
+  }
+  return (i);
+}
+
+static void grow_symbol_hash(struct SymbolHash *hash) {
+  struct SymbolTable *t;
+  int i;
+
+  free(hash->slot_list);
+  hash->size = hash->size * 2;
+  hash->slot_list = (struct SymbolTable **) malloc(hash->size * sizeof(struct SymbolTable *));
+  for (i = 0; i < hash->size; i++) hash->slot_list[i] = NULL;
+  for (i = 0; i < hash->count; i++) {
+    t = hash->undo_list[i];
+    hash->slot_list[find_symbol_hash_slot(hash, t->name)] = t;
+  }
+}
+
+static void insert_symbol_hash(struct SymbolHash *hash, struct SymbolTable *t) {
+  int i;
+
+  if (!t->name) return;
+  if ((hash->count + 1) * 2 > hash->size) grow_symbol_hash(hash);
+  i = find_symbol_hash_slot(hash, t->name);
+  if (hash->slot_list[i]) return;
+
+  hash->slot_list[i] = t;
+  if (hash->count == hash->undo_capacity) {
+    hash->undo_capacity = hash->undo_capacity * 2;
+    hash->undo_list = (struct SymbolTable **) realloc(
+      hash->undo_list, hash->undo_capacity * sizeof(struct SymbolTable *));
+  }
+  hash->undo_list[hash->count] = t;
+  hash->count = hash->count + 1;
+}
+
+static struct SymbolTable *lookup_symbol_hash(struct SymbolHash *hash, char *name) {
+  return (hash->slot_list[find_symbol_hash_slot(hash, name)]);
+}
+
+// 逆序撤销所有插入，代价与插入的符号个数成正比，与表的大小无关
+static void clear_symbol_hash(struct SymbolHash *hash) {
+  struct SymbolTable *t;
+
+  while (hash->count > 0) {
+    hash->count = hash->count - 1;
+    t = hash->undo_list[hash->count];
+    hash->slot_list[find_symbol_hash_slot(hash, t->name)] = NULL;
+  }
+}
 
 static struct SymbolTable *add_symbol_core(
   char *symbol_string,
@@ -16,7 +126,9 @@ static struct SymbolTable *add_symbol_core(
   int position,
   struct SymbolTable** head,
   struct SymbolTable** tail,
-  struct SymbolTable *composite_type
+  struct SymbolTable *composite_type,
+  struct SymbolHash *hash,
+  struct Arena *arena
 ) {
   struct SymbolTable *t = new_symbol_table(
     symbol_string,
@@ -25,7 +137,8 @@ static struct SymbolTable *add_symbol_core(
     size,
     storage_class,
     position,
-    composite_type
+    composite_type,
+    arena
   );
   // size: 变量里面所有元素的【大小】
   // element_number: 变量里面所有元素的【个数】
@@ -34,6 +147,7 @@ static struct SymbolTable *add_symbol_core(
       composite_type)
     t->size = composite_type->size;
   append_to_symbol_table(head, tail, t);
+  if (hash) insert_symbol_hash(hash, t);
   return (t);
 }
 
@@ -42,8 +156,9 @@ static struct SymbolTable *find_symbol_in_list(
   struct SymbolTable *list,
   int storage_class
 ) {
+  // 名字都是经过 intern_string 驻留的，直接比较指针即可
   for (; list; list = list->next) {
-    if (list->name && (!strcmp(symbol_string, list->name)))
+    if (list->name == symbol_string)
       if (!storage_class || storage_class == list->storage_class)
         return (list);
   }
@@ -51,7 +166,7 @@ static struct SymbolTable *find_symbol_in_list(
 }
 
 struct SymbolTable *find_global_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, global_head, 0));
+  return (lookup_symbol_hash(global_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_local_symbol(char *symbol_string) {
@@ -61,7 +176,7 @@ struct SymbolTable *find_local_symbol(char *symbol_string) {
     node = find_symbol_in_list(symbol_string, current_function_symbol_id->member, 0);
     if (node) return (node);
   }
-  return (find_symbol_in_list(symbol_string, local_head, 0));
+  return (lookup_symbol_hash(local_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_composite_symbol(char *symbol_string) {
@@ -73,23 +188,23 @@ struct SymbolTable *find_temp_member_symbol(char *symbol_string) {
 }
 
 struct SymbolTable *find_struct_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, struct_head, 0));
+  return (lookup_symbol_hash(struct_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_union_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, union_head, 0));
+  return (lookup_symbol_hash(union_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_enum_type_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, enum_head, STORAGE_CLASS_ENUM_TYPE));
+  return (lookup_symbol_hash(enum_type_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_enum_value_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, enum_head, STORAGE_CLASS_ENUM_VALUE));
+  return (lookup_symbol_hash(enum_value_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_typedef_symbol(char *symbol_string) {
-  return (find_symbol_in_list(symbol_string, typedef_head, 0));
+  return (lookup_symbol_hash(typedef_symbol_hash, symbol_string));
 }
 
 struct SymbolTable *find_symbol(char *symbol_string) {
@@ -125,16 +240,14 @@ struct SymbolTable *new_symbol_table(
   int element_number,
   int storage_class,
   int position,
-  struct SymbolTable *composite_type
+  struct SymbolTable *composite_type,
+  struct Arena *arena
 ) {
-  struct SymbolTable *node = (struct SymbolTable *) malloc(sizeof(struct SymbolTable));
-  if (!node)
-    error("Unable to malloc a symbol table node in update_symbol_table");
-
-  if (name == NULL || !name)
-    node->name = NULL;
-  else
-    node->name = strdup(name);
+  struct SymbolTable *node = (struct SymbolTable *)
+    allocate_from_arena(arena, sizeof(struct SymbolTable));
+
+  // name 是驻留的字符串，不需要复制
+  node->name = name;
   node->primitive_type = primitive_type;
   node->structural_type = structural_type;
   node->element_number = element_number;
@@ -152,6 +265,7 @@ struct SymbolTable *new_symbol_table(
   node->next = NULL;
   node->member = NULL;
   node->init_value_list = NULL;
+  node->is_defined = 0;
 
   return (node);
 }
@@ -174,7 +288,9 @@ struct SymbolTable *add_global_symbol(
       position,
       &global_head,
       &global_tail,
-      composite_type
+      composite_type,
+      global_symbol_hash,
+      translation_unit_arena
     )
   );
 }
@@ -195,7 +311,9 @@ struct SymbolTable *add_local_symbol(
       0,
       &local_head,
       &local_tail,
-      composite_type
+      composite_type,
+      local_symbol_hash,
+      function_arena
     )
   );
 }
@@ -216,7 +334,9 @@ struct SymbolTable *add_parameter_symbol(
       0,
       &parameter_head,
       &parameter_tail,
-      composite_type
+      composite_type,
+      NULL,
+      translation_unit_arena
     )
   );
 }
@@ -238,7 +358,9 @@ struct SymbolTable *add_temp_member_symbol(
       0,
       &temp_member_head,
       &temp_member_tail,
-      composite_type
+      composite_type,
+      NULL,
+      translation_unit_arena
     )
   );
 }
@@ -253,7 +375,9 @@ struct SymbolTable *add_struct_symbol(char *symbol_string) {
       0,
       &struct_head,
       &struct_tail,
-      NULL
+      NULL,
+      struct_symbol_hash,
+      translation_unit_arena
     )
   );
 }
@@ -268,7 +392,9 @@ struct SymbolTable *add_union_symbol(char *symbol_string) {
       0,
       &union_head,
       &union_tail,
-      NULL
+      NULL,
+      union_symbol_hash,
+      translation_unit_arena
     )
   );
 }
@@ -278,6 +404,9 @@ struct SymbolTable *add_enum_symbol(
   int storage_class,
   int value
 ) {
+  // 枚举类型和枚举值共用一个链表，但是各自有一个哈希表
+  struct SymbolHash *hash = enum_value_symbol_hash;
+  if (storage_class == STORAGE_CLASS_ENUM_TYPE) hash = enum_type_symbol_hash;
   return (
     add_symbol_core(
       symbol_string,
@@ -288,7 +417,9 @@ struct SymbolTable *add_enum_symbol(
       value,
       &enum_head,
       &enum_tail,
-      NULL
+      NULL,
+      hash,
+      translation_unit_arena
     )
   );
 }
@@ -310,13 +441,44 @@ struct SymbolTable *add_typedef_symbol(
       0,
       &typedef_head,
       &typedef_tail,
-      composite_type
+      composite_type,
+      typedef_symbol_hash,
+      translation_unit_arena
     )
   );
 }
 
 void clear_all_symbol_tables() {
+  if (!global_symbol_hash) {
+    global_symbol_hash = new_symbol_hash();
+    local_symbol_hash = new_symbol_hash();
+    struct_symbol_hash = new_symbol_hash();
+    union_symbol_hash = new_symbol_hash();
+    enum_type_symbol_hash = new_symbol_hash();
+    enum_value_symbol_hash = new_symbol_hash();
+    typedef_symbol_hash = new_symbol_hash();
+    function_arena = new_arena(FUNCTION_ARENA_BLOCK_SIZE);
+    translation_unit_arena = new_arena(TRANSLATION_UNIT_ARENA_BLOCK_SIZE);
+  } else {
+    clear_symbol_hash(global_symbol_hash);
+    clear_symbol_hash(local_symbol_hash);
+    clear_symbol_hash(struct_symbol_hash);
+    clear_symbol_hash(union_symbol_hash);
+    clear_symbol_hash(enum_type_symbol_hash);
+    clear_symbol_hash(enum_value_symbol_hash);
+    clear_symbol_hash(typedef_symbol_hash);
+    reset_arena(function_arena);
+    reset_arena(translation_unit_arena);
+    // -v 输出的是每个源文件的统计
+    function_arena->allocated_bytes = 0;
+    translation_unit_arena->allocated_bytes = 0;
+  }
+  // AST 节点表和 arena 一起清空
+  reset_function_ast_nodes();
+  reset_translation_unit_ast_nodes();
+
   global_head = global_tail = NULL;
+  inline_function_head = NULL;
   local_head = local_tail = NULL;
   parameter_head = parameter_tail = NULL;
   composite_head = composite_tail = NULL;
@@ -327,7 +489,9 @@ void clear_all_symbol_tables() {
   typedef_head = typedef_tail = NULL;
 }
 
+// 离开函数作用域
 void clear_local_symbol_table() {
+  clear_symbol_hash(local_symbol_hash);
   local_head = local_tail = NULL;
   parameter_head = parameter_tail = NULL;
   current_function_symbol_id = NULL;
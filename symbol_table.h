@@ -25,7 +25,8 @@ struct SymbolTable *new_symbol_table(
   int element_number,
   int storage_class,
   int position,
-  struct SymbolTable *composite_type
+  struct SymbolTable *composite_type,
+  struct Arena *arena
 );
 struct SymbolTable *add_global_symbol(
   char *symbol_string,
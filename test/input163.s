@@ -0,0 +1,436 @@
+	.text
+	.globl	tiny
+	.type	tiny, @function
+tiny:
+	movslq	%edi, %rdi
+	cmpq	$1, %rdi
+	je	L23
+	cmpq	$2, %rdi
+	je	L22
+	jmp	L21
+L22:
+	movq	$20, %rdi
+	movl	%edi, %eax
+	jmp	L20
+L23:
+	movq	$10, %rdi
+	movl	%edi, %eax
+	jmp	L20
+L21:
+	movq	$0, %rdi
+	movl	%edi, %eax
+L20:
+	ret
+	.globl	dense
+	.type	dense, @function
+dense:
+	movslq	%edi, %rdi
+	movq	$0, %rsi
+	movslq	%esi, %rsi
+	movq	%rdi, %rax
+	subq	$-2, %rax
+	cmpq	$9, %rax
+	ja	L35
+	leaq	L36(%rip), %r11
+	movslq	(%r11,%rax,4), %rax
+	addq	%r11, %rax
+	jmp	*%rax
+L36:
+	.long	L26 - L36
+	.long	L27 - L36
+	.long	L28 - L36
+	.long	L29 - L36
+	.long	L30 - L36
+	.long	L35 - L36
+	.long	L31 - L36
+	.long	L32 - L36
+	.long	L33 - L36
+	.long	L34 - L36
+L26:
+	movq	$1, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L27:
+	movq	$2, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L28:
+	movq	$3, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L29:
+	movq	$4, %rdi
+	movslq	%edi, %rsi
+L30:
+	movq	%rsi, %rdi
+	addq	$5, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L31:
+	movq	$6, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L32:
+	movq	$7, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L33:
+	movq	$8, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L34:
+	movq	$9, %rdi
+	movslq	%edi, %rsi
+	jmp	L25
+L35:
+	movq	$99, %rdi
+	movslq	%edi, %rsi
+L25:
+	movl	%esi, %eax
+L24:
+	ret
+	.globl	sparse
+	.type	sparse, @function
+sparse:
+	movslq	%edi, %rdi
+	cmpq	$42, %rdi
+	je	L43
+	jl	L49
+	cmpq	$1000, %rdi
+	je	L39
+	jl	L50
+	cmpq	$99999, %rdi
+	je	L44
+	cmpq	$123456, %rdi
+	je	L42
+	jmp	L48
+L50:
+	cmpq	$640, %rdi
+	je	L47
+	jmp	L48
+L49:
+	cmpq	$-500, %rdi
+	je	L41
+	jl	L51
+	cmpq	$3, %rdi
+	je	L45
+	cmpq	$7, %rdi
+	je	L40
+	jmp	L48
+L51:
+	cmpq	$-70000, %rdi
+	je	L46
+	jmp	L48
+L39:
+	movq	$1, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L40:
+	movq	$2, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L41:
+	movq	$3, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L42:
+	movq	$4, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L43:
+	movq	$5, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L44:
+	movq	$6, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L45:
+	movq	$7, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L46:
+	movq	$8, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L47:
+	movq	$9, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L48:
+	movq	$-1, %rdi
+	movl	%edi, %eax
+	jmp	L37
+L38:
+	movq	$0, %rdi
+	movl	%edi, %eax
+L37:
+	ret
+	.globl	only_default
+	.type	only_default, @function
+only_default:
+	movslq	%edi, %rdi
+L54:
+	salq	$1, %rdi
+	movl	%edi, %eax
+	jmp	L52
+L53:
+	movq	$0, %rdi
+	movl	%edi, %eax
+L52:
+	ret
+L56:
+	.byte	116
+	.byte	105
+	.byte	110
+	.byte	121
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	58
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L57:
+	.byte	100
+	.byte	101
+	.byte	110
+	.byte	115
+	.byte	101
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	58
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L58:
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L59:
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L60:
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L61:
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	32
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L62:
+	.byte	37
+	.byte	100
+	.byte	10
+	.byte	0
+L63:
+	.byte	97
+	.byte	10
+	.byte	0
+L64:
+	.byte	98
+	.byte	10
+	.byte	0
+L65:
+	.byte	99
+	.byte	10
+	.byte	0
+L66:
+	.byte	100
+	.byte	10
+	.byte	0
+L67:
+	.byte	101
+	.byte	10
+	.byte	0
+	.globl	main
+	.type	main, @function
+main:
+	pushq	%rbp
+	movq	%rsp, %rbp
+	movq	%rbx, -8(%rbp)
+	movq	%r12, -16(%rbp)
+	addq	$-16, %rsp
+	movq	$0, %rdi
+	movslq	%edi, %rbx
+	jmp	L69
+L68:
+	movq	%rbx, %rdi
+	call	tiny
+	movslq	%eax, %rdx
+	leaq	L56(%rip), %rdi
+	movq	%rbx, %rsi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	%rbx, %rdi
+	movq	%rbx, %rdi
+	addq	$1, %rdi
+	movslq	%edi, %rbx
+L69:
+	cmpl	$4, %ebx
+	jl	L68
+L70:
+	movq	$-4, %rdi
+	movslq	%edi, %rbx
+	jmp	L72
+L71:
+	movq	%rbx, %rdi
+	call	dense
+	movslq	%eax, %rdx
+	leaq	L57(%rip), %rdi
+	movq	%rbx, %rsi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	%rbx, %rdi
+	movq	%rbx, %rdi
+	addq	$1, %rdi
+	movslq	%edi, %rbx
+L72:
+	cmpl	$10, %ebx
+	jl	L71
+L73:
+	movq	$-500, %rdi
+	call	sparse
+	movslq	%eax, %rbx
+	movq	$7, %rdi
+	call	sparse
+	movslq	%eax, %r12
+	movq	$1000, %rdi
+	call	sparse
+	movslq	%eax, %rsi
+	leaq	L58(%rip), %rdi
+	movq	%rbx, %rcx
+	movq	%r12, %rdx
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	$99999, %rdi
+	call	sparse
+	movslq	%eax, %rbx
+	movq	$42, %rdi
+	call	sparse
+	movslq	%eax, %r12
+	movq	$123456, %rdi
+	call	sparse
+	movslq	%eax, %rsi
+	leaq	L59(%rip), %rdi
+	movq	%rbx, %rcx
+	movq	%r12, %rdx
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	$640, %rdi
+	call	sparse
+	movslq	%eax, %rbx
+	movq	$-70000, %rdi
+	call	sparse
+	movslq	%eax, %r12
+	movq	$3, %rdi
+	call	sparse
+	movslq	%eax, %rsi
+	leaq	L60(%rip), %rdi
+	movq	%rbx, %rcx
+	movq	%r12, %rdx
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	$-1000000, %rdi
+	call	sparse
+	movslq	%eax, %rbx
+	movq	$8, %rdi
+	call	sparse
+	movslq	%eax, %r12
+	movq	$0, %rdi
+	call	sparse
+	movslq	%eax, %rsi
+	leaq	L61(%rip), %rdi
+	movq	%rbx, %rcx
+	movq	%r12, %rdx
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	$21, %rdi
+	call	only_default
+	movslq	%eax, %rsi
+	leaq	L62(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	movq	$99, %rdi
+	movzbq	%dil, %rdi
+	movq	%rdi, %rax
+	subq	$97, %rax
+	cmpq	$4, %rax
+	ja	L74
+	leaq	L80(%rip), %r11
+	movslq	(%r11,%rax,4), %rax
+	addq	%r11, %rax
+	jmp	*%rax
+L80:
+	.long	L75 - L80
+	.long	L76 - L80
+	.long	L77 - L80
+	.long	L78 - L80
+	.long	L79 - L80
+L75:
+	leaq	L63(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	jmp	L74
+L76:
+	leaq	L64(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	jmp	L74
+L77:
+	leaq	L65(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	jmp	L74
+L78:
+	leaq	L66(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+	jmp	L74
+L79:
+	leaq	L67(%rip), %rdi
+	call	printf@PLT
+	movslq	%eax, %rdi
+L74:
+	movq	$0, %rdi
+	movl	%edi, %eax
+L55:
+	movq	-8(%rbp), %rbx
+	movq	-16(%rbp), %r12
+	addq	$16, %rsp
+	popq	%rbp
+	ret
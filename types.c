@@ -14,6 +14,16 @@ int check_pointer_type(int primitive_type) {
   return ((primitive_type & 0xf) != 0);
 }
 
+/**
+ * 类型分别为 type1 和 type2 的两次内存访问会不会读写同一个对象
+ * char 可以访问任何对象；指针的表示都一样，不同类型的指针之间也当作会重叠；其余的类型相同才会重叠
+*/
+int check_type_may_alias(int type1, int type2) {
+  if (type1 == PRIMITIVE_CHAR || type2 == PRIMITIVE_CHAR) return (1);
+  if (check_pointer_type(type1) && check_pointer_type(type2)) return (1);
+  return (type1 == type2);
+}
+
 int get_primitive_type_size(
   int primitive_type,
   struct SymbolTable *composite_type
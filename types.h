@@ -5,6 +5,7 @@ int pointer_to(int primitive_type);
 int value_at(int primitive_type);
 int check_int_type(int primitive_type);
 int check_pointer_type(int primitive_type);
+int check_type_may_alias(int type1, int type2);
 int get_primitive_type_size(
   int primitive_type,
   struct SymbolTable *composite_type
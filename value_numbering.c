@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include "data.h"
+#include "definations.h"
+#include "arena.h"
+#include "types.h"
+#include "generator.h"
+#include "linear_ir.h"
+#include "value_numbering.h"
+
+// 局部值编号
+// 在扩展基本块中给 IR 算出的每个值一个编号，运算、类型、操作数的值编号和立即数都相同的指令算出的是同一个值
+// 1. 这个值已经在某个虚拟寄存器中时，指令改成从这个寄存器复制；
+//    两个虚拟寄存器都只被写入一次时，把后一个寄存器的使用都换成前一个，删掉这条指令
+// 2. 读内存按地址的值编号记下来，两次读之间没有可能改到这块内存的写入时，第二次读可以省掉
+//    写内存时只去掉可能被改掉的读，是否可能是同一块内存按 types.c 中的类型判断；
+//    写入的值记在这个地址上，之后从这里读时直接用写入的值
+// 3. 调用函数可能改掉任何内存，之前读到的值都不能再用
+// 扩展基本块：只有一个前驱并且前驱就是数组中上一个块的块，接着用上一个块的值编号
+
+// 表达式哈希表的大小，必须是 2 的 n 次方
+#define VALUE_HASH_SIZE 1024
+// 同时记住的读内存表达式最多这么多个，再多就不记了
+#define MAX_MEMORY_EXPRESSION 256
+
+// 一个算出过的值，操作数都是值编号，没有时为 0
+struct ValueExpression {
+  struct SymbolTable *symbol;
+  int operation;
+  int primitive_type;
+  int condition;
+  int source1;
+  int source2;
+  int index;
+  int scale;
+  int value;
+  int value_number;
+  int forward_register;         // 写入这个地址的寄存器，读的时候可以从它复制
+  int forward_value_number;     // forward_register 写入时的值编号
+  int generation;               // 属于第几个扩展基本块，旧的表达式不再使用
+  int is_killed;                // 读内存的表达式被写入改掉了
+  struct ValueExpression *hash_next;
+};
+
+static struct IRFunction *value_function;
+static struct ValueExpression **value_hash;
+static struct ValueExpression *value_key;
+static struct ValueExpression **memory_expression_list;
+static int memory_expression_number;
+static int value_generation;
+static int value_number_count;
+
+// 虚拟寄存器当前的值编号，register_generation_list 不是当前的扩展基本块时还没有编号
+static int *register_value_list;
+static int *register_generation_list;
+// 放着这个值编号的虚拟寄存器，0 表示没有
+static int *value_holder_list;
+// 每个虚拟寄存器被写入的次数
+static int *definition_count_list;
+// 被删掉的指令的目标寄存器换成哪个寄存器，0 表示不换
+static int *replacement_list;
+
+static int redundant_expression_count;
+static int reused_load_count;
+static int forwarded_store_count;
+static int removed_instruction_count;
+
+static int *allocate_value_list(int n) {
+  return ((int *) allocate_from_arena(function_arena, n * sizeof(int)));
+}
+
+// 值编号 value_number 现在还放在它记下的寄存器中
+static int check_value_holder(int value_number) {
+  int r = value_holder_list[value_number];
+
+  return (r && register_generation_list[r] == value_generation && register_value_list[r] == value_number);
+}
+
+static void set_register_value(int r, int value_number) {
+  register_value_list[r] = value_number;
+  register_generation_list[r] = value_generation;
+  if (!check_value_holder(value_number)) value_holder_list[value_number] = r;
+}
+
+static int new_value_number() {
+  value_number_count++;
+  return (value_number_count);
+}
+
+// 寄存器的值编号，当前扩展基本块中第一次读到的寄存器给一个新的编号
+static int get_register_value(int r) {
+  if (r == NO_REGISTER) return (0);
+  if (register_generation_list[r] != value_generation)
+    set_register_value(r, new_value_number());
+  return (register_value_list[r]);
+}
+
+// 变量的读写只有 symbol 不同，symbol 的地址也要算进去，否则它们都在同一个桶中
+static int hash_value_expression(struct ValueExpression *e) {
+  long symbol = (long) e->symbol;
+  int h = e->operation;
+
+  h = (h * 31 + e->primitive_type) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->condition) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->source1) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->source2) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->index) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->scale) & (VALUE_HASH_SIZE - 1);
+  h = (h * 31 + e->value) & (VALUE_HASH_SIZE - 1);
+  // symbol table 按 8 字节对齐，低 3 位都是 0
+  h = (h * 31 + (int) (symbol >> 3)) & (VALUE_HASH_SIZE - 1);
+  return (h);
+}
+
+static int compare_value_expression(struct ValueExpression *a, struct ValueExpression *b) {
+  return (a->operation == b->operation && a->primitive_type == b->primitive_type &&
+          a->condition == b->condition && a->source1 == b->source1 &&
+          a->source2 == b->source2 && a->index == b->index &&
+          a->scale == b->scale && a->value == b->value && a->symbol == b->symbol);
+}
+
+/**
+ * 在当前的扩展基本块中查找和 value_key 相同的表达式
+ * 之前的扩展基本块的表达式不会再用到，经过时从桶中去掉，桶的长度只和当前的扩展基本块有关
+*/
+static struct ValueExpression *find_value_expression() {
+  struct ValueExpression *e, *previous = NULL, *next;
+  int h = hash_value_expression(value_key);
+
+  e = value_hash[h];
+  while (e) {
+    next = e->hash_next;
+    if (e->generation != value_generation) {
+      if (previous) previous->hash_next = next;
+      else value_hash[h] = next;
+    } else if (compare_value_expression(e, value_key)) {
+      return (e);
+    } else {
+      previous = e;
+    }
+    e = next;
+  }
+  return (NULL);
+}
+
+// 把 value_key 复制一份加入哈希表
+static struct ValueExpression *add_value_expression(int value_number) {
+  struct ValueExpression *e = (struct ValueExpression *)
+    allocate_from_arena(function_arena, sizeof(struct ValueExpression));
+  int h = hash_value_expression(value_key);
+
+  e->symbol = value_key->symbol;
+  e->operation = value_key->operation;
+  e->primitive_type = value_key->primitive_type;
+  e->condition = value_key->condition;
+  e->source1 = value_key->source1;
+  e->source2 = value_key->source2;
+  e->index = value_key->index;
+  e->scale = value_key->scale;
+  e->value = value_key->value;
+  e->value_number = value_number;
+  e->generation = value_generation;
+  e->hash_next = value_hash[h];
+  value_hash[h] = e;
+  return (e);
+}
+
+static int check_memory_operation(int operation) {
+  return (operation == IR_LOAD || operation == IR_LOAD_VARIABLE);
+}
+
+static void add_memory_expression(struct ValueExpression *e) {
+  e->is_killed = 0;
+  e->forward_register = 0;
+  if (memory_expression_number < MAX_MEMORY_EXPRESSION) {
+    memory_expression_list[memory_expression_number] = e;
+    memory_expression_number++;
+  } else {
+    // 记不下的读不能留在哈希表中，否则之后的写入改不到它
+    e->is_killed = 1;
+  }
+}
+
+/**
+ * 两次读写内存会不会碰到同一块内存
+ * 1. 同一个变量才重叠
+ * 2. 基址和下标的值编号都相同时，按偏移和宽度判断，这时不看类型，联合体的不同成员也能正确处理
+ * 3. 其余情况按类型判断
+*/
+static int check_value_may_alias(struct ValueExpression *a, struct ValueExpression *b) {
+  int a_end = a->value + generate_get_primitive_type_size(a->primitive_type);
+  int b_end = b->value + generate_get_primitive_type_size(b->primitive_type);
+
+  if (a->operation == IR_LOAD_VARIABLE && b->operation == IR_LOAD_VARIABLE)
+    return (a->symbol == b->symbol);
+  if (a->operation == IR_LOAD && b->operation == IR_LOAD &&
+      a->source1 == b->source1 && a->index == b->index && a->scale == b->scale)
+    return (a->value < b_end && b->value < a_end);
+  return (check_type_may_alias(a->primitive_type, b->primitive_type));
+}
+
+// 去掉可能和 value_key 碰到同一块内存的读，value_key 为 NULL 时全部去掉
+static void kill_memory_expressions(struct ValueExpression *key) {
+  struct ValueExpression *e;
+  int i, n = 0;
+
+  for (i = 0; i < memory_expression_number; i++) {
+    e = memory_expression_list[i];
+    if (!key || check_value_may_alias(e, key)) {
+      e->is_killed = 1;
+    } else {
+      memory_expression_list[n] = e;
+      n++;
+    }
+  }
+  memory_expression_number = n;
+}
+
+// 用指令的运算和操作数的值编号填写 value_key
+static void fill_value_key(struct IRInstruction *instruction) {
+  int swap;
+
+  value_key->symbol = instruction->symbol;
+  value_key->operation = instruction->operation;
+  value_key->primitive_type = instruction->primitive_type;
+  value_key->condition = instruction->condition;
+  value_key->source1 = get_register_value(instruction->source1);
+  value_key->source2 = get_register_value(instruction->source2);
+  value_key->index = 0;
+  value_key->scale = 0;
+  value_key->value = instruction->value;
+  if (instruction->operation == IR_LOAD) {
+    value_key->index = get_register_value(instruction->index);
+    value_key->scale = instruction->scale;
+  }
+
+  // 满足交换律的运算把值编号小的放在前面
+  switch (instruction->operation) {
+    case IR_ADD:
+    case IR_MULTIPLY:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+      if (value_key->source2 && value_key->source2 < value_key->source1) {
+        swap = value_key->source1;
+        value_key->source1 = value_key->source2;
+        value_key->source2 = swap;
+      }
+  }
+}
+
+/**
+ * 写内存指令对应的读内存表达式填到 value_key 中
+ * IR_STORE 的值在 source2 中，地址和 IR_LOAD 一样；IR_STORE_VARIABLE 对应 IR_LOAD_VARIABLE
+*/
+static void fill_store_key(struct IRInstruction *instruction) {
+  value_key->symbol = instruction->symbol;
+  value_key->primitive_type = instruction->primitive_type;
+  value_key->condition = 0;
+  value_key->source2 = 0;
+  value_key->value = 0;
+  value_key->index = 0;
+  value_key->scale = 0;
+  if (instruction->operation == IR_STORE) {
+    value_key->operation = IR_LOAD;
+    value_key->source1 = get_register_value(instruction->source1);
+    value_key->index = get_register_value(instruction->index);
+    value_key->scale = instruction->scale;
+    value_key->value = instruction->value;
+  } else {
+    value_key->operation = IR_LOAD_VARIABLE;
+    value_key->source1 = 0;
+  }
+}
+
+// 删掉第 i 条指令
+static void remove_value_instruction(int i) {
+  value_function->instruction_list[i] = NULL;
+  removed_instruction_count++;
+}
+
+/**
+ * 第 i 条指令算出的值已经在寄存器 holder 中
+ * 目标寄存器和 holder 都只写入一次时，之后用 holder 代替目标寄存器，否则改成复制
+*/
+static void replace_with_holder(int i, int holder, int value_number) {
+  struct IRInstruction *instruction = value_function->instruction_list[i];
+  int destination = instruction->destination;
+
+  if (destination == holder) {
+    remove_value_instruction(i);
+  } else if (definition_count_list[destination] == 1 && definition_count_list[holder] == 1) {
+    replacement_list[destination] = holder;
+    remove_value_instruction(i);
+  } else {
+    instruction->operation = (char) IR_COPY;
+    instruction->primitive_type = (char) PRIMITIVE_LONG;
+    instruction->symbol = NULL;
+    instruction->source1 = holder;
+    instruction->source2 = NO_REGISTER;
+    instruction->index = NO_REGISTER;
+    instruction->value = 0;
+  }
+  set_register_value(destination, value_number);
+}
+
+/**
+ * 给一条算出值的指令编号
+ * 常量、字符串和变量的地址只要一条指令，编号之后不替换，只让用到它们的表达式可以匹配
+*/
+static void number_expression(int i) {
+  struct IRInstruction *instruction = value_function->instruction_list[i];
+  struct ValueExpression *e;
+  int operation = instruction->operation, value_number, r;
+
+  fill_value_key(instruction);
+  e = find_value_expression();
+  if (e && !e->is_killed) {
+    value_number = e->value_number;
+    if (operation == IR_CONSTANT || operation == IR_STRING || operation == IR_ADDRESS) {
+      set_register_value(instruction->destination, value_number);
+    } else if (check_value_holder(value_number)) {
+      if (check_memory_operation(operation)) reused_load_count++;
+      else redundant_expression_count++;
+      replace_with_holder(i, value_holder_list[value_number], value_number);
+    } else if (e->forward_register &&
+               register_generation_list[e->forward_register] == value_generation &&
+               register_value_list[e->forward_register] == e->forward_value_number) {
+      // 读出刚写入的值，按照读的宽度截断再扩展
+      forwarded_store_count++;
+      r = e->forward_register;
+      instruction->operation = (char) IR_COPY;
+      instruction->symbol = NULL;
+      instruction->source1 = r;
+      instruction->index = NO_REGISTER;
+      instruction->value = 0;
+      set_register_value(instruction->destination, value_number);
+    } else {
+      set_register_value(instruction->destination, value_number);
+    }
+    return;
+  }
+
+  value_number = new_value_number();
+  if (e) {
+    add_memory_expression(e);
+  } else {
+    e = add_value_expression(value_number);
+    if (check_memory_operation(operation)) add_memory_expression(e);
+  }
+  e->value_number = value_number;
+  set_register_value(instruction->destination, value_number);
+}
+
+/**
+ * 8 字节的复制不改变值，目标寄存器直接用源寄存器的值编号，已经是这个值时删掉
+ * 更窄的复制会截断，和其他运算一样编号
+*/
+static void number_copy(int i) {
+  struct IRInstruction *instruction = value_function->instruction_list[i];
+  int value_number;
+
+  if (generate_get_primitive_type_size(instruction->primitive_type) < 8) {
+    number_expression(i);
+    return;
+  }
+  value_number = get_register_value(instruction->source1);
+  if (get_register_value(instruction->destination) == value_number) {
+    remove_value_instruction(i);
+    return;
+  }
+  set_register_value(instruction->destination, value_number);
+}
+
+/**
+ * 写内存之前先去掉可能被改掉的读，再把写入的值记在这个地址上
+ * 8 字节的值读出来还是同一个值；更窄的值读出来会截断，给一个新的编号，读的时候从写入的寄存器复制
+*/
+static void number_store(int i) {
+  struct IRInstruction *instruction = value_function->instruction_list[i];
+  struct ValueExpression *e;
+  int source = instruction->source1, value_number;
+
+  if (instruction->operation == IR_STORE) source = instruction->source2;
+  fill_store_key(instruction);
+  kill_memory_expressions(value_key);
+
+  e = find_value_expression();
+  if (!e) e = add_value_expression(0);
+  add_memory_expression(e);
+  if (generate_get_primitive_type_size(instruction->primitive_type) < 8) {
+    e->value_number = new_value_number();
+    e->forward_register = source;
+    e->forward_value_number = get_register_value(source);
+  } else {
+    value_number = get_register_value(source);
+    e->value_number = value_number;
+    if (!check_value_holder(value_number)) value_holder_list[value_number] = source;
+  }
+}
+
+static void number_instruction(int i) {
+  struct IRInstruction *instruction = value_function->instruction_list[i];
+
+  switch (instruction->operation) {
+    case IR_LABEL:
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_SWITCH:
+    case IR_ARGUMENT:
+    case IR_TAIL_CALL:
+    case IR_RETURN:
+      break;
+    case IR_PARAMETER:
+      set_register_value(instruction->destination, new_value_number());
+      break;
+    case IR_CALL:
+      kill_memory_expressions(NULL);
+      set_register_value(instruction->destination, new_value_number());
+      break;
+    case IR_STORE:
+    case IR_STORE_VARIABLE:
+      number_store(i);
+      break;
+    case IR_COPY:
+      number_copy(i);
+      break;
+    default:
+      number_expression(i);
+  }
+}
+
+// 块 block 接着上一个块的扩展基本块：只有一个前驱，并且就是上一个块
+static int *find_extended_block_list() {
+  int n = value_function->block_number;
+  int *predecessor_count_list = allocate_value_list(n + 1);
+  int *predecessor_list = allocate_value_list(n + 1);
+  int *continue_list = allocate_value_list(n + 1);
+  int block, i, successor;
+
+  for (block = 0; block < n; block++) {
+    for (i = 0; i < get_ir_successor_number(value_function, block); i++) {
+      successor = get_ir_successor(value_function, block, i);
+      predecessor_count_list[successor] = predecessor_count_list[successor] + 1;
+      predecessor_list[successor] = block;
+    }
+  }
+  for (block = 1; block < n; block++) {
+    if (predecessor_count_list[block] == 1 && predecessor_list[block] == block - 1)
+      continue_list[block] = 1;
+  }
+  return (continue_list);
+}
+
+static int find_replacement(int r) {
+  if (r == NO_REGISTER) return (r);
+  while (replacement_list[r]) r = replacement_list[r];
+  return (r);
+}
+
+// 把被删掉的指令的目标寄存器换掉，再把删掉的指令从数组中去掉
+static int compact_value_instructions() {
+  struct IRInstruction *instruction;
+  int i, n = 0;
+
+  for (i = 0; i < value_function->instruction_number; i++) {
+    instruction = value_function->instruction_list[i];
+    if (instruction) {
+      instruction->source1 = find_replacement(instruction->source1);
+      instruction->source2 = find_replacement(instruction->source2);
+      if (instruction->operation == IR_LOAD || instruction->operation == IR_STORE)
+        instruction->index = find_replacement(instruction->index);
+      value_function->instruction_list[n] = instruction;
+      n++;
+    }
+  }
+  i = value_function->instruction_number - n;
+  value_function->instruction_number = n;
+  return (i);
+}
+
+/**
+ * 对一个函数的 IR 做局部值编号，要先划分好基本块
+ * 返回删掉的指令的条数，不为 0 时调用者要重新划分基本块
+*/
+int number_ir_values(struct IRFunction *function) {
+  int n = function->register_number, block, i;
+  int *continue_list;
+  struct IRInstruction *instruction;
+
+  value_function = function;
+  value_hash = (struct ValueExpression **)
+    allocate_from_arena(function_arena, VALUE_HASH_SIZE * sizeof(struct ValueExpression *));
+  value_key = (struct ValueExpression *)
+    allocate_from_arena(function_arena, sizeof(struct ValueExpression));
+  memory_expression_list = (struct ValueExpression **)
+    allocate_from_arena(function_arena, MAX_MEMORY_EXPRESSION * sizeof(struct ValueExpression *));
+  register_value_list = allocate_value_list(n);
+  register_generation_list = allocate_value_list(n);
+  definition_count_list = allocate_value_list(n);
+  replacement_list = allocate_value_list(n);
+  // 每条指令最多读三个寄存器、写一个寄存器，每次最多产生一个新编号
+  value_holder_list = allocate_value_list(4 * function->instruction_number + 1);
+  value_number_count = 0;
+  value_generation = 0;
+  memory_expression_number = 0;
+
+  for (i = 0; i < function->instruction_number; i++) {
+    instruction = function->instruction_list[i];
+    if (instruction->destination != NO_REGISTER)
+      definition_count_list[instruction->destination] = definition_count_list[instruction->destination] + 1;
+  }
+
+  continue_list = find_extended_block_list();
+  for (block = 0; block < function->block_number; block++) {
+    if (!continue_list[block]) {
+      value_generation++;
+      memory_expression_number = 0;
+    }
+    for (i = get_ir_block_start(function, block); i < get_ir_block_start(function, block + 1); i++)
+      number_instruction(i);
+  }
+
+  i = compact_value_instructions();
+  value_function = NULL;
+  return (i);
+}
+
+// -v 时输出值编号的结果，之后清零，下一个文件重新计数
+void print_value_numbering_statistics() {
+  printf("value numbering: %d redundant expressions, %d loads reused, %d stores forwarded, %d instructions removed\n",
+    redundant_expression_count, reused_load_count, forwarded_store_count, removed_instruction_count);
+  redundant_expression_count = 0;
+  reused_load_count = 0;
+  forwarded_store_count = 0;
+  removed_instruction_count = 0;
+}
@@ -0,0 +1,9 @@
+#ifndef __VALUE_NUMBERING_H__
+#define __VALUE_NUMBERING_H__
+
+#include "definations.h"
+
+int number_ir_values(struct IRFunction *function);
+void print_value_numbering_statistics();
+
+#endif